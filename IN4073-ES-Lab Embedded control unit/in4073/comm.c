@@ -3,13 +3,27 @@
 #include "hal/timers.h"
 #include "hal/spi_flash.h"
 #include "hal/uart.h"
+#include "utils/settings.h"
+#include "utils/trace.h"
+#include "utils/log_catalog.h"
+#include "mpu6050/mpu6050.h"
+#include "app_util_platform.h"
 
 // Array to store pressed keys
 bool keys[18];
 
-// Flash memory variables
-uint32_t flashAdr = 0x000000;
+// Flash memory variables: address of the next row and rows of the flight (utils/log_catalog.h)
+uint32_t flashAdr = LOG_AREA_START;
 uint32_t storedRows = 0;
+// Set to true when the flight got too long for the log area
+static bool flashFull = false;
+// Rows of the flight dropped because the flash queue was full
+static uint32_t droppedRows = 0;
+
+// Log catalog request of the PC, answered from the main loop
+static bool flightRequested = false;
+static uint8_t flightRequest;
+static uint32_t flightRequestNumber;
 
 // Joystick values
 uint8_t joystickRoll;
@@ -20,7 +34,22 @@ uint8_t joystickThrottle;
 // Time of last received message
 uint32_t last_system_count;
 
-char msg[100];
+// Number of arguments of every event
+#define EVENT_ARGS(name, args, format) args,
+static const uint8_t eventArgs[EVENT_COUNT] = { EVENT_LIST(EVENT_ARGS) };
+#undef EVENT_ARGS
+
+typedef struct
+{
+	eventId id;
+	int32_t args[EVENT_MAX_ARGS];
+} eventRecord;
+
+// Events from interrupts, only touched in critical regions
+static eventRecord eventQueue[EVENT_QUEUE_SIZE];
+static uint8_t eventHead = 0;
+static uint8_t eventTail = 0;
+static uint32_t eventsLost = 0;
 
 void comm_init()
 {
@@ -114,6 +143,8 @@ void processMsg(msgType type, uint8_t *pData)
 		Gain_P1 = to_i16(&pData[2]);
 		Gain_P2 = to_i16(&pData[4]);
 		Gain_height = to_i16(&pData[6]);
+		updateControlGains();
+		settings_save();
 		// Send one character ACK after config
 		uint8_t ack = 'C';
 		packMessage(ACK, &ack, NULL);
@@ -188,6 +219,12 @@ void processMsg(msgType type, uint8_t *pData)
 		}
 		idx++;
 
+		// Send the flight trace if user pressed 't'
+		if ((pData[6] >> 6) & 0x01)
+		{
+			trace_dump();
+		}
+
 		// End flight if user pressed '.' (only in safe mode)
 		if (((pData[6] >> 7) == 1) && (systemState == SafeMode))
 		{
@@ -196,6 +233,22 @@ void processMsg(msgType type, uint8_t *pData)
 		}
 		break;
 	}
+
+	case FLIGHT_REQ:
+	{
+		// The logs are sent in blocking mode, only in safe mode
+		if (systemState == SafeMode)
+		{
+			flightRequest = pData[0];
+			flightRequestNumber = to_ui32(&pData[1]);
+			flightRequested = true;
+		}
+		else
+		{
+			packMessage(DEBUG, NULL, "Flight logs are only sent in safe mode");
+		}
+		break;
+	}
 	
 	default:
 	{
@@ -223,7 +276,7 @@ void packMessage(msgType type, uint8_t *pData, const char* debugMsg)
 {
 	// Send log in blocking mode -> other way the queue would get full almost immediately
 	bool blocking = false;
-	if (type == LOG) blocking = true;
+	if (type == LOG || type == TRACE || type == FLIGHT) blocking = true;
 
 	// DON'T send any messages in wireless mode!!!
 	if (!wireless_mode)
@@ -242,15 +295,25 @@ void packMessage(msgType type, uint8_t *pData, const char* debugMsg)
 		switch (type)
 		{
 		case TELEM:
-			uart_put((uint8_t)TELEM_SIZE, blocking);
-			checkSum ^= TELEM_SIZE;
-			for (uint8_t i = 0; i < TELEM_SIZE; i++)
+			uart_put((uint8_t)TELEM_MSG_SIZE, blocking);
+			checkSum ^= TELEM_MSG_SIZE;
+			for (uint8_t i = 0; i < TELEM_MSG_SIZE; i++)
 			{
 				uart_put(pData[i], blocking);
 				checkSum ^= pData[i];
 			}
 			break;
 			
+		case ATT:
+			uart_put((uint8_t)ATT_SIZE, blocking);
+			checkSum ^= ATT_SIZE;
+			for (uint8_t i = 0; i < ATT_SIZE; i++)
+			{
+				uart_put(pData[i], blocking);
+				checkSum ^= pData[i];
+			}
+			break;
+
 		case LOG:
 			uart_put((uint8_t)LOG_SIZE, blocking);
 			checkSum ^= LOG_SIZE;
@@ -270,9 +333,43 @@ void packMessage(msgType type, uint8_t *pData, const char* debugMsg)
 
 		case DEBUG:
 			// We can send debug messages (there's no length and checksum then, always ends with the '\n' character)
-			printf("%s\n", debugMsg);
+			while (*debugMsg) uart_put((uint8_t)*debugMsg++, blocking);
+			uart_put((uint8_t)'\n', blocking);
+			break;
+
+		case TRACE:
+			uart_put((uint8_t)TRACE_BLOCK_SIZE, blocking);
+			checkSum ^= TRACE_BLOCK_SIZE;
+			for (uint8_t i = 0; i < TRACE_BLOCK_SIZE; i++)
+			{
+				uart_put(pData[i], blocking);
+				checkSum ^= pData[i];
+			}
+			break;
+
+		case FLIGHT:
+			uart_put((uint8_t)FLIGHT_SIZE, blocking);
+			checkSum ^= FLIGHT_SIZE;
+			for (uint8_t i = 0; i < FLIGHT_SIZE; i++)
+			{
+				uart_put(pData[i], blocking);
+				checkSum ^= pData[i];
+			}
 			break;
 
+		case EVENT:
+		{
+			uint8_t len = 1 + 4 * eventArgs[pData[0]];
+			uart_put(len, blocking);
+			checkSum ^= len;
+			for (uint8_t i = 0; i < len; i++)
+			{
+				uart_put(pData[i], blocking);
+				checkSum ^= pData[i];
+			}
+			break;
+		}
+
 		default:
 			uart_put((uint8_t)1, blocking);	// Length 1
 			checkSum ^= 1;
@@ -315,10 +412,11 @@ void unpackMessage(uint8_t c, recMachine *SM)
 
 	case TYPE:
 		SM->recType = c;
-		if (SM->recType != CFG && SM->recType != MODE && SM->recType != CMD)
+		if (SM->recType != CFG && SM->recType != MODE && SM->recType != CMD && SM->recType != PING && SM->recType != FLIGHT_REQ)
 		{
 			error = 1; // Start again as we have an error
 			packMessage(DEBUG, NULL, "DRONE: Type error at receiving!");
+			trace(TR_RX_TYPE_ERROR, c, SM->ble);
 		}
 		SM->actualState++;
 		break;
@@ -340,6 +438,12 @@ void unpackMessage(uint8_t c, recMachine *SM)
 		if (c != SM->recCsum)
 		{
 			packMessage(DEBUG, NULL, "DRONE: Checksum error at receiving!");
+			trace(TR_RX_CHECKSUM, SM->recType, SM->ble);
+		}
+		// Answer the latency probe right here, it mustn't wait for anything else
+		else if (SM->recType == PING)
+		{
+			sendPong(SM->msg, get_time_us(), SM->ble);
 		}
 		// Process message if check sum was correct
 		else
@@ -367,6 +471,136 @@ void unpackMessage(uint8_t c, recMachine *SM)
 	
 }
 
+/**
+ * @brief Function to answer a latency probe. The PING data is sent back
+ * with the drone time of receiving and answering it. In wireless mode
+ * the answer goes on bluetooth, every other message is uart only.
+ * @param uint8_t* Pointer to the received PING data (PING_SIZE bytes)
+ * @param uint32_t Drone time (us) when the PING was received
+ * @param bool True if the PING came on bluetooth
+ */
+void sendPong(uint8_t *pingData, uint32_t rxTime, bool ble)
+{
+	uint8_t msg[PONG_SIZE + 4];
+	uint8_t checkSum = 0;
+
+	msg[0] = '?';
+	msg[1] = PONG;
+	msg[2] = PONG_SIZE;
+	memcpy(&msg[3], pingData, PING_SIZE);
+	ui32_to_ui8(rxTime, &msg[3 + PING_SIZE]);
+	ui32_to_ui8(get_time_us(), &msg[3 + PING_SIZE + 4]);
+
+	for (uint8_t i = 0; i < PONG_SIZE + 3; i++)
+	{
+		checkSum ^= msg[i];
+	}
+	msg[PONG_SIZE + 3] = checkSum;
+
+	if (ble)
+	{
+		for (uint8_t i = 0; i < sizeof(msg); i++)
+		{
+			enqueue(&ble_tx_queue, msg[i]);
+		}
+		quad_ble_send();
+	}
+	else
+	{
+		for (uint8_t i = 0; i < sizeof(msg); i++)
+		{
+			uart_put(msg[i], false);
+		}
+	}
+}
+
+/**
+ * @brief Sends one event: the number and the arguments it uses, big-endian
+ */
+static void packEvent(const eventRecord *event)
+{
+	uint8_t data[1 + 4 * EVENT_MAX_ARGS];
+
+	data[0] = (uint8_t)event->id;
+	for (uint8_t i = 0; i < eventArgs[event->id]; i++)
+	{
+		i32_to_ui8(event->args[i], &data[1 + 4 * i]);
+	}
+	packMessage(EVENT, data, NULL);
+}
+
+/**
+ * @brief Sends a status event, the PC formats it with the format string
+ * of events.h. Nothing is formatted on the drone. In an interrupt the
+ * event is only queued, flushEvents() sends it from the main loop.
+ * Use the SEND_EVENT() macro, the unused arguments are filled with 0.
+ * @param eventId Event number
+ * @param int32_t The arguments, as many as the event has
+ */
+void sendEvent(eventId id, int32_t a0, int32_t a1, int32_t a2, int32_t a3)
+{
+	eventRecord event = {id, {a0, a1, a2, a3}};
+
+	if (id >= EVENT_COUNT) return;
+
+	if (current_int_priority_get() != NRF_APP_PRIORITY_THREAD)
+	{
+		CRITICAL_REGION_ENTER();
+		if ((uint8_t)(eventHead - eventTail) < EVENT_QUEUE_SIZE)
+		{
+			eventQueue[eventHead % EVENT_QUEUE_SIZE] = event;
+			eventHead++;
+		}
+		else
+		{
+			eventsLost++;
+		}
+		CRITICAL_REGION_EXIT();
+		return;
+	}
+
+	// Keep the order: the queued events happened first
+	flushEvents();
+	packEvent(&event);
+}
+
+/**
+ * @brief Sends the events queued by interrupts. Called from the main loop
+ * (and by every sendEvent() outside of interrupts).
+ */
+void flushEvents(void)
+{
+	eventRecord event;
+	bool pending;
+	uint32_t lost;
+
+	do
+	{
+		CRITICAL_REGION_ENTER();
+		pending = eventHead != eventTail;
+		if (pending)
+		{
+			event = eventQueue[eventTail % EVENT_QUEUE_SIZE];
+			eventTail++;
+		}
+		CRITICAL_REGION_EXIT();
+
+		if (pending) packEvent(&event);
+	} while (pending);
+
+	// The queue was full, the newest events are missing
+	CRITICAL_REGION_ENTER();
+	lost = eventsLost;
+	eventsLost = 0;
+	CRITICAL_REGION_EXIT();
+
+	if (lost)
+	{
+		eventRecord lostEvent = {EV_EVENTS_LOST, {(int32_t)lost, 0, 0, 0}};
+		packEvent(&lostEvent);
+	}
+}
+
 /**
  * @brief Function to serialize telemetry data into an uint8_t array
  * @param telemetry* Pointer to telemetry struct
@@ -411,6 +645,7 @@ void serializeProfiling(profilingTelemetry *profilingTelem, uint8_t *pData) {
 	ui32_to_ui8(profilingTelem->heightModeTime, &pData[20]);
 	ui32_to_ui8(profilingTelem->loggingTime, &pData[24]);
 	ui32_to_ui8(profilingTelem->sqrtTime, &pData[28]);
+	ui32_to_ui8(profilingTelem->attitudeTime, &pData[32]);
 }
 
 /**
@@ -420,85 +655,119 @@ void serializeProfiling(profilingTelemetry *profilingTelem, uint8_t *pData) {
  * @param profilingTelem - Profiling telemetry
  */
 void sendProfilingData(profilingTelemetry *profilingTelem) {
-	char msg[100];
-	snprintf(msg, 100, "Profiling: Control (%ld ns), Timer (%ld ns), Yaw (%ld ns), Full (%ld ns), Raw (%ld ns), Height (%ld ns) ,Log (%ld ns), Sqrt (%ld ns)", 
+	SEND_EVENT(EV_PROFILING_1,
 		profilingTelem->controlLoopTime,
 		profilingTelem->timerFlagTime,
 		profilingTelem->yawModeTime,
-		profilingTelem->fullModeTime,
+		profilingTelem->fullModeTime);
+	SEND_EVENT(EV_PROFILING_2,
 		profilingTelem->rawModeTime,
 		profilingTelem->heightModeTime,
 		profilingTelem->loggingTime,
 		profilingTelem->sqrtTime);
-	packMessage(DEBUG, NULL, msg);
+	SEND_EVENT(EV_PROFILING_3, profilingTelem->attitudeTime);
 }
 
 /**
- * @brief Function to send all telemetry data to PC
+ * @brief Function to send all telemetry data to PC. The current time
+ * is appended, so the PC can timestamp the attitude samples, followed by
+ * the stack high-water mark.
  * @param uint8_t* Pointer where serialized telemetry data starts
+ * @param uint16_t Stack high-water mark (bytes), not logged
  * @author Kristóf
  */
-void sendTelemetry(uint8_t *telemData)
+void sendTelemetry(uint8_t *telemData, uint16_t stackUsed)
 {
-	packMessage(TELEM, telemData, NULL);
+	uint8_t msg[TELEM_MSG_SIZE];
+
+	memcpy(msg, telemData, TELEM_SIZE);
+	ui32_to_ui8(get_time_us(), &msg[TELEM_SIZE]);
+	ui16_to_ui8(stackUsed, &msg[TELEM_SIZE + 4]);
+	packMessage(TELEM, msg, NULL);
+}
+
+/**
+ * @brief Sends the attitude of the last sample to the attitude stream of
+ * the PC. It is skipped when the whole message doesn't fit in the UART
+ * queue, a half message would only cost a checksum error on the PC.
+ */
+void sendAttitude(void)
+{
+	uint8_t msg[ATT_SIZE];
+
+	// Start, type, length and checksum around the data
+	if (QUEUE_SIZE - tx_queue.count < ATT_SIZE + 4) return;
+
+	ui32_to_ui8(sensor_time, &msg[0]);
+	i16_to_ui8(phi - phi_trim, &msg[4]);
+	i16_to_ui8(theta - theta_trim, &msg[6]);
+	i16_to_ui8(psi - psi_trim, &msg[8]);
+	i16_to_ui8(sp - sp_trim, &msg[10]);
+	i16_to_ui8(sq - sq_trim, &msg[12]);
+	i16_to_ui8(sr - sr_trim, &msg[14]);
+	packMessage(ATT, msg, NULL);
+}
+
+/**
+ * @brief Writes one row at the end of the log: it wraps around the end of
+ * the log area, the catalog makes room for it first. The row is dropped
+ * (and counted) when the flash queue is full behind an erase, the control
+ * loop doesn't wait for the flash.
+ * @param uint8_t* Row (time, type, data)
+ * @param uint8_t Bytes of the row to write, the rest stays erased
+ */
+static void writeLogRow(uint8_t *row, uint8_t count)
+{
+	uint32_t adr = catalog_row_address(flashAdr);
+
+	if (!catalog_make_room(adr) || !flash_write_bytes(adr, row, count))
+	{
+		droppedRows++;
+		return;
+	}
+	catalog_add_row(adr);
+	flashAdr = adr + LOG_SIZE;
+
+	// Increment number of rows
+	storedRows++;
 }
 
 /**
  * @brief Function to save log to flash.
  * Maybe add length parameter, so that I can also log the profiling results :)
+ * Nothing is logged while no flight is open (startLog()).
  * @param logType Log type enum
  * @param uint8_t* Pointer to data which we want to save in flash memory (max. TELEM_SIZE bytes)
  * @author Kristóf
  */
 void saveLog(logType type, uint8_t *pData)
 {
-	// Set to true when flash got full
-	static bool flashFull = false;
-
 	// Don't store more data when flash is full
-	if (!flashFull)
+	if (!flashFull && catalog_is_open())
 	{
 		startProfiling(p_Logging);
 
-		// Check if there is still free space in the flash
-		// 131071 bytes -> for 44 bytes packages it's only 2978 rows
-		if (flashAdr >= (131070 - 3 * (LOG_SIZE)))
+		// Check if there is still free space for the flight: the log
+		// mustn't wrap around onto its start, about 2500 rows of 44 bytes
+		if ((storedRows + 2) * (LOG_SIZE) > CATALOG_FLIGHT_MAX)
 		{
 			flashFull = true;
 			packMessage(DEBUG, NULL, "Flash is full, storing last row");
 		}
 
-		// Store current time in flash
-		uint8_t ts[4];
-		ui32_to_ui8(get_time_us(), ts);
-		if(!flash_write_bytes(flashAdr, ts, 4)) packMessage(DEBUG, NULL, "Flash write error");
-		flashAdr += 4;	
-
-		// Store log type
-		if(!flash_write_byte(flashAdr, type)) packMessage(DEBUG, NULL, "Flash write error");
-		flashAdr += 1;
-
-		// Store data in flash
-		if(!flash_write_bytes(flashAdr, pData, TELEM_SIZE))  packMessage(DEBUG, NULL, "Flash write error");
-		flashAdr += TELEM_SIZE;
-
-		// Increment number of rows
-		storedRows++;
+		// Time, type and data in one queued flash write
+		uint8_t row[LOG_SIZE];
+		ui32_to_ui8(get_time_us(), row);
+		row[4] = type;
+		memcpy(&row[5], pData, TELEM_SIZE);
+		writeLogRow(row, LOG_SIZE);
 
 		// If flash got full now, we store one last row which indicates that flash is full
 		if (flashFull)
 		{
-			// Store current time in flash
-			uint8_t ts[4];
-			ui32_to_ui8(get_time_us(), ts);
-			if(!flash_write_bytes(flashAdr, ts, 4)) packMessage(DEBUG, NULL, "Flash write error");
-			flashAdr += 4;	
-
-			// Store log type
-			if(!flash_write_byte(flashAdr, Full)) packMessage(DEBUG, NULL, "Flash write error");
-			flashAdr += 1;
-
-			storedRows++;
+			ui32_to_ui8(get_time_us(), row);
+			row[4] = Full;
+			writeLogRow(row, 5);
 		}
 
 		stopProfiling(p_Logging, true, &profileData);
@@ -506,29 +775,66 @@ void saveLog(logType type, uint8_t *pData)
 }
 
 /**
- * @brief Function to send log to PC.
- * Called only when the flight is finished.
- * @author Kristóf
+ * @brief Starts a new flight in the log catalog when the drone is armed
+ * (leaves safe mode). The rows logged until the flight is downloaded
+ * (sendLog()) belong to it, also after going back to safe mode.
  */
-void sendLog()
+void startLog(void)
+{
+	catalog_open(catalog_row_address(flashAdr));
+}
+
+/**
+ * @brief Sends the catalog entry of a flight. The PC writes the LOG rows
+ * after it to a new log file.
+ * @param flightRecord* Catalog entry
+ */
+static void packFlight(const flightRecord *flight)
+{
+	uint8_t data[FLIGHT_SIZE];
+
+	ui32_to_ui8(flight->number, &data[0]);
+	ui16_to_ui8(flight->boot, &data[4]);
+	ui32_to_ui8(flight->build, &data[6]);
+	ui32_to_ui8(flight->bootTime, &data[10]);
+	ui32_to_ui8(flight->start, &data[14]);
+	ui32_to_ui8(flight->length, &data[18]);
+	ui32_to_ui8(flight->rows, &data[22]);
+	packMessage(FLIGHT, data, NULL);
+}
+
+/**
+ * @brief Sends the log of a flight of the catalog to the PC: its entry,
+ * then its rows.
+ * @param uint32_t Flight number
+ */
+static void sendFlight(uint32_t number)
 {
+	flightRecord flight;
+
+	if (!catalog_find(number, &flight))
+	{
+		SEND_EVENT(EV_FLIGHT_UNKNOWN, number);
+		return;
+	}
+
 	packMessage(DEBUG, NULL, "Start to send log");
 
 	uint8_t logRow[LOG_SIZE];
-	uint32_t adr = 0x000000;
+	uint32_t adr = flight.start;
 
-	snprintf(msg, 100, "Number of rows to send %lu", storedRows);
-	packMessage(DEBUG, NULL, msg);
-	uint32_t temp = storedRows;
+	packFlight(&flight);
+	SEND_EVENT(EV_LOG_ROWS, flight.rows);
 
-	// Send all rows from the flash
+	// Send all rows of the flight
 	/*
 	*	DON'T SEND DEBUG MESSAGES HERE, AS WE CALL THE UART_PUT IN BLOCKING MODE
 	*/
 	bool error = false;
-	for (uint32_t i = 0; i < temp; i++)
+	for (uint32_t i = 0; i < flight.rows; i++)
 	{
 		// Read data from flash memory
+		adr = catalog_row_address(adr);
 		if(!flash_read_bytes(adr, logRow, LOG_SIZE)) 
 		{
 			error = true;
@@ -542,17 +848,54 @@ void sendLog()
 	*/
 	if (error == true) packMessage(DEBUG, NULL, "Flash read error");
 
-	// Erase flash
-	if(!flash_chip_erase())
-	{
-		packMessage(DEBUG, NULL, "Flash couldn't be erased");
-	}
+	packMessage(DEBUG, NULL, "Everything sent");
+}
+
+/**
+ * @brief Function to send log to PC.
+ * Called only when the flight is finished: the flight is closed in the
+ * log catalog and stays there, the next arming starts a new one.
+ * @author Kristóf
+ */
+void sendLog()
+{
+	uint32_t number = catalog_close();
 
-	// Set flash adress to 0x000000 again (we can overwrite the sent data)
-	flashAdr = 0x000000;
+	if (droppedRows) SEND_EVENT(EV_LOG_DROPPED, droppedRows);
 	storedRows = 0;
+	flashFull = false;
+	droppedRows = 0;
 
-	packMessage(DEBUG, NULL, "Everything sent");
+	if (number != FLIGHT_NONE) sendFlight(number);
+}
+
+/**
+ * @brief Answers the log catalog request of the PC: the entries of all
+ * flights, ACK 'F' at the end, or the log of one flight, ACK 'L' at the
+ * end. Called from the main loop.
+ */
+void processFlightRequest(void)
+{
+	flightRecord flight;
+	uint8_t ack;
+
+	if (!flightRequested) return;
+	flightRequested = false;
+
+	if (flightRequest == FLIGHT_LIST)
+	{
+		for (uint8_t i = 0; i < catalog_count(); i++)
+		{
+			if (catalog_get(i, &flight)) packFlight(&flight);
+		}
+		ack = 'F';
+	}
+	else
+	{
+		sendFlight(flightRequestNumber);
+		ack = 'L';
+	}
+	packMessage(ACK, &ack, NULL);
 }
 
 /**
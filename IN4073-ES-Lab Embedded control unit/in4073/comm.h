@@ -8,13 +8,23 @@
 #include "in4073.h"
 #include "control.h"
 #include "utils/quad_ble.h"
+#include "events.h"
 
 // Buffer and array size defines
 #define BUF_SIZE 20
 #define CMD_SIZE 7
 #define TELEM_SIZE 39
+#define TELEM_MSG_SIZE (TELEM_SIZE + 6)	// Telemetry + drone time (us) of sending + stack high-water mark (bytes)
+#define ATT_SIZE 16		// Drone time of the sample (4) + phi, theta, psi (6) + sp, sq, sr (6)
 #define PROFILING_SIZE 32
 #define LOG_SIZE TELEM_SIZE+5
+#define PING_SIZE 10	// Sequence number (2) + PC CLOCK_MONOTONIC time in us (8)
+#define PONG_SIZE 18	// PING data + drone time at receiving (4) + drone time at answering (4)
+#define EVENT_QUEUE_SIZE 8	// Events from interrupts waiting to be sent, power of 2
+#define FLIGHT_REQ_SIZE 5	// Request (FLIGHT_LIST / FLIGHT_SEND) + flight number (4)
+#define FLIGHT_SIZE 26		// Number (4), boot (2), build (4), boot time (4), start (4), length (4), rows (4)
+#define FLIGHT_LIST 0		// FLIGHT_REQ: list the flights of the log catalog
+#define FLIGHT_SEND 1		// FLIGHT_REQ: send the log of one flight
 
 // Bool array containing the key presses
 extern bool keys[18];
@@ -53,7 +63,14 @@ typedef enum
 	TELEM,	// Telemetry data
 	LOG,	// Logged data
 	ACK,	// ACK message
-	DEBUG	// Debug message
+	DEBUG,	// Debug message
+	PING,	// Latency probe from the PC
+	PONG,	// Answer to PING
+	EVENT,	// Event number + arguments, the PC formats the text (events.h)
+	TRACE,	// Block of flight trace records (utils/trace.h)
+	FLIGHT_REQ,	// Log catalog request of the PC
+	FLIGHT,	// Log catalog entry of a flight (utils/log_catalog.h)
+	ATT		// Attitude sample for the attitude stream of the PC
 } msgType;
 
 // Receiver state machine states enum
@@ -71,6 +88,7 @@ typedef struct
 	msgType recType;
 	uint8_t msg[BUF_SIZE];
 	uint8_t idx;
+	bool ble;			// The machine reads the bluetooth link
 } recMachine;
 
 void comm_init();
@@ -97,18 +115,31 @@ void unpackMessage(uint8_t c, recMachine *SM);
 
 bool checkConnection();
 
+// Latency probe answer, sent on the link the PING came on
+void sendPong(uint8_t *pingData, uint32_t rxTime, bool ble);
+
+// Status events, SEND_EVENT(id, up to 4 arguments). Also safe to use in
+// interrupts: there the event is queued and sent by flushEvents().
+void sendEvent(eventId id, int32_t a0, int32_t a1, int32_t a2, int32_t a3);
+void flushEvents(void);
+#define SEND_EVENT(...) SEND_EVENT_(__VA_ARGS__, 0, 0, 0, 0, 0)
+#define SEND_EVENT_(id, a0, a1, a2, a3, ...) sendEvent(id, a0, a1, a2, a3)
+
 // Log types enum
 typedef enum {
 	Telemetry,
 	ModeChg,
 	Command,
 	l_Profiling,
-	Full
+	Full,
+	l_Trace,	// Block of flight trace records, saved at a panic
+	l_Timing	// Sample period and sensor to motor latency of the control cycles
 } logType;
 
 // Telemetry functions
 void serializeTelemetry(telemetry *telem, uint8_t *pData);
-void sendTelemetry(uint8_t *telemData);
+void sendTelemetry(uint8_t *telemData, uint16_t stackUsed);
+void sendAttitude(void);
 
 // Profiling functions
 void serializeProfiling(profilingTelemetry *profilingTelem, uint8_t *pData);
@@ -116,6 +147,8 @@ void sendProfilingData(profilingTelemetry *profilingTelem);
 
 // Functions for logging
 void saveLog(logType type, uint8_t *pData);
+void startLog(void);
 void sendLog();
+void processFlightRequest(void);
 
 #endif /* COMM_H_ */
\ No newline at end of file
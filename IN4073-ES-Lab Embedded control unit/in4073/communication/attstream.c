@@ -0,0 +1,183 @@
+#include "attstream.h"
+#include "scheduler.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// Subscribed viewer
+typedef struct
+{
+	struct sockaddr_in addr;
+	uint64_t lastSeenNs;	// Time of the last (re)subscription
+	bool used;
+} attViewer;
+
+static int fd_stream = -1;
+static uint32_t seq = 0;
+static attViewer viewers[ATT_MAX_VIEWERS];
+
+/**
+ * @brief Opens the UDP socket the viewers subscribe to (localhost only)
+ * @param uint16_t UDP port
+ * @return true on success
+ */
+bool att_stream_open(uint16_t port)
+{
+	struct sockaddr_in addr;
+
+	fd_stream = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd_stream == -1)
+	{
+		perror("Attitude stream socket");
+		return false;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bind(fd_stream, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+	{
+		perror("Attitude stream bind");
+		close(fd_stream);
+		fd_stream = -1;
+		return false;
+	}
+
+	memset(viewers, 0, sizeof(viewers));
+	seq = 0;
+	printf("Attitude stream: viewers can subscribe on UDP port %d\n", port);
+	return true;
+}
+
+/**
+ * @brief Closes the stream socket
+ */
+void att_stream_close(void)
+{
+	if (fd_stream != -1) close(fd_stream);
+	fd_stream = -1;
+}
+
+/**
+ * @brief Handles the pending (un)subscriptions and forgets the viewers
+ * which didn't renew their subscription in time
+ */
+static void att_stream_update_viewers(void)
+{
+	char buf[16];
+	struct sockaddr_in from;
+	socklen_t fromLen = sizeof(from);
+	ssize_t len;
+	uint64_t now = get_mono_ns();
+
+	while ((len = recvfrom(fd_stream, buf, sizeof(buf), 0, (struct sockaddr *)&from, &fromLen)) > 0)
+	{
+		bool subscribe = (len >= 5 && !memcmp(buf, ATT_SUBSCRIBE, 5));
+		bool unsubscribe = (len >= 5 && !memcmp(buf, ATT_UNSUBSCRIBE, 5));
+		int freeSlot = -1;
+		int i;
+
+		for (i = 0; i < ATT_MAX_VIEWERS; i++)
+		{
+			if (viewers[i].used && viewers[i].addr.sin_port == from.sin_port && viewers[i].addr.sin_addr.s_addr == from.sin_addr.s_addr) break;
+			if (!viewers[i].used && freeSlot == -1) freeSlot = i;
+		}
+
+		if (i < ATT_MAX_VIEWERS)
+		{
+			if (subscribe) viewers[i].lastSeenNs = now;
+			if (unsubscribe) viewers[i].used = false;
+		}
+		else if (subscribe && freeSlot != -1)
+		{
+			viewers[freeSlot].addr = from;
+			viewers[freeSlot].lastSeenNs = now;
+			viewers[freeSlot].used = true;
+			printf("Attitude stream: viewer %s:%d subscribed\n", inet_ntoa(from.sin_addr), ntohs(from.sin_port));
+		}
+		fromLen = sizeof(from);
+	}
+
+	for (int i = 0; i < ATT_MAX_VIEWERS; i++)
+	{
+		if (viewers[i].used && now - viewers[i].lastSeenNs > ATT_VIEWER_TIMEOUT_MS * 1000000ULL)
+		{
+			viewers[i].used = false;
+			printf("Attitude stream: viewer %s:%d timed out\n", inet_ntoa(viewers[i].addr.sin_addr), ntohs(viewers[i].addr.sin_port));
+		}
+	}
+}
+
+/**
+ * @brief Writes a number to a buffer in big endian order
+ */
+static void put_be(uint8_t *dest, uint64_t value, int bytes)
+{
+	for (int i = bytes - 1; i >= 0; i--)
+	{
+		dest[i] = (uint8_t)(value & 0xFF);
+		value >>= 8;
+	}
+}
+
+/**
+ * @brief Sends one attitude sample to every subscribed viewer. Nothing
+ * is ever blocking, a viewer which can't keep up only loses datagrams.
+ * @param uint32_t Drone time of the sample in us
+ * @param int16_t* Phi, theta, psi
+ * @param int16_t* Sp, sq, sr
+ */
+void att_stream_send(uint32_t droneUs, const int16_t *angles, const int16_t *rates)
+{
+	uint8_t pkt[ATT_PACKET_SIZE];
+
+	if (fd_stream == -1) return;
+
+	att_stream_update_viewers();
+
+	pkt[0] = 'A';
+	pkt[1] = 'T';
+	pkt[2] = ATT_STREAM_VERSION;
+	pkt[3] = 0;
+	put_be(&pkt[4], seq++, 4);
+	put_be(&pkt[8], droneUs, 4);
+	put_be(&pkt[12], get_mono_ns() / 1000, 8);
+	for (int i = 0; i < 3; i++)
+	{
+		put_be(&pkt[20 + 2 * i], (uint16_t)angles[i], 2);
+		put_be(&pkt[26 + 2 * i], (uint16_t)rates[i], 2);
+	}
+
+	for (int i = 0; i < ATT_MAX_VIEWERS; i++)
+	{
+		if (!viewers[i].used) continue;
+
+		if (sendto(fd_stream, pkt, sizeof(pkt), MSG_DONTWAIT | MSG_NOSIGNAL, (struct sockaddr *)&viewers[i].addr, sizeof(viewers[i].addr)) == -1
+			&& errno != EAGAIN && errno != EWOULDBLOCK)
+		{
+			// The viewer is gone, it is added again when it subscribes
+			viewers[i].used = false;
+		}
+	}
+}
+
+/**
+ * @brief Function to get the number of subscribed viewers
+ * @return Number of viewers
+ */
+int att_stream_viewers(void)
+{
+	int n = 0;
+	for (int i = 0; i < ATT_MAX_VIEWERS; i++)
+	{
+		if (viewers[i].used) n++;
+	}
+	return n;
+}
@@ -0,0 +1,45 @@
+#ifndef ATTSTREAM_H__
+#define ATTSTREAM_H__
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+// Binary attitude stream for external viewers (processing/drone_view).
+// Viewers subscribe by sending ATT_SUBSCRIBE to ATT_STREAM_PORT on
+// localhost and repeat it at least every ATT_VIEWER_TIMEOUT_MS. Every
+// subscribed viewer gets a datagram for each ATT message of the drone:
+// every control sample (100 Hz) in raw mode, 20 Hz in the DMP modes.
+//
+//   offset size
+//      0    2   'A' 'T'
+//      2    1   version (ATT_STREAM_VERSION)
+//      3    1   flags (0)
+//      4    4   sequence number (counts every sample, gaps = lost datagrams)
+//      8    4   drone time in us (sensor_time of the sample)
+//     12    8   PC CLOCK_MONOTONIC time in us when the sample was received
+//     20    6   phi, theta, psi (int16, 32768 = pi rad)
+//     26    6   sp, sq, sr (int16, raw gyro)
+//
+// All fields are big endian, like the drone protocol.
+#define ATT_STREAM_PORT 12345
+#define ATT_STREAM_VERSION 1
+#define ATT_PACKET_SIZE 32
+#define ATT_SUBSCRIBE "ATSUB"
+#define ATT_UNSUBSCRIBE "ATBYE"
+#define ATT_MAX_VIEWERS 8
+#define ATT_VIEWER_TIMEOUT_MS 5000
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+bool att_stream_open(uint16_t port);
+void att_stream_close(void);
+void att_stream_send(uint32_t droneUs, const int16_t *angles, const int16_t *rates);
+int att_stream_viewers(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ATTSTREAM_H__
@@ -0,0 +1,347 @@
+#include "capture.h"
+#include "scheduler.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+/*------------------------------------------------------------
+ * Capture
+ *------------------------------------------------------------
+ */
+
+static FILE *capFile = NULL;
+static uint64_t capStartNs = 0;
+static uint64_t capLastUs = 0;
+static uint64_t capBytes = 0;
+
+// Block being collected
+static uint8_t blockLink = 0;
+static uint8_t blockLen = 0;
+static uint8_t blockData[255];
+static uint64_t blockNs = 0;
+
+/**
+ * @brief Writes an unsigned number in 7 bit groups, low group first
+ * (small time differences take only one byte)
+ * @param uint64_t Number to write
+ */
+static void write_varint(uint64_t value)
+{
+	do
+	{
+		uint8_t b = value & 0x7F;
+		value >>= 7;
+		if (value) b |= 0x80;
+		fputc(b, capFile);
+	}
+	while (value);
+}
+
+/**
+ * @brief Writes the collected block to the capture file
+ */
+static void capture_flush_block(void)
+{
+	if (blockLen == 0) return;
+
+	// Times are stored relative to the start, so the rounding doesn't add up
+	uint64_t blockUs = (blockNs - capStartNs) / 1000;
+	fputc(blockLink, capFile);
+	write_varint(blockUs - capLastUs);
+	fputc(blockLen, capFile);
+	fwrite(blockData, 1, blockLen, capFile);
+
+	// The terminal is usually left with ^C, so don't keep blocks in the stdio buffer
+	fflush(capFile);
+
+	capLastUs = blockUs;
+	blockLen = 0;
+}
+
+/**
+ * @brief Creates a capture file, from now on every received byte is recorded
+ * @param char* Path of the capture file
+ * @return true on success
+ */
+bool capture_open(const char *path)
+{
+	uint8_t header[CAPTURE_HEADER_SIZE] = {0};
+
+	capFile = fopen(path, "wb");
+	if (capFile == NULL)
+	{
+		perror("Capture open");
+		return false;
+	}
+
+	capStartNs = get_mono_ns();
+	capLastUs = 0;
+	capBytes = 0;
+	blockLen = 0;
+
+	memcpy(header, CAPTURE_MAGIC, 6);
+	header[6] = CAPTURE_VERSION;
+	for (int i = 0; i < 8; i++) header[8 + i] = (uint8_t)(capStartNs >> (8 * i));
+	fwrite(header, 1, sizeof(header), capFile);
+	fflush(capFile);
+
+	printf("Capturing received bytes to %s\n", path);
+	return true;
+}
+
+/**
+ * @brief Writes the last block and closes the capture file
+ */
+void capture_close(void)
+{
+	if (capFile == NULL) return;
+
+	capture_flush_block();
+	fclose(capFile);
+	capFile = NULL;
+	printf("Capture closed, %" PRIu64 " bytes recorded\n", capBytes);
+}
+
+/**
+ * @brief Function to check if the received bytes are recorded
+ * @return true if a capture file is open
+ */
+bool capture_active(void)
+{
+	return capFile != NULL;
+}
+
+/**
+ * @brief Records one received byte with its receive time
+ * @param uint8_t Link the byte came on (UART or BLUETOOTH)
+ * @param uint8_t Received byte
+ */
+void capture_byte(uint8_t link, uint8_t c)
+{
+	if (capFile == NULL) return;
+
+	uint64_t now = get_mono_ns();
+
+	if (blockLen && (link != blockLink || blockLen == sizeof(blockData) || now - blockNs > CAPTURE_GAP_US * 1000ULL))
+	{
+		capture_flush_block();
+	}
+
+	if (blockLen == 0)
+	{
+		blockLink = link;
+		blockNs = now;
+	}
+	blockData[blockLen++] = c;
+	capBytes++;
+}
+
+/*------------------------------------------------------------
+ * Replay
+ *------------------------------------------------------------
+ */
+
+static uint8_t *repData = NULL;
+static size_t repSize = 0;
+static size_t repPos = 0;
+static double repSpeed = 1.0;
+static uint64_t repStartNs = 0;
+static uint64_t repEndNs = 0;
+static uint64_t repBytes = 0;
+static uint64_t repBlocks = 0;
+
+// Current block
+static bool curValid = false;
+static uint8_t curLink = 0;
+static uint64_t curUs = 0;
+static size_t curLen = 0;
+static size_t curIdx = 0;
+static bool curStarted = false;
+
+/**
+ * @brief Reads the header of the next block
+ * @return false at the end of the file (or if the file is truncated)
+ */
+static bool replay_next_block(void)
+{
+	uint64_t dt = 0;
+	int shift = 0;
+
+	curValid = false;
+	if (repPos + 3 > repSize) return false;
+
+	curLink = repData[repPos++];
+	while (repPos < repSize && shift < 64)
+	{
+		uint8_t b = repData[repPos++];
+		dt |= (uint64_t)(b & 0x7F) << shift;
+		shift += 7;
+		if (!(b & 0x80)) break;
+	}
+	if (repPos >= repSize) return false;
+
+	curLen = repData[repPos++];
+	if (curLen == 0 || repPos + curLen > repSize) return false;
+
+	curUs += dt;
+	curIdx = 0;
+	curStarted = false;
+	curValid = true;
+	repBlocks++;
+	return true;
+}
+
+/**
+ * @brief Loads a capture file into memory and starts replaying it
+ * @param char* Path of the capture file
+ * @param double Replay speed (1 = real time, 0 = as fast as possible)
+ * @return true on success
+ */
+bool replay_open(const char *path, double speed)
+{
+	FILE *fp = fopen(path, "rb");
+	if (fp == NULL)
+	{
+		perror("Replay open");
+		return false;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	long size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	if (size < CAPTURE_HEADER_SIZE)
+	{
+		printf("Replay: %s is not a capture file\n", path);
+		fclose(fp);
+		return false;
+	}
+
+	repData = (uint8_t *)malloc(size);
+	if (repData == NULL || fread(repData, 1, size, fp) != (size_t)size)
+	{
+		printf("Replay: couldn't read %s\n", path);
+		free(repData);
+		repData = NULL;
+		fclose(fp);
+		return false;
+	}
+	fclose(fp);
+
+	if (memcmp(repData, CAPTURE_MAGIC, 6) != 0 || repData[6] != CAPTURE_VERSION)
+	{
+		printf("Replay: %s is not a capture file (or has a different version)\n", path);
+		replay_close();
+		return false;
+	}
+
+	repSize = (size_t)size;
+	repPos = CAPTURE_HEADER_SIZE;
+	repSpeed = speed < 0.0 ? 0.0 : speed;
+	repBytes = 0;
+	repBlocks = 0;
+	repEndNs = 0;
+	curUs = 0;
+	replay_next_block();
+	repStartNs = get_mono_ns();
+
+	if (repSpeed == 0.0) printf("Replaying %s as fast as possible\n", path);
+	else printf("Replaying %s at %.2fx speed\n", path, repSpeed);
+	return true;
+}
+
+/**
+ * @brief Frees the loaded capture
+ */
+void replay_close(void)
+{
+	free(repData);
+	repData = NULL;
+	repSize = 0;
+	curValid = false;
+}
+
+/**
+ * @brief Function to check if the received bytes come from a capture
+ * @return true if a capture is loaded
+ */
+bool replay_active(void)
+{
+	return repData != NULL;
+}
+
+/**
+ * @brief Function to check if every byte of the capture was replayed
+ * @return true at the end of the capture
+ */
+bool replay_finished(void)
+{
+	return repData != NULL && !curValid;
+}
+
+/**
+ * @brief Microseconds of capture time elapsed since the replay started
+ */
+static uint64_t replay_elapsed_us(void)
+{
+	return (uint64_t)((get_mono_ns() - repStartNs) / 1000.0 * repSpeed);
+}
+
+/**
+ * @brief Gives the next replayed byte of a link, if its time has come
+ * @param uint8_t Link to read (UART or BLUETOOTH)
+ * @return One byte, -1 if there is nothing to read now on this link
+ */
+int replay_getchar(uint8_t link)
+{
+	if (!curValid || curLink != link) return -1;
+
+	// Only the first byte of a block waits for its time
+	if (!curStarted)
+	{
+		if (repSpeed != 0.0 && replay_elapsed_us() < curUs) return -1;
+		curStarted = true;
+	}
+
+	uint8_t c = repData[repPos + curIdx++];
+	repBytes++;
+
+	if (curIdx == curLen)
+	{
+		repPos += curLen;
+		if (!replay_next_block()) repEndNs = get_mono_ns();
+	}
+	return c;
+}
+
+/**
+ * @brief Time until the next replayed block is due (poll timeout)
+ * @return Milliseconds to wait, 0 if a block is due, -1 at the end of the capture
+ */
+int replay_timeout_ms(void)
+{
+	if (!curValid) return -1;
+	if (repSpeed == 0.0 || curStarted) return 0;
+
+	uint64_t elapsed = replay_elapsed_us();
+	if (elapsed >= curUs) return 0;
+	return (int)((curUs - elapsed) / repSpeed / 1000.0) + 1;
+}
+
+/**
+ * @brief Prints the replay statistics. The throughput of an as fast as
+ * possible replay is the throughput of the decoder.
+ * @param FILE* Where to print
+ */
+void replay_print_stats(FILE *fp)
+{
+	uint64_t end = repEndNs ? repEndNs : get_mono_ns();
+	double wallS = (end - repStartNs) / 1e9;
+
+	fprintf(fp, "\nReplayed %" PRIu64 " bytes in %" PRIu64 " blocks, capture length %.3f s, replay took %.3f s\n",
+		repBytes, repBlocks, curUs / 1e6, wallS);
+	if (wallS > 0.0)
+	{
+		fprintf(fp, "Decoder throughput: %.2f MB/s\n", repBytes / wallS / 1e6);
+	}
+}
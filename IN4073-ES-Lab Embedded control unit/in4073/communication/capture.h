@@ -0,0 +1,43 @@
+#ifndef CAPTURE_H__
+#define CAPTURE_H__
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+// Capture file format (little endian):
+//   header: "ESLCAP", version byte, 0 byte, uint64 CLOCK_MONOTONIC start time (ns)
+//   blocks: link byte (UART / BLUETOOTH), varint time since the previous block (us),
+//           length byte (1-255), received bytes
+#define CAPTURE_MAGIC "ESLCAP"
+#define CAPTURE_VERSION 1
+#define CAPTURE_HEADER_SIZE 16
+
+// Bytes received within this time after the first byte of a block share its timestamp
+#define CAPTURE_GAP_US 50
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Recording of the received bytes
+bool capture_open(const char *path);
+void capture_close(void);
+bool capture_active(void);
+void capture_byte(uint8_t link, uint8_t c);
+
+// Replay of a capture through the normal receive path.
+// Speed is a multiplier of the real time, 0 means as fast as possible.
+bool replay_open(const char *path, double speed);
+void replay_close(void);
+bool replay_active(void);
+bool replay_finished(void);
+int replay_getchar(uint8_t link);
+int replay_timeout_ms(void);
+void replay_print_stats(FILE *fp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CAPTURE_H__
@@ -9,7 +9,11 @@
 #define CONFIG_H_
 
 // PC side defines
-#define SEND_RATE_MS 50
+#define SEND_RATE_HZ 20		// Default CMD send rate
+#define SEND_RATE_MAX_HZ 200	// Upper limit of the CMD send rate
+#define CMD_CHANGE_MIN_MS 10	// Minimum time between a stick change send and the previous send
+#define JOY_CHANGE_THRESHOLD 2	// Axis change (0..255 scale) which is sent immediately
+#define PING_PERIOD_MS 200		// Period of the latency probes
 #define DEBUG_MODE 1
 #define SERIAL_PORT "/dev/ttyUSB0"
 #define BT_PORT "/dev/pts/3"
@@ -1,15 +1,31 @@
 #include "joy.h"
+#include "scheduler.h"
+
+#include <math.h>
 
 #define NAME_LENGTH 128
 #define JS_DEV	"/dev/input/js0"
 
 // Variables to store joystick related values
-int fd;
+int fd = -1;
 unsigned char axes = 2;
 unsigned char buttons = 2;
 int *axis;
 char *button;
 
+// Last sent axes (0..255) and fire button
+static uint8_t sentAxes[4] = {127, 127, 127, 0};
+static char sentFire = 0;
+
+// Kernel event time -> CLOCK_MONOTONIC offset and the oldest unsent change
+static int64_t clockOffsetNs = 0;
+static bool offsetValid = false;
+static bool changePending = false;
+static uint64_t changeNs = 0;
+
+// Stick-to-wire latency statistics
+static joyLatency latency = {0, UINT32_MAX, 0, 0.0, 0.0, {0}};
+
 /**
  * @brief Function to open joystick communication.
  * Similar to joystick example's code.
@@ -43,28 +59,60 @@ int openJoy(void)
 }
 
 /**
- * @brief Function to readout joystick axes and buttons.
- * Based on joystick example's Event interface, single line readout code.
- * @param uint8_t* Pointer to pilotCmd array
- * @author Kristóf
+ * @brief Function to get the joystick file descriptor (for poll)
+ * @return Joystick fd, -1 if it is not opened
  */
-void getJoyValues(uint8_t* pilotCmd)
+int get_fd_joy(void)
+{
+    return fd;
+}
+
+/**
+ * @brief Reads all pending joystick events. The event times are kernel
+ * times in ms. They are mapped to CLOCK_MONOTONIC with the smallest
+ * (read time - event time) seen so far, which converges to the offset
+ * between the two clocks.
+ * @return true if an axis or button changed
+ */
+bool readJoyEvents(void)
 {
-    int i;
     struct js_event js;
-    
+    bool changed = false;
+
+    if (fd < 0) return false;
+
     // Read while there are new events
     while (read(fd, &js, sizeof(struct js_event)) == sizeof(struct js_event))  
     {
         switch(js.type & ~JS_EVENT_INIT)
         {
         case JS_EVENT_BUTTON:
+            if (button[js.number] != js.value) changed = true;
             button[js.number] = js.value;
             break;
         case JS_EVENT_AXIS:
+            if (axis[js.number] != js.value) changed = true;
             axis[js.number] = js.value;
             break;
         }
+
+        // The initial state events are generated at open, they have no real time
+        if (js.type & JS_EVENT_INIT) continue;
+
+        uint64_t now = get_mono_ns();
+        int64_t offset = (int64_t)(now - (uint64_t)js.time * 1000000ULL);
+        if (!offsetValid || offset < clockOffsetNs)
+        {
+            clockOffsetNs = offset;
+            offsetValid = true;
+        }
+
+        // Remember when the oldest unsent change happened
+        if (!changePending)
+        {
+            changeNs = (uint64_t)((int64_t)((uint64_t)js.time * 1000000ULL) + clockOffsetNs);
+            changePending = true;
+        }
     }
 
     if (errno != EAGAIN) 
@@ -72,20 +120,64 @@ void getJoyValues(uint8_t* pilotCmd)
         perror("\njstest: error reading");
     }
 
+    return changed;
+}
+
+/**
+ * @brief Maps the axes to the 0..255 command range
+ * @param uint8_t* Roll, pitch, yaw, lift (4 bytes)
+ */
+static void mapAxes(uint8_t* out)
+{
+    out[0] = (axis[0] + 32767) * 255 / 65534;            // Roll
+    out[1] = (((-1)*axis[1]) + 32767) * 255 / 65534;     // Pitch
+    out[2] = (axis[2] + 32767) * 255 / 65534;            // Yaw
+    out[3] = (((-1)*axis[3]) + 32767) * 255 / 65534;     // Lift
+}
+
+/**
+ * @brief Function to check if the stick moved significantly since the
+ * last send (JOY_CHANGE_THRESHOLD on any axis) or the fire button changed
+ * @return true if a CMD should be sent now
+ */
+bool joyChanged(void)
+{
+    uint8_t now[4];
+
+    if (fd < 0) return false;
+
+    if (axes >= 4)
+    {
+        mapAxes(now);
+        for (int i = 0; i < 4; i++)
+        {
+            if (abs((int)now[i] - (int)sentAxes[i]) >= JOY_CHANGE_THRESHOLD) return true;
+        }
+    }
+    if (buttons && button[0] != sentFire) return true;
+
+    return false;
+}
+
+/**
+ * @brief Puts the current axes and buttons into the command. The values
+ * are remembered as sent, the command has to be sent right after.
+ * @param uint8_t* Pointer to pilotCmd array
+ * @author Kristóf
+ */
+void fillJoyCmd(uint8_t* pilotCmd)
+{
     // Handle axes
-    if (axes) 
+    if (axes >= 4) 
     {
         // Map between 0 and 255
-        uint8_t roll   = (axis[0] + 32767) * 255 / 65534;
-        uint8_t pitch  = (((-1)*axis[1]) + 32767) * 255 / 65534;
-        uint8_t yaw    = (axis[2] + 32767) * 255 / 65534;
-        uint8_t lift   = (((-1)*axis[3]) + 32767) * 255 / 65534;
+        mapAxes(sentAxes);
 
         // Put axis values into pilotCmd array
-        pilotCmd[2] = roll;    // Roll
-        pilotCmd[3] = pitch;   // Pitch
-        pilotCmd[4] = yaw;     // Yaw
-        pilotCmd[5] = lift;    // Lift
+        pilotCmd[2] = sentAxes[0];   // Roll
+        pilotCmd[3] = sentAxes[1];   // Pitch
+        pilotCmd[4] = sentAxes[2];   // Yaw
+        pilotCmd[5] = sentAxes[3];   // Lift
     }
 
     // Handle buttons
@@ -96,5 +188,97 @@ void getJoyValues(uint8_t* pilotCmd)
         {
             pilotCmd[1] |= (0x01 << 6);
         }
+        sentFire = button[0];
+    }
+}
+
+/**
+ * @brief Function to readout joystick axes and buttons.
+ * Based on joystick example's Event interface, single line readout code.
+ * @param uint8_t* Pointer to pilotCmd array
+ * @author Kristóf
+ */
+void getJoyValues(uint8_t* pilotCmd)
+{
+    readJoyEvents();
+    fillJoyCmd(pilotCmd);
+}
+
+/**
+ * @brief Called after a CMD was written to the port. Measures the time
+ * from the oldest unsent stick change until now.
+ */
+void joyMarkSent(void)
+{
+    if (!changePending) return;
+    changePending = false;
+
+    int64_t diff = (int64_t)(get_mono_ns() - changeNs) / 1000;
+    uint32_t us = diff < 0 ? 0 : (uint32_t)diff;
+
+    if (us < latency.minUs) latency.minUs = us;
+    if (us > latency.maxUs) latency.maxUs = us;
+
+    // Welford's running mean and variance
+    latency.count++;
+    double delta = us - latency.meanUs;
+    latency.meanUs += delta / latency.count;
+    latency.m2 += delta * (us - latency.meanUs);
+
+    uint32_t bin = us / JOY_LAT_BIN_US;
+    if (bin >= JOY_LAT_BINS) bin = JOY_LAT_BINS - 1;
+    latency.bins[bin]++;
+}
+
+/**
+ * @brief Copies the stick-to-wire latency statistics
+ * @param joyLatency* Where to copy them
+ */
+void getJoyLatency(joyLatency* lat)
+{
+    *lat = latency;
+}
+
+/**
+ * @brief Standard deviation of the stick-to-wire latency
+ * @param joyLatency* Statistics to use
+ * @return Standard deviation in us
+ */
+double joyLatencyStddev(const joyLatency* lat)
+{
+    if (lat->count < 2) return 0.0;
+    return sqrt(lat->m2 / (lat->count - 1));
+}
+
+/**
+ * @brief Prints the stick-to-wire latency statistics with a text histogram
+ * @param FILE* Where to print
+ */
+void printJoyLatency(FILE* fp)
+{
+    uint32_t maxCount = 1;
+
+    fprintf(fp, "\nStick-to-wire latency: %" PRIu64 " changes sent\n", latency.count);
+    if (latency.count == 0) return;
+
+    fprintf(fp, "Latency: mean %.0f us, stddev %.0f us, min %u us, max %u us\n", latency.meanUs,
+        joyLatencyStddev(&latency), latency.minUs, latency.maxUs);
+
+    for (int i = 0; i < JOY_LAT_BINS; i++)
+    {
+        if (latency.bins[i] > maxCount) maxCount = latency.bins[i];
     }
-}
\ No newline at end of file
+
+    // Only print the non-empty bins, bars are scaled to 50 characters
+    for (int i = 0; i < JOY_LAT_BINS; i++)
+    {
+        if (!latency.bins[i]) continue;
+
+        if (i == JOY_LAT_BINS - 1) fprintf(fp, "    >=%3d ms %8u | ", i * JOY_LAT_BIN_US / 1000, latency.bins[i]);
+        else fprintf(fp, "      %3d ms %8u | ", i * JOY_LAT_BIN_US / 1000, latency.bins[i]);
+
+        int len = (int)((uint64_t)latency.bins[i] * 50 / maxCount);
+        for (int j = 0; j < len; j++) fputc('#', fp);
+        fputc('\n', fp);
+    }
+}
@@ -109,14 +109,39 @@ struct JS_DATA_SAVE_TYPE {
 	struct JS_DATA_TYPE JS_CORR;
 };
 
+// Stick-to-wire latency histogram: JOY_LAT_BIN_US wide bins, the last one collects everything above
+#define JOY_LAT_BINS 51
+#define JOY_LAT_BIN_US 1000
+
+// Stick-to-wire latency statistics
+typedef struct
+{
+	uint64_t count;					// Number of measured sends
+	uint32_t minUs;					// Smallest latency
+	uint32_t maxUs;					// Largest latency
+	double meanUs;					// Mean latency
+	double m2;						// Sum of squared differences (for the variance)
+	uint32_t bins[JOY_LAT_BINS];	// Latency histogram
+} joyLatency;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 // User functions
 int openJoy(void);
+int get_fd_joy(void);
+bool readJoyEvents(void);
+bool joyChanged(void);
+void fillJoyCmd(uint8_t* pilotCmd);
 void getJoyValues(uint8_t* pilotCmd);
 
+// Latency from the kernel event time of a stick change to sending it
+void joyMarkSent(void);
+void getJoyLatency(joyLatency* lat);
+double joyLatencyStddev(const joyLatency* lat);
+void printJoyLatency(FILE* fp);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,212 @@
+#include "ping.h"
+#include "protocol.h"
+#include "scheduler.h"
+#include "capture.h"
+
+#include <string.h>
+#include <math.h>
+
+// Per link statistics, indexed by UART / BLUETOOTH
+static linkStats stats[2] = {
+	{0, 0, 0, UINT32_MAX, 0, 0.0, 0.0, 0, {0}, 0, 0, 0.0},
+	{0, 0, 0, UINT32_MAX, 0, 0.0, 0.0, 0, {0}, 0, 0, 0.0}
+};
+
+static uint16_t seq = 0;
+static uint64_t lastPingNs = 0;
+
+// Last PONGs for the drone clock offset: drone receive time - PC send time
+// (mod 2^32) and the time the PING spent on the wire (RTT - drone time)
+typedef struct
+{
+	uint32_t rxMinusTx;
+	uint32_t wireUs;
+} offsetSample;
+
+static offsetSample offsetSamples[2][PING_OFFSET_WINDOW];
+static uint32_t offsetCount[2] = {0, 0};
+
+/**
+ * @brief Sends a PING on the active link when PING_PERIOD_MS elapsed
+ * since the previous one. Nothing is sent while a capture is replayed.
+ */
+void ping_poll(void)
+{
+	uint8_t data[PING_SIZE];
+	uint64_t now = get_mono_ns();
+
+	if (replay_active()) return;
+	if (lastPingNs != 0 && now - lastPingNs < PING_PERIOD_MS * 1000000ULL) return;
+	lastPingNs = now;
+
+	uint64_t nowUs = now / 1000;
+	ui16_to_ui8(seq++, &data[0]);
+	ui32_to_ui8((uint32_t)(nowUs >> 32), &data[2]);
+	ui32_to_ui8((uint32_t)nowUs, &data[6]);
+	packMessage(PING, data);
+
+	stats[get_active_link()].sent++;
+}
+
+/**
+ * @brief Time until the next PING is due (poll timeout)
+ * @return Milliseconds to wait, 0 if a PING is due
+ */
+int ping_timeout_ms(void)
+{
+	uint64_t elapsed = get_mono_ns() - lastPingNs;
+
+	if (replay_active()) return -1;
+	if (lastPingNs == 0 || elapsed >= PING_PERIOD_MS * 1000000ULL) return 0;
+	return (int)((PING_PERIOD_MS * 1000000ULL - elapsed + 999999) / 1000000);
+}
+
+/**
+ * @brief Drone clock offset (drone time - PC time in us, mod 2^32) from
+ * the PONG with the shortest wire time in the window. Half of its wire
+ * time is taken as the one-way delay.
+ * @param uint8_t Link
+ * @param uint32_t* Where to put the offset
+ * @return false if no PONG was received on the link yet
+ */
+static bool ping_clock_offset(uint8_t link, uint32_t *offset)
+{
+	uint32_t n = offsetCount[link] < PING_OFFSET_WINDOW ? offsetCount[link] : PING_OFFSET_WINDOW;
+	const offsetSample *best = NULL;
+
+	for (uint32_t i = 0; i < n; i++)
+	{
+		if (best == NULL || offsetSamples[link][i].wireUs < best->wireUs) best = &offsetSamples[link][i];
+	}
+	if (best == NULL) return false;
+
+	*offset = best->rxMinusTx - best->wireUs / 2;
+	return true;
+}
+
+/**
+ * @brief Processes a PONG: round trip time into the histogram of the
+ * link it came on and a new sample for the drone clock offset.
+ * @param uint8_t Link the PONG came on (UART or BLUETOOTH)
+ * @param uint8_t* PONG data
+ */
+void ping_pong_received(uint8_t link, uint8_t *pData)
+{
+	// The PC times of a replayed capture are from another run
+	if (replay_active() || link > BLUETOOTH) return;
+
+	uint64_t nowUs = get_mono_ns() / 1000;
+	uint64_t txUs = ((uint64_t)to_ui32(&pData[2]) << 32) | to_ui32(&pData[6]);
+	uint32_t droneRx = to_ui32(&pData[10]);
+	uint32_t droneTx = to_ui32(&pData[14]);
+	if (txUs > nowUs) return;
+
+	linkStats *s = &stats[link];
+	uint32_t rtt = (uint32_t)(nowUs - txUs);
+	uint32_t onDrone = droneTx - droneRx;
+
+	s->received++;
+	s->lastUs = rtt;
+	s->droneUs = onDrone;
+	if (rtt < s->minUs) s->minUs = rtt;
+	if (rtt > s->maxUs) s->maxUs = rtt;
+
+	// Welford's running mean and variance
+	double delta = rtt - s->meanUs;
+	s->meanUs += delta / s->received;
+	s->m2 += delta * (rtt - s->meanUs);
+
+	uint32_t bin = rtt / RTT_BIN_US;
+	if (bin >= RTT_BINS) bin = RTT_BINS - 1;
+	s->bins[bin]++;
+
+	offsetSample *o = &offsetSamples[link][offsetCount[link]++ % PING_OFFSET_WINDOW];
+	o->rxMinusTx = droneRx - (uint32_t)txUs;
+	o->wireUs = onDrone < rtt ? rtt - onDrone : 0;
+}
+
+/**
+ * @brief Measures how old a telemetry message is when it arrives, using
+ * the drone clock offset estimated from the PONGs of the same link
+ * @param uint8_t Link the telemetry came on (UART or BLUETOOTH)
+ * @param uint32_t Drone time (us) when the telemetry was sent
+ */
+void ping_telem_received(uint8_t link, uint32_t droneUs)
+{
+	uint32_t offset;
+
+	if (replay_active() || link > BLUETOOTH) return;
+	if (!ping_clock_offset(link, &offset)) return;
+
+	linkStats *s = &stats[link];
+	uint32_t nowUs = (uint32_t)(get_mono_ns() / 1000);
+	int32_t age = (int32_t)(nowUs - (droneUs - offset));
+
+	s->telemCount++;
+	s->telemLastUs = age;
+	s->telemMeanUs += (age - s->telemMeanUs) / s->telemCount;
+}
+
+/**
+ * @brief Copies the statistics of a link
+ * @param uint8_t Link (UART or BLUETOOTH)
+ * @param linkStats* Where to copy them
+ */
+void ping_get_stats(uint8_t link, linkStats *out)
+{
+	*out = stats[link > BLUETOOTH ? UART : link];
+}
+
+/**
+ * @brief Standard deviation of the round trip time
+ * @param linkStats* Statistics to use
+ * @return Standard deviation in us
+ */
+double ping_stddev_us(const linkStats *s)
+{
+	if (s->received < 2) return 0.0;
+	return sqrt(s->m2 / (s->received - 1));
+}
+
+/**
+ * @brief Prints the round trip statistics of both links with text histograms
+ * @param FILE* Where to print
+ */
+void ping_print_stats(FILE *fp)
+{
+	static const char *names[2] = {"UART", "Bluetooth"};
+
+	for (int link = UART; link <= BLUETOOTH; link++)
+	{
+		const linkStats *s = &stats[link];
+		uint32_t maxCount = 1;
+
+		fprintf(fp, "\n%s round trip: %" PRIu64 " PINGs sent, %" PRIu64 " PONGs received\n", names[link], s->sent, s->received);
+		if (s->received == 0) continue;
+
+		fprintf(fp, "RTT: mean %.0f us, stddev %.0f us, min %u us, max %u us, last %u us (%u us on the drone)\n",
+			s->meanUs, ping_stddev_us(s), s->minUs, s->maxUs, s->lastUs, s->droneUs);
+		if (s->telemCount)
+		{
+			fprintf(fp, "Telemetry age: mean %.0f us, last %d us\n", s->telemMeanUs, s->telemLastUs);
+		}
+
+		for (int i = 0; i < RTT_BINS; i++)
+		{
+			if (s->bins[i] > maxCount) maxCount = s->bins[i];
+		}
+
+		// Only print the non-empty bins, bars are scaled to 50 characters
+		for (int i = 0; i < RTT_BINS; i++)
+		{
+			if (!s->bins[i]) continue;
+
+			if (i == RTT_BINS - 1) fprintf(fp, "    >=%4d ms %8u | ", i * RTT_BIN_US / 1000, s->bins[i]);
+			else fprintf(fp, "      %4d ms %8u | ", i * RTT_BIN_US / 1000, s->bins[i]);
+
+			int len = (int)((uint64_t)s->bins[i] * 50 / maxCount);
+			for (int j = 0; j < len; j++) fputc('#', fp);
+			fputc('\n', fp);
+		}
+	}
+}
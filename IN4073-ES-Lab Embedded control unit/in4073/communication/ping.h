@@ -0,0 +1,60 @@
+#ifndef PING_H__
+#define PING_H__
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+// PING data (PING_SIZE bytes, big endian):
+//   0  2  sequence number
+//   2  8  PC CLOCK_MONOTONIC time in us when the PING was sent
+// PONG data (PONG_SIZE bytes): the PING data, then
+//  10  4  drone get_time_us() when the PING was received
+//  14  4  drone get_time_us() when the PONG was sent
+#define PING_SIZE 10
+#define PONG_SIZE 18
+
+// Round trip time histogram: RTT_BIN_US wide bins, the last one collects everything above
+#define RTT_BINS 101
+#define RTT_BIN_US 2000
+
+// Number of the last PONGs the drone clock offset is estimated from
+#define PING_OFFSET_WINDOW 16
+
+// Latency statistics of one link (UART or BLUETOOTH)
+typedef struct
+{
+	uint64_t sent;				// PINGs sent on the link
+	uint64_t received;			// PONGs received on the link
+	uint32_t lastUs;			// Last round trip time
+	uint32_t minUs;				// Smallest round trip time
+	uint32_t maxUs;				// Largest round trip time
+	double meanUs;				// Mean round trip time
+	double m2;					// Sum of squared differences (for the variance)
+	uint32_t droneUs;			// Last time the PING spent on the drone (receive to answer)
+	uint32_t bins[RTT_BINS];	// Round trip time histogram
+
+	// Age of the telemetry when it is received (drone send time to PC receive time)
+	uint64_t telemCount;		// Telemetry messages measured
+	int32_t telemLastUs;		// Age of the last telemetry
+	double telemMeanUs;			// Mean age
+} linkStats;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void ping_poll(void);
+int ping_timeout_ms(void);
+void ping_pong_received(uint8_t link, uint8_t *pData);
+void ping_telem_received(uint8_t link, uint32_t droneUs);
+
+void ping_get_stats(uint8_t link, linkStats *out);
+double ping_stddev_us(const linkStats *stats);
+void ping_print_stats(FILE *fp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PING_H__
@@ -1,4 +1,7 @@
 #include "protocol.h"
+#include "capture.h"
+#include "attstream.h"
+#include "ping.h"
 
 /**
  * @brief Functions to serialize / deserialize 2/4 bytes wide variables
@@ -63,6 +66,142 @@ int32_t to_i32(uint8_t *pData)
 	return ret;
 }
 
+// Format strings and argument counts of the drone events
+#define EVENT_FORMAT(name, args, format) format,
+static const char *eventFormats[EVENT_COUNT] = { EVENT_LIST(EVENT_FORMAT) };
+#undef EVENT_FORMAT
+#define EVENT_ARGS(name, args, format) args,
+static const uint8_t eventArgs[EVENT_COUNT] = { EVENT_LIST(EVENT_ARGS) };
+#undef EVENT_ARGS
+
+/**
+ * @brief Formats an EVENT message of the drone with its format string
+ * from events.h. The arguments are int32 on the drone: they are passed as
+ * long, sign extended for %ld and zero extended for %lu and %lx.
+ * @param uint8_t* Message data: event number, then the arguments
+ * @param char* Text buffer, the text ends with a newline
+ * @param size_t Size of the text buffer
+ */
+void formatEvent(uint8_t *pData, char *text, size_t len)
+{
+	uint8_t id = pData[0];
+	long args[EVENT_MAX_ARGS] = {0, 0, 0, 0};
+
+	if (id >= EVENT_COUNT)
+	{
+		snprintf(text, len, "Unknown drone event %d\n", id);
+		return;
+	}
+
+	// Find the conversion of every argument
+	const char *f = eventFormats[id];
+	for (uint8_t i = 0; i < eventArgs[id]; i++)
+	{
+		while (*f && (*f != '%' || f[1] == '%')) f += (*f == '%') ? 2 : 1;
+		if (*f) f++;
+		while (*f && !isalpha((unsigned char)*f)) f++;
+		while (*f == 'l') f++;
+
+		int32_t value = to_i32(&pData[1 + 4 * i]);
+		args[i] = (*f == 'u' || *f == 'x' || *f == 'X') ? (long)(uint32_t)value : (long)value;
+	}
+
+	int n = snprintf(text, len, eventFormats[id], args[0], args[1], args[2], args[3]);
+	if (n >= 0 && (size_t)n + 1 < len) strcat(text, "\n");
+}
+
+// Format strings of the drone trace records
+#define TRACE_FORMAT(name, format) format,
+static const char *traceFormats[TRACE_COUNT] = { TRACE_LIST(TRACE_FORMAT) };
+#undef TRACE_FORMAT
+
+/**
+ * @brief Formats a block of trace records (TRACE message or Trace log
+ * row) as a timeline, one line per record: drone time, time since the
+ * previous record and the text from events.h.
+ * @param uint8_t* Block: number of records, then the records
+ * @param uint32_t* Time of the previous record, updated
+ * @param char* Text buffer, every line ends with a newline
+ * @param size_t Size of the text buffer
+ */
+void formatTrace(uint8_t *pData, uint32_t *lastTime, char *text, size_t len)
+{
+	text[0] = '\0';
+
+	for (uint8_t i = 0; i < pData[0]; i++)
+	{
+		uint8_t *record = &pData[1 + i * TRACE_RECORD_SIZE];
+		uint32_t time = to_ui32(&record[0]);
+		uint8_t id = record[4];
+		char line[160];
+		int n = snprintf(line, sizeof(line), "%10u us %+9d us | ", time, (int32_t)(time - *lastTime));
+
+		if (id < TRACE_COUNT)
+			snprintf(&line[n], sizeof(line) - n, traceFormats[id], (long)record[5], (long)to_ui16(&record[6]));
+		else
+			snprintf(&line[n], sizeof(line) - n, "Unknown trace record %d", id);
+
+		*lastTime = time;
+		strncat(text, line, len - strlen(text) - 1);
+		strncat(text, "\n", len - strlen(text) - 1);
+	}
+}
+
+/**
+ * @brief Formats a Timing log row: the sample period and the sensor
+ * interrupt to motor latency of every control cycle, and their maximum.
+ * @param uint8_t* Row: cycles in it, cycles that didn't fit, then the cycles
+ * @param char* Text buffer, ends with a newline
+ * @param size_t Size of the text buffer
+ */
+void formatTiming(uint8_t *pData, char *text, size_t len)
+{
+	uint16_t maxLatency = 0;
+	int n = snprintf(text, len, "Timing: dt/latency (us)");
+
+	for (uint8_t i = 0; i < pData[0] && n > 0 && (size_t)n < len; i++)
+	{
+		uint8_t *cycle = &pData[2 + i * TIMING_CYCLE_SIZE];
+		uint16_t latency = to_ui16(&cycle[2]);
+
+		if (latency > maxLatency) maxLatency = latency;
+		n += snprintf(&text[n], len - n, " %u/%u", to_ui16(&cycle[0]), latency);
+	}
+	if (n > 0 && (size_t)n < len)
+		snprintf(&text[n], len - n, " | max latency: %u | not logged: %u\n", maxLatency, pData[1]);
+}
+
+/**
+ * @brief Formats a FLIGHT message: the catalog entry of a flight stored
+ * on the drone. The drone has no clock, the flight is dated by its boot
+ * and the drone time of its first row.
+ * @param uint8_t* Catalog entry (FLIGHT_SIZE bytes)
+ * @param char* Text buffer, ends with a newline
+ * @param size_t Size of the text buffer
+ */
+void formatFlight(uint8_t *pData, char *text, size_t len)
+{
+	uint32_t bootTime = to_ui32(&pData[10]);
+	uint32_t length = to_ui32(&pData[18]);
+	uint32_t rows = to_ui32(&pData[22]);
+	time_t build = to_ui32(&pData[6]);
+	char buildText[40] = "unknown";
+
+	if (build != 0) strftime(buildText, sizeof(buildText), "%Y-%m-%d %H:%M:%S", localtime(&build));
+
+	int n = snprintf(text, len, "Flight %u: boot %u, %u.%03u s after the boot | ",
+		to_ui32(&pData[0]), to_ui16(&pData[4]), bootTime / 1000000, bootTime / 1000 % 1000);
+	if (n < 0 || (size_t)n >= len) return;
+
+	// Length and rows are only written to the catalog when the flight ends
+	if (rows == 0xFFFFFFFF)
+		n += snprintf(&text[n], len - n, "still logging");
+	else
+		n += snprintf(&text[n], len - n, "%u rows, %u bytes", rows, length);
+	if (n > 0 && (size_t)n < len)
+		snprintf(&text[n], len - n, " | firmware built %s\n", buildText);
+}
+
 /**
  * @brief 
  * 
@@ -145,6 +284,9 @@ void serial_port_open(const char *serial_device)
 	int result;
 	struct termios tty;
 
+	// The received bytes come from a capture file
+	if (replay_active()) return;
+
 	fd_serial_port = open(serial_device, O_RDWR | O_NOCTTY);
 	printf("Serial FD %d opened\n", fd_serial_port);
 
@@ -170,7 +312,7 @@ void serial_port_open(const char *serial_device)
 	cfsetispeed(&tty, B115200);
 
 	tty.c_cc[VMIN]  = 0;
-	tty.c_cc[VTIME] = 1; // TODO check cpu usage
+	tty.c_cc[VTIME] = 0; // Non-blocking read, the main loops wait in poll()
 
 	tty.c_iflag &= ~(IXON|IXOFF|IXANY);
 
@@ -191,6 +333,9 @@ void ble_port_open(const char *serial_device)
 	int result;
 	struct termios tty;
 
+	// The received bytes come from a capture file
+	if (replay_active()) return;
+
 	fd_ble_port = open(serial_device, O_RDWR | O_NOCTTY);
 	printf("Ble FD %d opened\n", fd_ble_port);
 	if (fd_ble_port == -1)
@@ -220,7 +365,7 @@ void ble_port_open(const char *serial_device)
 	cfsetispeed(&tty, B115200);
 
 	tty.c_cc[VMIN]  = 0;
-	tty.c_cc[VTIME] = 1; // TODO check cpu usage
+	tty.c_cc[VTIME] = 0; // Non-blocking read, the main loops wait in poll()
 
 	tty.c_iflag &= ~(IXON|IXOFF|IXANY);
 
@@ -277,6 +422,9 @@ int serial_port_getchar(bool ble)
 	ssize_t result = -1;
 	uint8_t c;
 
+	// Replay the captured bytes instead of reading the ports
+	if (replay_active()) return replay_getchar(ble ? BLUETOOTH : UART);
+
 	// Read if we use uart
 	if (!ble)
 	{
@@ -292,6 +440,9 @@ int serial_port_getchar(bool ble)
 	{
 		return -1;
 	}
+
+	// Record the byte if capture is on
+	if (capture_active()) capture_byte(ble ? BLUETOOTH : UART, c);
 	return c;
 }
 
@@ -306,6 +457,9 @@ int serial_port_putchar(char c)
 {
 	int result;
 
+	// Nothing is sent while a capture is replayed
+	if (replay_active()) return 1;
+
 	do 
 	{
 		if (!useBluetooth) { result = (int) write(fd_serial_port, &c, 1); }
@@ -338,68 +492,13 @@ int get_fd_serial()
 	return fd_serial_port;
 }
 
-// Socket and client fd for TCP communication
-int sock = -1;
-int client_fd = -1;
-static bool tcp_enabled = false;
-
-/**
- * @brief Opens a new TCP socket for sending drone rotation positions and connects to Processing.org server as a client
- * @author Kristóf
- */
-void openSocket()
-{
-  struct sockaddr_in serv_addr;
-
-  // Create socket
-  if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0)
-  {
-    printf("TCP: Socket creation error\n");
-    return;
-  }
-
-  // Set IP address family + port
-  serv_addr.sin_family = AF_INET;
-  serv_addr.sin_port = htons(12345);
-
-  // Convert IPv4 and IPv6 addresses from text to binary form
-  if (inet_pton(AF_INET, "127.0.0.1", &serv_addr.sin_addr) <= 0) 
-  {
-    printf("TCP: Invalid address / Address not supported\n");
-    return;
-  }
-
-  // Connect to server
-  if ((client_fd = connect(sock, (struct sockaddr*)&serv_addr, sizeof(serv_addr))) < 0) 
-  {
-    printf("TCP: Connection Failed\n");
-    return;
-  }
-
-  tcp_enabled = true;
-}
-
 /**
- * @brief Closes TCP socket if it was opened
- * @author Kristóf
+ * @brief Function to get the link the messages are sent on
+ * @return BLUETOOTH in wireless mode, else UART
  */
-void closeSocket()
+uint8_t get_active_link(void)
 {
-	if (tcp_enabled)
-	{
-		if (client_fd != -1)
-		{
-			close(client_fd);
-		}
-		if (sock != -1)
-		{
-			close(sock);
-		}
-	}
-	
-	tcp_enabled = false;
-	client_fd = -1;
-	sock = -1;
+	return useBluetooth ? BLUETOOTH : UART;
 }
 
 /*----------------------------------------------------------------
@@ -411,12 +510,15 @@ void closeSocket()
 static bool logFileExist = false;
 char logName[50];
 static int receivedRows = 0;
+static long logFlight = -1;			// Flight number of the log being received, -1 if unknown
+static uint32_t traceTime = 0;		// Time of the last trace record received
+static uint32_t logTraceTime = 0;	// Time of the last trace record in the log
 
 /**
  * @brief Function to process the received message (in pc_terminal).
  * @param msgType Message type enum
  * @param uint8_t* Pointer to data to process
- * @return '.' if flight is finished, else 1
+ * @return '.' if flight is finished, 'F' or 'L' if the flight list or log is received, else 1
  * @author Kristóf
  */
 int processMsg(msgType type, uint8_t *pData)
@@ -432,21 +534,16 @@ int processMsg(msgType type, uint8_t *pData)
 		printf("Angles: %6d %6d %6d | ", to_i16(&pData[9]), to_i16(&pData[11]), to_i16(&pData[13]));
 		printf("Rates: %6d %6d %6d | ", to_i16(&pData[15]), to_i16(&pData[17]), to_i16(&pData[19]));
 		printf("Bat: %4d | Temp: %4d | Pressure: %6d | ", to_ui16(&pData[21]), to_i32(&pData[23]), to_i32(&pData[27]));
-		printf("P: %4d | P1: %4d | P2: %4d | HEI: %4d\n", to_i16(&pData[31]), to_i16(&pData[33]), to_i16(&pData[35]), to_i16(&pData[37]));
-		
-		// Send to processing (pitch, roll, yaw angles)
-		if (tcp_enabled && (client_fd != -1) && (sock != -1))
-		{
-			char TCPmsg[20];
-			snprintf(TCPmsg, sizeof(TCPmsg), "%d %d %d\n", to_i16(&pData[9]), to_i16(&pData[11]), to_i16(&pData[13]));
-			if(send(sock, TCPmsg, strlen(TCPmsg), MSG_DONTWAIT | MSG_NOSIGNAL) == -1)
-			{
-				printf("Can't send to socket, closing it\n");
-				tcp_enabled = false;
-				closeSocket();
-			} 
-		}
-		
+		printf("P: %4d | P1: %4d | P2: %4d | HEI: %4d | Stack: %4d\n", to_i16(&pData[31]), to_i16(&pData[33]), to_i16(&pData[35]), to_i16(&pData[37]), to_ui16(&pData[TELEM_STACK_IDX]));
+		break;
+	}
+
+	case ATT:
+	{
+		// Stream the attitude to the viewers (processing/drone_view)
+		int16_t angles[3] = {to_i16(&pData[4]), to_i16(&pData[6]), to_i16(&pData[8])};
+		int16_t rates[3] = {to_i16(&pData[10]), to_i16(&pData[12]), to_i16(&pData[14])};
+		att_stream_send(to_ui32(&pData[0]), angles, rates);
 		break;
 	}
 
@@ -456,7 +553,8 @@ int processMsg(msgType type, uint8_t *pData)
 		if (!logFileExist)
 		{
 			printf("No log file yet, create new one\n");
-			strcpy(logName, "log_");
+			if (logFlight >= 0) snprintf(logName, sizeof(logName), "log_flight%ld_", logFlight);
+			else strcpy(logName, "log_");
 
 			// Append current time
 			struct timeval tv;
@@ -509,14 +607,28 @@ int processMsg(msgType type, uint8_t *pData)
 		else if (pData[4] == Profiling)
 		{
 			// PROFILING
-			fprintf(fp, "Control loop: %10d, Timer flag: %10d, Yaw mode: %10d, Full mode: %10d, Raw mode: %10d, Height mode: %10d, Logging time: %10d, SQRT time: %10d\n", 
-			to_ui32(&pData[5]), to_ui32(&pData[9]), to_ui32(&pData[13]), to_ui32(&pData[17]), to_ui32(&pData[21]), to_ui32(&pData[25]), to_ui32(&pData[29]), to_ui32(&pData[33]));
+			fprintf(fp, "Control loop: %10d, Timer flag: %10d, Yaw mode: %10d, Full mode: %10d, Raw mode: %10d, Height mode: %10d, Logging time: %10d, SQRT time: %10d, Attitude: %10d\n", 
+			to_ui32(&pData[5]), to_ui32(&pData[9]), to_ui32(&pData[13]), to_ui32(&pData[17]), to_ui32(&pData[21]), to_ui32(&pData[25]), to_ui32(&pData[29]), to_ui32(&pData[33]), to_ui32(&pData[37]));
 		}
 		else if (pData[4] == Full)
 		{
 			// FULL
 			fprintf(fp, "Flash is full\n");
 		}
+		else if (pData[4] == Trace)
+		{
+			// TRACE, saved at a panic
+			char text[512];
+			formatTrace(&pData[5], &logTraceTime, text, sizeof(text));
+			fprintf(fp, "Trace:\n%s", text);
+		}
+		else if (pData[4] == Timing)
+		{
+			// TIMING of the control cycles
+			char text[256];
+			formatTiming(&pData[5], text, sizeof(text));
+			fprintf(fp, "%s", text);
+		}
 		else
 		{
 			// ERROR
@@ -530,6 +642,34 @@ int processMsg(msgType type, uint8_t *pData)
 		break;
 	}
 
+	case EVENT:
+	{
+		char text[256];
+		formatEvent(pData, text, sizeof(text));
+		printf("%s", text);
+		break;
+	}
+
+	case TRACE:
+	{
+		char text[512];
+		formatTrace(pData, &traceTime, text, sizeof(text));
+		printf("%s", text);
+		break;
+	}
+
+	case FLIGHT:
+	{
+		// Catalog entry, the LOG rows of the flight (if any) go to a new log file
+		char text[256];
+		formatFlight(pData, text, sizeof(text));
+		printf("%s", text);
+		logFlight = to_ui32(&pData[0]);
+		logFileExist = false;
+		receivedRows = 0;
+		break;
+	}
+
 	case ACK:
 	{
 		printf("ACK arrived: %d\n", pData[0]);
@@ -550,6 +690,12 @@ int processMsg(msgType type, uint8_t *pData)
 		{
 			printf("Drone finished flying\n");
 			ret = pData[0];
+		}
+		// Flight list or flight log of the catalog sent
+		else if (pData[0] == 'F' || pData[0] == 'L')
+		{
+			printf(pData[0] == 'F' ? "Flight list received\n" : "\nFlight log received\n");
+			ret = pData[0];
 		}		
 		// Every other mode
 		else
@@ -577,7 +723,7 @@ int processMsg(msgType type, uint8_t *pData)
  * @param msgType Message type enum
  * @param uint8_t* Pointer to data to process
  * @param pointers Structure of pointers which points to data fields used by GUI
- * @return '.' if flight is finished, else returns 1
+ * @return '.' if flight is finished, 'F' or 'L' if the flight list or log is received, else returns 1
  * @author Kristóf
  */
 int processMsgGui(msgType type, uint8_t *pData, pointers pointers)
@@ -598,20 +744,7 @@ int processMsgGui(msgType type, uint8_t *pData, pointers pointers)
 			printf("Angles: %6d %6d %6d | ", to_i16(&pData[9]), to_i16(&pData[11]), to_i16(&pData[13]));
 			printf("Rates: %6d %6d %6d | ", to_i16(&pData[15]), to_i16(&pData[17]), to_i16(&pData[19]));
 			printf("Bat: %4d | Temp: %4d | Pressure: %6d | ", to_ui16(&pData[21]), to_i32(&pData[23]), to_i32(&pData[27]));
-			printf("P: %4d | P1: %4d | P2: %4d | HEI: %4d\n", to_i16(&pData[31]), to_i16(&pData[33]), to_i16(&pData[35]), to_i16(&pData[37]));
-		}
-
-		// Send to processing (pitch, roll, yaw angles)
-		if (tcp_enabled && (client_fd != -1) && (sock != -1))
-		{
-			char TCPmsg[20];
-			snprintf(TCPmsg, sizeof(TCPmsg), "%d %d %d\n", to_i16(&pData[9]), to_i16(&pData[11]), to_i16(&pData[13]));
-			if(send(sock, TCPmsg, strlen(TCPmsg), MSG_DONTWAIT | MSG_NOSIGNAL) == -1)
-			{
-				printf("Can't send to socket, closing it\n");
-				tcp_enabled = false;
-				closeSocket();
-			} 
+			printf("P: %4d | P1: %4d | P2: %4d | HEI: %4d | Stack: %4d\n", to_i16(&pData[31]), to_i16(&pData[33]), to_i16(&pData[35]), to_i16(&pData[37]), to_ui16(&pData[TELEM_STACK_IDX]));
 		}
 
 		// Send telemetry data to GUI
@@ -625,6 +758,38 @@ int processMsgGui(msgType type, uint8_t *pData, pointers pointers)
 		pointers.gains[2] = to_i16(&pData[35]);
 		pointers.gains[3] = to_i16(&pData[37]);
 
+		// Fill the sample for the plots, the attitude comes with ATT
+		if (pointers.telem != NULL)
+		{
+			for (int i = 0; i < 4; i++)
+			{
+				pointers.telem->motors[i] = to_i16(&pData[1 + 2 * i]);
+			}
+			pointers.telem->battery = to_ui16(&pData[21]);
+			pointers.telem->pressure = to_i32(&pData[27]);
+			pointers.telem->seq++;
+		}
+
+		break;
+	}
+
+	case ATT:
+	{
+		// Stream the attitude to the viewers (processing/drone_view)
+		int16_t angles[3] = {to_i16(&pData[4]), to_i16(&pData[6]), to_i16(&pData[8])};
+		int16_t rates[3] = {to_i16(&pData[10]), to_i16(&pData[12]), to_i16(&pData[14])};
+		att_stream_send(to_ui32(&pData[0]), angles, rates);
+
+		// Fill the sample for the plots (int16 angles: 32768 = 180 degrees)
+		if (pointers.telem != NULL)
+		{
+			for (int i = 0; i < 3; i++)
+			{
+				pointers.telem->angles[i] = angles[i] * (180.0f / 32768.0f);
+				pointers.telem->rates[i] = rates[i];
+			}
+			pointers.telem->attSeq++;
+		}
 		break;
 	}
 
@@ -634,7 +799,8 @@ int processMsgGui(msgType type, uint8_t *pData, pointers pointers)
 		if (!logFileExist)
 		{
 			printf("No log file yet, create new one\n");
-			strcpy(logName, "log_");
+			if (logFlight >= 0) snprintf(logName, sizeof(logName), "log_flight%ld_", logFlight);
+			else strcpy(logName, "log_");
 
 			// Append current time
 			struct timeval tv;
@@ -687,14 +853,28 @@ int processMsgGui(msgType type, uint8_t *pData, pointers pointers)
 		else if (pData[4] == Profiling)
 		{
 			// PROFILING
-			fprintf(fp, "Control loop: %10d, Timer flag: %10d, Yaw mode: %10d, Full mode: %10d, Raw mode: %10d, Height mode: %10d, Logging time: %10d, SQRT time: %10d\n", 
-			to_ui32(&pData[5]), to_ui32(&pData[9]), to_ui32(&pData[13]), to_ui32(&pData[17]), to_ui32(&pData[21]), to_ui32(&pData[25]), to_ui32(&pData[29]), to_ui32(&pData[33]));
+			fprintf(fp, "Control loop: %10d, Timer flag: %10d, Yaw mode: %10d, Full mode: %10d, Raw mode: %10d, Height mode: %10d, Logging time: %10d, SQRT time: %10d, Attitude: %10d\n", 
+			to_ui32(&pData[5]), to_ui32(&pData[9]), to_ui32(&pData[13]), to_ui32(&pData[17]), to_ui32(&pData[21]), to_ui32(&pData[25]), to_ui32(&pData[29]), to_ui32(&pData[33]), to_ui32(&pData[37]));
 		}
 		else if (pData[4] == Full)
 		{
 			// FULL
 			fprintf(fp, "Flash is full\n");
 		}
+		else if (pData[4] == Trace)
+		{
+			// TRACE, saved at a panic
+			char text[512];
+			formatTrace(&pData[5], &logTraceTime, text, sizeof(text));
+			fprintf(fp, "Trace:\n%s", text);
+		}
+		else if (pData[4] == Timing)
+		{
+			// TIMING of the control cycles
+			char text[256];
+			formatTiming(&pData[5], text, sizeof(text));
+			fprintf(fp, "%s", text);
+		}
 		else
 		{
 			// ERROR
@@ -708,6 +888,40 @@ int processMsgGui(msgType type, uint8_t *pData, pointers pointers)
 		break;
 	}
 
+	case EVENT:
+	{
+		// Print the event to terminal and GUI text window
+		char text[256];
+		formatEvent(pData, text, sizeof(text));
+		printf("%s", text);
+		strncat(pointers.text, text, (TEXT_LEN - strlen(pointers.text) - 1)); // Protected against overflow (I hope so)
+		break;
+	}
+
+	case TRACE:
+	{
+		// Print the trace to terminal and GUI text window
+		char text[512];
+		formatTrace(pData, &traceTime, text, sizeof(text));
+		printf("%s", text);
+		strncat(pointers.text, text, (TEXT_LEN - strlen(pointers.text) - 1));
+		break;
+	}
+
+	case FLIGHT:
+	{
+		// Print the catalog entry to terminal and GUI text window,
+		// the LOG rows of the flight (if any) go to a new log file
+		char text[256];
+		formatFlight(pData, text, sizeof(text));
+		printf("%s", text);
+		strncat(pointers.text, text, (TEXT_LEN - strlen(pointers.text) - 1));
+		logFlight = to_ui32(&pData[0]);
+		logFileExist = false;
+		receivedRows = 0;
+		break;
+	}
+
 	case ACK:
 	{
 		printf("ACK arrived: %d\n", pData[0]);
@@ -730,6 +944,12 @@ int processMsgGui(msgType type, uint8_t *pData, pointers pointers)
 			printf("Drone finished flying\n");
 			ret = pData[0];
 		}
+		// Flight list or flight log of the catalog sent
+		else if (pData[0] == 'F' || pData[0] == 'L')
+		{
+			printf(pData[0] == 'F' ? "Flight list received\n" : "\nFlight log received\n");
+			ret = pData[0];
+		}
 		// Every other mode
 		else
 		{
@@ -809,6 +1029,30 @@ void packMessage(msgType type, uint8_t *pData)
 		break;
 	}
 
+	case PING:
+	{
+		serial_port_putchar(PING_SIZE);
+		checkSum ^= PING_SIZE;
+		for (int i = 0; i < PING_SIZE; i++)
+		{
+			serial_port_putchar(pData[i]);
+			checkSum ^= pData[i];
+		}
+		break;
+	}
+
+	case FLIGHT_REQ:
+	{
+		serial_port_putchar(FLIGHT_REQ_SIZE);
+		checkSum ^= FLIGHT_REQ_SIZE;
+		for (int i = 0; i < FLIGHT_REQ_SIZE; i++)
+		{
+			serial_port_putchar(pData[i]);
+			checkSum ^= pData[i];
+		}
+		break;
+	}
+
 	default:
 	{
 		serial_port_putchar(1);	// Length 1
@@ -823,6 +1067,21 @@ void packMessage(msgType type, uint8_t *pData)
 	serial_port_putchar(checkSum);
 }
 
+/**
+ * @brief Sends a request to the log catalog of the drone, answered only
+ * in safe mode.
+ * @param uint8_t FLIGHT_LIST or FLIGHT_SEND
+ * @param uint32_t Flight number to send (FLIGHT_SEND)
+ */
+void requestFlight(uint8_t request, uint32_t number)
+{
+	uint8_t data[FLIGHT_REQ_SIZE];
+
+	data[0] = request;
+	ui32_to_ui8(number, &data[1]);
+	packMessage(FLIGHT_REQ, data);
+}
+
 /**
  * @brief Function to process incoming characters (pc_terminal).
  * Calls processMsg when a message is finished.
@@ -853,7 +1112,7 @@ int unpackMessage(uint8_t c, recMachine *SM)
 	case TYPE:
 	{
 		SM->recType = (msgType)c;
-		if (SM->recType != TELEM && SM->recType != LOG && SM->recType != ACK && SM->recType != DEBUG)
+		if (SM->recType != TELEM && SM->recType != LOG && SM->recType != ACK && SM->recType != DEBUG && SM->recType != PONG && SM->recType != EVENT && SM->recType != TRACE && SM->recType != FLIGHT && SM->recType != ATT)
 		{
 			printf("Message type error at receiving!\n");
 			error = 1; // Start again as we have an error
@@ -894,9 +1153,16 @@ int unpackMessage(uint8_t c, recMachine *SM)
 		{
 			printf("Checksum error at receiving!\n");
 		}
+		// The latency probe answers are only measured
+		else if (SM->recType == PONG)
+		{
+			ping_pong_received(SM->link, SM->msg);
+			ret = 1;
+		}
 		// Process message if check sum was correct
 		else
 		{
+			if (SM->recType == TELEM) ping_telem_received(SM->link, to_ui32(&SM->msg[TELEM_TIME_IDX]));
 			ret = processMsg(SM->recType, SM->msg);
 		}
 		SM->actualState = START;
@@ -966,7 +1232,7 @@ int unpackMessageGui(uint8_t c, recMachine *SM, pointers pointers)
 	case TYPE:
 	{
 		SM->recType = (msgType)c;
-		if (SM->recType != TELEM && SM->recType != LOG && SM->recType != ACK && SM->recType != DEBUG)
+		if (SM->recType != TELEM && SM->recType != LOG && SM->recType != ACK && SM->recType != DEBUG && SM->recType != PONG && SM->recType != EVENT && SM->recType != TRACE && SM->recType != FLIGHT && SM->recType != ATT)
 		{
 			printf("Message type error at receiving!\n");
 			// Print to GUI text window
@@ -1011,9 +1277,16 @@ int unpackMessageGui(uint8_t c, recMachine *SM, pointers pointers)
 			// Print to GUI text window
 			strncat(pointers.text, "Checksum error at receiving!\n", (TEXT_LEN - strlen(pointers.text) - 1)); // Protected against overflow (I hope so)
 		}
+		// The latency probe answers are only measured
+		else if (SM->recType == PONG)
+		{
+			ping_pong_received(SM->link, SM->msg);
+			ret = 1;
+		}
 		// Process message if check sum was correct
 		else
 		{
+			if (SM->recType == TELEM) ping_telem_received(SM->link, to_ui32(&SM->msg[TELEM_TIME_IDX]));
 			ret = processMsgGui(SM->recType, SM->msg, pointers);
 		}
 		SM->actualState = START;
@@ -1173,6 +1446,15 @@ int8_t processKeyboard(char c, uint8_t *cmd)
 		cmd[6] |= 0x01;
 		break;
 
+	case 't':
+		cmd[6] |= (0x01 << 6);
+		break;
+
+	// List the flights stored on the drone
+	case 'f':
+		requestFlight(FLIGHT_LIST, 0);
+		break;
+
 	// Mode change keys (send mode change request immediately)
 	case '0':
 		mode = SafeMode; 
@@ -5,6 +5,15 @@
 #define BUF_SIZE 50
 #define CFG_SIZE 8
 #define CMD_SIZE 7
+#define TELEM_TIME_IDX 39	// Drone time (us) after the telemetry fields
+#define TELEM_STACK_IDX 43	// Stack high-water mark (bytes) of the drone
+#define ATT_SIZE 16		// Attitude sample: drone time (us, 4), phi, theta, psi (6), sp, sq, sr (6)
+#define TRACE_RECORD_SIZE 8	// Trace record: drone time (us, 4), id (1), a (1), b (2)
+#define TIMING_CYCLE_SIZE 4	// Timing log cycle: sample period (us, 2), sensor to motor latency (us, 2)
+#define FLIGHT_REQ_SIZE 5	// Flight request: FLIGHT_LIST or FLIGHT_SEND (1), flight number (4)
+#define FLIGHT_SIZE 26		// Catalog entry: number (4), boot (2), build (4), boot time (4), start (4), length (4), rows (4)
+#define FLIGHT_LIST 0		// Send the catalog entries of the stored flights, ACK 'F' at the end
+#define FLIGHT_SEND 1		// Send the log of a flight, ACK 'L' at the end
 
 #define TEXT_LEN 1024*128
 
@@ -27,6 +36,7 @@
 
 #include "joy.h"
 #include "config.h"
+#include "../events.h"
 
 // Message types enum
 typedef enum 
@@ -38,7 +48,14 @@ typedef enum
 	TELEM,	// Telemetry data
 	LOG,	// Logged data
 	ACK,	// ACK message
-	DEBUG	// Debug message
+	DEBUG,	// Debug message
+	PING,	// Latency probe to the drone
+	PONG,	// Answer to PING
+	EVENT,	// Status event of the drone, formatted with ../events.h
+	TRACE,	// Block of flight trace records of the drone
+	FLIGHT_REQ,	// Request to the log catalog of the drone
+	FLIGHT,	// Catalog entry of a stored flight
+	ATT		// Attitude sample of the drone, published by attstream.h
 } msgType;
 
 // System states enum
@@ -70,6 +87,7 @@ typedef struct
 	msgType recType;
 	uint8_t msg[BUF_SIZE];
 	uint8_t idx;
+	uint8_t link;		// UART or BLUETOOTH, the link the machine reads
 } recMachine;
 
 // Logging types enum
@@ -78,9 +96,23 @@ typedef enum {
 	ModeChg,
 	Command,
 	Profiling,
-	Full
+	Full,
+	Trace,		// Block of flight trace records, saved at a panic
+	Timing		// Sample period and sensor to motor latency of the control cycles
 } logType;
 
+// Latest telemetry sample, used by the GUI plots
+typedef struct
+{
+	uint32_t seq;		// Incremented on every received telemetry message (TELEM)
+	uint32_t attSeq;	// Incremented on every received attitude message (ATT)
+	float angles[3];	// Phi, theta, psi in degrees, from ATT
+	float rates[3];		// Sp, sq, sr (raw gyro values), from ATT
+	float motors[4];	// Motor values (raw)
+	float pressure;		// Barometer pressure
+	float battery;		// Battery voltage (raw ADC value)
+} telemSample;
+
 // Struct to pass the pointers to the msg process function
 typedef struct
 {
@@ -88,6 +120,7 @@ typedef struct
     float* motorValues;
     uint8_t* ackMode;
     int16_t* gains;
+    telemSample* telem;
 } pointers;
 
 #ifdef __cplusplus
@@ -112,12 +145,13 @@ int processMsgGui(msgType type, uint8_t *pData, pointers pointers);
 void packMessage(msgType type, uint8_t *pData);
 int unpackMessage(uint8_t c, recMachine *SM);
 int unpackMessageGui(uint8_t c, recMachine *SM, pointers pointers);
+void formatEvent(uint8_t *pData, char *text, size_t len);
+void formatTrace(uint8_t *pData, uint32_t *lastTime, char *text, size_t len);
+void formatTiming(uint8_t *pData, char *text, size_t len);
+void formatFlight(uint8_t *pData, char *text, size_t len);
+void requestFlight(uint8_t request, uint32_t number);
 int8_t processKeyboard(char c, uint8_t *cmd);
 
-// TCP socket for processing
-void openSocket();
-void closeSocket();
-
 // Console I/O
 void term_initio();
 void term_exitio();
@@ -135,6 +169,7 @@ int serial_port_getchar(bool ble);
 int serial_port_putchar(char c);
 int get_fd_ble();
 int get_fd_serial();
+uint8_t get_active_link(void);
 
 #ifdef __cplusplus
 }
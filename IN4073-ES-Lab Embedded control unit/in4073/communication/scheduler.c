@@ -0,0 +1,250 @@
+#include "scheduler.h"
+#include "config.h"
+
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/timerfd.h>
+
+// Timer file descriptor and the send statistics
+static int fd_timer = -1;
+static schedStats stats;
+
+// Time of the previous send, 0 if nothing was sent since (re)arming
+static uint64_t lastSendNs = 0;
+
+// Time of the previous send of any kind (periodic or stick change)
+static uint64_t lastAnySendNs = 0;
+
+/**
+ * @brief Reads the monotonic clock. Unlike gettimeofday() it never
+ * jumps when the wall clock is adjusted.
+ * @return Current CLOCK_MONOTONIC time in nanoseconds
+ */
+uint64_t get_mono_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Clears the statistics and sets the nominal period
+ * @param uint32_t Send rate in Hz
+ */
+static void sched_reset_stats(uint32_t rateHz)
+{
+	memset(&stats, 0, sizeof(stats));
+	stats.rateHz = rateHz;
+	stats.periodUs = 1000000 / rateHz;
+	stats.minUs = INT32_MAX;
+	stats.maxUs = INT32_MIN;
+	lastSendNs = 0;
+}
+
+/**
+ * @brief Creates a periodic timer on the monotonic clock. Its fd becomes
+ * readable once per period, so the main loop can wait for it with poll().
+ * @param uint32_t Send rate in Hz (clamped between 1 and SEND_RATE_MAX_HZ)
+ * @return Timer file descriptor, -1 on error
+ */
+int sched_open(uint32_t rateHz)
+{
+	fd_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd_timer == -1)
+	{
+		perror("timerfd_create");
+		return -1;
+	}
+
+	if (sched_set_rate(rateHz) == -1)
+	{
+		sched_close();
+		return -1;
+	}
+
+	return fd_timer;
+}
+
+/**
+ * @brief Changes the send rate. Rearms the timer and restarts the statistics.
+ * @param uint32_t Send rate in Hz (clamped between 1 and SEND_RATE_MAX_HZ)
+ * @return 0 on success, -1 on error
+ */
+int sched_set_rate(uint32_t rateHz)
+{
+	struct itimerspec its;
+
+	if (fd_timer == -1) return -1;
+
+	if (rateHz < 1) rateHz = 1;
+	if (rateHz > SEND_RATE_MAX_HZ) rateHz = SEND_RATE_MAX_HZ;
+
+	uint64_t periodNs = 1000000000ULL / rateHz;
+	its.it_interval.tv_sec = periodNs / 1000000000ULL;
+	its.it_interval.tv_nsec = periodNs % 1000000000ULL;
+	its.it_value = its.it_interval;
+
+	if (timerfd_settime(fd_timer, 0, &its, NULL) == -1)
+	{
+		perror("timerfd_settime");
+		return -1;
+	}
+
+	sched_reset_stats(rateHz);
+	return 0;
+}
+
+/**
+ * @brief Closes the timer if it was opened
+ */
+void sched_close(void)
+{
+	if (fd_timer != -1)
+	{
+		close(fd_timer);
+	}
+	fd_timer = -1;
+}
+
+/**
+ * @brief Function to get the timer file descriptor (for poll)
+ * @return Timer fd, -1 if it is not opened
+ */
+int sched_get_fd(void)
+{
+	return fd_timer;
+}
+
+/**
+ * @brief Consumes the timer expirations. More than one expiration means
+ * the loop could not keep up, the extra ones are counted as missed.
+ * @return Number of periods elapsed since the last call, 0 if not due yet
+ */
+uint64_t sched_expired(void)
+{
+	uint64_t expirations = 0;
+
+	if (fd_timer == -1) return 0;
+
+	if (read(fd_timer, &expirations, sizeof(expirations)) != sizeof(expirations))
+	{
+		if (errno != EAGAIN) perror("timerfd read");
+		return 0;
+	}
+
+	if (expirations > 1) stats.missed += expirations - 1;
+	return expirations;
+}
+
+/**
+ * @brief Stores the time of a send and puts the deviation of the
+ * send-to-send interval from the nominal period in the histogram.
+ */
+void sched_mark_sent(void)
+{
+	uint64_t now = get_mono_ns();
+
+	if (lastSendNs != 0)
+	{
+		int32_t devUs = (int32_t)((int64_t)(now - lastSendNs) / 1000 - stats.periodUs);
+
+		if (devUs < stats.minUs) stats.minUs = devUs;
+		if (devUs > stats.maxUs) stats.maxUs = devUs;
+
+		// Welford's running mean and variance
+		stats.sent++;
+		double delta = devUs - stats.meanUs;
+		stats.meanUs += delta / stats.sent;
+		stats.m2 += delta * (devUs - stats.meanUs);
+
+		// Outliers go to the first / last bin
+		int32_t bin = (devUs + (JITTER_BIN_US / 2) * (devUs >= 0 ? 1 : -1)) / JITTER_BIN_US + JITTER_BINS / 2;
+		if (bin < 0) bin = 0;
+		if (bin >= JITTER_BINS) bin = JITTER_BINS - 1;
+		stats.bins[bin]++;
+	}
+
+	lastSendNs = now;
+	lastAnySendNs = now;
+}
+
+/**
+ * @brief Stores the time of a send triggered by a stick change. It
+ * isn't part of the period statistics, the timer keeps running.
+ */
+void sched_mark_sent_change(void)
+{
+	stats.changeSent++;
+	lastAnySendNs = get_mono_ns();
+}
+
+/**
+ * @brief Function to check if a stick change may be sent now
+ * @return 0 if it may be sent, otherwise the ms to wait
+ */
+int sched_change_holdoff_ms(void)
+{
+	uint64_t elapsed = get_mono_ns() - lastAnySendNs;
+
+	if (lastAnySendNs == 0 || elapsed >= CMD_CHANGE_MIN_MS * 1000000ULL) return 0;
+	return (int)((CMD_CHANGE_MIN_MS * 1000000ULL - elapsed + 999999) / 1000000);
+}
+
+/**
+ * @brief Copies the current statistics
+ * @param schedStats* Where to copy them
+ */
+void sched_get_stats(schedStats *out)
+{
+	*out = stats;
+}
+
+/**
+ * @brief Standard deviation of the send period
+ * @param schedStats* Statistics to use
+ * @return Standard deviation in us
+ */
+double sched_stddev_us(const schedStats *s)
+{
+	if (s->sent < 2) return 0.0;
+	return sqrt(s->m2 / (s->sent - 1));
+}
+
+/**
+ * @brief Prints the jitter statistics with a text histogram
+ * @param FILE* Where to print
+ */
+void sched_print_stats(FILE *fp)
+{
+	uint32_t maxCount = 1;
+
+	fprintf(fp, "\nCMD send rate %u Hz (period %u us), %" PRIu64 " intervals, %" PRIu64 " missed periods, %" PRIu64 " stick change sends\n",
+		stats.rateHz, stats.periodUs, stats.sent, stats.missed, stats.changeSent);
+	if (stats.sent == 0) return;
+
+	fprintf(fp, "Deviation: mean %.1f us, stddev %.1f us, min %d us, max %d us\n",
+		stats.meanUs, sched_stddev_us(&stats), stats.minUs, stats.maxUs);
+
+	for (int i = 0; i < JITTER_BINS; i++)
+	{
+		if (stats.bins[i] > maxCount) maxCount = stats.bins[i];
+	}
+
+	// Only print the non-empty bins, bars are scaled to 50 characters
+	for (int i = 0; i < JITTER_BINS; i++)
+	{
+		if (!stats.bins[i]) continue;
+
+		int center = (i - JITTER_BINS / 2) * JITTER_BIN_US;
+		if (i == 0) fprintf(fp, "     <=%6d us %8u | ", center, stats.bins[i]);
+		else if (i == JITTER_BINS - 1) fprintf(fp, "     >=%6d us %8u | ", center, stats.bins[i]);
+		else fprintf(fp, "       %6d us %8u | ", center, stats.bins[i]);
+
+		int len = (int)((uint64_t)stats.bins[i] * 50 / maxCount);
+		for (int j = 0; j < len; j++) fputc('#', fp);
+		fputc('\n', fp);
+	}
+}
@@ -0,0 +1,55 @@
+#ifndef SCHEDULER_H__
+#define SCHEDULER_H__
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+// Jitter histogram layout: odd number of bins, the middle one is "on time"
+#define JITTER_BINS 41
+#define JITTER_BIN_US 100
+
+// Send period statistics of the CMD scheduler
+typedef struct
+{
+	uint32_t rateHz;			// Configured send rate
+	uint32_t periodUs;			// Nominal send period
+	uint64_t sent;				// Number of sends measured
+	uint64_t missed;			// Timer periods we were too late to serve
+	uint64_t changeSent;		// Extra sends triggered by stick changes
+	int32_t minUs;				// Smallest deviation from the nominal period
+	int32_t maxUs;				// Largest deviation from the nominal period
+	double meanUs;				// Mean deviation
+	double m2;					// Sum of squared differences (for the variance)
+	uint32_t bins[JITTER_BINS];	// Deviation histogram, JITTER_BIN_US wide bins
+} schedStats;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Monotonic clock in nanoseconds
+uint64_t get_mono_ns(void);
+
+// Periodic CMD scheduler (timerfd on CLOCK_MONOTONIC)
+int sched_open(uint32_t rateHz);
+int sched_set_rate(uint32_t rateHz);
+void sched_close(void);
+int sched_get_fd(void);
+uint64_t sched_expired(void);
+void sched_mark_sent(void);
+
+// Extra sends between the periods (stick changes), rate limited by CMD_CHANGE_MIN_MS
+void sched_mark_sent_change(void);
+int sched_change_holdoff_ms(void);
+
+// Jitter statistics
+void sched_get_stats(schedStats *stats);
+double sched_stddev_us(const schedStats *stats);
+void sched_print_stats(FILE *fp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SCHEDULER_H__
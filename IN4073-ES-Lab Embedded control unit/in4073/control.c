@@ -24,6 +24,10 @@
 #include "comm.h"
 #include "utils/profiling.h" 
 #include "filter.h"
+#include "pid.h"
+#include "mixer_lut.h"
+#include "utils/settings.h"
+#include "utils/trace.h"
 
 #include <math.h>
 
@@ -37,6 +41,10 @@
 #define B_CONSTANT 6000
 #define D_CONSTANT 4000
 
+#if B_CONSTANT != MIXER_LUT_B_CONSTANT || D_CONSTANT != MIXER_LUT_D_CONSTANT
+#error "mixer_lut.h is out of date, run make mixer_lut.h"
+#endif
+
 #define JOYSTICK_THROTTLE_MAX 600
 
 #define JOYSTICK_PR_DIVIDER 20
@@ -47,6 +55,27 @@
 #define JOYSTICK_ROLL_MUTIPLIER 30 // RollControllMode MUTIPLiER
 #define JOYSTICK_PITCH_MUTIPLIER 30 // PitchControllMode MUTIPLiER
 
+// Joystick to angle setpoint, (stick - 127) * 32767 / 127 / divider as a Q8 multiplier
+#define JOYSTICK_ANGLE_Q8(divider) ((32767L * 256 + 127 * (divider) / 2) / (127 * (divider)))
+#define JOYSTICK_ANGLE_FULL JOYSTICK_ANGLE_Q8(JOYSTICK_PR_DIVIDER)
+#define JOYSTICK_ANGLE_HEIGHT JOYSTICK_ANGLE_Q8(5)
+
+// Integral and derivative gains of the controllers, relative to the P gain
+// that is set with CFG / the keys: ki = KI_NUM / KP_DEN * kp per sample.
+// Zero keeps the original P control.
+#define PID_KP_DEN 256
+#define PID_YAW_KI_NUM 0
+#define PID_YAW_KD_NUM 0
+#define PID_ANGLE_KI_NUM 0
+#define PID_ANGLE_KD_NUM 0
+#define PID_RATE_KI_NUM 0
+#define PID_RATE_KD_NUM 0
+#define PID_HEIGHT_KI_NUM 0
+#define PID_HEIGHT_KD_NUM 0
+// Height hold damping: Z -= vertical speed (Pa/s) * Gain_height >> HEIGHT_SPEED_SHIFT
+#define HEIGHT_SPEED_SHIFT 2
+#define PID_D_FILTER_SHIFT 2
+
 uint16_t motor[4];
 int16_t ae[4] = {0, 0, 0, 0};
 int16_t te[4] = {0, 0, 0, 0};
@@ -57,9 +86,10 @@ int16_t phi_pre;//phi we want according to joystickRoll
 int16_t theta_pre;//theta we want according to joystickPitch
 // int16_t saz_pre;
 int16_t sq_filtered, sp_filtered;
-int16_t sa_phi, sa_theta, sa_phi_filtered, sa_theta_filtered;
-KalmanState_t kS_theta, kS_phi;
-ButterWorthState_t bS_sq, bS_sp, bS_sa_theta, bS_sa_phi, bS_sa_sr, bS_pressure;
+ButterWorthState_t bS_sq, bS_sp, bS_sa_sr;
+VerticalState_t vS_height;
+MahonyState_t mS_attitude;
+PidState_t pidYaw, pidPitch, pidRoll, pidPitchRate, pidRollRate, pidHeight;
 
 int16_t Gain_Yaw = 12;//18;//The Gain value of P controller in YawControlMode
 
@@ -74,10 +104,6 @@ calibrationData cData;
 // When was the last key command processed
 static uint32_t lastKeyProcess = 0;
 
-
-
-char msg[100];
-
 /**
  * @brief Set motor values to off. This is the most direct way to do so, motor vars are directly read by timer interrupts
  * @author Philip Groet
@@ -102,8 +128,8 @@ void update_motors(void)
 		|| ae[2] > 2000
 		|| ae[3] > 2000
 	) {
-		snprintf(msg, 100, "One of motor values too high: %d %d %d %d", ae[0], ae[1], ae[2], ae[3]);
-		packMessage(DEBUG, NULL, msg);
+		SEND_EVENT(EV_MOTOR_TOO_HIGH, ae[0], ae[1], ae[2], ae[3]);
+		trace(TR_MOTOR_LIMIT, systemState, MAX(MAX(ae[0], ae[1]), MAX(ae[2], ae[3])));
 
 		if(setSystemState(PanicMode))
 		{
@@ -174,8 +200,36 @@ void increaseYaw(int degrees) {
 	te[3] += degrees;
 }
 
+/**
+ * @brief Converts the thrust of one motor to its motor value:
+ * isqrt(thrust * gcd(B_CONSTANT, D_CONSTANT) / 4), linearly interpolated
+ * in mixerLut, at least MOTOR_TURN_MINIMUM. At most one count below
+ * the exact square root; thrusts past the end of the table (motor value
+ * above 2000, panic) give the last entry.
+ *
+ * @param thrust - (Z +- 2M) * MIXER_B_UNIT +- N * MIXER_D_UNIT.
+ * @return int16_t - motor value.
+ */
+static int16_t thrustToMotor(int32_t thrust) {
+	if (thrust <= 0) {
+		return MOTOR_TURN_MINIMUM;
+	}
+
+	uint32_t i = (uint32_t)thrust >> MIXER_LUT_SHIFT;
+	if (i >= MIXER_LUT_ENTRIES - 1) {
+		return mixerLut[MIXER_LUT_ENTRIES - 1] >> MIXER_LUT_FRAC_BITS;
+	}
+
+	uint32_t f = (uint32_t)thrust & ((1 << MIXER_LUT_SHIFT) - 1);
+	uint32_t v = mixerLut[i] + (((uint32_t)(mixerLut[i + 1] - mixerLut[i]) * f) >> MIXER_LUT_SHIFT);
+
+	return MAX(MOTOR_TURN_MINIMUM, (int16_t)(v >> MIXER_LUT_FRAC_BITS));
+}
+
 /**
  * @brief Calculates the basic motor values, based on yaw/roll/pitch/throttle and sets them in ae.
+ * Same result as isqrt(((Z+2M) * B_CONSTANT - N * D_CONSTANT) / 4) etc. within one count,
+ * but with the square root from a table.
  * 
  * @author Philip Groet & Wesley de Hek
  * @param Z - Desired lift.
@@ -184,16 +238,12 @@ void increaseYaw(int degrees) {
  * @param L - Desired roll.
  */
 void calculateMotorValues(int16_t Z, int16_t M, int16_t N, int16_t L) {
-	ae[0] = isqrt((MAX(0, ((Z+2*M) * B_CONSTANT - N * D_CONSTANT)) / 4));
-	ae[1] = isqrt((MAX(0, ((Z-2*L) * B_CONSTANT + N * D_CONSTANT)) / 4));
-	ae[2] = isqrt((MAX(0, ((Z-2*M) * B_CONSTANT - N * D_CONSTANT)) / 4));
-	ae[3] = isqrt((MAX(0, ((Z+2*L) * B_CONSTANT + N * D_CONSTANT)) / 4));
-
-	// Minimum value to keep rotors spinning
-	ae[0] = MAX(MOTOR_TURN_MINIMUM, ae[0]);
-	ae[1] = MAX(MOTOR_TURN_MINIMUM, ae[1]);
-	ae[2] = MAX(MOTOR_TURN_MINIMUM, ae[2]);
-	ae[3] = MAX(MOTOR_TURN_MINIMUM, ae[3]);
+	int32_t yaw = (int32_t)N * MIXER_D_UNIT;
+
+	ae[0] = thrustToMotor(((int32_t)Z + 2*M) * MIXER_B_UNIT - yaw);
+	ae[1] = thrustToMotor(((int32_t)Z - 2*L) * MIXER_B_UNIT + yaw);
+	ae[2] = thrustToMotor(((int32_t)Z - 2*M) * MIXER_B_UNIT - yaw);
+	ae[3] = thrustToMotor(((int32_t)Z + 2*L) * MIXER_B_UNIT + yaw);
 }
 
 /**
@@ -248,16 +298,18 @@ void processBasicKeyPress(enum SystemState_t sysState) {
 			}
 			lastKeyProcess = systemCounter;
 
-			snprintf(msg, 100, "Gain_Yaw: %d", Gain_Yaw);
-			packMessage(DEBUG, NULL, msg);
+			updateControlGains();
+			settings_save();
+			SEND_EVENT(EV_GAIN_YAW, Gain_Yaw);
 		}
 
 		if (keys[J_KEY]) { //Decrease Yaw gain
 			Gain_Yaw += 1;
 			lastKeyProcess = systemCounter;
 
-			snprintf(msg, 100, "Gain_Yaw: %d", Gain_Yaw);
-			packMessage(DEBUG, NULL, msg);
+			updateControlGains();
+			settings_save();
+			SEND_EVENT(EV_GAIN_YAW, Gain_Yaw);
 
 		}
 	}
@@ -268,8 +320,9 @@ void processBasicKeyPress(enum SystemState_t sysState) {
 			Gain_P1 += 1;
 			lastKeyProcess = systemCounter;
 
-			snprintf(msg, 100, "Gain_P1: %d", Gain_P1);
-			packMessage(DEBUG, NULL, msg);
+			updateControlGains();
+			settings_save();
+			SEND_EVENT(EV_GAIN_P1, Gain_P1);
 		}
 
 		if (keys[K_KEY]) {
@@ -278,8 +331,9 @@ void processBasicKeyPress(enum SystemState_t sysState) {
 			}
 			lastKeyProcess = systemCounter;
 
-			snprintf(msg, 100, "Gain_P1: %d", Gain_P1);
-			packMessage(DEBUG, NULL, msg);
+			updateControlGains();
+			settings_save();
+			SEND_EVENT(EV_GAIN_P1, Gain_P1);
 
 		}
 
@@ -290,16 +344,18 @@ void processBasicKeyPress(enum SystemState_t sysState) {
 			}
 			lastKeyProcess = systemCounter;
 
-			snprintf(msg, 100, "Gain_P2: %d", Gain_P2);
-			packMessage(DEBUG, NULL, msg);
+			updateControlGains();
+			settings_save();
+			SEND_EVENT(EV_GAIN_P2, Gain_P2);
 		}
 
 		if (keys[L_KEY]) {
 			Gain_P2 += 1;
 			lastKeyProcess = systemCounter;
 
-			snprintf(msg, 100, "Gain_P2: %d", Gain_P2);
-			packMessage(DEBUG, NULL, msg);
+			updateControlGains();
+			settings_save();
+			SEND_EVENT(EV_GAIN_P2, Gain_P2);
 
 		}
 	}
@@ -310,8 +366,9 @@ void processBasicKeyPress(enum SystemState_t sysState) {
 			Gain_height += 1;
 			lastKeyProcess = systemCounter;
 
-			snprintf(msg, 100, "Gain_Height: %d", Gain_height);
-			packMessage(DEBUG, NULL, msg);
+			updateControlGains();
+			settings_save();
+			SEND_EVENT(EV_GAIN_HEIGHT, Gain_height);
 		}
 
 		if (keys[H_KEY]) { //Decrease height gain
@@ -322,8 +379,9 @@ void processBasicKeyPress(enum SystemState_t sysState) {
 			
 			lastKeyProcess = systemCounter;
 
-			snprintf(msg, 100, "Gain_Height: %d", Gain_height);
-			packMessage(DEBUG, NULL, msg);
+			updateControlGains();
+			settings_save();
+			SEND_EVENT(EV_GAIN_HEIGHT, Gain_height);
 
 		}
 	}
@@ -374,6 +432,38 @@ void processPanicMode() {
 	}
 }
 
+/**
+ * @brief Converts a joystick axis to an angle setpoint without dividing.
+ * Rounds towards zero like the division it replaces.
+ *
+ * @param stick - joystick value, 127 is the middle.
+ * @param q8 - scale factor in Q8, see JOYSTICK_ANGLE_Q8.
+ * @return int16_t - angle setpoint.
+ */
+static int16_t joystickToAngle(uint8_t stick, int32_t q8) {
+	int32_t x = ((int16_t)stick - 127) * q8;
+	return x >= 0 ? (int16_t)(x >> 8) : -(int16_t)((-x) >> 8);
+}
+
+/**
+ * @brief Roll and pitch errors of the DMP attitude against the joystick
+ * setpoint, straight from the quaternion (no Euler angles, see
+ * attitudeError()). Also sets phi_pre and theta_pre.
+ *
+ * @param q8 - joystick to angle scale factor in Q8, see JOYSTICK_ANGLE_Q8.
+ * @param rollError, pitchError - setpoint - attitude, like phi_pre - (phi - phi_trim).
+ */
+static void dmpAttitudeError(int32_t q8, int16_t *rollError, int16_t *pitchError) {
+	int32_t setpoint[4];
+
+	phi_pre = joystickToAngle(joystickRoll, q8);
+	theta_pre = joystickToAngle(joystickPitch, q8);
+
+	// The trims are the angles of the DMP when the drone is level
+	attitudeSetpoint(setpoint, (int32_t)phi_pre + phi_trim, (int32_t)theta_pre + theta_trim);
+	attitudeError(rollError, pitchError, sensor_quat, setpoint);
+}
+
 /**
  * @brief Calculates the basic throttle value from the joystick.
  * 
@@ -431,7 +521,7 @@ void processYawControl() {
 	L =      ((int16_t)joystickRoll  - 127) / JOYSTICK_PR_DIVIDER;
 	// Yaw
 	sr_pre = -((int16_t)joystickYaw - 127) * JOYSTICK_YAW_MUTIPLIER;//define the yaw rate we want
-	N =      -(int16_t)((sr_pre - (sr - sr_trim)) / Gain_Yaw);//Achieve P control in YawControlMode
+	N =      -pid(&pidYaw, sr_pre, sr - sr_trim);//Achieve P control in YawControlMode
 
 	calculateMotorValues(Z, M, N, L);
 	
@@ -450,24 +540,25 @@ void processFullControl() {
 
 	startProfiling(p_FullControl);
 
-	int16_t Z, M, N, L, sroll, spitch;
+	int16_t Z, M, N, L, sroll, spitch, rollError, pitchError;
 
 	// throttle
 	Z = calculateBasicThrottle();
 
+	// Angle errors from the DMP quaternion, the controllers get the equivalent attitude (setpoint - error)
+	dmpAttitudeError(JOYSTICK_ANGLE_FULL, &rollError, &pitchError);
+
 	// pitch
-	theta_pre = ((int16_t)joystickPitch  - 127)*32767/127 / JOYSTICK_PR_DIVIDER ;//define the pitch position we want
-	spitch = (int16_t)(((theta_pre-(theta - theta_trim))*Gain_P1)*3600/32767);//transfer to the pitch rate we want
-	M = (int16_t)((-spitch+(sq - sq_trim))/Gain_P2);//Achieve P control on the pitch direction in FullControllMode
+	spitch = pid(&pidPitch, theta_pre, theta_pre - pitchError);//transfer to the pitch rate we want
+	M = -pid(&pidPitchRate, spitch, sq - sq_trim);//Achieve P control on the pitch direction in FullControllMode
 
 	// roll
-	phi_pre = (((int16_t)joystickRoll  - 127))*32767/127 / JOYSTICK_PR_DIVIDER; //define the roll position we want
-	sroll =  (int16_t)(((phi_pre - (phi - phi_trim))    *Gain_P1)*3600/32767); // transfer to the roll rate we want
-	L = (int16_t)((sroll-(sp-sp_trim))/Gain_P2); //Achieve P control on the roll direction in FullControllMode
+	sroll = pid(&pidRoll, phi_pre, phi_pre - rollError); // transfer to the roll rate we want
+	L = pid(&pidRollRate, sroll, sp - sp_trim); //Achieve P control on the roll direction in FullControllMode
 
 	// Yaw
 	sr_pre = -((int16_t)joystickYaw - 127) * JOYSTICK_YAW_MUTIPLIER;//define the yaw rate we want
-	N =      -(int16_t)((sr_pre - (sr-sr_trim)) / Gain_Yaw);//Achieve P control on the Yaw direction in FullControllMode
+	N =      -pid(&pidYaw, sr_pre, sr - sr_trim);//Achieve P control on the Yaw direction in FullControllMode
 
 	calculateMotorValues(Z, M, N, L);
 
@@ -498,7 +589,7 @@ void processHeightControl() {
 
 	startProfiling(p_HeightMode);
 
-	int16_t Z, M, N, L, sroll, spitch;
+	int16_t Z, M, N, L, sroll, spitch, rollError, pitchError;
 	// throttle
 	// pressure=butterworth(&bS_pressure, pressure, BW_COEFf_Height_Y_i, BW_COEFf_Height_Y_i1);
 	// saz_pre=(int16_t)((pressure_pre-pressure)*Gain_height1);
@@ -515,22 +606,27 @@ void processHeightControl() {
 	// {
 	// 	light=2;
 	// }
-	Z =  calculateBasicThrottle() - (int16_t)((pressure_pre-butterworth(&bS_pressure, pressure, BW_COEFf_Height_Y_i, BW_COEFf_Height_Y_i1))*Gain_height);
+	// Height from the fused barometer / accelerometer estimate, which is
+	// updated every sample, plus damping on the estimated vertical speed
+	int32_t z = pid(&pidHeight, pressure_pre, verticalPressure(&vS_height));
+	z += ((verticalSpeed(&vS_height) >> 8) * Gain_height) >> HEIGHT_SPEED_SHIFT;
+	z = MAX(-JOYSTICK_THROTTLE_MAX, MIN(z, JOYSTICK_THROTTLE_MAX));
+	Z = calculateBasicThrottle() - (int16_t)z;
 	//same with FullControlMode in other directions
 	
+	dmpAttitudeError(JOYSTICK_ANGLE_HEIGHT, &rollError, &pitchError);
+
 	// pitch
-	theta_pre = ((int16_t)joystickPitch  - 127)*32767/127 / 5;
-	spitch = (int16_t)(((theta_pre-(theta - theta_trim))*Gain_P1)*3600/32767);
-	M = (int16_t)((-spitch+(sq - sq_trim))/Gain_P2);
+	spitch = pid(&pidPitch, theta_pre, theta_pre - pitchError);
+	M = -pid(&pidPitchRate, spitch, sq - sq_trim);
 
 	// roll
-	phi_pre = (((int16_t)joystickRoll  - 127))*32767/127 / 5; // rate p control
-	sroll =  (int16_t)(((phi_pre - (phi - phi_trim))    *Gain_P1)*3600/32767); // abs pos p control
-	L = (int16_t)((sroll-(sp-sp_trim))/Gain_P2); // Roll component
+	sroll = pid(&pidRoll, phi_pre, phi_pre - rollError); // abs pos p control
+	L = pid(&pidRollRate, sroll, sp - sp_trim); // Roll component
 
 	// Yaw
 	sr_pre = -((int16_t)joystickYaw - 127) * JOYSTICK_YAW_MUTIPLIER;//define the sr we want
-	N =      -(int16_t)((sr_pre - (sr-sr_trim)) / Gain_Yaw);
+	N =      -pid(&pidYaw, sr_pre, sr - sr_trim);
 
 	calculateMotorValues(Z, M, N, L);
 			
@@ -543,6 +639,11 @@ void processHeightControl() {
  * @author Philip Groet
  */
 void processRawMode() {
+	// The attitude is estimated at every sample, also before the throttle is accepted
+	startProfiling(p_Attitude);
+	mahony(&phi, &theta, &psi, &mS_attitude, sp - sp_trim, sq - sq_trim, sr - sr_trim, sax, say, saz, sensor_dt);
+	stopProfiling(p_Attitude, true, &profileData);
+
 	if(!checkJoystickThrottle()) {
 		return;
 	}
@@ -554,32 +655,26 @@ void processRawMode() {
 	// throttle
 	Z = calculateBasicThrottle();
 
-	// // pitch
-	sa_theta = sax; // say = sin(theta)*g = theta * g = theta*10
-	sa_theta_filtered = butterworth(&bS_sa_theta, sa_theta, BW_COEFf_Raw_Y_i, BW_COEFf_Raw_Y_i1);
+	// Only the rates are low pass filtered, the angles come from the estimator
 	sq_filtered = butterworth(&bS_sq, sq, BW_COEFf_Raw_Y_i, BW_COEFf_Raw_Y_i1);
-	kalman(&sq_filtered, &theta, &kS_theta, -sa_theta_filtered, -sq_filtered);
+	sp_filtered = butterworth(&bS_sp, sp, BW_COEFf_Raw_Y_i, BW_COEFf_Raw_Y_i1);
 
-	theta_pre = ((int16_t)joystickPitch  - 127)*32767/127 / 5;
-	spitch = (int16_t)(((theta_pre-(theta - theta_trim))*Gain_P1)*3600/32767);
-	M = (int16_t)((-spitch+(sq_filtered - sq_trim))/Gain_P2);
+	// // pitch
+	theta_pre = joystickToAngle(joystickPitch, JOYSTICK_ANGLE_HEIGHT);
+	spitch = pid(&pidPitch, theta_pre, theta - theta_trim);
+	M = -pid(&pidPitchRate, spitch, sq_filtered - sq_trim);
 
 	// // roll
-	sa_phi = say; // say = sin(theta)*g = theta * g = theta*10
-	sa_phi_filtered = butterworth(&bS_sa_phi, sa_phi, BW_COEFf_Raw_Y_i, BW_COEFf_Raw_Y_i1);
-	sp_filtered = butterworth(&bS_sp, sp, BW_COEFf_Raw_Y_i, BW_COEFf_Raw_Y_i1);
-	kalman(&sp_filtered, &phi, &kS_phi, sa_phi_filtered, sp_filtered);
-
-	phi_pre = (((int16_t)joystickRoll  - 127))*32767/127 / 5; // rate p control
-	sroll =  (int16_t)(((phi_pre - (phi - phi_trim))    *Gain_P1)*3600/32767); // abs pos p control
-	L = (int16_t)((sroll-(sp_filtered-sp_trim))/Gain_P2); // Roll component
+	phi_pre = joystickToAngle(joystickRoll, JOYSTICK_ANGLE_HEIGHT); // rate p control
+	sroll = pid(&pidRoll, phi_pre, phi - phi_trim); // abs pos p control
+	L = pid(&pidRollRate, sroll, sp_filtered - sp_trim); // Roll component
 
 	//Yaw, assignment manual tells us to use butterworth here?
 	sr_pre = -((int16_t)joystickYaw - 127) * JOYSTICK_YAW_MUTIPLIER;//define the sr we want
 
 	sr = butterworth(&bS_sa_sr, sr, BW_COEFf_Raw_Y_i, BW_COEFf_Raw_Y_i1);
 
-	N =      -(int16_t)((sr_pre - (sr-sr_trim)) / Gain_Yaw);
+	N =      -pid(&pidYaw, sr_pre, sr - sr_trim);
 
 	calculateMotorValues(Z, M, N, L);
 
@@ -587,6 +682,14 @@ void processRawMode() {
 }
 
 
+/**
+ * @brief Restarts the raw mode attitude estimator (level), called when
+ * the raw sensor readout is switched on.
+ */
+void resetRawEstimator() {
+	initMahonyState(&mS_attitude);
+}
+
 /**
  * @brief Initializes the motor control, by zeroing out the motor values at start.
  * 
@@ -594,6 +697,51 @@ void processRawMode() {
  */
 void initializeMotorControl() {
 	motors_off();
+
+	initPidState(&pidYaw, -MAX_MOTOR_VAL, MAX_MOTOR_VAL, PID_D_FILTER_SHIFT);
+	initPidState(&pidPitch, INT16_MIN, INT16_MAX, PID_D_FILTER_SHIFT);
+	initPidState(&pidRoll, INT16_MIN, INT16_MAX, PID_D_FILTER_SHIFT);
+	initPidState(&pidPitchRate, -MAX_MOTOR_VAL, MAX_MOTOR_VAL, PID_D_FILTER_SHIFT);
+	initPidState(&pidRollRate, -MAX_MOTOR_VAL, MAX_MOTOR_VAL, PID_D_FILTER_SHIFT);
+	initPidState(&pidHeight, -JOYSTICK_THROTTLE_MAX, JOYSTICK_THROTTLE_MAX, PID_D_FILTER_SHIFT);
+	updateControlGains();
+	initVerticalState(&vS_height);
+}
+
+/**
+ * @brief Converts the gains to the fixed point multipliers of the
+ * controllers. Has to be called whenever one of the Gain_ variables
+ * changes, the control loop itself never divides.
+ */
+void updateControlGains() {
+	// N = (sr_pre - sr) / Gain_Yaw
+	pidSetGains(&pidYaw, PID_KP_DEN, PID_YAW_KI_NUM, PID_YAW_KD_NUM, (int32_t)MAX(1, Gain_Yaw) * PID_KP_DEN);
+
+	// Rate setpoint = (angle_pre - angle) * Gain_P1 * 3600 / 32767
+	int32_t angleKp = (int32_t)Gain_P1 * 3600;
+	pidSetGains(&pidPitch, angleKp, angleKp / PID_KP_DEN * PID_ANGLE_KI_NUM, angleKp / PID_KP_DEN * PID_ANGLE_KD_NUM, 32767);
+	pidSetGains(&pidRoll, angleKp, angleKp / PID_KP_DEN * PID_ANGLE_KI_NUM, angleKp / PID_KP_DEN * PID_ANGLE_KD_NUM, 32767);
+
+	// M, L = (rate_pre - rate) / Gain_P2
+	pidSetGains(&pidPitchRate, PID_KP_DEN, PID_RATE_KI_NUM, PID_RATE_KD_NUM, (int32_t)MAX(1, Gain_P2) * PID_KP_DEN);
+	pidSetGains(&pidRollRate, PID_KP_DEN, PID_RATE_KI_NUM, PID_RATE_KD_NUM, (int32_t)MAX(1, Gain_P2) * PID_KP_DEN);
+
+	// Z correction = (pressure_pre - pressure) * Gain_height
+	pidSetGains(&pidHeight, (int32_t)Gain_height * PID_KP_DEN, (int32_t)Gain_height * PID_HEIGHT_KI_NUM,
+		(int32_t)Gain_height * PID_HEIGHT_KD_NUM, PID_KP_DEN);
+}
+
+/**
+ * @brief Clears the integrators and derivative history, called when the
+ * flight mode changes so a controller doesn't start with stale state.
+ */
+static void resetControllers() {
+	pidReset(&pidYaw);
+	pidReset(&pidPitch);
+	pidReset(&pidRoll);
+	pidReset(&pidPitchRate);
+	pidReset(&pidRollRate);
+	pidReset(&pidHeight);
 }
 
 /**
@@ -602,6 +750,16 @@ void initializeMotorControl() {
  */
 void run_filters_and_control()
 {
+	static enum SystemState_t lastState = SafeMode;
+
+	if (systemState != lastState) {
+		resetControllers();
+		lastState = systemState;
+	}
+
+	// Runs in every mode, so the estimate has settled when height control starts
+	vertical(&vS_height, pressure, saz);
+
 	switch (systemState)
 	{
 		case PanicMode:
@@ -664,7 +822,8 @@ unsigned int isqrt( unsigned int y )
 
 	unsigned int L = 0;
 	unsigned int M;
-	unsigned int R = y + 1;
+	// The root of a 32 bit number is below 65536, a larger R overflows M * M
+	unsigned int R = y < 65535 ? y + 1 : 65536;
 
 	uint16_t i = 0;
 
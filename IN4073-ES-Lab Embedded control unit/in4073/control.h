@@ -3,12 +3,15 @@
 
 #include <inttypes.h>
 #include <stdbool.h>
+#include "utils/tools.h"
+#include "filter.h"
 
 #define MAX_MOTOR_VAL 1000
-#define CALIBRATION_SAMPLES 200
+#define CALIBRATION_SAMPLES 200 // Longest calibration, gives up when the trims are not accurate enough by then
 
 typedef struct {
-    int8_t calibrationCycle;
+    uint16_t calibrationCycle;
+    welfordState axis[6]; // sp, sq, sr, phi, theta, psi
 } calibrationData;
 
 extern uint16_t motor[4];
@@ -26,11 +29,15 @@ bool checkJoystickThrottle();
 
 void initializeMotorControl();
 void run_filters_and_control();
+void resetRawEstimator();
+void updateControlGains();
 
 uint16_t calculateHeight(int32_t temp, int32_t pressure);
 
 unsigned int isqrt( unsigned int y );
 
+extern VerticalState_t vS_height;
+
 int32_t pressure_pre;
 int16_t throttle_pre;
 
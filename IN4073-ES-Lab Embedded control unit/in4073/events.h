@@ -0,0 +1,96 @@
+#ifndef EVENTS_H__
+#define EVENTS_H__
+
+// Status messages of the drone, shared by the drone and the PC. The drone
+// only sends the event number and its arguments (EVENT message), the PC
+// formats the text. Every argument is an int32, so every conversion in
+// the format strings has to be %ld, %lu or %lx.
+//
+// Only add events at the end: the number of an event is its position,
+// and a PC with an older table has to keep decoding the known ones.
+//
+//  X(name, number of arguments (max. EVENT_MAX_ARGS), format)
+#define EVENT_LIST(X) \
+	X(EV_MODE_CHANGED,          1, "Mode successfully changed to: %ld") \
+	X(EV_MODE_PANIC_ONLY_SAFE,  1, "Can't change the mode to %ld, panic mode only allows transition to safe mode.") \
+	X(EV_MODE_JOYSTICK,         4, "Can't change the mode, joystick not neutral, roll: %ld, pitch: %ld, yaw: %ld, throttle: %ld") \
+	X(EV_HEIGHT_START,          2, "Height control, pressure_pre: %ld, throttle_pre: %ld") \
+	X(EV_DMP_OFF,               2, "Turning dmp off: %lu us, %lu I2C transactions") \
+	X(EV_DMP_ON,                2, "Turning dmp on: %lu us, %lu I2C transactions") \
+	X(EV_GAIN_YAW,              1, "Gain_Yaw: %ld") \
+	X(EV_GAIN_P1,               1, "Gain_P1: %ld") \
+	X(EV_GAIN_P2,               1, "Gain_P2: %ld") \
+	X(EV_GAIN_HEIGHT,           1, "Gain_Height: %ld") \
+	X(EV_MOTOR_TOO_HIGH,        4, "One of motor values too high: %ld %ld %ld %ld") \
+	X(EV_BATTERY_LOW,           1, "Battery voltage low: %ld volt") \
+	X(EV_BATTERY_EMPTY,         1, "Battery empty, putting drone in panic mode (%ld volt)") \
+	X(EV_CALIBRATION_STARTED,   1, "Calibration started! (DMP: %ld)") \
+	X(EV_CALIBRATION_MOVED,     2, "Calibration rejected, drone moved (axis %ld off by %ld), keeping the old trims") \
+	X(EV_CALIBRATION_DONE,      4, "Calibration finished after %ld samples, noise (0.01 LSB) sp %ld sq %ld sr %ld") \
+	X(EV_CALIBRATION_FAILED,    4, "Calibration rejected, too noisy, after %ld samples, noise (0.01 LSB) sp %ld sq %ld sr %ld") \
+	X(EV_CALIBRATION_NOISE,     3, "Calibration noise (0.01 LSB) phi %ld theta %ld psi %ld") \
+	X(EV_CALIBRATION_RATE_TRIM, 3, "Leaving calibration. Using sr_trim=%ld sp_trim=%ld sq_trim=%ld") \
+	X(EV_CALIBRATION_ANGLE_TRIM, 3, "Leaving calibration. Using phi_trim=%ld psi_trim=%ld theta_trim=%ld") \
+	X(EV_PROFILING_1,           4, "Profiling: Control (%ld us), Timer (%ld us), Yaw (%ld us), Full (%ld us)") \
+	X(EV_PROFILING_2,           4, "Profiling: Raw (%ld us), Height (%ld us), Log (%ld us), Sqrt (%ld us)") \
+	X(EV_PROFILING_START_TYPE,  1, "Cannot start profiling for type %ld, type does not exist.") \
+	X(EV_PROFILING_RUNNING,     1, "Cannot start profiling for type %ld, already running.") \
+	X(EV_PROFILING_STOP_TYPE,   1, "Cannot stop profiling for type %ld, type does not exist.") \
+	X(EV_PROFILING_NOT_RUNNING, 1, "Cannot stop profiling for type %ld, no profile was running for this type.") \
+	X(EV_LOG_ROWS,              1, "Number of rows to send %lu") \
+	X(EV_SETTINGS_LOADED,       4, "Settings loaded in %lu us: sp=%ld sq=%ld sr=%ld trims") \
+	X(EV_SETTINGS_GAINS,        4, "Stored gains %ld %ld %ld %ld") \
+	X(EV_DRIFT_OK,              3, "Gyro drift since calibration: %ld %ld %ld, ready to fly") \
+	X(EV_DRIFT_TOO_LARGE,       3, "Gyro drift since calibration: %ld %ld %ld, calibrate before flying") \
+	X(EV_STACK_ALMOST_FULL,     2, "Stack almost full: %lu of %lu bytes used") \
+	X(EV_TWI_ERROR,             3, "TWI error, code: %lx | at %lu usecs, from device: %ld") \
+	X(EV_UART_ERROR,            1, "uart error: %lu") \
+	X(EV_EVENTS_LOST,           1, "%lu events from interrupts lost") \
+	X(EV_DMP_FIFO_ERROR,        1, "Error reading dmp sensor fifo: %ld") \
+	X(EV_RAW_FIFO_ERROR,        1, "Error reading raw sensor fifo: %ld") \
+	X(EV_CATALOG_FORMATTED,     0, "No log catalog on the flash, formatted it") \
+	X(EV_CATALOG_LOADED,        4, "Log catalog: %lu flights, logging at 0x%lx, %lu rows recovered, found in %lu us") \
+	X(EV_FLIGHT_UNKNOWN,        1, "Flight %lu is not in the log catalog") \
+	X(EV_LOG_DROPPED,           1, "%lu log rows dropped, the flash was busy") \
+	X(EV_SETTINGS_SAVE_FAILED,  1, "Saving settings failed (error 0x%lx), trying again") \
+	X(EV_PROFILING_3,           1, "Profiling: Attitude (%ld us)") \
+	X(EV_MODE_HEIGHT_ONLY_FROM_FULL, 1, "Can't switch to height control mode from mode %ld, only from full control mode.") \
+	X(EV_MODE_NEEDS_CALIBRATION, 1, "Can't change the mode to %ld, gyro drifted since the stored calibration. Calibrate first.") \
+	X(EV_MODE_MOTORS_ON,        4, "Can't change the mode, motors not off: %ld %ld %ld %ld")
+
+#define EVENT_MAX_ARGS 4
+
+#define EVENT_ENUM(name, args, format) name,
+typedef enum {
+	EVENT_LIST(EVENT_ENUM)
+	EVENT_COUNT
+} eventId;
+#undef EVENT_ENUM
+
+// Records of the flight trace (utils/trace.h), shared by the drone and the
+// PC like the events. A record has two arguments, a (8 bit) and b
+// (16 bit); the format takes them in that order, as %ld / %lx.
+//
+//  X(name, format)
+#define TRACE_LIST(X) \
+	X(TR_BOOT,            "Boot") \
+	X(TR_MODE,            "Mode %ld -> %ld") \
+	X(TR_MODE_REFUSED,    "Mode %ld -> %ld refused") \
+	X(TR_PANIC,           "Panic, from mode %ld") \
+	X(TR_TWI_ERROR,       "TWI error, device %ld, code %lx") \
+	X(TR_UART_ERROR,      "UART error, code %lx") \
+	X(TR_RX_TYPE_ERROR,   "Received unknown message type %ld (ble %ld)") \
+	X(TR_RX_CHECKSUM,     "Received message %ld with wrong checksum (ble %ld)") \
+	X(TR_CONNECTION_LOST, "Connection lost, in mode %ld") \
+	X(TR_BATTERY_EMPTY,   "Battery empty, in mode %ld, %ld volt") \
+	X(TR_MOTOR_LIMIT,     "Motor limit, in mode %ld, ae %ld") \
+	X(TR_DUMP,            "Trace requested")
+
+#define TRACE_ENUM(name, format) name,
+typedef enum {
+	TRACE_LIST(TRACE_ENUM)
+	TRACE_COUNT
+} traceId;
+#undef TRACE_ENUM
+
+#endif /* EVENTS_H__ */
@@ -3,6 +3,8 @@
 #include "mpu6050/mpu6050.h"
 #include "hal/timers.h"
 
+#include <stddef.h>
+
 // x-axis towards forward
 // y-axis towards left
 // z-axis towards up???
@@ -43,31 +45,321 @@ uint16_t butterworth(ButterWorthState_t *state, int16_t x, float coeff_yi, float
   return y;
 }
 
-#define KALMAN_P2PHI 100 //(1/(TIMER_PERIOD/1000)) // Compiler will optimize... I hope... It did not
-#define KALMAN_C1 50 //2
-#define KALMAN_C2 50000 // (KALMAN_C1/1100)
+// Raw mode sample rate, see imu_init(false, 100). The gains are per
+// sample of this rate, scaled to the measured period.
+#define MAHONY_SAMPLE_HZ 100
+#define MAHONY_SAMPLE_US (1000000 / MAHONY_SAMPLE_HZ)
+#define MAHONY_DT_MAX_US (4 * MAHONY_SAMPLE_US)
+// Period to Q14 fraction of a sample: 2^30 / MAHONY_SAMPLE_US, >> 16 (32 bits up to MAHONY_DT_MAX_US, no rounding)
+#define MAHONY_DT_Q30 ((uint32_t)(1073741824.0 / MAHONY_SAMPLE_US + 0.5))
+// Gyro LSB (16.4 LSB/deg/s) to half rotation angle per sample in Q30 rad, folded by the compiler
+#define MAHONY_GYRO_HALF_Q30 ((int32_t)(3.14159265358979 / (180.0 * 16.4 * 2.0 * MAHONY_SAMPLE_HZ) * 1073741824.0 + 0.5))
+// Proportional feedback: Kp = 2^-7 * 2 * 100 Hz = 1.56 rad/s, stronger while settling after init
+#define MAHONY_KP_SHIFT 7
+#define MAHONY_KP_SHIFT_WARMUP 3
+#define MAHONY_WARMUP_SAMPLES 100
+// Integral feedback (gyro bias): Ki = 2^-18 * 2 * 100^2 = 0.076 rad/s^2
+#define MAHONY_KI_SHIFT 18
+#define MAHONY_BIAS_MAX (MAHONY_GYRO_HALF_Q30 * 200)
+// Accelerometer is only trusted between 0.75 g and 1.25 g (16384 LSB/g), squared
+#define MAHONY_ACC_MIN2 150994944UL
+#define MAHONY_ACC_MAX2 419430400UL
+
+#define MAHONY_CORDIC_STEPS 15
+
+// atan(2^-i), 32768 = pi
+static const int16_t cordicAtan[MAHONY_CORDIC_STEPS] = {
+  8192, 4836, 2555, 1297, 651, 326, 163, 81, 41, 20, 10, 5, 3, 1, 1
+};
+
 /**
- * @author Philip Groet
+ * @brief atan2 with CORDIC vectoring, only shifts and adds
+ * @param y, x Vector (at most 2^29 long)
+ * @param magnitude Length of the vector times the CORDIC gain (1.647), may be NULL
+ * @return Angle of the vector, 32768 = pi (the phi/theta/psi scale)
  */
-void initKalmanState(KalmanState_t *state) {
-  state->b = 0;
-  state->phi = 0;
+static int16_t cordic_atan2(int32_t y, int32_t x, int32_t *magnitude) {
+  int32_t angle = 0;
+  int32_t t;
+
+  // Rotate into the right half plane by +-90 degrees first
+  if (x < 0) {
+    if (y >= 0) { t = x; x = y; y = -t; angle = 16384; }
+    else { t = x; x = -y; y = t; angle = -16384; }
+  }
+
+  for (uint8_t i = 0; i < MAHONY_CORDIC_STEPS; i++) {
+    int32_t dx = x >> i;
+    int32_t dy = y >> i;
+    if (y > 0) { x += dy; y -= dx; angle += cordicAtan[i]; }
+    else { x -= dy; y += dx; angle -= cordicAtan[i]; }
+  }
+
+  if (magnitude) *magnitude = x;
+  return (int16_t)angle;
 }
 
 /**
- * @brief Executes one iteration of the kalman filter
- * 
- * @author Philip Groet
+ * @brief Gravity direction in the body frame (last row of the rotation
+ * matrix) of a Q30 quaternion, Q30
+ */
+static void quatGravity(const int32_t *q, int32_t *v) {
+  v[0] = (int32_t)(((int64_t)q[1] * q[3] - (int64_t)q[0] * q[2]) >> 29);
+  v[1] = (int32_t)(((int64_t)q[0] * q[1] + (int64_t)q[2] * q[3]) >> 29);
+  v[2] = (int32_t)(((int64_t)q[0] * q[0] - (int64_t)q[1] * q[1] - (int64_t)q[2] * q[2] + (int64_t)q[3] * q[3]) >> 30);
+}
+
+/**
+ * @brief Starts the estimator level, facing forward
  */
-void kalman(int16_t *result_p, int16_t *result_phi, KalmanState_t *state, int16_t accelAngle, int16_t gyroAngle) {
-  int16_t p, e;
-
-  p = gyroAngle - state->b; // estimate real p, subtract bias
-  state->phi = state->phi + p/KALMAN_P2PHI; // predict phi
-  e = state->phi - accelAngle; // compare to measured phi
-  state->phi = state->phi - e/KALMAN_C1; // correct phi to some extent
-  state->b = state->b + (e/KALMAN_P2PHI) / KALMAN_C2; // adjust bias term
-
-  *result_p = p;
-  *result_phi = state->phi; 
-} 
\ No newline at end of file
+void initMahonyState(MahonyState_t *state) {
+  state->q[0] = 1L << 30;
+  state->q[1] = 0;
+  state->q[2] = 0;
+  state->q[3] = 0;
+  state->v[0] = 0;
+  state->v[1] = 0;
+  state->v[2] = 1L << 30;
+  state->bias[0] = 0;
+  state->bias[1] = 0;
+  state->bias[2] = 0;
+  state->warmup = MAHONY_WARMUP_SAMPLES;
+}
+
+/**
+ * @brief Executes one iteration of the quaternion attitude estimator.
+ * The gyro is integrated into the quaternion, the difference between the
+ * measured and the estimated gravity direction pulls it back (Mahony).
+ * Integers only: 64 bit products, no division, no square root.
+ * @param result_phi, result_theta, result_psi Attitude, 32768 = pi like the DMP angles
+ * @param gx, gy, gz Gyro without offset (16.4 LSB/deg/s)
+ * @param ax, ay, az Accelerometer (16384 LSB/g)
+ * @param dt_us Time since the previous sample (us), the rotation is scaled to it
+ */
+void mahony(int16_t *result_phi, int16_t *result_theta, int16_t *result_psi, MahonyState_t *state,
+            int16_t gx, int16_t gy, int16_t gz, int16_t ax, int16_t ay, int16_t az, uint32_t dt_us) {
+  int32_t *q = state->q;
+  int32_t *v = state->v;
+  int32_t ex = 0, ey = 0, ez = 0;
+
+  // Init state when not done yet
+  if (q[0] == 0 && q[1] == 0 && q[2] == 0 && q[3] == 0) {
+    initMahonyState(state);
+  }
+
+  // Error is measured x estimated gravity. The accelerometer isn't
+  // normalized, 1 g is taken as 16384, and it is ignored while the drone
+  // accelerates (its length is not about 1 g).
+  uint32_t a2 = (uint32_t)((int32_t)ax * ax) + (uint32_t)((int32_t)ay * ay) + (uint32_t)((int32_t)az * az);
+  if (a2 > MAHONY_ACC_MIN2 && a2 < MAHONY_ACC_MAX2) {
+    ex = (int32_t)(((int64_t)ay * v[2] - (int64_t)az * v[1]) >> 14);
+    ey = (int32_t)(((int64_t)az * v[0] - (int64_t)ax * v[2]) >> 14);
+    ez = (int32_t)(((int64_t)ax * v[1] - (int64_t)ay * v[0]) >> 14);
+
+    state->bias[0] += ex >> MAHONY_KI_SHIFT;
+    state->bias[1] += ey >> MAHONY_KI_SHIFT;
+    state->bias[2] += ez >> MAHONY_KI_SHIFT;
+    for (uint8_t i = 0; i < 3; i++) {
+      if (state->bias[i] > MAHONY_BIAS_MAX) state->bias[i] = MAHONY_BIAS_MAX;
+      if (state->bias[i] < -MAHONY_BIAS_MAX) state->bias[i] = -MAHONY_BIAS_MAX;
+    }
+  }
+
+  uint8_t kpShift = MAHONY_KP_SHIFT;
+  if (state->warmup) {
+    state->warmup--;
+    kpShift = MAHONY_KP_SHIFT_WARMUP;
+  }
+
+  // Half rotation angle of this sample (Q30 rad)
+  int32_t wx = gx * MAHONY_GYRO_HALF_Q30 + state->bias[0] + (ex >> kpShift);
+  int32_t wy = gy * MAHONY_GYRO_HALF_Q30 + state->bias[1] + (ey >> kpShift);
+  int32_t wz = gz * MAHONY_GYRO_HALF_Q30 + state->bias[2] + (ez >> kpShift);
+
+  // Same rate over the measured period instead of one nominal sample
+  if (dt_us != MAHONY_SAMPLE_US) {
+    if (dt_us > MAHONY_DT_MAX_US) dt_us = MAHONY_DT_MAX_US;
+    int32_t scale = (int32_t)((dt_us * MAHONY_DT_Q30) >> 16);   // Q14
+    wx = (int32_t)(((int64_t)wx * scale) >> 14);
+    wy = (int32_t)(((int64_t)wy * scale) >> 14);
+    wz = (int32_t)(((int64_t)wz * scale) >> 14);
+  }
+
+  // q = q + q * (0, w)
+  int32_t q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+  q[0] += (int32_t)((-(int64_t)q1 * wx - (int64_t)q2 * wy - (int64_t)q3 * wz) >> 30);
+  q[1] += (int32_t)(( (int64_t)q0 * wx + (int64_t)q2 * wz - (int64_t)q3 * wy) >> 30);
+  q[2] += (int32_t)(( (int64_t)q0 * wy - (int64_t)q1 * wz + (int64_t)q3 * wx) >> 30);
+  q[3] += (int32_t)(( (int64_t)q0 * wz + (int64_t)q1 * wy - (int64_t)q2 * wx) >> 30);
+
+  // Renormalize with one Newton step of 1/sqrt(n) around 1: q * (3 - n) / 2
+  int64_t n = ((int64_t)q[0] * q[0] + (int64_t)q[1] * q[1] + (int64_t)q[2] * q[2] + (int64_t)q[3] * q[3]) >> 30;
+  int64_t f = ((3LL << 30) - n) >> 1;
+  for (uint8_t i = 0; i < 4; i++) {
+    q[i] = (int32_t)(((int64_t)q[i] * f) >> 30);
+  }
+  q0 = q[0]; q1 = q[1]; q2 = q[2]; q3 = q[3];
+
+  // Gravity estimate, also used by the next iteration
+  quatGravity(q, v);
+
+  // Euler angles, same formulas as update_euler_from_quaternions() (Q28 for CORDIC headroom)
+  int32_t cosTheta;
+  *result_phi = cordic_atan2(v[1] >> 2, v[2] >> 2, &cosTheta);
+  cosTheta = (int32_t)(((int64_t)cosTheta * 19898) >> 15);   // Remove the CORDIC gain (0.60725)
+  *result_theta = cordic_atan2(-(v[0] >> 2), cosTheta, NULL);
+
+  int32_t r21 = (int32_t)(((int64_t)q1 * q2 + (int64_t)q0 * q3) >> 29);
+  int32_t r11 = (int32_t)(((int64_t)q0 * q0 + (int64_t)q1 * q1 - (int64_t)q2 * q2 - (int64_t)q3 * q3) >> 30);
+  *result_psi = cordic_atan2(r21 >> 2, r11 >> 2, NULL);
+}
+
+// Angle (32768 = pi) to Q30 half angle in rad: pi / 65536 * 2^30, Q6
+#define ATTITUDE_HALF_Q30 3294199
+// Q30 rad to angle (32768 = pi): 32768 / pi
+#define ATTITUDE_ANGLE_PER_RAD 10430
+#define Q30_ONE (1L << 30)
+
+static int32_t mulQ30(int32_t a, int32_t b) {
+  return (int32_t)(((int64_t)a * b) >> 30);
+}
+
+/**
+ * @brief sin and cos of half an angle, Taylor series in Q30 (error < 1e-6)
+ * @param angle Full angle, 32768 = pi, at most +-16384
+ */
+static void sinCosHalf(int16_t angle, int32_t *s, int32_t *c) {
+  int32_t x = (int32_t)(((int64_t)angle * ATTITUDE_HALF_Q30) >> 6);
+  int32_t x2 = mulQ30(x, x);
+
+  // sin x = x (1 - x^2/6 (1 - x^2/20 (1 - x^2/42 (1 - x^2/72)))), 1/n as Q30 constants
+  int32_t p = Q30_ONE - mulQ30(x2, Q30_ONE / 72);
+  p = Q30_ONE - mulQ30(mulQ30(x2, Q30_ONE / 42), p);
+  p = Q30_ONE - mulQ30(mulQ30(x2, Q30_ONE / 20), p);
+  p = Q30_ONE - mulQ30(mulQ30(x2, Q30_ONE / 6), p);
+  *s = mulQ30(x, p);
+
+  // cos x = 1 - x^2/2 (1 - x^2/12 (1 - x^2/30 (1 - x^2/56 (1 - x^2/90))))
+  p = Q30_ONE - mulQ30(x2, Q30_ONE / 90);
+  p = Q30_ONE - mulQ30(mulQ30(x2, Q30_ONE / 56), p);
+  p = Q30_ONE - mulQ30(mulQ30(x2, Q30_ONE / 30), p);
+  p = Q30_ONE - mulQ30(mulQ30(x2, Q30_ONE / 12), p);
+  *c = Q30_ONE - mulQ30(x2 >> 1, p);
+}
+
+/**
+ * @brief Builds the Q30 setpoint quaternion of a roll and pitch angle
+ * (yaw 0, rotated like the DMP: pitch, then roll). Once per sample, no
+ * trigonometry functions or floats.
+ * @param q Setpoint quaternion (w, x, y, z)
+ * @param phi, theta Roll and pitch, 32768 = pi, clamped to +-90 degrees
+ */
+void attitudeSetpoint(int32_t *q, int32_t phi, int32_t theta) {
+  int32_t sr, cr, sp, cp;
+
+  if (phi > 16384) phi = 16384;
+  if (phi < -16384) phi = -16384;
+  if (theta > 16384) theta = 16384;
+  if (theta < -16384) theta = -16384;
+
+  sinCosHalf((int16_t)phi, &sr, &cr);
+  sinCosHalf((int16_t)theta, &sp, &cp);
+
+  q[0] = mulQ30(cp, cr);
+  q[1] = mulQ30(cp, sr);
+  q[2] = mulQ30(sp, cr);
+  q[3] = -mulQ30(sp, sr);
+}
+
+/**
+ * @brief Roll and pitch error between a Q30 attitude quaternion (DMP) and a
+ * setpoint quaternion, without going through Euler angles. The error is
+ * the rotation between the gravity directions of the two (their cross
+ * product), in the body frame like the gyro, so the yaw doesn't matter and
+ * there is no singularity at +-90 degrees pitch. It is the sine of the
+ * angle: equal to the Euler angle difference for small errors, it keeps
+ * its sign up to 180 degrees.
+ * @param result_roll, result_pitch Setpoint - attitude, 32768 = pi like the Euler angles
+ * @param q Attitude quaternion, Q30
+ * @param setpoint Setpoint quaternion, Q30 (attitudeSetpoint())
+ */
+void attitudeError(int16_t *result_roll, int16_t *result_pitch, const int32_t *q, const int32_t *setpoint) {
+  int32_t g[3], gs[3];
+
+  quatGravity(q, g);
+  quatGravity(setpoint, gs);
+
+  int32_t ex = (int32_t)(((int64_t)gs[1] * g[2] - (int64_t)gs[2] * g[1]) >> 30);
+  int32_t ey = (int32_t)(((int64_t)gs[2] * g[0] - (int64_t)gs[0] * g[2]) >> 30);
+
+  *result_roll = (int16_t)(((int64_t)ex * ATTITUDE_ANGLE_PER_RAD) >> 30);
+  *result_pitch = (int16_t)(((int64_t)ey * ATTITUDE_ANGLE_PER_RAD) >> 30);
+}
+
+// Per sample gains of the vertical estimator, from the continuous 3rd order
+// complementary filter (k1 = 3/tau, k2 = 3/tau^2, k3 = 1/tau^3) with the
+// unit changes folded in, so the update is multiplies and shifts only
+#define VZ_K1 ((int32_t)(3.0 / VZ_TAU_S / VZ_RATE_HZ * 256 + 0.5))                                     // >> 8
+#define VZ_K2 ((int32_t)(3.0 / (VZ_TAU_S * VZ_TAU_S) / (VZ_RATE_HZ * VZ_RATE_HZ) * 65536 + 0.5))       // >> 8, Q16 -> Q24
+#define VZ_K3 ((int32_t)(1.0 / (VZ_TAU_S * VZ_TAU_S * VZ_TAU_S) / ((double)VZ_RATE_HZ * VZ_RATE_HZ * VZ_RATE_HZ) * 16777216 + 0.5)) // >> 16
+#define VZ_ACCEL ((int32_t)(VZ_PA_PER_M * 9.81 / VZ_ACCEL_LSB_PER_G / (VZ_RATE_HZ * VZ_RATE_HZ) * 4294967296.0 + 0.5)) // >> 8, LSB -> Q24
+#define VZ_ERROR_MAX (1000L << 16)   // Clamp of the baro error, keeps the products in 32 bits
+
+/**
+ * @brief Starts the vertical estimator at the next sample
+ */
+void initVerticalState(VerticalState_t *state) {
+  state->h = 0;
+  state->v = 0;
+  state->bias = 0;
+  state->p0 = 0;
+  state->accelRef = 0;
+  state->started = false;
+}
+
+/**
+ * @brief Executes one iteration of the vertical estimator: the
+ * accelerometer predicts height and vertical speed every sample, the
+ * (slow, noisy) barometer pulls them back with time constant VZ_TAU_S and
+ * trains the accelerometer offset. The z axis is taken as vertical, small
+ * tilts end up in the offset.
+ *
+ * @param pressure Last barometer reading (Pa)
+ * @param az Accelerometer z (16384 LSB/g, up positive)
+ */
+void vertical(VerticalState_t *state, int32_t pressure, int16_t az) {
+  if (!state->started) {
+    state->p0 = pressure;
+    state->accelRef = az;
+    state->started = true;
+  }
+
+  // Baro height (Pa above the reference, up positive) minus the estimate
+  int32_t error = ((state->p0 - pressure) << 16) - state->h;
+  if (error > VZ_ERROR_MAX) error = VZ_ERROR_MAX;
+  if (error < -VZ_ERROR_MAX) error = -VZ_ERROR_MAX;
+
+  // Prediction with the accelerometer
+  int32_t dv = (((int32_t)(az - state->accelRef) * VZ_ACCEL) >> 8) - state->bias;
+
+  // Correction with the barometer
+  state->bias -= ((error >> 8) * VZ_K3) >> 8;
+  state->v += dv + ((error * VZ_K2) >> 8);
+  state->h += (state->v >> 8) + ((error * VZ_K1) >> 8);
+}
+
+/**
+ * @brief Estimated pressure, the barometer reading without the noise and delay
+ * @return Pressure (Pa)
+ */
+int32_t verticalPressure(const VerticalState_t *state) {
+  return state->p0 - ((state->h + (1 << 15)) >> 16);
+}
+
+/**
+ * @brief Estimated vertical speed
+ * @return Pa/s in Q8, up positive (12 Pa/s ~ 1 m/s)
+ */
+int32_t verticalSpeed(const VerticalState_t *state) {
+  return ((state->v >> 8) * VZ_RATE_HZ) >> 8;
+}
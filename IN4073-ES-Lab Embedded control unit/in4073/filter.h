@@ -15,14 +15,45 @@ typedef struct {
   int16_t y_old;
 } ButterWorthState_t;
 
+// Quaternion attitude estimator (Mahony), integer only.
+// The quaternion and the gravity estimate are Q30 (1 << 30 = 1.0), the
+// gyro bias is Q30 half rotation angle per sample.
 typedef struct {
-  int16_t b;
-  int16_t phi;
-} KalmanState_t;
+  int32_t q[4];
+  int32_t v[3];
+  int32_t bias[3];
+  uint16_t warmup;
+} MahonyState_t;
+
+// Vertical estimator (3rd order complementary filter) fusing the barometer
+// with the z accelerometer. Height is in pressure units (Pa above the
+// reference pressure, 1 Pa ~ 8 cm), so it compares directly with pressure.
+// h is Q16 Pa, v is Q24 Pa per sample (speed * dt), bias is Q24 Pa per
+// sample^2 (accelerometer offset from 1 g).
+#define VZ_RATE_HZ 100          // Control loop rate the estimator is called at
+#define VZ_TAU_S 1.0            // Crossover: baro below, accelerometer above ~1/(2 pi tau)
+#define VZ_PA_PER_M 12.0        // Air density * g near sea level
+#define VZ_ACCEL_LSB_PER_G 16384
+
+typedef struct {
+  int32_t h;
+  int32_t v;
+  int32_t bias;
+  int32_t p0;             // Reference pressure (Pa), height 0
+  int16_t accelRef;       // Accelerometer reading of 1 g
+  bool started;
+} VerticalState_t;
 
 uint16_t butterworth(ButterWorthState_t *state, int16_t x, float coeff_yi, float coeff_yi1);
-void initKalmanState(KalmanState_t *state);
-void kalman(int16_t *result_p, int16_t *result_phi, KalmanState_t *state, int16_t accelAngle, int16_t gyroAngle);
+void initMahonyState(MahonyState_t *state);
+void mahony(int16_t *result_phi, int16_t *result_theta, int16_t *result_psi, MahonyState_t *state,
+            int16_t gx, int16_t gy, int16_t gz, int16_t ax, int16_t ay, int16_t az, uint32_t dt_us);
+void attitudeSetpoint(int32_t *q, int32_t phi, int32_t theta);
+void attitudeError(int16_t *result_roll, int16_t *result_pitch, const int32_t *q, const int32_t *setpoint);
+void initVerticalState(VerticalState_t *state);
+void vertical(VerticalState_t *state, int32_t pressure, int16_t az);
+int32_t verticalPressure(const VerticalState_t *state);
+int32_t verticalSpeed(const VerticalState_t *state);
 
 
 #endif
\ No newline at end of file
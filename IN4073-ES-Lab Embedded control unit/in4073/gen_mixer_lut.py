@@ -0,0 +1,58 @@
+#!/usr/bin/env python3
+"""Generates mixer_lut.h, the thrust to motor command table of calculateMotorValues().
+
+The original mixer computes per motor
+
+    ae = isqrt(((Z +- 2M) * B_CONSTANT +- N * D_CONSTANT) / 4)
+
+With G = gcd(B_CONSTANT, D_CONSTANT) the part inside the square root is
+G / 4 * T, where T = (Z +- 2M) * B / G +- N * D / G is a small integer
+"thrust". The table holds sqrt(G / 4 * T) for every STEP'th T in Q4, so
+the firmware only needs a shift, a mask and one multiply-add to
+interpolate. Run it again (make mixer_lut.h) when B_CONSTANT or
+D_CONSTANT in control.c change.
+"""
+
+import math
+import sys
+
+B_CONSTANT = 6000
+D_CONSTANT = 4000
+
+# Thrusts past the panic threshold (ae > 2000) are clamped to the last entry
+SHIFT = 4
+ENTRIES = 513
+FRAC_BITS = 4
+
+
+def main(path):
+    g = math.gcd(B_CONSTANT, D_CONSTANT)
+    if g % 4:
+        sys.exit("gcd(B_CONSTANT, D_CONSTANT) must be a multiple of 4")
+    scale = g // 4
+
+    # floor(sqrt(scale * T) * 2^FRAC_BITS), exact in integers
+    values = [math.isqrt(scale * (i << SHIFT) << (2 * FRAC_BITS)) for i in range(ENTRIES)]
+    if values[-1] > 0xFFFF:
+        sys.exit("table values don't fit in 16 bits")
+
+    with open(path, "w") as f:
+        f.write("// Generated by gen_mixer_lut.py, do not edit\n")
+        f.write("#ifndef _H_MIXER_LUT\n#define _H_MIXER_LUT\n\n")
+        f.write("#include <inttypes.h>\n\n")
+        f.write("#define MIXER_LUT_B_CONSTANT %d\n" % B_CONSTANT)
+        f.write("#define MIXER_LUT_D_CONSTANT %d\n" % D_CONSTANT)
+        f.write("#define MIXER_B_UNIT %d // B_CONSTANT / gcd(B_CONSTANT, D_CONSTANT)\n" % (B_CONSTANT // g))
+        f.write("#define MIXER_D_UNIT %d // D_CONSTANT / gcd(B_CONSTANT, D_CONSTANT)\n" % (D_CONSTANT // g))
+        f.write("#define MIXER_LUT_SHIFT %d // Thrust step between entries is 1 << MIXER_LUT_SHIFT\n" % SHIFT)
+        f.write("#define MIXER_LUT_FRAC_BITS %d\n" % FRAC_BITS)
+        f.write("#define MIXER_LUT_ENTRIES %d\n\n" % ENTRIES)
+        f.write("// sqrt(%d * thrust) in Q%d, thrust = index << MIXER_LUT_SHIFT\n" % (scale, FRAC_BITS))
+        f.write("static const uint16_t mixerLut[MIXER_LUT_ENTRIES] = {\n")
+        for i in range(0, ENTRIES, 10):
+            f.write("\t" + ", ".join("%5d" % v for v in values[i:i + 10]) + ",\n")
+        f.write("};\n\n#endif\n")
+
+
+if __name__ == "__main__":
+    main(sys.argv[1] if len(sys.argv) > 1 else "mixer_lut.h")
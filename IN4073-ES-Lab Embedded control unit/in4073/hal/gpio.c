@@ -38,7 +38,7 @@ void gpio_init(void)
 	nrf_gpio_cfg_output(10);
 	nrf_gpio_cfg_output(8);
 	
-	// dmp interrupt 
-	nrf_gpio_cfg_input(INT_PIN, 0);
+	// dmp interrupt, the sense raises the GPIOTE PORT event (timestamp, see timers_init())
+	nrf_gpio_cfg_sense_input(INT_PIN, NRF_GPIO_PIN_NOPULL, NRF_GPIO_PIN_SENSE_HIGH);
 }
 
@@ -11,8 +11,8 @@
 #include <stdint.h>
 #include <string.h>
 #include "nrf_gpio.h"
-#include "nrf_delay.h"
 #include "spi_flash.h"
+#include "timers.h"
 #include "app_util_platform.h"
 
 #define SPI_CS		17
@@ -29,9 +29,14 @@
 #define RDSR            0x05
 #define WREN            0x06
 #define EWSR            0x50
+#define SECTOR_ERASE    0x20
 #define CHIP_ERASE      0x60
 #define AAI             0xAF 
 
+#define STATUS_BUSY     0x01
+#define FLASH_SIZE      0x20000
+#define FLASH_SECTORS   (FLASH_SIZE / FLASH_SECTOR_SIZE)	// 32, one bit each in erasedSectors
+
 #define SPI_FREQ_4MBPS        0x40
 #define SPI_MODULE            0x01
 #define SPI_BITORDER_MSB_LSB  0x00
@@ -60,6 +65,60 @@ static SPI_config_t spi_config_table[2];
 static NRF_SPI_Type *spi_base[2] = {NRF_SPI0, NRF_SPI1};
 static NRF_SPI_Type *SPI;
 
+/*
+ * Writes and erases are queued and run by the SPI interrupt, one byte per
+ * READY event. The flash is ready again when the BUSY bit of its status
+ * clears, after a programmed byte (20 us) or an erase (25-100 ms). The
+ * interrupt doesn't wait for it: flash_poll() reads the status from the
+ * main loop, at most once per FLASH_PROGRAM_POLL_US or FLASH_ERASE_POLL_US,
+ * with chip select released in between.
+ *
+ * Sectors are erased when needed (erasedSectors), in idle time ahead of
+ * the log by the log catalog (utils/log_catalog.c), so a new log never
+ * waits for a whole chip erase.
+ */
+typedef enum {
+	FLASH_WRITE,
+	FLASH_ERASE_SECTOR,
+	FLASH_ERASE_CHIP
+} flashJobType;
+
+typedef struct {
+	uint8_t type;
+	uint8_t count;
+	uint32_t address;
+	uint8_t data[FLASH_JOB_SIZE];
+} flashJob;
+
+typedef enum {
+	FLASH_IDLE,
+	FLASH_WREN,			// Write enable sent
+	FLASH_PROGRAM,		// AAI command with the next byte sent
+	FLASH_PROGRAM_BUSY,	// Programming, waits for flash_poll()
+	FLASH_PROGRAM_CHECK,	// Status read of flash_poll()
+	FLASH_WRDI,			// End of the AAI sequence sent
+	FLASH_ERASE,		// Erase command sent
+	FLASH_ERASE_BUSY,	// Erasing, waits for flash_poll()
+	FLASH_ERASE_CHECK	// Status read of flash_poll()
+} flashState;
+
+#define FLASH_JOBS 6
+#define FLASH_PROGRAM_POLL_US 20	// Byte program time
+#define FLASH_ERASE_POLL_US 1000	// Sector erase 25 ms, chip erase 100 ms
+static flashJob flashJobs[FLASH_JOBS];
+static volatile uint8_t jobHead, jobTail;	// Added by the main loop, removed by the interrupt
+static volatile flashState state = FLASH_IDLE;
+static uint8_t jobPos;						// Bytes of the current job programmed
+static uint32_t lastPoll;					// Time (us) of the last status read of flash_poll()
+
+// Segment on the bus: chip select low from the first to the last byte
+static uint8_t segment[5];
+static uint8_t segmentLen, segmentPos;
+
+// Sectors erased (or queued for it) and not discarded since: the bytes
+// after the last write are still 0xFF. Unknown after boot.
+static uint32_t erasedSectors;
+
 uint32_t* spi_master_init(uint8_t spi_num, SPI_config_t *spi_config)
 {
     if(spi_num > 1)
@@ -270,102 +329,270 @@ bool spi_master_tx_rx_fast_read(uint8_t spi_num, uint16_t transfer_size, const u
     return true;
 }
 
-bool spi_master_tx_rx_fast_write(uint8_t spi_num, uint16_t transfer_size, const uint8_t *tx_data, uint8_t *bytes)
+/**
+ * @brief Puts a command on the bus, the interrupt sends the other bytes
+ */
+static void segment_start(uint8_t len)
 {
-	volatile uint32_t dummyread;
-	uint32_t bytesWritten = 0;
-	uint32_t address = tx_data[3] + (tx_data[2]<<8) + (tx_data[1]<<16);
-	
-	if(tx_data == 0 || bytes == 0)
-		{
+	segmentLen = len;
+	segmentPos = 1;
+	nrf_gpio_pin_clear(SPI_CS);
+	NRF_SPI1->TXD = segment[0];
+}
+
+/**
+ * @brief Starts the job at the tail of the queue (write enable first)
+ * or stops the interrupts when there is none.
+ */
+static void job_next(void)
+{
+	if (jobTail == jobHead) {
+		state = FLASH_IDLE;
+		NRF_SPI1->INTENCLR = SPI_INTENCLR_READY_Msk;
+		return;
+	}
+	jobPos = 0;
+	state = FLASH_WREN;
+	segment[0] = WREN;
+	segment_start(1);
+}
+
+static void job_done(void)
+{
+	jobTail = (jobTail + 1) % FLASH_JOBS;
+	job_next();
+}
+
+/**
+ * @brief Next step of the current job, the last segment is finished
+ * @param status Last byte received (the status after a status read)
+ */
+static void job_step(uint8_t status)
+{
+	flashJob *job = &flashJobs[jobTail];
+
+	switch (state) {
+		case FLASH_WREN:
+			if (job->type == FLASH_ERASE_CHIP) {
+				state = FLASH_ERASE;
+				segment[0] = CHIP_ERASE;
+				segment_start(1);
+			} else if (job->type == FLASH_ERASE_SECTOR) {
+				state = FLASH_ERASE;
+				segment[0] = SECTOR_ERASE;
+				segment[1] = (job->address & 0xFFFFFF) >> 16;
+				segment[2] = (job->address & 0xFFFF) >> 8;
+				segment[3] = job->address & 0xFF;
+				segment_start(4);
+			} else {
+				state = FLASH_PROGRAM;
+				segment[0] = AAI;
+				segment[1] = (job->address & 0xFFFFFF) >> 16;
+				segment[2] = (job->address & 0xFFFF) >> 8;
+				segment[3] = job->address & 0xFF;
+				segment[4] = job->data[jobPos++];
+				segment_start(5);
+			}
+			break;
+		case FLASH_PROGRAM:
+			state = FLASH_PROGRAM_BUSY;
+			break;
+		case FLASH_PROGRAM_CHECK:
+			if (status & STATUS_BUSY) {
+				state = FLASH_PROGRAM_BUSY;
+			} else if (jobPos < job->count) {
+				state = FLASH_PROGRAM;
+				segment[0] = AAI;
+				segment[1] = job->data[jobPos++];
+				segment_start(2);
+			} else {
+				state = FLASH_WRDI;
+				segment[0] = WRDI;
+				segment_start(1);
+			}
+			break;
+		case FLASH_ERASE:
+			state = FLASH_ERASE_BUSY;
+			break;
+		case FLASH_ERASE_CHECK:
+			if (status & STATUS_BUSY) state = FLASH_ERASE_BUSY;
+			else job_done();
+			break;
+		default:
+			job_done();
+			break;
+	}
+}
+
+void SPI1_TWI1_IRQHandler(void)
+{
+	if (!NRF_SPI1->EVENTS_READY) return;
+	NRF_SPI1->EVENTS_READY = 0;
+	uint8_t rx = NRF_SPI1->RXD;
+
+	if (segmentPos < segmentLen) {
+		NRF_SPI1->TXD = segment[segmentPos++];
+		return;
+	}
+
+	nrf_gpio_pin_set(SPI_CS);
+	job_step(rx);
+}
+
+/**
+ * Checks whether the programmed byte or the running erase is done, with one status read. Call it from
+ * the main loop, the interrupt doesn't wait for the flash. The status is read at most once per
+ * FLASH_PROGRAM_POLL_US while programming, once per FLASH_ERASE_POLL_US while erasing.
+ */
+void flash_poll(void)
+{
+	uint32_t now = get_time_us();
+
+	CRITICAL_REGION_ENTER();
+	if ((state == FLASH_PROGRAM_BUSY && now - lastPoll >= FLASH_PROGRAM_POLL_US) ||
+		(state == FLASH_ERASE_BUSY && now - lastPoll >= FLASH_ERASE_POLL_US)) {
+		state = (state == FLASH_PROGRAM_BUSY) ? FLASH_PROGRAM_CHECK : FLASH_ERASE_CHECK;
+		lastPoll = now;
+		segment[0] = RDSR;
+		segment[1] = 0x00;
+		segment_start(2);
+	}
+	CRITICAL_REGION_EXIT();
+}
+
+/**
+ * Waits until all queued writes and erases are done.
+ */
+void flash_sync(void)
+{
+	while (state != FLASH_IDLE) {
+		flash_poll();
+	}
+}
+
+/**
+ * Number of jobs that can still be queued. The queue is full while an erase runs and writes pile up
+ * behind it, the writes fail then instead of waiting.
+ */
+uint8_t flash_queue_free(void)
+{
+	return (jobTail + FLASH_JOBS - jobHead - 1) % FLASH_JOBS;
+}
+
+/**
+ * Queues a job.
+ *
+ * @return
+ * @retval true if the job is queued.
+ * @retval false if it doesn't fit in the flash or the queue is full.
+ */
+static bool job_add(flashJobType type, uint32_t address, const uint8_t *data, uint8_t count)
+{
+	if (address + count > FLASH_SIZE) {
 		return false;
 	}
-	if(transfer_size < 1)
-	{
+	if (!flash_queue_free()) {
 		return false;
 	}
-	SPI = spi_base[spi_num];
-    
-    	/* enable slave (slave select active low) */
-    	nrf_gpio_pin_clear(spi_config_table[spi_num].pin_CSN);
 
-    	SPI->EVENTS_READY = 0; 
+	flashJob *job = &flashJobs[jobHead];
+	job->type = type;
+	job->address = address;
+	job->count = count;
+	if (count) memcpy(job->data, data, count);
+
+	CRITICAL_REGION_ENTER();
+	jobHead = (jobHead + 1) % FLASH_JOBS;
+	if (state == FLASH_IDLE) {
+		NRF_SPI1->EVENTS_READY = 0;
+		NRF_SPI1->INTENSET = SPI_INTENSET_READY_Msk;
+		job_next();
+	}
+	CRITICAL_REGION_EXIT();
 
-	for(int i=0; i<4; i++)
-	{
-		SPI->TXD = (uint32_t)*tx_data++;
-		while (SPI->EVENTS_READY == 0);		
-		SPI->EVENTS_READY = 0;
-		dummyread = SPI->RXD;
+	return true;
+}
+
+/**
+ * Queues the erase of a sector, unless it is erased already.
+ *
+ * @return
+ * @retval false if the queue is full.
+ */
+static bool sector_erase(uint32_t sector)
+{
+	if (erasedSectors & (1UL << sector)) {
+		return true;
+	}
+	if (!job_add(FLASH_ERASE_SECTOR, sector * FLASH_SECTOR_SIZE, NULL, 0)) {
+		return false;
 	}
+	erasedSectors |= 1UL << sector;
+	return true;
+}
 
-	//Send first byte
-	SPI->TXD = (uint32_t)*bytes++;
-	while (SPI->EVENTS_READY == 0);
-	SPI->EVENTS_READY = 0;
-	dummyread = SPI->RXD;
-	
-	/* disable slave (slave select active low) */
-	nrf_gpio_pin_set(spi_config_table[spi_num].pin_CSN);
-
-	while(--transfer_size)
-    	{
-		nrf_delay_us(15); /////////////////////////
-		
-		/* enable slave (slave select active low) */
-        	nrf_gpio_pin_clear(spi_config_table[spi_num].pin_CSN);
-		
-		//Send AAI
-		SPI->TXD = (uint32_t)AAI;
-
-        	/* Wait for the transaction complete or timeout (about 10ms - 20 ms) */
-        	while (SPI->EVENTS_READY == 0);
-
-        	/* clear the event to be ready to receive next messages */
-        	SPI->EVENTS_READY = 0;
-        	dummyread = SPI->RXD; 
-	
-        	SPI->TXD = (uint32_t)*bytes++;
-
-        	/* Wait for the transaction complete or timeout (about 10ms - 20 ms) */
-        	while (SPI->EVENTS_READY == 0);
-
-        	/* clear the event to be ready to receive next messages */
-        	SPI->EVENTS_READY = 0;
-        	dummyread = SPI->RXD; 
-		
-		bytesWritten++;
-		/* disable slave (slave select active low) */
-        	nrf_gpio_pin_set(spi_config_table[spi_num].pin_CSN);
-		if(address + bytesWritten >= 0x1FFFF)
-		{
-			if(transfer_size)
-			{
-				return false;
-			}
-		}
-    	}
+/**
+ * Queues the erase of the sector holding an address, unless it is erased already.
+ *
+ * @param address any address in the sector.
+ * @return
+ * @retval true if the sector is erased or queued for it.
+ * @retval false if the address is outside the flash or the queue is full.
+ */
+bool flash_erase_sector(uint32_t address)
+{
+	if (address >= FLASH_SIZE) {
+		return false;
+	}
+	return sector_erase(address / FLASH_SECTOR_SIZE);
+}
+
+/**
+ * Checks whether the sector holding an address is erased (or queued for it) and not discarded since.
+ *
+ * @param address any address in the sector.
+ */
+bool flash_sector_erased(uint32_t address)
+{
+	return address < FLASH_SIZE && (erasedSectors & (1UL << (address / FLASH_SECTOR_SIZE)));
+}
 
-	nrf_delay_us(20);
+/**
+ * Marks the sector holding an address as erased without erasing it: writes go on after the bytes in use.
+ * For sectors a scan at boot found written only up to some point, the rest still 0xFF.
+ *
+ * @param address any address in the sector.
+ */
+void flash_mark_erased(uint32_t address)
+{
+	if (address < FLASH_SIZE) {
+		erasedSectors |= 1UL << (address / FLASH_SECTOR_SIZE);
+	}
+}
 
-	/* enable slave (slave select active low) */
-	nrf_gpio_pin_clear(spi_config_table[spi_num].pin_CSN);
-	
-	//Send WRDI
-	SPI->TXD = (uint32_t)WRDI;
-
-    	/* Wait for the transaction complete or timeout (about 10ms - 20 ms) */
-    	while (SPI->EVENTS_READY == 0);
-
-    	/* clear the event to be ready to receive next messages */
-    	SPI->EVENTS_READY = 0;
-    	dummyread = SPI->RXD; 
-		
-    	/* disable slave (slave select active low) */
-    	nrf_gpio_pin_set(spi_config_table[spi_num].pin_CSN);
-    
-	dummyread++;
-    	return true;
+/**
+ * Checks whether all queued writes and erases are done.
+ */
+bool flash_idle(void)
+{
+	return state == FLASH_IDLE;
+}
+
+/**
+ * Marks a range as holding old data. Its sectors are erased again before they are written, ahead of
+ * the log or at the latest by the write.
+ *
+ * @param address start of the range.
+ * @param count length of the range in bytes.
+ */
+void flash_discard(uint32_t address, uint32_t count)
+{
+	if (!count) {
+		return;
+	}
+	for (uint32_t sector = address / FLASH_SECTOR_SIZE; sector <= (address + count - 1) / FLASH_SECTOR_SIZE && sector < FLASH_SECTORS; sector++) {
+		erasedSectors &= ~(1UL << sector);
+	}
 }
 
 /**
@@ -395,7 +622,8 @@ bool flash_write_disable(void)
 }
 
 /**
- * Clears all memory locations by setting value to 0xFF.
+ * Clears all memory locations by setting value to 0xFF. The erase is queued, writes queued after it
+ * wait for it.
  *
  * @return
  * @retval true if operation is successful.
@@ -403,14 +631,11 @@ bool flash_write_disable(void)
  */
 bool flash_chip_erase(void)
 {
-	uint8_t tx_data = CHIP_ERASE;
-	if(!flash_write_enable())
-	{
+	if (!job_add(FLASH_ERASE_CHIP, 0, NULL, 0)) {
 		return false;
 	}
-	bool result = spi_master_tx(SPI_MODULE, 1, &tx_data);
-	nrf_delay_ms(100);
-	return result;
+	erasedSectors = 0xFFFFFFFFUL;
+	return true;
 }
 
 /**
@@ -459,11 +684,10 @@ bool flash_set_WRSR(void)
 }
 
 /**
- * Writes one byte data to specified address.
+ * Writes one byte data to specified address. The write is queued, see flash_sync().
  *
- * @note Make sure that the memory location is cleared before writing data. If data is already present 
- *       in the memory location (given address), new data cannot be written to that memory location unless 
- *   	 flash_chip_erase() function is called.
+ * @note A sector that isn't known to be erased is erased before the write, see flash_discard(). Writing
+ *       the same location twice without a discard in between only clears bits.
  *
  * @param address any address between 0x000000 to 0x01FFFF where the data should be stored.
  * @param data one byte data to be stored.
@@ -473,43 +697,61 @@ bool flash_set_WRSR(void)
  */
 bool flash_write_byte(uint32_t address, uint8_t data)
 {
-	uint8_t tx_data[5] = {BYTEWRITE,(address & 0xFFFFFF) >> 16,(address & 0xFFFF)>> 8,address & 0xFF,data};
-	if(!flash_write_enable())
-	{
-		return false;
-	}
-	bool result = spi_master_tx(SPI_MODULE, 5, tx_data);
-	nrf_delay_us(20);
-	return result;
+	return flash_write_bytes(address, &data, 1);
 }
 
 /**
  * Writes multi-byte data into memory starting from specified address. Each memory location (address) 
- * holds one byte of data.
+ * holds one byte of data. The data is copied into the queue, in FLASH_JOB_SIZE pieces. Nothing is
+ * queued when the pieces and the erases before them don't all fit in the queue: the caller drops or
+ * retries the data, the main loop never waits for an erase here.
  *
- * @note Make sure that the memory location is cleared before writing data. If data is already present 
- *       in the memory location (given address), new data cannot be written to that memory location unless 
- *   	 flash_chip_erase() function is called.
+ * @note A sector that isn't known to be erased is erased before the write, see flash_discard(). Writing
+ *       the same location twice without a discard in between only clears bits.
  * 
  * @param address starting address (between 0x000000 to 0x01FFFF) from which the data should be stored.
  * @param data pointer to uint8_t type array containing data.
  * @param count number of bytes to be stored.
  * @return
  * @retval true if operation is successful.
- * @retval false if operation is failed.
+ * @retval false if operation is failed or the queue is full.
  */
 bool flash_write_bytes(uint32_t address, uint8_t *data, uint32_t count)
 {
-	if(!flash_write_enable())
+	if(address + count > FLASH_SIZE)
+	{
+		return false;
+	}
+
+	uint32_t jobs = (count + FLASH_JOB_SIZE - 1) / FLASH_JOB_SIZE;
+	for(uint32_t sector = address / FLASH_SECTOR_SIZE; count && sector <= (address + count - 1) / FLASH_SECTOR_SIZE; sector++)
+	{
+		if(!(erasedSectors & (1UL << sector))) jobs++;
+	}
+	if(jobs > flash_queue_free())
 	{
 		return false;
 	}
-	uint8_t tx_data[4] = {AAI,(address & 0xFFFFFF) >> 16,(address & 0xFFFF)>> 8,address & 0xFF};
-	return spi_master_tx_rx_fast_write(SPI_MODULE, count, tx_data, data);
+
+	// Sectors with old data are erased first, the write waits for it in the queue
+	for(uint32_t sector = address / FLASH_SECTOR_SIZE; count && sector <= (address + count - 1) / FLASH_SECTOR_SIZE; sector++)
+	{
+		sector_erase(sector);
+	}
+
+	while(count)
+	{
+		uint8_t n = (count > FLASH_JOB_SIZE) ? FLASH_JOB_SIZE : count;
+		job_add(FLASH_WRITE, address, data, n);
+		address += n;
+		data += n;
+		count -= n;
+	}
+	return true;
 }
 
 /**
- * Reads one byte data from specified address.
+ * Reads one byte data from specified address, after the queued writes.
  *
  * @param address any address between 0x000000 to 0x01FFFF from where the data should be read.
  *                The address is incremented automatically and once the data is written to last accessible 
@@ -523,13 +765,14 @@ bool flash_read_byte(uint32_t address, uint8_t *buffer)
 {
 	uint8_t tx_data[5] = {BYTEREAD,(address & 0xFFFFFF) >> 16,(address & 0xFFFF)>> 8,address & 0xFF,0x00};
 	uint8_t rx_data[5];
+	flash_sync();
 	bool result = spi_master_tx_rx(SPI_MODULE, 5, tx_data, rx_data);
     *buffer = rx_data[4];
 	return result;
 }
 
 /**
- * Reads multi-byte data starting from specified address.
+ * Reads multi-byte data starting from specified address, after the queued writes.
  *
  * @param address starting address (between 0x000000 to 0x01FFFF) from which the data is read.
  *                The address is incremented automatically and once the data from address 0x01FFFF 
@@ -543,6 +786,7 @@ bool flash_read_byte(uint32_t address, uint8_t *buffer)
 bool flash_read_bytes(uint32_t address, uint8_t *buffer, uint32_t count)
 {
 	uint8_t tx_data[4] = {BYTEREAD,(address & 0xFFFFFF) >> 16,(address & 0xFFFF)>> 8,address & 0xFF};
+	flash_sync();
 	return spi_master_tx_rx_fast_read(SPI_MODULE, count, tx_data, buffer);
 }
 
@@ -585,13 +829,13 @@ bool spi_flash_init(void)
 //	{
 //		return false;
 //	}
-	if(!flash_chip_erase())
-	{
-		return false;
-	}
-	if(!flash_write_enable())
-	{
-		return false;
-	}
+
+	// Writes and erases from here on go through the queue. Nothing is known to be erased,
+	// catalog_init() marks what the log can append to.
+	NVIC_ClearPendingIRQ(SPI1_TWI1_IRQn);
+	NVIC_SetPriority(SPI1_TWI1_IRQn, 3);
+	NVIC_EnableIRQ(SPI1_TWI1_IRQn);
+	erasedSectors = 0;
+
     return true;
 }
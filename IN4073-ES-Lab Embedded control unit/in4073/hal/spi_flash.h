@@ -1,7 +1,18 @@
 #ifndef SPI_FLASH_H_
 #define SPI_FLASH_H_
 
+#define FLASH_JOB_SIZE 48	// Bytes per queued write, a log row fits
+#define FLASH_SECTOR_SIZE 4096	// Smallest erase, 25 ms
+
 bool spi_flash_init(void);
+void flash_poll(void);
+void flash_sync(void);
+bool flash_idle(void);
+uint8_t flash_queue_free(void);
+bool flash_erase_sector(uint32_t address);
+bool flash_sector_erased(uint32_t address);
+void flash_mark_erased(uint32_t address);
+void flash_discard(uint32_t address, uint32_t count);
 bool flash_chip_erase(void);
 bool flash_write_byte(uint32_t address, uint8_t data);
 bool flash_write_bytes(uint32_t address, uint8_t *data, uint32_t count);
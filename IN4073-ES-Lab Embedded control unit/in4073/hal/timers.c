@@ -1,6 +1,7 @@
 /*------------------------------------------------------------------
  *  timers.c -- TIMER2 is for time-keeping, TIMER1 for motors. 
  *		TIMER0 is for soft-device
+ *		TIMER1 CC[2] captures the sensor interrupt (PPI channel 8)
  *
  *  I. Protonotarios
  *  Embedded Software Lab
@@ -22,6 +23,13 @@
 /* static */ uint32_t global_time;
 static bool timer_flag;
 
+#define TIMER_PERIOD_COUNTS	2500	// Both timers: 312 us at 8 MHz
+#define TIMER_PERIOD_US		312
+
+// Times (us) of the sensor interrupts, captured by PPI when INT_PIN rose
+#define SENSOR_STAMPS 8		// Power of 2
+static volatile uint32_t sensorStamps[SENSOR_STAMPS];
+static volatile uint8_t stampHead, stampTail;
 
 
 void TIMER2_IRQHandler(void)
@@ -46,8 +54,9 @@ void TIMER1_IRQHandler(void)
 	if (NRF_TIMER1->EVENTS_COMPARE[3]) {
 		NRF_TIMER1->EVENTS_COMPARE[3] = 0;
 
-		NRF_TIMER1->TASKS_CAPTURE[2]=1;
-		if(!radio_active && (NRF_TIMER1->CC[2] < 500)) {
+		// TIMER1 CC[2] belongs to the sensor interrupt, TIMER2 runs in phase
+		NRF_TIMER2->TASKS_CAPTURE[2]=1;
+		if(!radio_active && (NRF_TIMER2->CC[2] < 500)) {
 			nrf_gpio_pin_set(20);
 			motor[0] = (motor[0] < MAX_MOTOR_VAL) ? ((motor[0] < 0) ? 0: motor[0]) : MAX_MOTOR_VAL;
 			motor[1] = (motor[1] < MAX_MOTOR_VAL) ? ((motor[1] < 0) ? 0: motor[1]) : MAX_MOTOR_VAL;
@@ -59,6 +68,76 @@ void TIMER1_IRQHandler(void)
 }
 
 
+/**
+ * @brief Dates the sensor interrupt from the TIMER1 count PPI captured
+ * when INT_PIN rose, so the time doesn't depend on when the main loop
+ * gets to the FIFO. Same priority as the timer interrupts, global_time
+ * can't change meanwhile.
+ */
+void GPIOTE_IRQHandler(void)
+{
+	if (NRF_GPIOTE->EVENTS_PORT) {
+		NRF_GPIOTE->EVENTS_PORT = 0;
+
+		uint32_t captured = NRF_TIMER1->CC[2];
+		NRF_TIMER2->TASKS_CAPTURE[2]=1;
+		uint32_t now = NRF_TIMER2->CC[2];
+		uint32_t base = global_time;
+
+		// Period started but not counted yet by TIMER2_IRQHandler
+		if (NRF_TIMER2->EVENTS_COMPARE[3] && now < TIMER_PERIOD_COUNTS / 2)
+			base += TIMER_PERIOD_US;
+
+		// Counts since the capture, the interrupt is served within a period
+		uint32_t age = (now >= captured) ? now - captured : now + TIMER_PERIOD_COUNTS - captured;
+		uint32_t time = base + (now >> 3) - (age >> 3);
+
+		// Full: the oldest stamp goes, the FIFO overflowed as well
+		uint8_t head = stampHead;
+		sensorStamps[head] = time;
+		stampHead = (head + 1) & (SENSOR_STAMPS - 1);
+		if (stampHead == stampTail) stampTail = (stampTail + 1) & (SENSOR_STAMPS - 1);
+	}
+}
+
+/**
+ * @brief Takes the time of the oldest sensor interrupt not read yet
+ * @param time Time (us) of the interrupt
+ * @return false if there was none
+ */
+bool sensor_stamp_pop(uint32_t *time)
+{
+	bool found = false;
+
+	CRITICAL_REGION_ENTER();
+	if (stampTail != stampHead) {
+		*time = sensorStamps[stampTail];
+		stampTail = (stampTail + 1) & (SENSOR_STAMPS - 1);
+		found = true;
+	}
+	CRITICAL_REGION_EXIT();
+
+	return found;
+}
+
+/**
+ * @brief Whether a sensor interrupt came that wasn't read yet
+ */
+bool sensor_stamp_pending(void)
+{
+	return stampTail != stampHead;
+}
+
+/**
+ * @brief Drops the stamps of the samples the sensor discards (mode switch)
+ */
+void sensor_stamps_clear(void)
+{
+	CRITICAL_REGION_ENTER();
+	stampTail = stampHead;
+	CRITICAL_REGION_EXIT();
+}
+
 uint32_t get_time_us(void)
 {
 	NRF_TIMER2->TASKS_CAPTURE[2]=1;
@@ -140,7 +219,19 @@ void timers_init(void)
 	NRF_PPI->CH[7].EEP = (uint32_t)&NRF_TIMER2->EVENTS_COMPARE[3];
 	NRF_PPI->CH[7].TEP = (uint32_t)&NRF_GPIOTE->TASKS_OUT[3];
 
-	NRF_PPI->CHENSET = PPI_CHENSET_CH0_Msk | PPI_CHENSET_CH1_Msk | PPI_CHENSET_CH2_Msk | PPI_CHENSET_CH3_Msk | PPI_CHENSET_CH4_Msk | PPI_CHENSET_CH5_Msk | PPI_CHENSET_CH6_Msk | PPI_CHENSET_CH7_Msk;
+	// sensor interrupt - timer capture. The GPIOTE channels all drive
+	// motors, so it is the PORT event of the pin sense (gpio_init())
+	NRF_PPI->CH[8].EEP = (uint32_t)&NRF_GPIOTE->EVENTS_PORT;
+	NRF_PPI->CH[8].TEP = (uint32_t)&NRF_TIMER1->TASKS_CAPTURE[2];
+
+	NRF_PPI->CHENSET = PPI_CHENSET_CH0_Msk | PPI_CHENSET_CH1_Msk | PPI_CHENSET_CH2_Msk | PPI_CHENSET_CH3_Msk | PPI_CHENSET_CH4_Msk | PPI_CHENSET_CH5_Msk | PPI_CHENSET_CH6_Msk | PPI_CHENSET_CH7_Msk | PPI_CHENSET_CH8_Msk;
+
+	stampHead = stampTail = 0;
+	NRF_GPIOTE->EVENTS_PORT = 0;
+	NRF_GPIOTE->INTENSET = GPIOTE_INTENSET_PORT_Msk;
+	NVIC_ClearPendingIRQ(GPIOTE_IRQn);
+	NVIC_SetPriority(GPIOTE_IRQn, 1);
+	NVIC_EnableIRQ(GPIOTE_IRQn);
 
 
 	APP_TIMER_INIT(APP_TIMER_PRESCALER, APP_TIMER_OP_QUEUE_SIZE, false);
@@ -16,6 +16,9 @@ extern uint32_t global_time;
 
 void timers_init(void);
 uint32_t get_time_us(void);
+bool sensor_stamp_pop(uint32_t *time);
+bool sensor_stamp_pending(void);
+void sensor_stamps_clear(void);
 bool check_timer_flag(void);
 void clear_timer_flag(void);
 
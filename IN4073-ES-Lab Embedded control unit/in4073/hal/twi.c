@@ -15,16 +15,22 @@
 #include "app_util_platform.h"
 #include "nrf_gpio.h"
 #include "timers.h"
+#include "comm.h"
+#include "utils/trace.h"
 
 static volatile bool sent = false;
 static volatile bool read = false;
 
+// Number of i2c_read / i2c_write calls since boot
+uint32_t i2c_transactions = 0;
+
 bool i2c_read(uint8_t slave_addr, uint8_t reg_addr, uint8_t data_length, uint8_t *data)
 {
 	if (!data_length) {
 		return -1;
 	}
 
+	i2c_transactions++;
 	sent = false;
 	read = false;
 	NRF_TWI0->ADDRESS = slave_addr;
@@ -65,6 +71,7 @@ bool i2c_write(uint8_t slave_addr, uint8_t reg_addr, uint8_t data_length, uint8_
 		return -1;
 	}
 
+	i2c_transactions++;
 	sent = false;
 	NRF_TWI0->ADDRESS = slave_addr;
 	NRF_TWI0->SHORTS = 0;
@@ -99,7 +106,8 @@ void SPI0_TWI0_IRQHandler(void)
 	}
 
 	if(NRF_TWI0->EVENTS_ERROR != 0) {
-		printf("\rTWI error, code: %lx | at %lu usecs, from device: %ld\n", NRF_TWI0->ERRORSRC, get_time_us(), NRF_TWI0->ADDRESS);
+		SEND_EVENT(EV_TWI_ERROR, NRF_TWI0->ERRORSRC, get_time_us(), NRF_TWI0->ADDRESS);
+		trace(TR_TWI_ERROR, NRF_TWI0->ADDRESS, NRF_TWI0->ERRORSRC);
 		NRF_TWI0->ERRORSRC = 3;
 		NRF_TWI0->EVENTS_ERROR = 0;
 	}
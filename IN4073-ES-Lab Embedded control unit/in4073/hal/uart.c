@@ -16,6 +16,8 @@
 #include "in4073.h"
 #include "utils/queue.h"
 #include "control.h"
+#include "comm.h"
+#include "utils/trace.h"
 
 // My include
 #include "nrf_delay.h"
@@ -108,7 +110,8 @@ void UART0_IRQHandler(void)
 
 	if (NRF_UART0->EVENTS_ERROR != 0) {
 		NRF_UART0->EVENTS_ERROR = 0;
-		printf("uart error: %lu\n", NRF_UART0->ERRORSRC);
+		SEND_EVENT(EV_UART_ERROR, NRF_UART0->ERRORSRC);
+		trace(TR_UART_ERROR, 0, NRF_UART0->ERRORSRC);
 	}
 }
 
@@ -0,0 +1,61 @@
+/*------------------------------------------------------------------
+ *  bench.c -- host micro-benchmarks of the portable firmware modules
+ *
+ *  Prints one CSV line per benchmark (bench_cases.c): name, iterations,
+ *  ns per operation and heap allocations made while it ran. The host
+ *  numbers don't say how fast the Cortex-M0 is, only whether a change
+ *  made the code faster or slower ("make m0-bench" counts M0
+ *  instructions and cycles). Fails (exit code 1) if anything allocated.
+ *  Run with "make host-bench".
+ *------------------------------------------------------------------
+ */
+#include "host_hal.h"
+#include "bench.h"
+#include "control.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#define BENCH_MIN_NS 200000000LL	// Run every benchmark at least 0.2 s
+
+static long long now_ns(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+int main(void)
+{
+	int allocating = 0;
+
+	host_reset();
+	initializeMotorControl();
+
+	printf("benchmark,iterations,ns_per_op,allocations\n");
+	for (size_t b = 0; b < benchmarkCount; b++)
+	{
+		uint32_t n = 1000;
+		long long elapsed;
+		uint32_t allocations;
+
+		// Double the iterations until it runs long enough to time
+		while (true)
+		{
+			host_reset();
+			allocations = host_allocations;
+			long long start = now_ns();
+			benchmarks[b].run(n);
+			elapsed = now_ns() - start;
+			allocations = host_allocations - allocations;
+			if (elapsed >= BENCH_MIN_NS || n >= (1u << 30)) break;
+			n *= 2;
+		}
+
+		printf("%s,%u,%.2f,%u\n", benchmarks[b].name, n, (double)elapsed / n, allocations);
+		if (allocations) allocating++;
+	}
+
+	if (allocating) fprintf(stderr, "%d benchmarks allocated memory\n", allocating);
+	return allocating ? 1 : 0;
+}
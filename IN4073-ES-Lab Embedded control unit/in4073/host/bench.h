@@ -0,0 +1,16 @@
+#ifndef BENCH_H__
+#define BENCH_H__
+
+#include <inttypes.h>
+#include <stddef.h>
+
+typedef struct
+{
+	const char *name;
+	void (*run)(uint32_t n);	// Runs the case n times
+} benchmark;
+
+extern const benchmark benchmarks[];
+extern const size_t benchmarkCount;
+
+#endif /* BENCH_H__ */
@@ -0,0 +1,297 @@
+/*------------------------------------------------------------------
+ *  bench_cases.c -- micro-benchmarks of the portable firmware modules
+ *
+ *  Only firmware code, no timing: the same cases are timed on the PC
+ *  (bench.c, "make host-bench") and counted in instructions and cycles
+ *  on the simulated nRF51 (../m0, "make m0-bench"). Every case is
+ *  called with the number of iterations to run.
+ *------------------------------------------------------------------
+ */
+#include "bench.h"
+#include "comm.h"
+#include "control.h"
+#include "filter.h"
+#include "pid.h"
+#include "utils/queue.h"
+#include "utils/tools.h"
+#include "utils/trace.h"
+#include "mpu6050/mpu6050.h"
+#include "hal/barometer.h"
+
+void calculateMotorValues(int16_t Z, int16_t M, int16_t N, int16_t L);
+
+// Results go here, so the compiler can't drop the work
+static volatile int32_t sink;
+
+// Inputs that change every iteration (xorshift), not constant folded
+static uint32_t seed = 2463534242u;
+
+static inline uint32_t next(void)
+{
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+static void bench_isqrt(uint32_t n)
+{
+	for (uint32_t i = 0; i < n; i++) sink = isqrt(next() >> 8);
+}
+
+static void bench_calculate_motor_values(uint32_t n)
+{
+	for (uint32_t i = 0; i < n; i++)
+	{
+		uint32_t r = next();
+		calculateMotorValues(r % 600, (int8_t)(r >> 8), (int8_t)(r >> 16), (int8_t)(r >> 24));
+		sink = ae[0];
+	}
+}
+
+static void bench_pid(uint32_t n)
+{
+	PidState_t s;
+	initPidState(&s, -1000, 1000, 2);
+	pidSetGains(&s, 300, 5, 40, 256);
+
+	for (uint32_t i = 0; i < n; i++) sink = pid(&s, (int16_t)next() >> 4, (int16_t)next() >> 4);
+}
+
+/**
+ * @brief The yaw and pitch P control of the full mode as it was before
+ * pid.c, dividing by the gains: the baseline of pid_chain
+ */
+static void bench_p_control_div(uint32_t n)
+{
+	for (uint32_t i = 0; i < n; i++)
+	{
+		uint32_t r = next();
+		int16_t theta_m = (int8_t)(r >> 8) << 6, sq_m = (int8_t)(r >> 16) << 2, sr_m = (int8_t)(r >> 24) << 2;
+
+		int16_t theta_pre = ((int16_t)(uint8_t)r - 127) * 32767 / 127 / 20;
+		int16_t spitch = (int16_t)(((theta_pre - theta_m) * Gain_P1) * 3600 / 32767);
+		int16_t M = (int16_t)((-spitch + sq_m) / Gain_P2);
+		int16_t sr_pre = -((int16_t)(uint8_t)(r >> 4) - 127) * 15;
+		int16_t N = -(int16_t)((sr_pre - sr_m) / Gain_Yaw);
+		sink = M + N;
+	}
+}
+
+/**
+ * @brief The same yaw and pitch chain with pid(), gains as set by
+ * updateControlGains(): compare with p_control_div
+ */
+static void bench_pid_chain(uint32_t n)
+{
+	PidState_t yaw, pitch, pitchRate;
+	initPidState(&yaw, -1000, 1000, 2);
+	initPidState(&pitch, INT16_MIN, INT16_MAX, 2);
+	initPidState(&pitchRate, -1000, 1000, 2);
+	pidSetGains(&yaw, 256, 0, 0, (int32_t)Gain_Yaw * 256);
+	pidSetGains(&pitch, (int32_t)Gain_P1 * 3600, 0, 0, 32767);
+	pidSetGains(&pitchRate, 256, 0, 0, (int32_t)Gain_P2 * 256);
+
+	for (uint32_t i = 0; i < n; i++)
+	{
+		uint32_t r = next();
+		int16_t theta_m = (int8_t)(r >> 8) << 6, sq_m = (int8_t)(r >> 16) << 2, sr_m = (int8_t)(r >> 24) << 2;
+
+		int32_t x = ((int16_t)(uint8_t)r - 127) * ((32767L * 256 + 127 * 10) / (127 * 20));
+		int16_t theta_pre = x >= 0 ? (int16_t)(x >> 8) : -(int16_t)((-x) >> 8);
+		int16_t spitch = pid(&pitch, theta_pre, theta_m);
+		int16_t M = -pid(&pitchRate, spitch, sq_m);
+		int16_t sr_pre = -((int16_t)(uint8_t)(r >> 4) - 127) * 15;
+		int16_t N = -pid(&yaw, sr_pre, sr_m);
+		sink = M + N;
+	}
+}
+
+static void bench_mahony(uint32_t n)
+{
+	MahonyState_t s;
+	int16_t a, b, c;
+	initMahonyState(&s);
+
+	for (uint32_t i = 0; i < n; i++)
+	{
+		uint32_t r = next();
+		// Measured period jitters around the nominal one
+		uint32_t t = next();
+		uint32_t dt = SENSOR_DT_NOMINAL_US - 128 + (t & 0xff);
+		// Tilted up to 30 degrees, and now and then accelerating outside the
+		// 0.75 .. 1.25 g window where the correction is skipped
+		int16_t ax = (int8_t)(t >> 8) * 64, ay = (int8_t)(t >> 16) * 64;
+		int16_t az = (t >> 24) < 16 ? 8192 : 14189 + (int8_t)(t >> 24) * 4;
+		mahony(&a, &b, &c, &s, (int8_t)r, (int8_t)(r >> 8), (int8_t)(r >> 16), ax, ay, az, dt);
+		sink = a;
+	}
+}
+
+static void bench_attitude_error(uint32_t n)
+{
+	int32_t q[4] = {1L << 30, 0, 0, 0}, setpoint[4];
+	int16_t roll, pitch;
+
+	for (uint32_t i = 0; i < n; i++)
+	{
+		uint32_t r = next();
+		q[1] = (int32_t)(int8_t)r << 20;
+		q[2] = (int32_t)(int8_t)(r >> 8) << 20;
+		attitudeSetpoint(setpoint, (int8_t)(r >> 16) << 4, (int8_t)(r >> 24) << 4);
+		attitudeError(&roll, &pitch, q, setpoint);
+		sink = roll + pitch;
+	}
+}
+
+static void bench_vertical(uint32_t n)
+{
+	VerticalState_t s;
+	initVerticalState(&s);
+
+	for (uint32_t i = 0; i < n; i++)
+	{
+		uint32_t r = next();
+		vertical(&s, 101325 + (int8_t)r, 16384 + (int8_t)(r >> 8));
+		sink = verticalPressure(&s);
+	}
+}
+
+static void bench_butterworth(uint32_t n)
+{
+	ButterWorthState_t s = {0, 0};
+
+	for (uint32_t i = 0; i < n; i++) sink = butterworth(&s, (int16_t)next(), BW_COEFf_Raw_Y_i, BW_COEFf_Raw_Y_i1);
+}
+
+static void bench_welford_add(uint32_t n)
+{
+	welfordState w;
+	welfordInit(&w);
+
+	for (uint32_t i = 0; i < n; i++)
+	{
+		if (w.n == UINT16_MAX) welfordInit(&w);
+		welfordAdd(&w, (int8_t)next());
+	}
+	sink = welfordMean(&w);
+}
+
+/**
+ * @brief One control loop iteration (filters, controllers, mixer, motors)
+ * of the given mode, with the joystick just above idle
+ */
+static void bench_control(uint32_t n, enum SystemState_t mode)
+{
+	systemState = mode;
+	joystickThrottle = 100;
+	joystickRoll = joystickPitch = joystickYaw = 127;
+	throttle_pre = joystickThrottle;
+	run_filters_and_control();
+
+	for (uint32_t i = 0; i < n; i++)
+	{
+		uint32_t r = next();
+		sp = (int8_t)r; sq = (int8_t)(r >> 8); sr = (int8_t)(r >> 16);
+		phi = theta = (int8_t)(r >> 24);
+		sensor_quat[1] = sensor_quat[2] = (int32_t)(int8_t)(r >> 24) << 16;
+		saz = 16384;
+		pressure = 101325;
+		run_filters_and_control();
+		sink = motor[0];
+	}
+	systemState = SafeMode;
+}
+
+static void bench_control_full(uint32_t n)
+{
+	bench_control(n, FullControllMode);
+}
+
+static void bench_control_raw(uint32_t n)
+{
+	bench_control(n, RawMode);
+}
+
+static void bench_control_height(uint32_t n)
+{
+	bench_control(n, HeightControl);
+}
+
+static void bench_serialize_telemetry(uint32_t n)
+{
+	telemetry telem = {0};
+	uint8_t data[TELEM_SIZE];
+
+	for (uint32_t i = 0; i < n; i++)
+	{
+		telem.phi = (int16_t)i;
+		serializeTelemetry(&telem, data);
+		sink = data[9];
+	}
+}
+
+static void bench_pack_telemetry(uint32_t n)
+{
+	uint8_t data[TELEM_SIZE] = {0};
+
+	for (uint32_t i = 0; i < n; i++) sendTelemetry(data, (uint16_t)i);
+	sink = data[0];
+}
+
+/**
+ * @brief Receiving one joystick command, byte by byte, up to processMsg()
+ */
+static void bench_unpack_cmd(uint32_t n)
+{
+	recMachine SM = {0};
+	uint8_t msg[4 + CMD_SIZE] = {'?', CMD, CMD_SIZE, 0, 0, 127, 127, 127, 100, 0, 0};
+
+	for (uint8_t i = 0; i < sizeof(msg) - 1; i++) msg[sizeof(msg) - 1] ^= msg[i];
+
+	for (uint32_t i = 0; i < n; i++)
+	{
+		for (uint8_t j = 0; j < sizeof(msg); j++) unpackMessage(msg[j], &SM);
+	}
+	sink = joystickThrottle;
+}
+
+static void bench_queue(uint32_t n)
+{
+	static Queue q;
+	init_queue(&q);
+
+	for (uint32_t i = 0; i < n; i++)
+	{
+		enqueue(&q, (uint8_t)i);
+		sink = dequeue(&q);
+	}
+}
+
+static void bench_trace(uint32_t n)
+{
+	for (uint32_t i = 0; i < n; i++) trace(TR_MODE, (uint8_t)i, (uint16_t)i);
+}
+
+const benchmark benchmarks[] = {
+	{"isqrt", bench_isqrt},
+	{"calculate_motor_values", bench_calculate_motor_values},
+	{"pid", bench_pid},
+	{"p_control_div", bench_p_control_div},
+	{"pid_chain", bench_pid_chain},
+	{"mahony", bench_mahony},
+	{"attitude_error", bench_attitude_error},
+	{"vertical", bench_vertical},
+	{"butterworth", bench_butterworth},
+	{"welford_add", bench_welford_add},
+	{"control_full", bench_control_full},
+	{"control_raw", bench_control_raw},
+	{"control_height", bench_control_height},
+	{"serialize_telemetry", bench_serialize_telemetry},
+	{"pack_telemetry", bench_pack_telemetry},
+	{"unpack_cmd", bench_unpack_cmd},
+	{"queue", bench_queue},
+	{"trace", bench_trace},
+};
+
+const size_t benchmarkCount = sizeof(benchmarks) / sizeof(benchmarks[0]);
@@ -0,0 +1,308 @@
+#include "host_hal.h"
+#include "app_util_platform.h"
+#include "hal/timers.h"
+#include "hal/uart.h"
+#include "hal/spi_flash.h"
+#include "hal/twi.h"
+#include "utils/quad_ble.h"
+#include "utils/settings.h"
+#include "utils/log_catalog.h"
+#include "comm.h"
+#include "mpu6050/mpu6050.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+uint32_t host_time_us = 0;
+uint8_t host_priority = NRF_APP_PRIORITY_THREAD;
+uint8_t host_uart[HOST_UART_SIZE];
+uint32_t host_uart_len = 0;
+uint8_t host_flash[HOST_FLASH_SIZE];
+uint32_t host_erased_sectors = 0;
+uint8_t host_flash_queue_free = HOST_FLASH_JOBS;
+bool host_mode_accept = true;
+int host_mode_requests = 0;
+uint32_t host_allocations = 0;
+uint8_t host_mpu_regs[HOST_MPU_REGS];
+uint32_t i2c_transactions = 0;
+
+// Globals of in4073.c and the barometer driver
+enum SystemState_t systemState = SafeMode;
+uint32_t systemCounter = 0;
+profilingData profileData;
+int32_t pressure;
+int32_t temperature;
+Queue ble_tx_queue;
+Queue tx_queue;		// Always empty, uart_put() doesn't queue
+
+/**
+ * @brief Puts the shims and the drone state back to their boot values
+ */
+void host_reset(void)
+{
+	host_time_us = 0;
+	host_priority = NRF_APP_PRIORITY_THREAD;
+	host_mode_accept = true;
+	host_mode_requests = 0;
+	memset(host_flash, 0xFF, sizeof(host_flash));
+	host_erased_sectors = 0;
+	host_flash_queue_free = HOST_FLASH_JOBS;
+
+	systemState = SafeMode;
+	systemCounter = 0;
+	sensor_quat[0] = 1L << 30;
+	sensor_quat[1] = sensor_quat[2] = sensor_quat[3] = 0;
+	sensor_time = 0;
+	sensor_dt = SENSOR_DT_NOMINAL_US;
+	wireless_mode = false;
+	storedRows = 0;
+	flashAdr = catalog_init();
+	init_queue(&ble_tx_queue);
+	comm_init();
+	host_uart_clear();
+}
+
+void host_uart_clear(void)
+{
+	host_uart_len = 0;
+}
+
+uint8_t current_int_priority_get(void)
+{
+	return host_priority;
+}
+
+uint32_t get_time_us(void)
+{
+	return host_time_us;
+}
+
+void uart_put(uint8_t byte, bool blocking)
+{
+	host_uart[host_uart_len++ % HOST_UART_SIZE] = byte;
+}
+
+uint32_t quad_ble_send(void)
+{
+	return 0;
+}
+
+bool setSystemState(enum SystemState_t newState)
+{
+	host_mode_requests++;
+	if (host_mode_accept) systemState = newState;
+	return host_mode_accept;
+}
+
+void finishFlying()
+{
+}
+
+void settings_save(void)
+{
+}
+
+// No sensor interrupts: every sample is taken a nominal period after the previous one
+bool sensor_stamp_pop(uint32_t *time)
+{
+	return false;
+}
+
+bool sensor_stamp_pending(void)
+{
+	return false;
+}
+
+void sensor_stamps_clear(void)
+{
+}
+
+// MPU-6050 on the I2C bus, enough of it for the InvenSense driver: a
+// register file, the DMP memory behind the bank / address / data
+// registers, a device reset and an always empty FIFO. Every read or write
+// is one transaction (counted in i2c_transactions like twi.c does) and
+// takes its bus time at 400 kHz, 9 bit times per byte.
+#define MPU_REG_PRODUCT 0x06
+#define MPU_REG_USER_CTRL 0x6A
+#define MPU_REG_PWR_MGMT_1 0x6B
+#define MPU_REG_BANK_SEL 0x6D
+#define MPU_REG_MEM_ADDR 0x6E
+#define MPU_REG_MEM_R_W 0x6F
+#define MPU_REG_FIFO_COUNT 0x72
+#define MPU_REG_FIFO_R_W 0x74
+#define MPU_REG_WHO_AM_I 0x75
+#define MPU_USER_CTRL_RESETS 0x0F	// FIFO, DMP, I2C master and signal path resets clear themselves
+#define MPU_BIT_DEVICE_RESET 0x80
+#define MPU_BIT_SLEEP 0x40
+
+static uint8_t hostMpuMem[16 * 256];
+static uint16_t hostMpuMemAddr;
+
+static void host_i2c_transaction(uint8_t length)
+{
+	i2c_transactions++;
+	host_time_us += (2 + length) * 9 * 1000000UL / 400000 + 10;
+}
+
+bool i2c_write(uint8_t slave_addr, uint8_t reg_addr, uint8_t length, uint8_t const *data)
+{
+	host_i2c_transaction(length);
+
+	for (uint8_t i = 0; i < length; i++)
+	{
+		uint8_t reg = reg_addr + i;
+		if (reg_addr == MPU_REG_MEM_R_W)
+		{
+			hostMpuMem[hostMpuMemAddr++ % sizeof(hostMpuMem)] = data[i];
+		}
+		else if (reg_addr != MPU_REG_FIFO_R_W && reg < HOST_MPU_REGS)
+		{
+			host_mpu_regs[reg] = data[i];
+			if (reg == MPU_REG_BANK_SEL || reg == MPU_REG_MEM_ADDR)
+			{
+				hostMpuMemAddr = (host_mpu_regs[MPU_REG_BANK_SEL] & 0x1F) << 8 | host_mpu_regs[MPU_REG_MEM_ADDR];
+			}
+		}
+	}
+
+	host_mpu_regs[MPU_REG_USER_CTRL] &= ~MPU_USER_CTRL_RESETS;
+	if (host_mpu_regs[MPU_REG_PWR_MGMT_1] & MPU_BIT_DEVICE_RESET)
+	{
+		memset(host_mpu_regs, 0, sizeof(host_mpu_regs));
+		host_mpu_regs[MPU_REG_PWR_MGMT_1] = MPU_BIT_SLEEP;
+		host_mpu_regs[MPU_REG_WHO_AM_I] = 0x68;
+	}
+	return false;
+}
+
+bool i2c_read(uint8_t slave_addr, uint8_t reg_addr, uint8_t length, uint8_t *data)
+{
+	host_i2c_transaction(length);
+
+	for (uint8_t i = 0; i < length; i++)
+	{
+		uint8_t reg = reg_addr + i;
+		if (reg_addr == MPU_REG_MEM_R_W) data[i] = hostMpuMem[hostMpuMemAddr++ % sizeof(hostMpuMem)];
+		// Product revision 2 (full accelerometer sensitivity) in the low bit of the 4th byte
+		else if (reg_addr == MPU_REG_PRODUCT) data[i] = (i == 3);
+		else if (reg_addr == MPU_REG_FIFO_COUNT || reg_addr == MPU_REG_FIFO_R_W || reg >= HOST_MPU_REGS) data[i] = 0;
+		else data[i] = host_mpu_regs[reg];
+	}
+	return false;
+}
+
+// SPI flash in RAM: erased bytes are 0xFF and writing can only clear bits.
+// The erased sectors are tracked like the driver does, the erases are
+// done right away. Like the driver, nothing is written when the jobs of a
+// write don't fit in host_flash_queue_free.
+static void host_sector_erase(uint32_t sector)
+{
+	memset(&host_flash[sector * FLASH_SECTOR_SIZE], 0xFF, FLASH_SECTOR_SIZE);
+	host_erased_sectors |= 1UL << sector;
+}
+
+bool flash_chip_erase(void)
+{
+	memset(host_flash, 0xFF, sizeof(host_flash));
+	host_erased_sectors = 0xFFFFFFFFUL;
+	return true;
+}
+
+bool flash_idle(void)
+{
+	return true;
+}
+
+uint8_t flash_queue_free(void)
+{
+	return host_flash_queue_free;
+}
+
+// The queued jobs are done: the queue is empty again
+void flash_sync(void)
+{
+	host_flash_queue_free = HOST_FLASH_JOBS;
+}
+
+bool flash_erase_sector(uint32_t address)
+{
+	if (address >= HOST_FLASH_SIZE) return false;
+	if (flash_sector_erased(address)) return true;
+	if (!host_flash_queue_free) return false;
+	host_sector_erase(address / FLASH_SECTOR_SIZE);
+	return true;
+}
+
+bool flash_sector_erased(uint32_t address)
+{
+	return address < HOST_FLASH_SIZE && (host_erased_sectors & (1UL << (address / FLASH_SECTOR_SIZE)));
+}
+
+void flash_mark_erased(uint32_t address)
+{
+	if (address < HOST_FLASH_SIZE) host_erased_sectors |= 1UL << (address / FLASH_SECTOR_SIZE);
+}
+
+void flash_discard(uint32_t address, uint32_t count)
+{
+	if (!count) return;
+	for (uint32_t sector = address / FLASH_SECTOR_SIZE; sector <= (address + count - 1) / FLASH_SECTOR_SIZE && sector < HOST_FLASH_SIZE / FLASH_SECTOR_SIZE; sector++)
+	{
+		host_erased_sectors &= ~(1UL << sector);
+	}
+}
+
+bool flash_write_byte(uint32_t address, uint8_t data)
+{
+	return flash_write_bytes(address, &data, 1);
+}
+
+bool flash_write_bytes(uint32_t address, uint8_t *data, uint32_t count)
+{
+	if (!count || address + count > HOST_FLASH_SIZE) return false;
+
+	uint32_t jobs = (count + FLASH_JOB_SIZE - 1) / FLASH_JOB_SIZE;
+	for (uint32_t sector = address / FLASH_SECTOR_SIZE; sector <= (address + count - 1) / FLASH_SECTOR_SIZE; sector++)
+	{
+		if (!(host_erased_sectors & (1UL << sector))) jobs++;
+	}
+	if (jobs > host_flash_queue_free) return false;
+
+	for (uint32_t sector = address / FLASH_SECTOR_SIZE; sector <= (address + count - 1) / FLASH_SECTOR_SIZE; sector++)
+	{
+		if (!(host_erased_sectors & (1UL << sector))) host_sector_erase(sector);
+	}
+	for (uint32_t i = 0; i < count; i++) host_flash[address + i] &= data[i];
+	return true;
+}
+
+bool flash_read_bytes(uint32_t address, uint8_t *buffer, uint32_t count)
+{
+	if (address + count > HOST_FLASH_SIZE) return false;
+	memcpy(buffer, &host_flash[address], count);
+	return true;
+}
+
+// The firmware has no heap to spare: every allocation of the modules
+// under test is counted (linked with --wrap=malloc etc.)
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+	host_allocations++;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+	host_allocations++;
+	return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t size)
+{
+	host_allocations++;
+	return __real_realloc(p, size);
+}
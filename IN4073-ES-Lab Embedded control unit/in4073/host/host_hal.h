@@ -0,0 +1,38 @@
+#ifndef HOST_HAL_H__
+#define HOST_HAL_H__
+
+// Host replacements of the drone hardware (timers, UART, SPI flash, MPU,
+// interrupt level) and of the globals of in4073.c, so the portable
+// modules can be built and run on the PC. The tests drive and inspect
+// them through these variables.
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "in4073.h"
+
+#define HOST_UART_SIZE 4096
+#define HOST_FLASH_SIZE 0x20000	// 128 KB, like the SST25 on the drone
+#define HOST_FLASH_JOBS 5		// Free jobs of the idle flash queue of the driver
+#define HOST_MPU_REGS 128
+
+extern uint32_t host_time_us;		// get_time_us()
+extern uint8_t host_priority;		// current_int_priority_get()
+
+extern uint8_t host_uart[HOST_UART_SIZE];	// Bytes sent with uart_put(), wraps
+extern uint32_t host_uart_len;
+
+extern uint8_t host_flash[HOST_FLASH_SIZE];
+extern uint32_t host_erased_sectors;	// Sectors the flash shim knows to be erased
+extern uint8_t host_flash_queue_free;	// flash_queue_free(), 0 is a queue full behind an erase
+
+extern uint8_t host_mpu_regs[HOST_MPU_REGS];	// Registers of the MPU-6050 on the I2C shim
+
+extern bool host_mode_accept;		// Result of setSystemState()
+extern int host_mode_requests;		// Number of setSystemState() calls
+extern uint32_t host_allocations;	// malloc / calloc / realloc calls
+
+void host_reset(void);
+void host_uart_clear(void);
+
+#endif /* HOST_HAL_H__ */
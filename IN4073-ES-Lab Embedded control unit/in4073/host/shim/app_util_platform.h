@@ -0,0 +1,18 @@
+#ifndef APP_UTIL_PLATFORM_H__
+#define APP_UTIL_PLATFORM_H__
+
+// Host stand-in for the nRF SDK header: the interrupt level is whatever
+// the test sets in host_priority, critical regions do nothing (one thread).
+
+#include <inttypes.h>
+
+#define NRF_APP_PRIORITY_THREAD 4
+#define APP_IRQ_PRIORITY_HIGH 1
+#define APP_IRQ_PRIORITY_LOW 3
+
+#define CRITICAL_REGION_ENTER() {
+#define CRITICAL_REGION_EXIT() }
+
+uint8_t current_int_priority_get(void);
+
+#endif /* APP_UTIL_PLATFORM_H__ */
@@ -0,0 +1,13 @@
+#ifndef NRF_DELAY_H__
+#define NRF_DELAY_H__
+
+// Host stand-in for the nRF SDK header, a delay only advances the host clock
+
+#include <inttypes.h>
+
+extern uint32_t host_time_us;
+
+static inline void nrf_delay_us(uint32_t us) { host_time_us += us; }
+static inline void nrf_delay_ms(uint32_t ms) { host_time_us += ms * 1000; }
+
+#endif /* NRF_DELAY_H__ */
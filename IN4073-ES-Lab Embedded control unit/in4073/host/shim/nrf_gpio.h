@@ -0,0 +1,14 @@
+#ifndef NRF_GPIO_H__
+#define NRF_GPIO_H__
+
+// Host stand-in for the nRF SDK header, the LEDs do nothing and no
+// input pin is ever high
+
+#include <inttypes.h>
+
+static inline void nrf_gpio_pin_set(uint32_t pin) { (void)pin; }
+static inline void nrf_gpio_pin_clear(uint32_t pin) { (void)pin; }
+static inline void nrf_gpio_pin_toggle(uint32_t pin) { (void)pin; }
+static inline uint32_t nrf_gpio_pin_read(uint32_t pin) { (void)pin; return 0; }
+
+#endif /* NRF_GPIO_H__ */
@@ -0,0 +1,1007 @@
+/*------------------------------------------------------------------
+ *  test.c -- host unit tests of the portable firmware modules
+ *
+ *  Prints the results in TAP format (ok / not ok per test), the exit
+ *  code is the number of failed tests. Run with "make host-test".
+ *------------------------------------------------------------------
+ */
+#include "host_hal.h"
+#include "app_util_platform.h"
+#include "comm.h"
+#include "control.h"
+#include "filter.h"
+#include "pid.h"
+#include "utils/queue.h"
+#include "utils/tools.h"
+#include "utils/trace.h"
+#include "utils/log_catalog.h"
+#include "mixer_lut.h"
+#include "mpu6050/mpu6050.h"
+#include "hal/twi.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+void calculateMotorValues(int16_t Z, int16_t M, int16_t N, int16_t L);
+
+static int checkFailures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		checkFailures++; \
+		printf("#   %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+	} \
+} while (0)
+
+#define CHECK_EQ(a, b) do { \
+	long long a_ = (long long)(a), b_ = (long long)(b); \
+	if (a_ != b_) { \
+		checkFailures++; \
+		printf("#   %s:%d: %s == %s failed: %lld != %lld\n", __FILE__, __LINE__, #a, #b, a_, b_); \
+	} \
+} while (0)
+
+/**
+ * @brief Feeds a message to the drone receiver: start character, type,
+ * length, data and the checksum
+ */
+static void receive(recMachine *SM, msgType type, const uint8_t *data, uint8_t len, bool goodChecksum)
+{
+	uint8_t csum = '?' ^ type ^ len;
+
+	unpackMessage('?', SM);
+	unpackMessage(type, SM);
+	unpackMessage(len, SM);
+	for (uint8_t i = 0; i < len; i++)
+	{
+		unpackMessage(data[i], SM);
+		csum ^= data[i];
+	}
+	unpackMessage(goodChecksum ? csum : csum ^ 0x5A, SM);
+}
+
+/**
+ * @brief Finds a framed message of the given type in the UART output
+ * @return Offset of its data, -1 if there is none
+ */
+static int findMessage(msgType type, uint32_t from)
+{
+	for (uint32_t i = from; i + 3 < host_uart_len && i + 3 < HOST_UART_SIZE; i++)
+	{
+		if (host_uart[i] != '?' || host_uart[i + 1] != type) continue;
+
+		uint8_t len = host_uart[i + 2];
+		if (i + 4 + len > host_uart_len) continue;
+
+		uint8_t csum = 0;
+		for (uint32_t j = i; j < i + 3 + len; j++) csum ^= host_uart[j];
+		if (csum == host_uart[i + 3 + len]) return i + 3;
+	}
+	return -1;
+}
+
+static void test_serialization(void)
+{
+	uint8_t b[4];
+
+	ui16_to_ui8(0xBEEF, b);
+	CHECK_EQ(b[0], 0xBE);
+	CHECK_EQ(b[1], 0xEF);
+	CHECK_EQ(to_ui16(b), 0xBEEF);
+
+	const int16_t i16[] = {0, 1, -1, INT16_MAX, INT16_MIN, 12345, -12345};
+	for (size_t i = 0; i < sizeof(i16) / sizeof(i16[0]); i++)
+	{
+		i16_to_ui8(i16[i], b);
+		CHECK_EQ(to_i16(b), i16[i]);
+	}
+
+	const int32_t i32[] = {0, 1, -1, INT32_MAX, INT32_MIN, 100000, -100000};
+	for (size_t i = 0; i < sizeof(i32) / sizeof(i32[0]); i++)
+	{
+		i32_to_ui8(i32[i], b);
+		CHECK_EQ(to_i32(b), i32[i]);
+		ui32_to_ui8((uint32_t)i32[i], b);
+		CHECK_EQ(to_ui32(b), (uint32_t)i32[i]);
+	}
+
+	// Telemetry layout, the PC reads the same offsets
+	telemetry telem = {.mode = 5, .motor1 = 300, .motor4 = -1, .phi = -1000, .sr = 77,
+		.bat = 1110, .temp = -20, .pres = 101325, .hei = 9};
+	uint8_t data[TELEM_SIZE];
+	serializeTelemetry(&telem, data);
+	CHECK_EQ(data[0], 5);
+	CHECK_EQ(to_i16(&data[1]), 300);
+	CHECK_EQ(to_i16(&data[7]), -1);
+	CHECK_EQ(to_i16(&data[9]), -1000);
+	CHECK_EQ(to_i16(&data[19]), 77);
+	CHECK_EQ(to_ui16(&data[21]), 1110);
+	CHECK_EQ(to_i32(&data[23]), -20);
+	CHECK_EQ(to_i32(&data[27]), 101325);
+	CHECK_EQ(to_i16(&data[37]), 9);
+}
+
+static void test_queue(void)
+{
+	Queue q;
+	init_queue(&q);
+
+	for (int i = 0; i < QUEUE_SIZE; i++) CHECK(enqueue(&q, (uint8_t)i));
+	CHECK(!enqueue(&q, 0));
+	CHECK_EQ(q.count, QUEUE_SIZE);
+
+	for (int i = 0; i < QUEUE_SIZE / 2; i++) CHECK_EQ(dequeue(&q), (uint8_t)i);
+
+	// Wrap around the end of the buffer
+	for (int i = 0; i < QUEUE_SIZE / 2; i++) CHECK(enqueue(&q, (uint8_t)(i + 100)));
+	CHECK(!enqueue(&q, 0));
+	for (int i = QUEUE_SIZE / 2; i < QUEUE_SIZE; i++) CHECK_EQ(dequeue(&q), (uint8_t)i);
+	for (int i = 0; i < QUEUE_SIZE / 2; i++) CHECK_EQ(dequeue(&q), (uint8_t)(i + 100));
+	CHECK_EQ(q.count, 0);
+}
+
+static void test_unpack_cmd(void)
+{
+	recMachine SM = {0};
+	uint8_t cmd[CMD_SIZE] = {0x80, 0x01, 10, 20, 30, 40, 0x02};
+
+	host_reset();
+	startLog();
+	receive(&SM, CMD, cmd, CMD_SIZE, true);
+
+	CHECK_EQ(SM.actualState, START);
+	CHECK(keys[A_KEY]);
+	CHECK(!keys[Z_KEY]);
+	CHECK(keys[L_KEY]);
+	CHECK(keys[Y_KEY]);
+	CHECK(!keys[H_KEY]);
+	CHECK_EQ(joystickRoll, 10);
+	CHECK_EQ(joystickPitch, 20);
+	CHECK_EQ(joystickYaw, 30);
+	CHECK_EQ(joystickThrottle, 40);
+	CHECK_EQ(host_mode_requests, 0);
+
+	// The command was logged: time, type, the command
+	CHECK_EQ(storedRows, 1);
+	CHECK_EQ(host_flash[LOG_AREA_START + 4], Command);
+	CHECK_EQ(host_flash[LOG_AREA_START + 5 + 2], 10);
+}
+
+/**
+ * @brief Logs rows marked with a flight id and the row number, in the
+ * open flight
+ */
+static void log_rows(uint8_t id, uint32_t rows)
+{
+	uint8_t row[TELEM_SIZE] = {0};
+
+	for (uint32_t i = 0; i < rows; i++)
+	{
+		row[0] = id;
+		row[1] = (uint8_t)i;
+		host_time_us += 50000;
+		saveLog(Telemetry, row);
+	}
+}
+
+/**
+ * @brief Checks that a flight of the catalog holds its rows, in order
+ */
+static void check_flight(uint32_t number, uint8_t id, uint32_t rows)
+{
+	flightRecord flight;
+	uint8_t row[LOG_SIZE];
+
+	CHECK(catalog_find(number, &flight));
+	if (!catalog_find(number, &flight)) return;
+	CHECK_EQ(flight.rows, rows);
+	uint32_t adr = flight.start;
+	for (uint32_t i = 0; i < flight.rows; i++)
+	{
+		adr = catalog_row_address(adr);
+		flash_read_bytes(adr, row, LOG_SIZE);
+		if (row[4] != Telemetry || row[5] != id || row[6] != (uint8_t)i)
+		{
+			CHECK_EQ(row[5], id);
+			CHECK_EQ(row[6], (uint8_t)i);
+			break;
+		}
+		adr += LOG_SIZE;
+	}
+}
+
+/**
+ * @brief Power cycle: the RAM state is lost, the flash stays
+ */
+static void reboot(void)
+{
+	storedRows = 0;
+	flashAdr = catalog_init();
+}
+
+static void test_log_catalog(void)
+{
+	flightRecord flight;
+	recMachine SM = {0};
+	uint8_t request[FLIGHT_REQ_SIZE] = {FLIGHT_LIST, 0, 0, 0, 0};
+
+	// Empty flash: formatted, the log starts after the catalog
+	host_reset();
+	CHECK_EQ(flashAdr, LOG_AREA_START);
+	CHECK_EQ(catalog_count(), 0);
+
+	// Nothing is logged before the drone is armed
+	log_rows(1, 3);
+	CHECK_EQ(storedRows, 0);
+	CHECK_EQ(flashAdr, LOG_AREA_START);
+	CHECK_EQ(catalog_count(), 0);
+
+	// Leaving safe mode starts a flight, the download closes it and keeps it
+	startLog();
+	log_rows(1, 3);
+	CHECK_EQ(catalog_count(), 1);
+	sendLog();
+	CHECK_EQ(storedRows, 0);
+	CHECK_EQ(catalog_count(), 1);
+	CHECK(catalog_get(0, &flight));
+	CHECK_EQ(flight.number, 1);
+	CHECK_EQ(flight.boot, 1);
+	CHECK_EQ(flight.start, LOG_AREA_START);
+	CHECK_EQ(flight.length, 3 * (LOG_SIZE));
+	check_flight(1, 1, 3);
+
+	// Power off while logging the second flight: it is closed at boot
+	startLog();
+	log_rows(2, 200);
+	uint32_t end = flashAdr;
+	reboot();
+	CHECK_EQ(flashAdr, end);
+	CHECK_EQ(catalog_count(), 2);
+	check_flight(1, 1, 3);
+	check_flight(2, 2, 200);
+
+	// The next flight comes after it, with the next boot number
+	CHECK(!catalog_is_open());
+	startLog();
+	log_rows(3, 5);
+	CHECK(catalog_get(2, &flight));
+	CHECK_EQ(flight.number, 3);
+	CHECK_EQ(flight.boot, 2);
+	CHECK_EQ(flight.start, end);
+	CHECK_EQ(flight.rows, 5);
+	sendLog();
+
+	// Listing: one FLIGHT message per flight, ACK 'F' at the end
+	host_uart_clear();
+	receive(&SM, FLIGHT_REQ, request, FLIGHT_REQ_SIZE, true);
+	processFlightRequest();
+	int data = -3;
+	for (uint32_t number = 1; number <= 3; number++)
+	{
+		data = findMessage(FLIGHT, data + 3);
+		CHECK(data >= 0);
+		if (data < 0) break;
+		CHECK_EQ(to_ui32(&host_uart[data]), number);
+	}
+	int ack = findMessage(ACK, 0);
+	CHECK(ack >= 0);
+	if (ack >= 0) CHECK_EQ(host_uart[ack], 'F');
+
+	// A flight only starts in safe mode
+	systemState = ManualMode;
+	startLog();
+	CHECK(!catalog_is_open());
+	log_rows(4, 2);
+	CHECK_EQ(storedRows, 0);
+	CHECK_EQ(catalog_count(), 3);
+
+	// Not while flying
+	systemState = SafeMode;
+	startLog();
+	host_uart_clear();
+	systemState = ManualMode;
+	receive(&SM, FLIGHT_REQ, request, FLIGHT_REQ_SIZE, true);
+	processFlightRequest();
+	CHECK_EQ(findMessage(FLIGHT, 0), -1);
+
+	// Flash queue full behind an erase: the rows are dropped, not waited for
+	log_rows(4, 2);
+	end = flashAdr;
+	host_flash_queue_free = 0;
+	log_rows(4, 3);
+	CHECK_EQ(flashAdr, end);
+	CHECK_EQ(storedRows, 2);
+	host_flash_queue_free = HOST_FLASH_JOBS;
+	log_rows(4, 1);
+	CHECK_EQ(storedRows, 3);
+	systemState = SafeMode;
+	host_uart_clear();
+	sendLog();
+	int event = findMessage(EVENT, 0);
+	CHECK(event >= 0);
+	if (event >= 0) CHECK_EQ(host_uart[event], EV_LOG_DROPPED);
+	CHECK(catalog_find(4, &flight));
+	CHECK_EQ(flight.rows, 3);
+	CHECK_EQ(flight.length, 3 * (LOG_SIZE));
+}
+
+static void test_log_wrap(void)
+{
+	flightRecord flight;
+
+	host_reset();
+
+	// Five flights of 900 rows don't fit in the log area: the log wraps
+	// around and the oldest flights are dropped before they are erased
+	for (uint8_t id = 1; id <= 5; id++)
+	{
+		startLog();
+		log_rows(id, 900);
+		sendLog();
+	}
+	CHECK_EQ(catalog_count(), 2);
+	CHECK(!catalog_find(3, &flight));
+	check_flight(4, 4, 900);
+	check_flight(5, 5, 900);
+
+	// Power off in a flight across the end of the log area
+	startLog();
+	log_rows(6, 900);
+	reboot();
+	CHECK(!catalog_find(4, &flight));
+	check_flight(5, 5, 900);
+	check_flight(6, 6, 900);
+
+	// A full catalog moves to the other sector, the newest flights stay
+	for (uint32_t i = 0; i < CATALOG_ENTRIES; i++)
+	{
+		startLog();
+		log_rows(7, 2);
+		sendLog();
+	}
+	CHECK_EQ(catalog_count(), CATALOG_FLIGHTS);
+	CHECK(catalog_get(CATALOG_FLIGHTS - 1, &flight));
+	CHECK_EQ(flight.number, 6 + CATALOG_ENTRIES);
+	reboot();
+	CHECK_EQ(catalog_count(), CATALOG_FLIGHTS);
+	check_flight(6 + CATALOG_ENTRIES, 7, 2);
+	CHECK(catalog_get(0, &flight));
+	CHECK_EQ(flight.number, 7 + CATALOG_ENTRIES - CATALOG_FLIGHTS);
+}
+
+static void test_unpack_errors(void)
+{
+	recMachine SM = {0};
+	uint8_t cmd[CMD_SIZE] = {0, 0, 1, 2, 3, 4, 0};
+	uint8_t good[CMD_SIZE] = {0, 0, 127, 127, 127, 0, 0};
+
+	host_reset();
+	joystickRoll = 99;
+
+	// Wrong checksum: dropped
+	receive(&SM, CMD, cmd, CMD_SIZE, false);
+	CHECK_EQ(SM.actualState, START);
+	CHECK_EQ(joystickRoll, 99);
+
+	// Unknown type: the receiver starts over at the next '?'
+	unpackMessage('?', &SM);
+	unpackMessage(TELEM, &SM);
+	CHECK_EQ(SM.actualState, START);
+
+	// Garbage between messages is skipped
+	unpackMessage(0x00, &SM);
+	unpackMessage(0xFF, &SM);
+	receive(&SM, CMD, good, CMD_SIZE, true);
+	CHECK_EQ(joystickRoll, 127);
+	CHECK_EQ(joystickThrottle, 0);
+}
+
+static void test_unpack_mode(void)
+{
+	recMachine SM = {0};
+	uint8_t mode = ManualMode;
+
+	host_reset();
+	receive(&SM, MODE, &mode, 1, true);
+	CHECK_EQ(host_mode_requests, 1);
+	CHECK_EQ(systemState, ManualMode);
+
+	// Answered with an ACK of the new mode
+	int ack = findMessage(ACK, 0);
+	CHECK(ack >= 0);
+	if (ack >= 0) CHECK_EQ(host_uart[ack], ManualMode);
+
+	// A refused change is not acknowledged
+	host_uart_clear();
+	host_mode_accept = false;
+	mode = FullControllMode;
+	receive(&SM, MODE, &mode, 1, true);
+	CHECK_EQ(systemState, ManualMode);
+	CHECK_EQ(findMessage(ACK, 0), -1);
+}
+
+static void test_pack_message(void)
+{
+	uint8_t ack = 'C';
+
+	host_reset();
+	packMessage(ACK, &ack, NULL);
+	CHECK_EQ(host_uart_len, 5);
+	CHECK_EQ(host_uart[0], '?');
+	CHECK_EQ(host_uart[1], ACK);
+	CHECK_EQ(host_uart[2], 1);
+	CHECK_EQ(host_uart[3], 'C');
+	CHECK_EQ(host_uart[4], '?' ^ ACK ^ 1 ^ 'C');
+
+	// Nothing goes out on the cable in wireless mode
+	host_uart_clear();
+	wireless_mode = true;
+	packMessage(ACK, &ack, NULL);
+	CHECK_EQ(host_uart_len, 0);
+	wireless_mode = false;
+
+	// Telemetry: fields, time and stack mark
+	uint8_t telem[TELEM_SIZE] = {7};
+	host_time_us = 123456;
+	sendTelemetry(telem, 1500);
+	int data = findMessage(TELEM, 0);
+	CHECK(data >= 0);
+	if (data >= 0)
+	{
+		CHECK_EQ(host_uart[data - 1], TELEM_MSG_SIZE);
+		CHECK_EQ(host_uart[data], 7);
+		CHECK_EQ(to_ui32(&host_uart[data + TELEM_SIZE]), 123456);
+		CHECK_EQ(to_ui16(&host_uart[data + TELEM_SIZE + 4]), 1500);
+	}
+}
+
+static void test_events(void)
+{
+	host_reset();
+
+	// Thread mode: sent at once, id and the used arguments only
+	SEND_EVENT(EV_GAIN_YAW, -5);
+	int data = findMessage(EVENT, 0);
+	CHECK(data >= 0);
+	if (data >= 0)
+	{
+		CHECK_EQ(host_uart[data - 1], 5);
+		CHECK_EQ(host_uart[data], EV_GAIN_YAW);
+		CHECK_EQ(to_i32(&host_uart[data + 1]), -5);
+	}
+
+	// Interrupt: queued until flushEvents(), in order
+	host_uart_clear();
+	host_priority = APP_IRQ_PRIORITY_LOW;
+	SEND_EVENT(EV_UART_ERROR, 1);
+	SEND_EVENT(EV_UART_ERROR, 2);
+	CHECK_EQ(host_uart_len, 0);
+	host_priority = NRF_APP_PRIORITY_THREAD;
+	flushEvents();
+	data = findMessage(EVENT, 0);
+	CHECK(data >= 0);
+	if (data >= 0)
+	{
+		CHECK_EQ(to_i32(&host_uart[data + 1]), 1);
+		data = findMessage(EVENT, data);
+		CHECK(data >= 0);
+		if (data >= 0) CHECK_EQ(to_i32(&host_uart[data + 1]), 2);
+	}
+
+	// A full queue drops the newest events and says how many
+	host_uart_clear();
+	host_priority = APP_IRQ_PRIORITY_HIGH;
+	for (int i = 0; i < EVENT_QUEUE_SIZE + 3; i++) SEND_EVENT(EV_UART_ERROR, i);
+	host_priority = NRF_APP_PRIORITY_THREAD;
+	flushEvents();
+	int events = 0, lost = -1;
+	for (data = findMessage(EVENT, 0); data >= 0; data = findMessage(EVENT, data))
+	{
+		events++;
+		if (host_uart[data] == EV_EVENTS_LOST) lost = to_i32(&host_uart[data + 1]);
+	}
+	CHECK_EQ(events, EVENT_QUEUE_SIZE + 1);
+	CHECK_EQ(lost, 3);
+}
+
+static void test_isqrt(void)
+{
+	for (uint32_t y = 0; y < 300000; y++)
+	{
+		uint32_t r = isqrt(y);
+		if (!((uint64_t)r * r <= y && (uint64_t)(r + 1) * (r + 1) > y))
+		{
+			CHECK_EQ(r, (uint32_t)sqrt(y));
+			return;
+		}
+	}
+
+	const uint32_t large[] = {4294967295u, 4294836225u, 4294836224u, 65536u * 65535u, 1u << 31, 999999999u};
+	for (size_t i = 0; i < sizeof(large) / sizeof(large[0]); i++)
+	{
+		uint64_t r = isqrt(large[i]);
+		CHECK(r * r <= large[i] && (r + 1) * (r + 1) > large[i]);
+	}
+}
+
+static void test_motor_values(void)
+{
+	int worst = 0;
+	srand(1);
+
+	for (int i = 0; i < 100000; i++)
+	{
+		int16_t Z = rand() % 601, M = rand() % 301 - 150, N = rand() % 601 - 300, L = rand() % 301 - 150;
+		int32_t thrust[4] = {
+			(Z + 2 * M) * MIXER_B_UNIT - N * MIXER_D_UNIT,
+			(Z - 2 * L) * MIXER_B_UNIT + N * MIXER_D_UNIT,
+			(Z - 2 * M) * MIXER_B_UNIT - N * MIXER_D_UNIT,
+			(Z + 2 * L) * MIXER_B_UNIT + N * MIXER_D_UNIT,
+		};
+
+		calculateMotorValues(Z, M, N, L);
+
+		for (int m = 0; m < 4; m++)
+		{
+			// Past the end of the table is panic territory (motor > 2000)
+			if (thrust[m] >= (MIXER_LUT_ENTRIES - 1) << MIXER_LUT_SHIFT) continue;
+
+			// The float formula it replaced: sqrt((Z +- 2M) * B - N * D) / 4)
+			int32_t exact = thrust[m] > 0 ? (int32_t)isqrt((uint32_t)thrust[m] * (MIXER_LUT_B_CONSTANT / MIXER_B_UNIT) / 4) : 0;
+			if (exact < 220) exact = 220;
+
+			int error = exact - ae[m];
+			if (error < 0 || error > 1)
+			{
+				CHECK_EQ(ae[m], exact);
+				return;
+			}
+			if (error > worst) worst = error;
+		}
+	}
+	printf("#   largest motor error %d count\n", worst);
+}
+
+static void test_pid(void)
+{
+	PidState_t s;
+
+	// P only: gain 3/2
+	initPidState(&s, -1000, 1000, 0);
+	pidSetGains(&s, 3, 0, 0, 2);
+	CHECK_EQ(pid(&s, 100, 0), 150);
+	CHECK_EQ(pid(&s, 0, 100), -150);
+	CHECK_EQ(pid(&s, 10000, 0), 1000);
+	CHECK_EQ(pid(&s, -10000, 0), -1000);
+
+	// I: a constant error ramps the output up to the limit, then stops
+	initPidState(&s, -500, 500, 0);
+	pidSetGains(&s, 0, 1, 0, 10);
+	int16_t out = 0;
+	for (int i = 0; i < 10; i++) out = pid(&s, 100, 0);
+	CHECK(abs(out - 100) <= 1);	// Fixed point integral
+	for (int i = 0; i < 1000; i++) out = pid(&s, 100, 0);
+	CHECK_EQ(out, 500);
+	// No windup: the output leaves the limit at once when the error turns
+	out = pid(&s, -100, 0);
+	CHECK(out < 500);
+
+	// D on the measurement: no kick when only the setpoint jumps
+	initPidState(&s, -1000, 1000, 0);
+	pidSetGains(&s, 0, 0, 4, 1);
+	pid(&s, 0, 0);
+	CHECK_EQ(pid(&s, 500, 0), 0);
+	CHECK_EQ(pid(&s, 500, 10), -40);
+
+	// Gains just below 1 in Q15 and the largest errors: the integral winds
+	// up to its limit while the measurement jumps up, then the measurement
+	// jumps back. Every term is near 2^30, the sum must not wrap.
+	for (int sign = 1; sign >= -1; sign -= 2)
+	{
+		initPidState(&s, INT16_MIN, INT16_MAX, 0);
+		pidSetGains(&s, INT16_MAX, INT16_MAX, INT16_MAX, 1 << 15);
+		CHECK_EQ(s.shift, 15);
+		pid(&s, sign * 100000, 0);
+		pid(&s, sign * 100000, sign * INT16_MAX);
+		CHECK_EQ(pid(&s, sign * 100000, 0), sign > 0 ? INT16_MAX : INT16_MIN);
+	}
+
+	// Smaller gains with the integral at its limit: rescaled, it stays within the new limit
+	initPidState(&s, -1000, 1000, 0);
+	pidSetGains(&s, 0, 1000, 0, 1);
+	for (int i = 0; i < 10; i++) pid(&s, 1000, 0);
+	pidSetGains(&s, 0, 1, 0, 1000);
+	CHECK(s.integral > 0);
+	CHECK(s.integral <= 1000L << s.shift);
+	CHECK_EQ(pid(&s, 0, 0), 1000);
+}
+
+static void test_vertical(void)
+{
+	VerticalState_t s;
+	initVerticalState(&s);
+
+	// At rest: stays at the reference
+	for (int i = 0; i < 500; i++) vertical(&s, 101325, 16384);
+	CHECK_EQ(verticalPressure(&s), 101325);
+	CHECK(abs(verticalSpeed(&s)) < 256);
+
+	// 10 Pa lower (about 80 cm higher): follows within a few tau
+	for (int i = 0; i < 1000; i++) vertical(&s, 101315, 16384);
+	CHECK(abs(verticalPressure(&s) - 101315) <= 1);
+	CHECK(abs(verticalSpeed(&s)) < 256);
+
+	// An accelerometer offset is learned, not integrated into height
+	for (int i = 0; i < 3000; i++) vertical(&s, 101315, 16384 + 50);
+	CHECK(abs(verticalPressure(&s) - 101315) <= 1);
+}
+
+static void test_mahony(void)
+{
+	MahonyState_t s;
+	int16_t phi_, theta_, psi_;
+
+	// Level and still
+	initMahonyState(&s);
+	for (int i = 0; i < 500; i++) mahony(&phi_, &theta_, &psi_, &s, 0, 0, 0, 0, 0, 16384, SENSOR_DT_NOMINAL_US);
+	CHECK(abs(phi_) < 50);
+	CHECK(abs(theta_) < 50);
+	CHECK(abs(psi_) < 50);
+
+	// Rolled 30 degrees: gravity in y and z, phi settles at 30 degrees
+	initMahonyState(&s);
+	for (int i = 0; i < 3000; i++) mahony(&phi_, &theta_, &psi_, &s, 0, 0, 0, 0, 8192, 14189, SENSOR_DT_NOMINAL_US);
+	CHECK(abs(phi_ - 32768 / 6) < 200);
+	CHECK(abs(theta_) < 200);
+
+	// Mirrored, the same angle the other way
+	int16_t phiPlus = phi_;
+	initMahonyState(&s);
+	for (int i = 0; i < 3000; i++) mahony(&phi_, &theta_, &psi_, &s, 0, 0, 0, 0, -8192, 14189, SENSOR_DT_NOMINAL_US);
+	CHECK(abs(phi_ + phiPlus) < 10);
+
+	// Yawing 10 deg/s for 1 s, in 100 samples or in 50 that came twice as far apart
+	int16_t psi100;
+	initMahonyState(&s);
+	for (int i = 0; i < 100; i++) mahony(&phi_, &theta_, &psi_, &s, 0, 0, 164, 0, 0, 16384, SENSOR_DT_NOMINAL_US);
+	psi100 = psi_;
+	CHECK(abs(psi100 - 32768 / 18) < 20);
+	initMahonyState(&s);
+	for (int i = 0; i < 50; i++) mahony(&phi_, &theta_, &psi_, &s, 0, 0, 164, 0, 0, 16384, 2 * SENSOR_DT_NOMINAL_US);
+	CHECK(abs(psi_ - psi100) < 5);
+}
+
+/**
+ * @brief Q30 quaternion of Euler angles in degrees, rotated like the DMP (yaw, pitch, roll)
+ */
+static void quatFromEuler(int32_t *q, double phiDeg, double thetaDeg, double psiDeg)
+{
+	double r = phiDeg * M_PI / 360, p = thetaDeg * M_PI / 360, y = psiDeg * M_PI / 360;
+	double v[4] = {
+		cos(r) * cos(p) * cos(y) + sin(r) * sin(p) * sin(y),
+		sin(r) * cos(p) * cos(y) - cos(r) * sin(p) * sin(y),
+		cos(r) * sin(p) * cos(y) + sin(r) * cos(p) * sin(y),
+		cos(r) * cos(p) * sin(y) - sin(r) * sin(p) * cos(y),
+	};
+
+	for (int i = 0; i < 4; i++) q[i] = (int32_t)lround(v[i] * (1 << 30));
+}
+
+static void test_attitude(void)
+{
+	int32_t q[4], setpoint[4], expected[4];
+	int16_t roll, pitch;
+
+	// The setpoint quaternion matches the double precision one
+	attitudeSetpoint(setpoint, 5461, -2731);
+	quatFromEuler(expected, 5461 * 180.0 / 32768, -2731 * 180.0 / 32768, 0);
+	for (int i = 0; i < 4; i++) CHECK(abs(setpoint[i] - expected[i]) < 200);
+
+	attitudeSetpoint(setpoint, 16384, -16384);
+	quatFromEuler(expected, 90, -90, 0);
+	for (int i = 0; i < 4; i++) CHECK(abs(setpoint[i] - expected[i]) < 200);
+
+	// Level
+	attitudeSetpoint(setpoint, 0, 0);
+	quatFromEuler(q, 0, 0, 0);
+	attitudeError(&roll, &pitch, q, setpoint);
+	CHECK_EQ(roll, 0);
+	CHECK_EQ(pitch, 0);
+
+	// Rolled 10 degrees: error -sin(10 deg), whatever the yaw
+	const int16_t tenDegrees = (int16_t)lround(-sin(10 * M_PI / 180) * 10430);
+	quatFromEuler(q, 10, 0, 0);
+	attitudeError(&roll, &pitch, q, setpoint);
+	CHECK(abs(roll - tenDegrees) <= 2);
+	CHECK(abs(pitch) <= 2);
+
+	quatFromEuler(q, 10, 0, 135);
+	attitudeError(&roll, &pitch, q, setpoint);
+	CHECK(abs(roll - tenDegrees) <= 2);
+	CHECK(abs(pitch) <= 2);
+
+	// Pitched 90 degrees (the Euler singularity), setpoint 80: still a plain pitch error
+	attitudeSetpoint(setpoint, 0, 32768 * 80 / 180);
+	quatFromEuler(q, 0, 90, 20);
+	attitudeError(&roll, &pitch, q, setpoint);
+	CHECK(abs(pitch - tenDegrees) <= 2);
+	CHECK(abs(roll) <= 2);
+}
+
+/**
+ * @brief Euler angles of a Q30 quaternion, 32768 = pi, with the formulas of
+ * update_euler_from_quaternions() (the DMP angles)
+ */
+static void eulerFromQuat(const int32_t *q, double *phi_, double *theta_, double *psi_)
+{
+	double w = q[0] / (double)(1 << 30), x = q[1] / (double)(1 << 30);
+	double y = q[2] / (double)(1 << 30), z = q[3] / (double)(1 << 30);
+
+	*phi_ = atan2(2 * (w * x + y * z), 1 - 2 * (x * x + y * y)) * 32768 / M_PI;
+	*theta_ = asin(2 * (w * y - z * x)) * 32768 / M_PI;
+	*psi_ = atan2(2 * (w * z + x * y), 1 - 2 * (y * y + z * z)) * 32768 / M_PI;
+}
+
+/**
+ * @brief Angle difference wrapped to +-pi, 32768 = pi
+ */
+static double angleError(double a, double b)
+{
+	double e = fmod(a - b + 3 * 32768.0, 2 * 32768.0) - 32768.0;
+	return fabs(e);
+}
+
+static void test_mahony_dmp(void)
+{
+	MahonyState_t s;
+	int32_t dmp[2][4];
+	int16_t phi_, theta_, psi_;
+	double maxTilt = 0, maxYaw = 0;
+	uint32_t r = 1;
+
+	// A DMP quaternion trace at the raw sample rate: rolling and pitching
+	// up to 25 degrees while turning at 20 deg/s. The gyro and the
+	// accelerometer are what the sensor measures along it, with noise and
+	// a residual gyro offset the trim left.
+	initMahonyState(&s);
+	quatFromEuler(dmp[0], 0, 0, 0);
+	for (int i = 1; i <= 3000; i++)
+	{
+		double t = i * (SENSOR_DT_NOMINAL_US * 1e-6);
+		int32_t *q0 = dmp[(i - 1) & 1], *q1 = dmp[i & 1];
+		quatFromEuler(q1, 25 * sin(2 * M_PI * 0.4 * t), 20 * sin(2 * M_PI * 0.25 * t + 1) - 20 * sin(1), 20 * t);
+
+		// Body rate: conj(q0) * q1 = (1, w dt / 2)
+		double a[4], b[4];
+		for (int k = 0; k < 4; k++)
+		{
+			a[k] = q0[k] / (double)(1 << 30);
+			b[k] = q1[k] / (double)(1 << 30);
+		}
+		double half = 16.4 * 180 / M_PI * 2 / (SENSOR_DT_NOMINAL_US * 1e-6);
+		double wx = (a[0] * b[1] - a[1] * b[0] - a[2] * b[3] + a[3] * b[2]) * half;
+		double wy = (a[0] * b[2] + a[1] * b[3] - a[2] * b[0] - a[3] * b[1]) * half;
+		double wz = (a[0] * b[3] - a[1] * b[2] + a[2] * b[1] - a[3] * b[0]) * half;
+
+		// Gravity in the body frame, 16384 LSB/g
+		double ax = 2 * (b[1] * b[3] - b[0] * b[2]) * 16384;
+		double ay = 2 * (b[0] * b[1] + b[2] * b[3]) * 16384;
+		double az = (b[0] * b[0] - b[1] * b[1] - b[2] * b[2] + b[3] * b[3]) * 16384;
+
+		r = r * 1103515245 + 12345;
+		int16_t noise[6];
+		for (int k = 0; k < 6; k++) noise[k] = (int16_t)(((r >> (k * 5)) & 0x1f) - 16);
+
+		mahony(&phi_, &theta_, &psi_, &s,
+		       (int16_t)lround(wx) + 5 + noise[0] / 8, (int16_t)lround(wy) - 3 + noise[1] / 8, (int16_t)lround(wz) + noise[2] / 8,
+		       (int16_t)lround(ax) + noise[3] * 8, (int16_t)lround(ay) + noise[4] * 8, (int16_t)lround(az) + noise[5] * 8,
+		       SENSOR_DT_NOMINAL_US);
+
+		// Compared once the start-up gain has settled the offset
+		if (i < 200) continue;
+		double phiDmp, thetaDmp, psiDmp;
+		eulerFromQuat(q1, &phiDmp, &thetaDmp, &psiDmp);
+		double e = fmax(angleError(phi_, phiDmp), angleError(theta_, thetaDmp));
+		if (e > maxTilt) maxTilt = e;
+		e = angleError(psi_, psiDmp);
+		if (e > maxYaw) maxYaw = e;
+	}
+
+	printf("#   mahony vs DMP: roll/pitch within %.2f deg, yaw within %.2f deg\n",
+	       maxTilt * 180 / 32768, maxYaw * 180 / 32768);
+	CHECK(maxTilt < 32768 / 180);        // 1 degree
+	CHECK(maxYaw < 32768 * 3 / 180);     // 3 degrees
+}
+
+static void test_welford(void)
+{
+	welfordState w;
+	welfordInit(&w);
+
+	const int16_t x[] = {100, 102, 98, 101, 99, 100, 103, 97};
+	for (size_t i = 0; i < sizeof(x) / sizeof(x[0]); i++) welfordAdd(&w, x[i]);
+
+	CHECK_EQ(welfordMean(&w), 100);
+	CHECK(welfordMeanWithin(&w, 2));
+	CHECK(welfordVariance(&w) > 0);
+}
+
+static void test_trace(void)
+{
+	host_reset();
+
+	// Records of three levels, written out of order in time per level
+	host_time_us = 100; trace(TR_BOOT, 0, 0);
+	host_priority = APP_IRQ_PRIORITY_LOW;
+	host_time_us = 150; trace(TR_UART_ERROR, 0, 4);
+	host_priority = APP_IRQ_PRIORITY_HIGH;
+	host_time_us = 120; trace(TR_TWI_ERROR, 0x68, 1);
+	host_priority = NRF_APP_PRIORITY_THREAD;
+	host_time_us = 200; trace(TR_MODE, SafeMode, ManualMode);
+
+	host_uart_clear();
+	host_time_us = 300;
+	trace_dump();
+
+	// The records of all levels by time, earlier tests left some too
+	uint8_t ids[3 * TRACE_LEN + 1];
+	int n = 0;
+	uint32_t last = 0;
+	for (int data = findMessage(TRACE, 0); data >= 0; data = findMessage(TRACE, data))
+	{
+		CHECK(host_uart[data] >= 1 && host_uart[data] <= TRACE_BLOCK_RECORDS);
+		for (int i = 0; i < host_uart[data] && n < (int)sizeof(ids); i++)
+		{
+			uint8_t *record = &host_uart[data + 1 + i * TRACE_RECORD_SIZE];
+			CHECK(to_ui32(record) >= last);
+			last = to_ui32(record);
+			ids[n++] = record[4];
+		}
+	}
+
+	const uint8_t expected[] = {TR_BOOT, TR_TWI_ERROR, TR_UART_ERROR, TR_MODE, TR_DUMP};
+	CHECK(n >= 5);
+	if (n < 5) return;
+	for (int i = 0; i < 5; i++) CHECK_EQ(ids[n - 5 + i], expected[i]);
+}
+
+/**
+ * @brief Sends stdout to /dev/null (the sensor driver reports every init
+ * step with printf) or back, keeping the TAP output readable
+ */
+static void quiet(bool on)
+{
+	static int saved = -1;
+
+	fflush(stdout);
+	if (on && saved < 0)
+	{
+		saved = dup(STDOUT_FILENO);
+		int null = open("/dev/null", O_WRONLY);
+		dup2(null, STDOUT_FILENO);
+		close(null);
+	}
+	else if (!on && saved >= 0)
+	{
+		dup2(saved, STDOUT_FILENO);
+		close(saved);
+		saved = -1;
+	}
+}
+
+// Registers a mode switch must leave like a full imu_init()
+static const uint8_t imuModeRegs[] = {0x19, 0x1A, 0x23, 0x38, 0x6A, 0x6B, 0x6C};
+
+static void imu_mode_regs(uint8_t *regs)
+{
+	for (size_t i = 0; i < sizeof(imuModeRegs); i++) regs[i] = host_mpu_regs[imuModeRegs[i]];
+}
+
+static void test_imu_mode(void)
+{
+	uint8_t rawRegs[sizeof(imuModeRegs)], dmpRegs[sizeof(imuModeRegs)], regs[sizeof(imuModeRegs)];
+	uint32_t rawInit, dmpInit, start;
+
+	host_reset();
+	quiet(true);
+
+	// Full inits, as the mode changes did before imu_set_mode()
+	start = i2c_transactions;
+	imu_init(SENSOR_RAW, 100);
+	rawInit = i2c_transactions - start;
+	imu_mode_regs(rawRegs);
+
+	start = i2c_transactions;
+	imu_init(SENSOR_DMP, 100);
+	dmpInit = i2c_transactions - start;
+	imu_mode_regs(dmpRegs);
+
+	// DMP to raw: the firmware stays, a dozen register writes
+	start = i2c_transactions;
+	imu_set_mode(SENSOR_RAW, 100);
+	quiet(false);
+	CHECK_EQ(i2c_transactions - start, 12);
+	CHECK_EQ(imu_switch_stats.transactions, 12);
+	CHECK(!imu_switch_stats.reloaded);
+	CHECK_EQ(sensor_mode, SENSOR_RAW);
+	imu_mode_regs(regs);
+	CHECK(!memcmp(regs, rawRegs, sizeof(regs)));
+
+	// And back
+	start = i2c_transactions;
+	imu_set_mode(SENSOR_DMP, 100);
+	CHECK_EQ(i2c_transactions - start, 13);
+	CHECK_EQ(imu_switch_stats.transactions, 13);
+	CHECK(!imu_switch_stats.reloaded);
+	CHECK_EQ(sensor_mode, SENSOR_DMP);
+	imu_mode_regs(regs);
+	CHECK(!memcmp(regs, dmpRegs, sizeof(regs)));
+	printf("#   imu_init: raw %u, DMP %u transactions; imu_set_mode: %u\n",
+	       (unsigned)rawInit, (unsigned)dmpInit, (unsigned)imu_switch_stats.transactions);
+	CHECK(dmpInit > 50 * 13);
+
+	// Without the firmware loaded the full init is still done
+	quiet(true);
+	imu_init(SENSOR_RAW, 100);
+	start = i2c_transactions;
+	imu_set_mode(SENSOR_DMP, 100);
+	quiet(false);
+	CHECK(imu_switch_stats.reloaded);
+	CHECK_EQ(i2c_transactions - start, dmpInit);
+}
+
+static void test_allocations(void)
+{
+	// Everything above ran without a single heap allocation
+	CHECK_EQ(host_allocations, 0);
+}
+
+typedef struct
+{
+	const char *name;
+	void (*run)(void);
+} testCase;
+
+static const testCase tests[] = {
+	{"serialization", test_serialization},
+	{"queue", test_queue},
+	{"unpack_cmd", test_unpack_cmd},
+	{"log_catalog", test_log_catalog},
+	{"log_wrap", test_log_wrap},
+	{"unpack_errors", test_unpack_errors},
+	{"unpack_mode", test_unpack_mode},
+	{"pack_message", test_pack_message},
+	{"events", test_events},
+	{"isqrt", test_isqrt},
+	{"motor_values", test_motor_values},
+	{"pid", test_pid},
+	{"vertical", test_vertical},
+	{"mahony", test_mahony},
+	{"attitude", test_attitude},
+	{"mahony_dmp", test_mahony_dmp},
+	{"welford", test_welford},
+	{"trace", test_trace},
+	{"imu_mode", test_imu_mode},
+	{"allocations", test_allocations},
+};
+
+int main(void)
+{
+	const int count = sizeof(tests) / sizeof(tests[0]);
+	int failed = 0;
+
+	printf("1..%d\n", count);
+	for (int i = 0; i < count; i++)
+	{
+		checkFailures = 0;
+		tests[i].run();
+		printf("%s %d - %s\n", checkFailures ? "not ok" : "ok", i + 1, tests[i].name);
+		if (checkFailures) failed++;
+	}
+
+	return failed;
+}
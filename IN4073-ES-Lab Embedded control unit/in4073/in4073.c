@@ -28,11 +28,32 @@
 #include "utils/quad_ble.h"
 #include "utils/tools.h"
 #include "comm.h"   
+#include "utils/settings.h"
+#include "utils/stack.h"
+#include "utils/trace.h"
+#include "utils/log_catalog.h"
+
+#include <string.h>
 
 #define RequiredBatterySamples 20
 
+// Calibration: at least CALIBRATION_MIN_SAMPLES, done when the means are known to
+// +-CALIBRATION_*_ACCURACY LSB, motion check after CALIBRATION_SETTLE_SAMPLES
+#define CALIBRATION_MIN_SAMPLES 32
+#define CALIBRATION_SETTLE_SAMPLES 8
+#define CALIBRATION_GYRO_ACCURACY 1		// ~0.06 deg/s
+#define CALIBRATION_ANGLE_ACCURACY 18	// ~0.1 deg
+#define CALIBRATION_GYRO_MOTION 80		// 16.4 LSB/deg/s: ~5 deg/s
+#define CALIBRATION_ANGLE_MOTION 364	// 182 LSB/deg: 2 deg
+
 profilingData profileData;
 
+// Timing of the control cycles of the last 50 ms, one log row: cycles in
+// the row, cycles that didn't fit, then per cycle the sample period and
+// the sensor to motor latency (us, 2 bytes each)
+#define TIMING_CYCLES_PER_ROW ((TELEM_SIZE - 2) / 4)
+static uint8_t timingRow[TELEM_SIZE];
+
 // Current system state. Do not write to this directly, use bool setSystemState(enum SystemState_t newState)
 enum SystemState_t systemState;
 // Incremented every 50ms
@@ -40,18 +61,13 @@ uint32_t systemCounter = 0;
 
 // Trim values of th accelerometer sensor. To be set in CalibrationMode
 int16_t phi_trim, psi_trim, theta_trim;
-int32_t _phi_trim, _psi_trim, _theta_trim;
 // Trim values of th gyroscope sensor. To be set in CalibrationMode
 int16_t sr_trim, sp_trim, sq_trim;
-int32_t _sr_trim, _sp_trim, _sq_trim;
 
 //For battery average
 uint16_t batteryTotal = 0;
 uint8_t batterySampleCount = 0;
 
-//For pressure average:
-int32_t pressureCache[10];
-
 // Change to true, when we want to finish our fly and send the log
 bool flyEnded = false;
 bool useDmp = true;
@@ -63,16 +79,28 @@ bool useDmp = true;
  * @param newState - The new system state
  */
 void specificActionsNewState(enum SystemState_t newState) {
+	//Leaving safe mode arms the drone, the log starts a flight (still in safe mode):
+	if (systemState == SafeMode && newState != SafeMode) {
+		startLog();
+	}
+
 	//Checking newState on switch:
 	switch(newState) {
+		case PanicMode:
+			//Keep what led to the panic in the flight log. It survives a reboot: the catalog keeps the flight,
+			//only the sectors ahead of the last row are erased, until the log wraps around onto it:
+			trace(TR_PANIC, systemState, 0);
+			trace_save();
+			break;
+		case CalibrationMode:
+			//Start a new calibration, also when the previous one was interrupted:
+			cData.calibrationCycle = 0;
+			break;
 		case HeightControl:	
 			//Setting goal pressure and saving current throttle:
-			pressure_pre = pressure;
-			//pressure_pre = calculateAverage(pressureCache, 10);
+			pressure_pre = verticalPressure(&vS_height);
 			throttle_pre = (int16_t)joystickThrottle;
-			char msg[100];
-			snprintf(msg, 100, "Height control, pressure_pre: %ld, throttle_pre: %d", pressure_pre, throttle_pre);
-			packMessage(DEBUG, NULL, msg);
+			SEND_EVENT(EV_HEIGHT_START, pressure_pre, throttle_pre);
 			// switch (light)
 			// {
 			// case 0:
@@ -99,15 +127,18 @@ void specificActionsNewState(enum SystemState_t newState) {
 	//Turning on DMP based on mode:
 	if(newState == RawMode && useDmp) {
 		useDmp = false;
-		packMessage(DEBUG, NULL, "Turning dmp off.");
 
-		imu_init(false, 100);
+		imu_set_mode(SENSOR_RAW, 100);
+		resetRawEstimator();
+
+		SEND_EVENT(EV_DMP_OFF, imu_switch_stats.us, imu_switch_stats.transactions);
 	} 
 	else if(newState != CalibrationMode && newState != RawMode && !useDmp) {
 		useDmp = true;
-		packMessage(DEBUG, NULL, "Turning dmp on.");
 
-		imu_init(true, 100);
+		imu_set_mode(SENSOR_DMP, 100);
+
+		SEND_EVENT(EV_DMP_ON, imu_switch_stats.us, imu_switch_stats.transactions);
 	}
 }
 
@@ -127,23 +158,35 @@ bool setSystemState(enum SystemState_t newState) {
 
 	//Switching from panic can only happen to safe mode:
 	if(systemState == PanicMode && newState != SafeMode) {
-		char msg[100];
-		snprintf(msg, sizeof(msg), "Can't change the mode to %d, panic mode only allows transition to safe mode.", newState);
-		packMessage(DEBUG, NULL, msg);				// Log failed change
+		SEND_EVENT(EV_MODE_PANIC_ONLY_SAFE, newState);
 		
 		// Log failed change
 		mcData[2] = 0;
 		saveLog(ModeChg, mcData);
+		trace(TR_MODE_REFUSED, systemState, newState);
 
 		return false;
 	}
 
 	//Only allow switching to height control from full control:
 	if(newState == HeightControl && systemState != FullControllMode) {
-		packMessage(DEBUG, NULL, "Can't switch to Height control mode when not in Full control mode.");
+		SEND_EVENT(EV_MODE_HEIGHT_ONLY_FROM_FULL, systemState);
+		// Log failed change
+		mcData[2] = 0;
+		saveLog(ModeChg, mcData);
+		trace(TR_MODE_REFUSED, systemState, newState);
+
+		return false;
+	}
+
+	//The controlled modes need trims that still match the sensors:
+	if((newState == YawControlledMode || newState == FullControllMode || newState == RawMode || newState == HeightControl || newState == WirelessControl)
+		&& settings_calibration_needed()) {
+		SEND_EVENT(EV_MODE_NEEDS_CALIBRATION, newState);
 		// Log failed change
 		mcData[2] = 0;
 		saveLog(ModeChg, mcData);
+		trace(TR_MODE_REFUSED, systemState, newState);
 
 		return false;
 	}
@@ -156,26 +199,21 @@ bool setSystemState(enum SystemState_t newState) {
 			if ((newState != SafeMode) && ((joystickRoll != 127) || (joystickPitch != 127) || (joystickYaw != 127) || (joystickThrottle != 0)))
 			{
 				//Printing reason to console:
-				char msg[100];
-				snprintf(msg, sizeof(msg), "Can't change the mode, joystick not neutral, roll: %d, pitch: %d, yaw: %d, throttle: %d", joystickRoll, joystickPitch, joystickYaw, joystickThrottle);
-				packMessage(DEBUG, NULL, msg);
+				SEND_EVENT(EV_MODE_JOYSTICK, joystickRoll, joystickPitch, joystickYaw, joystickThrottle);
 				
 				// Log failed change
 				mcData[2] = 0;
 				saveLog(ModeChg, mcData);
+				trace(TR_MODE_REFUSED, systemState, newState);
 				return false;
 			}
 
 			break;
 		case CalibrationMode:
-		{
 			//Showing calibration values in console:
-			char msg[100];
-			snprintf(msg, sizeof(msg), "Calibration done. Using sr_trim=%d sp_trim=%d sq_trim=%d, phi_trim=%d psi_trim=%d theta_trim=%d", sr_trim, sp_trim, sq_trim, phi_trim, psi_trim, theta_trim);
-			packMessage(DEBUG, NULL, msg);
-
+			SEND_EVENT(EV_CALIBRATION_RATE_TRIM, sr_trim, sp_trim, sq_trim);
+			SEND_EVENT(EV_CALIBRATION_ANGLE_TRIM, phi_trim, psi_trim, theta_trim);
 			break;
-		}
 	default:
 		break;
 	}
@@ -186,22 +224,23 @@ bool setSystemState(enum SystemState_t newState) {
 		&& !(systemState == FullControllMode && newState == HeightControl) //Allowing mode switch from FULL -> Height
 		&& !(systemState == HeightControl && newState == FullControllMode) //Allowing mode switch from Height -> FULL
 	) {
-		packMessage(DEBUG, NULL, "Can't change the mode, motor not off");
+		SEND_EVENT(EV_MODE_MOTORS_ON, motor[0], motor[1], motor[2], motor[3]);
 		// Log failed change
 		mcData[2] = 0;
 		saveLog(ModeChg, mcData);
+		trace(TR_MODE_REFUSED, systemState, newState);
 		return false;
 	}
 	
+	trace(TR_MODE, systemState, newState);
+
 	//Process any action that need to happen before transitioning to the new state:
 	specificActionsNewState(newState);
 
 	systemState = newState;
 
 	//Showing mode change successfull in console:
-	char msg[100];
-	snprintf(msg, sizeof(msg), "Mode successfully changed to: %d", newState);
-	packMessage(DEBUG, NULL, msg);
+	SEND_EVENT(EV_MODE_CHANGED, newState);
 
 	// Log successful change
 	mcData[2] = 1;
@@ -211,9 +250,8 @@ bool setSystemState(enum SystemState_t newState) {
 }
 
 /**
- * @brief Function to set flyEnded variable true. It exits from the main
- * loop and stops the drone program. We will get back to bootloader after
- * sending the logged data.
+ * @brief Function to set flyEnded variable true. The main loop sends the
+ * logged data and goes on in safe mode, ready for the next flight.
  * @author Kristóf
  */
 void finishFlying()
@@ -243,9 +281,7 @@ void checkBatteryStatus(uint16_t battery_voltage) {
 
 		//Battery empty warning: https://blog.ampow.com/lipo-voltage-chart/, only used if battery not usb and battery voltage in warning range
 		if(averageBatteryVoltage > 650 && averageBatteryVoltage <= 1120) { // 12.622V is read as 12.320 -> offset in adc.c
-			char msg[100];
-			snprintf(msg, 100, "Battery voltage low: %d volt", averageBatteryVoltage);
-			packMessage(DEBUG, NULL, msg);
+			SEND_EVENT(EV_BATTERY_LOW, averageBatteryVoltage);
 		}
 
 		switch(systemState) {
@@ -258,9 +294,8 @@ void checkBatteryStatus(uint16_t battery_voltage) {
 			case WirelessControl:
 				// If battery not usb and battery voltage is starting to damage the battery. Never below 10.5 volts
 				if(averageBatteryVoltage > 650 && averageBatteryVoltage <= 1050) {
-					char msg[100];
-					snprintf(msg, 100, "Battery empty, putting drone in panic mode (%d volt)", averageBatteryVoltage);
-					packMessage(DEBUG, NULL, msg);
+					SEND_EVENT(EV_BATTERY_EMPTY, averageBatteryVoltage);
+					trace(TR_BATTERY_EMPTY, systemState, averageBatteryVoltage);
 
 					if(setSystemState(PanicMode))
 					{
@@ -284,6 +319,7 @@ void checkBatteryStatus(uint16_t battery_voltage) {
 void connectionLostCheck() {
 	if(!checkConnection() && systemState != PanicMode && systemState != SafeMode) {
 		packMessage(DEBUG, NULL, "Connection lost, putting drone in panic mode!");
+		trace(TR_CONNECTION_LOST, systemState, 0);
 		if(setSystemState(PanicMode))
 		{
 			// Send ACK
@@ -294,13 +330,13 @@ void connectionLostCheck() {
 }
 
 /**
- * @brief Save the current average profiling values per type to the log file.
- * TODO: Making it work.
+ * @brief Save the current average profiling values per type to the log
+ * file, and restart the averages.
  * @author Wesley de Hek
  */
 void saveProfilingResults(profilingTelemetry *telem) {
 	uint32_t averageResponseTime = 0;
-	uint8_t profileDataToLog[TELEM_SIZE];
+	uint8_t profileDataToLog[TELEM_SIZE] = {0};
 
 	//Grabbing control loop time:
 	averageResponseTime = getAverageProfilingTime(p_ControlLoop, &profileData);
@@ -334,63 +370,145 @@ void saveProfilingResults(profilingTelemetry *telem) {
 	averageResponseTime = getAverageProfilingTime(p_Sqrt, &profileData);
 	telem->sqrtTime = averageResponseTime;
 
+	//Grabbing attitude estimation time:
+	averageResponseTime = getAverageProfilingTime(p_Attitude, &profileData);
+	telem->attitudeTime = averageResponseTime;
+
 	//Serializing data:
 	serializeProfiling(telem, profileDataToLog);
 
 	//Logging progiling data:
 	saveLog(l_Profiling, profileDataToLog);
+}
 
-	//sendProfilingData(telem);
+/**
+ * @brief Adds one control cycle to the timing log row.
+ * 
+ * @param dt - Measured sample period (us)
+ * @param latency - Sensor interrupt to new motor values (us)
+ */
+static void recordLoopTiming(uint32_t dt, uint32_t latency) {
+	uint8_t n = timingRow[0];
+
+	if (n < TIMING_CYCLES_PER_ROW) {
+		ui16_to_ui8(dt > UINT16_MAX ? UINT16_MAX : dt, &timingRow[2 + 4 * n]);
+		ui16_to_ui8(latency > UINT16_MAX ? UINT16_MAX : latency, &timingRow[4 + 4 * n]);
+		timingRow[0]++;
+	} else if (timingRow[1] < UINT8_MAX) {
+		timingRow[1]++;
+	}
 }
 
 /**
- * @brief Apply calibration to the different sensors, runs it 100 times and than switches back to safe mode.
- * Calibrates: sr, sp, sq, phi, psi, theta
+ * @brief Logs the control cycles since the last call, only while flying.
+ */
+static void saveLoopTiming(void) {
+	if (timingRow[0] && systemState != SafeMode) {
+		saveLog(l_Timing, timingRow);
+	}
+	memset(timingRow, 0, sizeof(timingRow));
+}
+
+/**
+ * @brief Sends the log of the finished flight. It stays in the log catalog,
+ * the PC can download it again until the log area wraps around onto it.
+ */
+static void sendFlightLog(void) {
+	sendLog();
+
+	packMessage(DEBUG, NULL, "Fly ended. Goodbye! :)");
+
+	// Send ACK of finished flying
+	uint8_t ack = '.';
+	packMessage(ACK, &ack, NULL);
+}
+
+/**
+ * @brief Ends the calibration and goes back to safe mode.
  * 
- * @author Philip Groet
+ * @param success - Calibration succeeded, the new trims are used and saved.
  */
-void processCalibration() {
-	if(cData.calibrationCycle == 0) {
-		char msg[100];
-		snprintf(msg, 100, "Calibration started! (Mode: %s)", useDmp ? "DMP" : "RAW");
-		packMessage(DEBUG, NULL, msg);
+static void finishCalibration(bool success) {
+	if (success) {
+		sp_trim = welfordMean(&cData.axis[0]);
+		sq_trim = welfordMean(&cData.axis[1]);
+		sr_trim = welfordMean(&cData.axis[2]);
+		phi_trim = welfordMean(&cData.axis[3]);
+		theta_trim = welfordMean(&cData.axis[4]);
+		psi_trim = welfordMean(&cData.axis[5]);
+
+		//Trims are valid, store them:
+		settings_calibrated();
 	}
 
-	if(cData.calibrationCycle < CALIBRATION_SAMPLES) {
-		// _sr_trim is 10.000 times magnitude of sr
-		// Have the old values weigh for 9/10 and the new value 1/10
-		_sr_trim = (_sr_trim*9 + sr*10000) / 10;
-		// Restore magnitude from 10.000 to 1
-		sr_trim = _sr_trim / 10000;
+	//Putting drone in safe mode:
+	if(setSystemState(SafeMode))
+	{
+		// Send ACK
+		uint8_t ack = SafeMode;
+		packMessage(ACK, &ack, NULL);
+	}
 
-		_sp_trim = (_sp_trim*9 + sp*10000) / 10;
-		sp_trim = _sp_trim / 10000;
+	cData.calibrationCycle = 0;
+}
 
-		_sq_trim = (_sq_trim*9 + sq*10000) / 10;
-		sq_trim = _sq_trim / 10000;
+/**
+ * @brief Apply calibration to the different sensors: running mean and variance per axis,
+ * stops as soon as the means of the gyro and phi/theta are accurate to CALIBRATION_*_ACCURACY
+ * (95% confidence), rejects the calibration when the drone moves or the trims are not
+ * accurate enough after CALIBRATION_SAMPLES samples. Then switches back to safe mode.
+ * Calibrates: sr, sp, sq, phi, psi, theta
+ * 
+ * @author Philip Groet
+ */
+void processCalibration() {
+	int16_t sample[6] = {sp, sq, sr, phi, theta, psi};
 
+	if(cData.calibrationCycle == 0) {
+		SEND_EVENT(EV_CALIBRATION_STARTED, useDmp);
 
-		_phi_trim = (_phi_trim*9 + phi*10000) / 10;
-		phi_trim = _phi_trim / 10000;
+		for (uint8_t i = 0; i < 6; i++) {
+			welfordInit(&cData.axis[i]);
+		}
+	}
 
-		_psi_trim = (_psi_trim*9 + psi*10000) / 10;
-		psi_trim = _psi_trim / 10000;
+	// Motion check against the mean so far. Not on psi: the DMP yaw drifts
+	// and wraps at +-180 degrees, a still drone would count as moved
+	if (cData.calibrationCycle >= CALIBRATION_SETTLE_SAMPLES) {
+		for (uint8_t i = 0; i < 5; i++) {
+			int32_t limit = i < 3 ? CALIBRATION_GYRO_MOTION : CALIBRATION_ANGLE_MOTION;
+			int32_t deviation = welfordDeviation(&cData.axis[i], sample[i]);
+
+			if (deviation > limit) {
+				SEND_EVENT(EV_CALIBRATION_MOVED, i, deviation);
+				finishCalibration(false);
+				return;
+			}
+		}
+	}
 
-		_theta_trim = (_theta_trim*9 + theta*10000) / 10;
-		theta_trim = _theta_trim / 10000;
+	for (uint8_t i = 0; i < 6; i++) {
+		welfordAdd(&cData.axis[i], sample[i]);
+	}
+	cData.calibrationCycle++;
 
-		cData.calibrationCycle++;
+	// psi is not checked, the DMP yaw keeps drifting slowly
+	bool accurate = cData.calibrationCycle >= CALIBRATION_MIN_SAMPLES;
+	for (uint8_t i = 0; i < 5 && accurate; i++) {
+		accurate = welfordMeanWithin(&cData.axis[i], i < 3 ? CALIBRATION_GYRO_ACCURACY : CALIBRATION_ANGLE_ACCURACY);
 	}
-	else {
-		//Putting drone in safe mode:
-		if(setSystemState(SafeMode))
-		{
-			// Send ACK
-			uint8_t ack = SafeMode;
-			packMessage(ACK, &ack, NULL);
+
+	if (accurate || cData.calibrationCycle >= CALIBRATION_SAMPLES) {
+		// Noise (standard deviation) per axis in 1/100 counts
+		uint16_t sd[6];
+		for (uint8_t i = 0; i < 6; i++) {
+			sd[i] = (isqrt(welfordVariance(&cData.axis[i])) * 100) >> 8;
 		}
 
-		cData.calibrationCycle = 0;
+		SEND_EVENT(accurate ? EV_CALIBRATION_DONE : EV_CALIBRATION_FAILED, cData.calibrationCycle, sd[0], sd[1], sd[2]);
+		SEND_EVENT(EV_CALIBRATION_NOISE, sd[3], sd[4], sd[5]);
+
+		finishCalibration(accurate);
 	}
 }
 
@@ -401,6 +519,9 @@ void processCalibration() {
  */
 int main(void)
 {
+	//Before any interrupt can use the stack:
+	stack_paint();
+
 	uart_init();
 	gpio_init();
 	timers_init();
@@ -409,20 +530,27 @@ int main(void)
 	imu_init(true, 100);
 	baro_init();
 	spi_flash_init();
+	flashAdr = catalog_init();
 	quad_ble_init();
 	comm_init();
 
 	systemState = SafeMode;
+	trace(TR_BOOT, 0, 0);
 
 	//Initialize motor control, sets motors to 0;
 	initializeMotorControl();
 
+	//Load the trims and gains of the last calibration / configuration:
+	settings_init();
+
 	uint32_t panicStart = 0;
 
 	recMachine SSM;
 	SSM.actualState = START;
+	SSM.ble = false;
 	recMachine BSM;
 	BSM.actualState = START;
+	BSM.ble = true;
 
 	telemetry telem;
 	uint8_t telemData[TELEM_SIZE];
@@ -434,7 +562,7 @@ int main(void)
 	//Initializing profiling data:
 	initProfiling(&profileData);
 
-	while (!flyEnded) { //We should be able to break out of this, else the log will never be send.
+	while (true) {
 		maxRead = 0;
 
 		//Reading message queue
@@ -451,6 +579,13 @@ int main(void)
 			maxRead++;
 		}
 
+		//Send the events logged by interrupts:
+		flushEvents();
+
+		//Let the queued flash writes continue after an erase, erase ahead of the log:
+		flash_poll();
+		catalog_poll(flashAdr);
+
 		// Every 50ms
 		if (check_timer_flag()) {
 			startProfiling(p_Timer_Flag);
@@ -463,6 +598,12 @@ int main(void)
 				nrf_gpio_pin_toggle(YELLOW);
 			}
 
+			// The control loop doesn't need the Euler angles, only the telemetry does
+			update_euler();
+
+			// The DMP angles are only converted here, raw mode sends every sample
+			if (systemState != RawMode) sendAttitude();
+
 			// Save current telemetry to log
 			telem.mode = systemState;
 			telem.motor1 = motor[0]; telem.motor2 = motor[1]; telem.motor3 = motor[2]; telem.motor4 = motor[3];
@@ -472,33 +613,33 @@ int main(void)
 			telem.p = Gain_Yaw; telem.p1 = Gain_P1; telem.p2 = Gain_P2; telem.hei = Gain_height;
 			serializeTelemetry(&telem, telemData);
 			saveLog(Telemetry, telemData);
+			saveLoopTiming();
 
 			//Check battery voltage status:
 			checkBatteryStatus(bat_volt);
 
-			//Save progiling data to log:
-			//saveProfilingResults(&profilingTelem);
-
 			// Send telemetry every second
-			if (systemCounter % 20 == 0) sendTelemetry(telemData);
+			if (systemCounter % 20 == 0) {
+				uint16_t stackUsed = stack_high_water();
+				stack_check(stackUsed);
+				sendTelemetry(telemData, stackUsed);
+			}
 
 			// Every 20 50ms periods = Every second
 			if (systemCounter%20 == 0) {
 				//Blinking blue led to show drone is still alive:
 				nrf_gpio_pin_toggle(BLUE);
 
-				// Send telemetry every 1 sec -> for debug
-				//sendTelemetry(telemData);
-
-				//Send profiling data to terminal:
-				//sendProfilingData(&profilingTelem);
+				//Log and send the average times of the last second:
+				saveProfilingResults(&profilingTelem);
+				sendProfilingData(&profilingTelem);
 			}
 
 			adc_request_sample();
 			read_baro();	
 
-			//Saving pressure for height control:
-			pressureCache[systemCounter%10] = pressure;		
+			//Write changed trims / gains to flash, only with the motors off:
+			settings_poll(systemState == SafeMode);
 
 			clear_timer_flag();
 
@@ -508,15 +649,29 @@ int main(void)
 		if (check_sensor_int_flag()) {
 			startProfiling(p_ControlLoop);			
 
+			uint32_t lastSample = sensor_time;
 			get_sensor_data();
 
 			//Run calibration when in calibration mode:
 			if (systemState == CalibrationMode) {
+				update_euler();
 				processCalibration();
 			}
+			//Check the stored trims against the gyro while standing still:
+			else if (systemState == SafeMode) {
+				settings_drift_sample(sp, sq, sr);
+			}
 
 			run_filters_and_control();
 
+			// The estimator of raw mode updated the angles, 100 Hz fits the link
+			if (systemState == RawMode) sendAttitude();
+
+			// The timers take the motor values at their next period (312 us)
+			if (sensor_time != lastSample) {
+				recordLoopTiming(sensor_dt, get_time_us() - sensor_time);
+			}
+
 			stopProfiling(p_ControlLoop, true, &profileData);
 		}
 
@@ -571,18 +726,14 @@ int main(void)
 				}
 				break;
 		}
-	}
-
-	// Send log in the end
-	sendLog();
 
-	packMessage(DEBUG, NULL, "Fly ended. Goodbye! :)");
-
-	// Send ACK of finished flying
-	uint8_t ack = '.';
-	packMessage(ACK, &ack, NULL);
-
-	nrf_delay_ms(100);
+		//Send the log of the finished flight, the next one can start right away:
+		if (flyEnded) {
+			sendFlightLog();
+			flyEnded = false;
+		}
 
-	NVIC_SystemReset();
+		//Answer the log catalog requests of the PC:
+		processFlightRequest();
+	}
 }
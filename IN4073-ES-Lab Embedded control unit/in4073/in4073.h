@@ -30,9 +30,7 @@ extern enum SystemState_t systemState;
 extern uint32_t systemCounter;
 extern profilingData profileData; 
 int16_t phi_trim, psi_trim, theta_trim;
-int32_t _phi_trim, _psi_trim, _theta_trim;
 int16_t sr_trim, sp_trim, sq_trim;
-int32_t _sr_trim, _sp_trim, _sq_trim;
 
 bool setSystemState(enum SystemState_t newState);
 void finishFlying();
@@ -68,6 +66,7 @@ typedef struct {
 	uint32_t heightModeTime;
 	uint32_t loggingTime;
 	uint32_t sqrtTime;
+	uint32_t attitudeTime;	// mahony() of the raw mode
 
 } profilingTelemetry;
 
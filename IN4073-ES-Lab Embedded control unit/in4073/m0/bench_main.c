@@ -0,0 +1,60 @@
+/*------------------------------------------------------------------
+ *  bench_main.c -- Cortex-M0 benchmark image, run by m0sim
+ *
+ *  Runs every case of ../host/bench_cases.c, plus the Euler conversion
+ *  of the DMP quaternions, M0_BENCH_ITERATIONS times. Nothing is timed
+ *  here: m0sim counts the instructions and cycles between
+ *  m0_bench_begin() and m0_bench_end().
+ *------------------------------------------------------------------
+ */
+#include "m0_hal.h"
+#include "bench.h"
+#include "control.h"
+#include "mpu6050/mpu6050.h"
+
+#ifndef M0_BENCH_ITERATIONS
+#define M0_BENCH_ITERATIONS 100
+#endif
+
+void update_euler_from_quaternions(int32_t *quat);
+
+/**
+ * @brief DMP quaternion (Q30) to phi, theta, psi, in doubles and libm
+ */
+static void bench_euler(uint32_t n)
+{
+	int32_t quat[4] = {1 << 30, 0, 0, 0};
+
+	for (uint32_t i = 0; i < n; i++)
+	{
+		// Small rotation that changes every iteration: w ~ 1, x, y, z up to ~0.06
+		quat[1] = (int32_t)(i * 2654435761u) >> 5;
+		quat[2] = (int32_t)(i * 40503u << 16) >> 5;
+		quat[3] = (int32_t)(i * 2246822519u) >> 5;
+		update_euler_from_quaternions(quat);
+	}
+}
+
+static const benchmark extraBenchmarks[] = {
+	{"euler", bench_euler},
+};
+
+static void run(const benchmark *b)
+{
+	m0_reset();
+	m0_bench_begin(b->name);
+	b->run(M0_BENCH_ITERATIONS);
+	m0_bench_end();
+}
+
+int main(void)
+{
+	m0_reset();
+	initializeMotorControl();
+
+	for (size_t b = 0; b < benchmarkCount; b++) run(&benchmarks[b]);
+	for (size_t b = 0; b < sizeof(extraBenchmarks) / sizeof(extraBenchmarks[0]); b++) run(&extraBenchmarks[b]);
+
+	m0_exit(0);
+	return 0;
+}
@@ -0,0 +1,194 @@
+#include "m0_hal.h"
+#include "in4073.h"
+#include "hal/timers.h"
+#include "hal/uart.h"
+#include "hal/spi_flash.h"
+#include "hal/barometer.h"
+#include "utils/quad_ble.h"
+#include "utils/settings.h"
+#include "utils/log_catalog.h"
+#include "comm.h"
+#include "control.h"
+#include "mpu6050/mpu6050.h"
+
+#include <string.h>
+
+// Semihosting (ARM): operation in r0, argument in r1, "bkpt 0xab" hands it to m0sim.
+// 0x100 - 0x1FF are left to the application, m0sim counts between BEGIN and END.
+#define SYS_EXIT 0x18
+#define ADP_STOPPED_APPLICATION_EXIT 0x20026
+#define ADP_STOPPED_RUN_TIME_ERROR 0x20023
+#define M0SIM_BENCH_BEGIN 0x100
+#define M0SIM_BENCH_END 0x101
+
+// Globals of in4073.c and the barometer driver, the IMU ones are in mpu6050.c
+enum SystemState_t systemState = SafeMode;
+uint32_t systemCounter = 0;
+profilingData profileData;
+int32_t pressure;
+int32_t temperature;
+Queue ble_tx_queue;
+Queue tx_queue;		// Always empty, uart_put() doesn't queue
+
+// The bytes sent with uart_put() only land here, no UART in the timings
+static volatile uint8_t uartLast;
+static uint32_t timeUs = 0;
+
+static uint32_t semihosting(uint32_t operation, const void *argument)
+{
+	register uint32_t r0 __asm__("r0") = operation;
+	register const void *r1 __asm__("r1") = argument;
+
+	__asm__ volatile ("bkpt 0xab" : "+r"(r0) : "r"(r1) : "memory");
+	return r0;
+}
+
+/**
+ * @brief Puts the drone state back to its boot values, before every benchmark
+ */
+void m0_reset(void)
+{
+	timeUs = 0;
+	systemState = SafeMode;
+	systemCounter = 0;
+	sensor_quat[0] = 1L << 30;
+	sensor_quat[1] = sensor_quat[2] = sensor_quat[3] = 0;
+	sensor_time = 0;
+	sensor_dt = SENSOR_DT_NOMINAL_US;
+	wireless_mode = false;
+	storedRows = 0;
+	flashAdr = catalog_init();
+	init_queue(&ble_tx_queue);
+	comm_init();
+}
+
+/**
+ * @brief Starts counting the instructions and cycles of a benchmark
+ * @param const char* Name of the benchmark, its row in the results
+ */
+void m0_bench_begin(const char *name)
+{
+	semihosting(M0SIM_BENCH_BEGIN, name);
+}
+
+/**
+ * @brief Stops counting and reports the benchmark started last
+ */
+void m0_bench_end(void)
+{
+	semihosting(M0SIM_BENCH_END, 0);
+}
+
+/**
+ * @brief Stops m0sim
+ * @param int Exit status, 0 is success
+ */
+void m0_exit(int status)
+{
+	semihosting(SYS_EXIT, (const void *)(status ? ADP_STOPPED_RUN_TIME_ERROR : ADP_STOPPED_APPLICATION_EXIT));
+	while (true);
+}
+
+// No clocks to start
+void SystemInit(void)
+{
+}
+
+// Every call is one microsecond later, so the profiling and trace times still move
+uint32_t get_time_us(void)
+{
+	return timeUs++;
+}
+
+void uart_put(uint8_t byte, bool blocking)
+{
+	uartLast = byte;
+}
+
+uint32_t quad_ble_send(void)
+{
+	return 0;
+}
+
+bool setSystemState(enum SystemState_t newState)
+{
+	systemState = newState;
+	return true;
+}
+
+void finishFlying()
+{
+}
+
+void settings_save(void)
+{
+}
+
+// No sensor interrupts: every sample is taken a nominal period after the previous one
+bool sensor_stamp_pop(uint32_t *time)
+{
+	return false;
+}
+
+bool sensor_stamp_pending(void)
+{
+	return false;
+}
+
+void sensor_stamps_clear(void)
+{
+}
+
+// No SPI flash: writes are dropped, reads give erased bytes
+bool flash_chip_erase(void)
+{
+	return true;
+}
+
+bool flash_idle(void)
+{
+	return true;
+}
+
+uint8_t flash_queue_free(void)
+{
+	return 5;
+}
+
+void flash_sync(void)
+{
+}
+
+bool flash_erase_sector(uint32_t address)
+{
+	return true;
+}
+
+bool flash_sector_erased(uint32_t address)
+{
+	return true;
+}
+
+void flash_mark_erased(uint32_t address)
+{
+}
+
+void flash_discard(uint32_t address, uint32_t count)
+{
+}
+
+bool flash_write_byte(uint32_t address, uint8_t data)
+{
+	return true;
+}
+
+bool flash_write_bytes(uint32_t address, uint8_t *data, uint32_t count)
+{
+	return true;
+}
+
+bool flash_read_bytes(uint32_t address, uint8_t *buffer, uint32_t count)
+{
+	memset(buffer, 0xFF, count);
+	return true;
+}
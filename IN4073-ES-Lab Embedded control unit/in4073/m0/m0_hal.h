@@ -0,0 +1,14 @@
+#ifndef M0_HAL_H__
+#define M0_HAL_H__
+
+// Stand-ins for the drone hardware and the globals of in4073.c in the
+// Cortex-M0 benchmark image, and the semihosting calls to m0sim.
+
+#include <inttypes.h>
+
+void m0_reset(void);
+void m0_bench_begin(const char *name);
+void m0_bench_end(void);
+void m0_exit(int status);
+
+#endif /* M0_HAL_H__ */
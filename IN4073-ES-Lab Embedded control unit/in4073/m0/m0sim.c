@@ -0,0 +1,840 @@
+/*------------------------------------------------------------------
+ *  m0sim.c -- Cortex-M0 instruction set simulator for the benchmark image
+ *
+ *  Runs m0_bench.out on the PC and counts its instructions and cycles,
+ *  with the Cortex-M0 timings of the nRF51 (ARM DDI0432C table 3-1:
+ *  zero wait state flash, single cycle multiplier). Only the ARMv6-M
+ *  Thumb instructions, the flash and RAM of the nRF51822 and the
+ *  semihosting calls of m0_hal.c are modelled: the peripherals read 0
+ *  and ignore writes, there are no interrupts. Anything else (undefined
+ *  instruction, bus or alignment fault, "b .") stops with exit code 1.
+ *
+ *  Prints one CSV line per benchmark: instructions and cycles per
+ *  operation, and the cycles spent in the soft-float, division and
+ *  libm helpers. --functions writes the cycles of every function.
+ *  Run with "make m0-bench".
+ *------------------------------------------------------------------
+ */
+#include <elf.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FLASH_SIZE 0x40000		// 256 KB at 0
+#define RAM_START 0x20000000
+#define RAM_SIZE 0x4000			// 16 KB
+#define MAX_INSTRUCTIONS 4000000000ULL	// Stops an image that never exits
+
+#define PC 15
+#define LR 14
+#define SP 13
+
+// Semihosting operations, "bkpt 0xab" with the operation in r0
+#define SYS_WRITEC 0x03
+#define SYS_WRITE0 0x04
+#define SYS_WRITE 0x05
+#define SYS_HEAPINFO 0x16
+#define SYS_EXIT 0x18
+#define ADP_STOPPED_APPLICATION_EXIT 0x20026
+#define M0SIM_BENCH_BEGIN 0x100	// User operations of m0_hal.c, r1 is the name
+#define M0SIM_BENCH_END 0x101
+
+enum category { C_CODE, C_SOFT_FLOAT, C_DIVISION, C_LIBM, CATEGORIES };
+
+typedef struct
+{
+	uint32_t start, end;
+	char *name;
+	enum category category;
+	uint64_t instructions, cycles;
+} function;
+
+static uint8_t flash[FLASH_SIZE];
+static uint8_t ram[RAM_SIZE];
+
+static struct
+{
+	uint32_t r[16];		// r[PC] is the address of the next instruction
+	uint32_t current;	// Address of the instruction being executed
+	bool n, z, c, v;
+	bool primask;
+} cpu;
+
+static function *functions;
+static size_t functionCount;
+static function unknown = {0, 0, "?", C_CODE, 0, 0};
+
+static struct
+{
+	bool running;
+	char name[64];
+	uint64_t instructions, cycles;
+	uint64_t category[CATEGORIES];
+} bench;
+
+static uint32_t iterations = 100;
+static FILE *functionsCsv;
+static uint64_t executed;
+
+static function *function_at(uint32_t address);
+
+static void fault(const char *format, ...)
+{
+	va_list args;
+
+	fprintf(stderr, "m0sim: ");
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+	fprintf(stderr, " at pc 0x%08" PRIx32 " (%s)\n", cpu.current, function_at(cpu.current)->name);
+	exit(1);
+}
+
+/*------------------------------------------------------------------
+ * Memory
+ *------------------------------------------------------------------
+ */
+
+static bool is_peripheral(uint32_t address)
+{
+	return (address >= 0x40000000 && address < 0x60000000) || address >= 0xE0000000;
+}
+
+static uint8_t *memory(uint32_t address, uint32_t size, bool write)
+{
+	if (address & (size - 1)) fault("unaligned %s of %u bytes at 0x%08" PRIx32, write ? "write" : "read", size, address);
+	if (address < FLASH_SIZE)
+	{
+		if (write) fault("write to flash at 0x%08" PRIx32, address);
+		return flash + address;
+	}
+	if (address - RAM_START < RAM_SIZE) return ram + (address - RAM_START);
+	if (is_peripheral(address)) return NULL;
+	fault("bus fault, %s at 0x%08" PRIx32, write ? "write" : "read", address);
+	return NULL;
+}
+
+static uint32_t load(uint32_t address, uint32_t size)
+{
+	uint8_t *p = memory(address, size, false);
+	uint32_t value = 0;
+
+	if (p) memcpy(&value, p, size);		// Little endian, like the host
+	return value;
+}
+
+static void store(uint32_t address, uint32_t size, uint32_t value)
+{
+	uint8_t *p = memory(address, size, true);
+
+	if (p) memcpy(p, &value, size);
+}
+
+static void read_string(uint32_t address, char *text, size_t size)
+{
+	size_t i = 0;
+
+	for (; i + 1 < size; i++)
+	{
+		text[i] = (char)load(address + i, 1);
+		if (!text[i]) return;
+	}
+	text[i] = '\0';
+}
+
+/*------------------------------------------------------------------
+ * Image and symbols
+ *------------------------------------------------------------------
+ */
+
+// The name groups of the old QEMU report: libgcc float and division helpers, newlib libm
+static bool in_list(const char *name, const char *const *list)
+{
+	for (; *list; list++) if (!strcmp(name, *list)) return true;
+	return false;
+}
+
+static enum category categorize(const char *name)
+{
+	static const char *const division[] = {
+		"__aeabi_idiv", "__aeabi_uidiv", "__aeabi_idivmod", "__aeabi_uidivmod", "__aeabi_ldivmod",
+		"__aeabi_uldivmod", "__aeabi_idiv0", "__aeabi_ldiv0", "__divsi3", "__udivsi3", "__modsi3",
+		"__umodsi3", "__divdi3", "__udivdi3", "__moddi3", "__umoddi3", "__divmoddi4", "__udivmoddi4",
+		"__gnu_ldivmod_helper", "__gnu_uldivmod_helper", NULL};
+	static const char *const libm[] = {
+		"sin", "cos", "tan", "asin", "acos", "atan", "sinh", "cosh", "tanh", "asinh", "acosh", "atanh",
+		"atan2", "sqrt", "cbrt", "exp", "expm1", "log", "log10", "log1p", "pow", "hypot", "copysign",
+		"fabs", "floor", "ceil", "round", "trunc", "fmod", "scalbn", "frexp", "ldexp", "nan", NULL};
+	static const char *const floatSuffix[] = {"sf", "df", "sf2", "df2", "sf3", "df3"};
+	size_t length = strlen(name);
+	char base[64];
+
+	if (in_list(name, division)) return C_DIVISION;
+
+	if (!strncmp(name, "__ieee754_", 10) || !strncmp(name, "__kernel_", 9) || !strncmp(name, "__math_", 7) ||
+		!strncmp(name, "__fpclassify", 12)) return C_LIBM;
+	snprintf(base, sizeof(base), "%s", name);
+	if (length > 1 && length < sizeof(base) && base[length - 1] == 'f') base[length - 1] = '\0';	// sinf, sqrtf, ...
+	if (in_list(name, libm) || in_list(base, libm)) return C_LIBM;
+
+	if (strncmp(name, "__", 2)) return C_CODE;
+	name += 2;
+	length -= 2;
+	if (!strncmp(name, "aeabi_", 6))
+	{
+		const char *f = name + 6;
+		size_t digits = strspn(f, "iul");
+
+		if (*f == 'f' || *f == 'd') return C_SOFT_FLOAT;		// __aeabi_fmul, __aeabi_dadd, __aeabi_f2d, ...
+		if (digits && f[digits] == '2' && (f[digits + 1] == 'f' || f[digits + 1] == 'd')) return C_SOFT_FLOAT;	// __aeabi_i2f
+		if (!strncmp(f, "cf", 2) || !strncmp(f, "cd", 2)) return C_SOFT_FLOAT;	// __aeabi_cfcmpeq, ...
+		return C_CODE;
+	}
+	if (!strncmp(name, "fix", 3) || !strncmp(name, "float", 5) || !strcmp(name, "clzsi2") || !strcmp(name, "clzdi2"))
+		return C_SOFT_FLOAT;
+	for (size_t i = 0; i < sizeof(floatSuffix) / sizeof(floatSuffix[0]); i++)
+	{
+		size_t s = strlen(floatSuffix[i]);
+		if (length > s && !strcmp(name + length - s, floatSuffix[i])) return C_SOFT_FLOAT;	// __addsf3, __ltdf2
+	}
+	return C_CODE;
+}
+
+static int by_address(const void *a, const void *b)
+{
+	const function *x = a, *y = b;
+
+	if (x->start != y->start) return x->start < y->start ? -1 : 1;
+	return (y->end - y->start > x->end - x->start) - (y->end - y->start < x->end - x->start);
+}
+
+static void load_image(const char *path)
+{
+	FILE *file = fopen(path, "rb");
+	uint8_t *elf;
+	long size;
+
+	if (!file) { perror(path); exit(1); }
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	rewind(file);
+	elf = malloc(size);
+	if (!elf || fread(elf, 1, size, file) != (size_t)size) { fprintf(stderr, "m0sim: can't read %s\n", path); exit(1); }
+	fclose(file);
+
+	Elf32_Ehdr *header = (Elf32_Ehdr *)elf;
+	if (size < (long)sizeof(*header) || memcmp(header->e_ident, ELFMAG, SELFMAG) || header->e_ident[EI_CLASS] != ELFCLASS32 ||
+		header->e_ident[EI_DATA] != ELFDATA2LSB || header->e_machine != EM_ARM)
+	{
+		fprintf(stderr, "m0sim: %s is not a 32 bit little endian ARM ELF file\n", path);
+		exit(1);
+	}
+
+	// Segments at their load address, the startup code copies .data to RAM
+	for (int i = 0; i < header->e_phnum; i++)
+	{
+		Elf32_Phdr *segment = (Elf32_Phdr *)(elf + header->e_phoff + i * header->e_phentsize);
+		uint32_t address = segment->p_paddr;
+
+		if (segment->p_type != PT_LOAD || !segment->p_filesz) continue;
+		if (address + segment->p_filesz <= FLASH_SIZE) memcpy(flash + address, elf + segment->p_offset, segment->p_filesz);
+		else if (address >= RAM_START && address - RAM_START + segment->p_filesz <= RAM_SIZE)
+			memcpy(ram + (address - RAM_START), elf + segment->p_offset, segment->p_filesz);
+		else
+		{
+			fprintf(stderr, "m0sim: segment at 0x%08" PRIx32 " is outside the flash and RAM\n", address);
+			exit(1);
+		}
+	}
+
+	// Function symbols, for the cycles per function
+	for (int i = 0; i < header->e_shnum; i++)
+	{
+		Elf32_Shdr *section = (Elf32_Shdr *)(elf + header->e_shoff + i * header->e_shentsize);
+		if (section->sh_type != SHT_SYMTAB) continue;
+
+		Elf32_Shdr *strings = (Elf32_Shdr *)(elf + header->e_shoff + section->sh_link * header->e_shentsize);
+		size_t count = section->sh_size / sizeof(Elf32_Sym);
+		functions = calloc(count, sizeof(function));
+
+		for (size_t s = 0; s < count; s++)
+		{
+			Elf32_Sym *symbol = (Elf32_Sym *)(elf + section->sh_offset) + s;
+			if (ELF32_ST_TYPE(symbol->st_info) != STT_FUNC || symbol->st_shndx == SHN_UNDEF) continue;
+
+			function *f = &functions[functionCount++];
+			f->start = symbol->st_value & ~1u;
+			f->end = f->start + symbol->st_size;
+			f->name = strdup((char *)elf + strings->sh_offset + symbol->st_name);
+			f->name[strcspn(f->name, ".")] = '\0';	// foo.constprop.0, foo.part.1 are foo
+			f->category = categorize(f->name);
+		}
+	}
+	if (!functionCount)
+	{
+		fprintf(stderr, "m0sim: %s has no function symbols\n", path);
+		exit(1);
+	}
+
+	// One function per address (the largest), assembly labels without a size reach the next one
+	qsort(functions, functionCount, sizeof(function), by_address);
+	size_t kept = 0;
+	for (size_t i = 0; i < functionCount; i++)
+	{
+		if (kept && functions[kept - 1].start == functions[i].start) continue;
+		functions[kept++] = functions[i];
+	}
+	functionCount = kept;
+	for (size_t i = 0; i < functionCount; i++)
+	{
+		uint32_t next = i + 1 < functionCount ? functions[i + 1].start : FLASH_SIZE;
+		if (functions[i].end == functions[i].start || functions[i].end > next) functions[i].end = next;
+	}
+	free(elf);
+}
+
+static function *function_at(uint32_t address)
+{
+	static function *last;
+	size_t low = 0, high = functionCount;
+
+	if (last && address >= last->start && address < last->end) return last;
+	while (low < high)
+	{
+		size_t middle = (low + high) / 2;
+		if (address < functions[middle].start) high = middle;
+		else if (address >= functions[middle].end) low = middle + 1;
+		else return last = &functions[middle];
+	}
+	return &unknown;
+}
+
+/*------------------------------------------------------------------
+ * Benchmarks
+ *------------------------------------------------------------------
+ */
+
+static int by_cycles(const void *a, const void *b)
+{
+	const function *x = *(function *const *)a, *y = *(function *const *)b;
+
+	return (y->cycles > x->cycles) - (y->cycles < x->cycles);
+}
+
+static void bench_begin(uint32_t name)
+{
+	if (bench.running) fault("benchmark %s still running", bench.name);
+	memset(&bench, 0, sizeof(bench));
+	read_string(name, bench.name, sizeof(bench.name));
+	for (size_t i = 0; i < functionCount; i++) functions[i].instructions = functions[i].cycles = 0;
+	unknown.instructions = unknown.cycles = 0;
+	bench.running = true;
+}
+
+static void bench_end(void)
+{
+	double n = iterations;
+
+	if (!bench.running) fault("no benchmark running");
+	bench.running = false;
+	printf("%s,%" PRIu32 ",%.1f,%.1f,%.1f,%.1f,%.1f\n", bench.name, iterations,
+		bench.instructions / n, bench.cycles / n, bench.category[C_SOFT_FLOAT] / n,
+		bench.category[C_DIVISION] / n, bench.category[C_LIBM] / n);
+	fflush(stdout);
+	if (!functionsCsv) return;
+
+	function **used = malloc((functionCount + 1) * sizeof(function *));
+	size_t count = 0;
+	for (size_t i = 0; i < functionCount; i++) if (functions[i].instructions) used[count++] = &functions[i];
+	if (unknown.instructions) used[count++] = &unknown;
+	qsort(used, count, sizeof(function *), by_cycles);
+	for (size_t i = 0; i < count; i++)
+		fprintf(functionsCsv, "%s,%s,%.1f,%.1f\n", bench.name, used[i]->name, used[i]->instructions / n, used[i]->cycles / n);
+	free(used);
+}
+
+// The semihosting call at pc, r0 is the operation and gets the result
+static void semihosting(void)
+{
+	uint32_t operation = cpu.r[0], argument = cpu.r[1];
+
+	switch (operation)
+	{
+		case SYS_WRITEC:
+			fputc((int)load(argument, 1), stderr);
+			break;
+		case SYS_WRITE0:
+			for (uint8_t c; (c = (uint8_t)load(argument++, 1)); ) fputc(c, stderr);
+			break;
+		case SYS_WRITE:
+		{
+			uint32_t data = load(argument + 4, 4), length = load(argument + 8, 4);
+			for (uint32_t i = 0; i < length; i++) fputc((int)load(data + i, 1), stderr);
+			cpu.r[0] = 0;
+			return;
+		}
+		case SYS_HEAPINFO:
+			// Heap and stack unknown: the C library falls back on the linker symbols
+			for (uint32_t i = 0; i < 4; i++) store(load(argument, 4) + 4 * i, 4, 0);
+			break;
+		case SYS_EXIT:
+			if (bench.running) fault("exit during benchmark %s", bench.name);
+			if (functionsCsv) fclose(functionsCsv);
+			exit(argument == ADP_STOPPED_APPLICATION_EXIT ? 0 : 1);
+		case M0SIM_BENCH_BEGIN:
+			bench_begin(argument);
+			break;
+		case M0SIM_BENCH_END:
+			bench_end();
+			break;
+		default:
+			fault("unsupported semihosting operation 0x%" PRIx32, operation);
+	}
+	cpu.r[0] = 0;
+}
+
+/*------------------------------------------------------------------
+ * Instructions
+ *------------------------------------------------------------------
+ */
+
+// Register as an operand, the pc reads 4 ahead
+static uint32_t reg(int n)
+{
+	return n == PC ? cpu.current + 4 : cpu.r[n];
+}
+
+static void set_nz(uint32_t result)
+{
+	cpu.n = result >> 31;
+	cpu.z = result == 0;
+}
+
+static uint32_t add_with_carry(uint32_t a, uint32_t b, bool carry, bool flags)
+{
+	uint64_t sum = (uint64_t)a + b + carry;
+	uint32_t result = (uint32_t)sum;
+
+	if (flags)
+	{
+		set_nz(result);
+		cpu.c = sum >> 32;
+		cpu.v = ((a ^ result) & (b ^ result)) >> 31;
+	}
+	return result;
+}
+
+static bool condition(int cond)
+{
+	switch (cond)
+	{
+		case 0: return cpu.z;
+		case 1: return !cpu.z;
+		case 2: return cpu.c;
+		case 3: return !cpu.c;
+		case 4: return cpu.n;
+		case 5: return !cpu.n;
+		case 6: return cpu.v;
+		case 7: return !cpu.v;
+		case 8: return cpu.c && !cpu.z;
+		case 9: return !cpu.c || cpu.z;
+		case 10: return cpu.n == cpu.v;
+		case 11: return cpu.n != cpu.v;
+		case 12: return !cpu.z && cpu.n == cpu.v;
+		default: return cpu.z || cpu.n != cpu.v;
+	}
+}
+
+// Shifts by a register, only the bottom byte counts, 0 keeps the carry
+static uint32_t shift(int type, uint32_t value, uint32_t amount)
+{
+	amount &= 0xFF;
+	if (!amount) return value;
+	switch (type)
+	{
+		case 0:	// LSL
+			cpu.c = amount <= 32 ? (value >> (32 - amount)) & 1 : 0;
+			return amount < 32 ? value << amount : 0;
+		case 1:	// LSR
+			cpu.c = amount <= 32 ? (value >> (amount - 1)) & 1 : 0;
+			return amount < 32 ? value >> amount : 0;
+		case 2:	// ASR
+			if (amount >= 32)
+			{
+				cpu.c = value >> 31;
+				return (uint32_t)((int32_t)value >> 31);
+			}
+			cpu.c = (value >> (amount - 1)) & 1;
+			return (uint32_t)((int32_t)value >> amount);
+		default:	// ROR
+			amount &= 31;
+			if (amount) value = (value >> amount) | (value << (32 - amount));
+			cpu.c = value >> 31;
+			return value;
+	}
+}
+
+static void branch(uint32_t target)
+{
+	cpu.r[PC] = target & ~1u;
+}
+
+// Exchanging branch, the M0 can't leave Thumb state and there are no exceptions to return from
+static void branch_exchange(uint32_t target)
+{
+	if (!(target & 1)) fault("branch to ARM state 0x%08" PRIx32, target);
+	branch(target);
+}
+
+static int count_bits(uint32_t list)
+{
+	return __builtin_popcount(list);
+}
+
+static uint32_t system_register(int sysm)
+{
+	switch (sysm)
+	{
+		case 0: case 1: case 2: case 3: case 5: case 6: case 7:	// APSR, IPSR (thread mode), EPSR
+			return (uint32_t)cpu.n << 31 | (uint32_t)cpu.z << 30 | (uint32_t)cpu.c << 29 | (uint32_t)cpu.v << 28;
+		case 8: return cpu.r[SP];	// MSP
+		case 9: return 0;			// PSP, never used
+		case 16: return cpu.primask;
+		case 20: return 0;			// CONTROL
+		default:
+			fault("unknown special register %d", sysm);
+			return 0;
+	}
+}
+
+// 32 bit instructions: BL, MSR, MRS and the barriers
+static uint32_t execute32(uint32_t pc, uint16_t op)
+{
+	uint16_t op2 = (uint16_t)load(pc + 2, 2);
+
+	cpu.r[PC] = pc + 4;
+	if ((op & 0xF800) == 0xF000 && (op2 & 0xD000) == 0xD000)	// BL
+	{
+		uint32_t s = (op >> 10) & 1;
+		uint32_t i1 = !(((op2 >> 13) & 1) ^ s), i2 = !(((op2 >> 11) & 1) ^ s);
+		uint32_t offset = s << 24 | i1 << 23 | i2 << 22 | (op & 0x3FFu) << 12 | (op2 & 0x7FFu) << 1;
+
+		offset = (uint32_t)((int32_t)(offset << 7) >> 7);
+		cpu.r[LR] = (pc + 4) | 1;
+		branch(pc + 4 + offset);
+		return 4;
+	}
+	if ((op & 0xFFF0) == 0xF380 && (op2 & 0xFF00) == 0x8800)	// MSR
+	{
+		uint32_t value = reg(op & 0xF);
+		switch (op2 & 0xFF)
+		{
+			case 0: case 1: case 2: case 3:
+				cpu.n = value >> 31; cpu.z = (value >> 30) & 1; cpu.c = (value >> 29) & 1; cpu.v = (value >> 28) & 1;
+				break;
+			case 8: cpu.r[SP] = value & ~3u; break;
+			case 16: cpu.primask = value & 1; break;
+			case 20: if (value) fault("process stack / unprivileged mode not modelled"); break;
+			default: fault("unknown special register %d", op2 & 0xFF);
+		}
+		return 4;
+	}
+	if (op == 0xF3EF && (op2 & 0xF000) == 0x8000)	// MRS
+	{
+		cpu.r[(op2 >> 8) & 0xF] = system_register(op2 & 0xFF);
+		return 4;
+	}
+	if (op == 0xF3BF && (op2 & 0xFF00) == 0x8F00) return 4;	// DSB, DMB, ISB
+	fault("undefined instruction 0x%04x 0x%04x", op, op2);
+	return 0;
+}
+
+// Executes the instruction at pc, returns its cycles (0: not counted)
+static uint32_t execute(void)
+{
+	uint32_t pc = cpu.current = cpu.r[PC];
+	uint16_t op = (uint16_t)load(pc, 2);
+	int rd = op & 7, rn = (op >> 3) & 7, rm = (op >> 6) & 7;
+	uint32_t imm5 = (op >> 6) & 0x1F, imm8 = op & 0xFF;
+
+	if ((op >> 11) >= 0x1D) return execute32(pc, op);
+	cpu.r[PC] = pc + 2;
+
+	switch (op >> 11)
+	{
+		case 0x00:	// LSL imm
+			if (imm5) cpu.c = (cpu.r[rn] >> (32 - imm5)) & 1;
+			cpu.r[rd] = cpu.r[rn] << imm5;
+			set_nz(cpu.r[rd]);
+			return 1;
+		case 0x01:	// LSR imm, 0 is 32
+			cpu.r[rd] = shift(1, cpu.r[rn], imm5 ? imm5 : 32);
+			set_nz(cpu.r[rd]);
+			return 1;
+		case 0x02:	// ASR imm, 0 is 32
+			cpu.r[rd] = shift(2, cpu.r[rn], imm5 ? imm5 : 32);
+			set_nz(cpu.r[rd]);
+			return 1;
+		case 0x03:	// ADD / SUB, register or imm3
+		{
+			uint32_t operand = (op & 0x400) ? (uint32_t)rm : cpu.r[rm];
+			cpu.r[rd] = (op & 0x200) ? add_with_carry(cpu.r[rn], ~operand, 1, true) : add_with_carry(cpu.r[rn], operand, 0, true);
+			return 1;
+		}
+		case 0x04:	// MOV imm8
+			rd = (op >> 8) & 7;
+			cpu.r[rd] = imm8;
+			set_nz(imm8);
+			return 1;
+		case 0x05:	// CMP imm8
+			add_with_carry(cpu.r[(op >> 8) & 7], ~imm8, 1, true);
+			return 1;
+		case 0x06:	// ADD imm8
+			rd = (op >> 8) & 7;
+			cpu.r[rd] = add_with_carry(cpu.r[rd], imm8, 0, true);
+			return 1;
+		case 0x07:	// SUB imm8
+			rd = (op >> 8) & 7;
+			cpu.r[rd] = add_with_carry(cpu.r[rd], ~imm8, 1, true);
+			return 1;
+		case 0x08:
+			if (!(op & 0x400))	// Data processing
+			{
+				uint32_t a = cpu.r[rd], b = cpu.r[rn], result;
+				switch ((op >> 6) & 0xF)
+				{
+					case 0x0: result = a & b; break;
+					case 0x1: result = a ^ b; break;
+					case 0x2: result = shift(0, a, b); break;
+					case 0x3: result = shift(1, a, b); break;
+					case 0x4: result = shift(2, a, b); break;
+					case 0x5: cpu.r[rd] = add_with_carry(a, b, cpu.c, true); return 1;
+					case 0x6: cpu.r[rd] = add_with_carry(a, ~b, cpu.c, true); return 1;
+					case 0x7: result = shift(3, a, b); break;
+					case 0x8: set_nz(a & b); return 1;	// TST
+					case 0x9: cpu.r[rd] = add_with_carry(0, ~b, 1, true); return 1;	// RSB #0
+					case 0xA: add_with_carry(a, ~b, 1, true); return 1;	// CMP
+					case 0xB: add_with_carry(a, b, 0, true); return 1;	// CMN
+					case 0xC: result = a | b; break;
+					case 0xD: result = a * b; break;	// MULS, single cycle on the nRF51
+					case 0xE: result = a & ~b; break;
+					default: result = ~b; break;
+				}
+				cpu.r[rd] = result;
+				set_nz(result);
+				return 1;
+			}
+			else	// High registers, BX, BLX
+			{
+				int d = ((op >> 4) & 8) | rd, m = (op >> 3) & 0xF;
+				switch ((op >> 8) & 3)
+				{
+					case 0:
+						if (d == PC) { branch(reg(d) + reg(m)); return 3; }
+						cpu.r[d] = reg(d) + reg(m);
+						return 1;
+					case 1:
+						add_with_carry(reg(d), ~reg(m), 1, true);
+						return 1;
+					case 2:
+						if (d == PC) { branch(reg(m)); return 3; }
+						cpu.r[d] = reg(m);
+						return 1;
+					default:
+					{
+						uint32_t target = reg(m);
+						if (op & 0x80) cpu.r[LR] = (pc + 2) | 1;
+						branch_exchange(target);
+						return 3;
+					}
+				}
+			}
+		case 0x09:	// LDR literal
+			cpu.r[(op >> 8) & 7] = load(((pc + 4) & ~3u) + imm8 * 4, 4);
+			return 2;
+		case 0x0A: case 0x0B:	// Load / store, register offset
+		{
+			uint32_t address = cpu.r[rn] + cpu.r[rm];
+			switch ((op >> 9) & 7)
+			{
+				case 0: store(address, 4, cpu.r[rd]); break;
+				case 1: store(address, 2, cpu.r[rd]); break;
+				case 2: store(address, 1, cpu.r[rd]); break;
+				case 3: cpu.r[rd] = (uint32_t)(int8_t)load(address, 1); break;
+				case 4: cpu.r[rd] = load(address, 4); break;
+				case 5: cpu.r[rd] = load(address, 2); break;
+				case 6: cpu.r[rd] = load(address, 1); break;
+				default: cpu.r[rd] = (uint32_t)(int16_t)load(address, 2); break;
+			}
+			return 2;
+		}
+		case 0x0C: store(cpu.r[rn] + imm5 * 4, 4, cpu.r[rd]); return 2;
+		case 0x0D: cpu.r[rd] = load(cpu.r[rn] + imm5 * 4, 4); return 2;
+		case 0x0E: store(cpu.r[rn] + imm5, 1, cpu.r[rd]); return 2;
+		case 0x0F: cpu.r[rd] = load(cpu.r[rn] + imm5, 1); return 2;
+		case 0x10: store(cpu.r[rn] + imm5 * 2, 2, cpu.r[rd]); return 2;
+		case 0x11: cpu.r[rd] = load(cpu.r[rn] + imm5 * 2, 2); return 2;
+		case 0x12: store(cpu.r[SP] + imm8 * 4, 4, cpu.r[(op >> 8) & 7]); return 2;
+		case 0x13: cpu.r[(op >> 8) & 7] = load(cpu.r[SP] + imm8 * 4, 4); return 2;
+		case 0x14: cpu.r[(op >> 8) & 7] = ((pc + 4) & ~3u) + imm8 * 4; return 1;	// ADR
+		case 0x15: cpu.r[(op >> 8) & 7] = cpu.r[SP] + imm8 * 4; return 1;		// ADD rd, sp, #imm
+		case 0x16: case 0x17:	// Miscellaneous
+			if ((op & 0xFF00) == 0xB000)	// ADD / SUB sp, #imm7
+			{
+				uint32_t offset = (op & 0x7F) * 4;
+				cpu.r[SP] = (op & 0x80) ? cpu.r[SP] - offset : cpu.r[SP] + offset;
+				return 1;
+			}
+			if ((op & 0xFF00) == 0xB200)	// SXTH, SXTB, UXTH, UXTB
+			{
+				uint32_t value = cpu.r[rn];
+				switch ((op >> 6) & 3)
+				{
+					case 0: cpu.r[rd] = (uint32_t)(int16_t)value; break;
+					case 1: cpu.r[rd] = (uint32_t)(int8_t)value; break;
+					case 2: cpu.r[rd] = value & 0xFFFF; break;
+					default: cpu.r[rd] = value & 0xFF; break;
+				}
+				return 1;
+			}
+			if ((op & 0xFE00) == 0xB400)	// PUSH
+			{
+				uint32_t list = (op & 0xFF) | ((op & 0x100) ? 1u << LR : 0);
+				uint32_t address = cpu.r[SP] - 4 * count_bits(list);
+				cpu.r[SP] = address;
+				for (int i = 0; i < 16; i++) if (list & (1u << i)) { store(address, 4, cpu.r[i]); address += 4; }
+				return 1 + count_bits(list);
+			}
+			if ((op & 0xFFEF) == 0xB662)	// CPSIE / CPSID i
+			{
+				cpu.primask = (op >> 4) & 1;
+				return 1;
+			}
+			if ((op & 0xFF00) == 0xBA00 && ((op >> 6) & 3) != 2)	// REV, REV16, REVSH
+			{
+				uint32_t value = cpu.r[rn];
+				switch ((op >> 6) & 3)
+				{
+					case 0: cpu.r[rd] = __builtin_bswap32(value); break;
+					case 1: cpu.r[rd] = ((value & 0x00FF00FF) << 8) | ((value >> 8) & 0x00FF00FF); break;
+					default: cpu.r[rd] = (uint32_t)(int16_t)__builtin_bswap16((uint16_t)value); break;
+				}
+				return 1;
+			}
+			if ((op & 0xFE00) == 0xBC00)	// POP
+			{
+				uint32_t list = (op & 0xFF) | ((op & 0x100) ? 1u << PC : 0);
+				uint32_t address = cpu.r[SP], target = 0;
+				for (int i = 0; i < 16; i++)
+				{
+					if (!(list & (1u << i))) continue;
+					if (i == PC) target = load(address, 4);
+					else cpu.r[i] = load(address, 4);
+					address += 4;
+				}
+				cpu.r[SP] = address;
+				if (!(list & (1u << PC))) return 1 + count_bits(list);
+				branch_exchange(target);
+				return 3 + count_bits(list);
+			}
+			if ((op & 0xFF00) == 0xBE00)	// BKPT
+			{
+				if (imm8 != 0xAB) fault("breakpoint 0x%02x", imm8);
+				semihosting();
+				return 0;
+			}
+			if ((op & 0xFF0F) == 0xBF00 && ((op >> 4) & 0xF) <= 4) return 1;	// NOP, YIELD, WFE, WFI, SEV
+			break;
+		case 0x18:	// STMIA rn!
+		{
+			rn = (op >> 8) & 7;
+			uint32_t address = cpu.r[rn];
+			for (int i = 0; i < 8; i++) if (op & (1u << i)) { store(address, 4, cpu.r[i]); address += 4; }
+			cpu.r[rn] = address;
+			return 1 + count_bits(imm8);
+		}
+		case 0x19:	// LDMIA rn(!)
+		{
+			rn = (op >> 8) & 7;
+			uint32_t address = cpu.r[rn];
+			for (int i = 0; i < 8; i++) if (op & (1u << i)) { cpu.r[i] = load(address, 4); address += 4; }
+			if (!(op & (1u << rn))) cpu.r[rn] = address;
+			return 1 + count_bits(imm8);
+		}
+		case 0x1A: case 0x1B:	// B<cond>, UDF, SVC
+		{
+			int cond = (op >> 8) & 0xF;
+			if (cond >= 0xE) break;
+			if (!condition(cond)) return 1;
+			branch(pc + 4 + (uint32_t)((int32_t)(int8_t)imm8 * 2));
+			return 3;
+		}
+		case 0x1C:	// B
+		{
+			uint32_t target = pc + 4 + (uint32_t)((int32_t)((uint32_t)op << 21) >> 20);
+			if (target == pc) fault("endless loop (b .)");
+			branch(target);
+			return 3;
+		}
+	}
+	fault("undefined instruction 0x%04x", op);
+	return 0;
+}
+
+static void run(void)
+{
+	cpu.r[SP] = load(0, 4);
+	branch_exchange(load(4, 4));
+	cpu.r[LR] = 0xFFFFFFFF;
+
+	for (;;)
+	{
+		uint32_t pc = cpu.r[PC];
+		uint32_t cycles = execute();
+
+		if (++executed > MAX_INSTRUCTIONS) fault("no exit after %" PRIu64 " instructions", executed - 1);
+		if (!bench.running || !cycles) continue;
+
+		function *f = function_at(pc);
+		f->instructions++;
+		f->cycles += cycles;
+		bench.instructions++;
+		bench.cycles += cycles;
+		bench.category[f->category] += cycles;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const char *image = NULL;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--iterations") && i + 1 < argc) iterations = (uint32_t)strtoul(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "--functions") && i + 1 < argc)
+		{
+			functionsCsv = fopen(argv[++i], "w");
+			if (!functionsCsv) { perror(argv[i]); return 1; }
+			fprintf(functionsCsv, "benchmark,function,instructions_per_op,cycles_per_op\n");
+		}
+		else if (argv[i][0] != '-' && !image) image = argv[i];
+		else
+		{
+			fprintf(stderr, "usage: %s [--iterations n] [--functions file.csv] image.out\n", argv[0]);
+			return 1;
+		}
+	}
+	if (!image || !iterations)
+	{
+		fprintf(stderr, "usage: %s [--iterations n] [--functions file.csv] image.out\n", argv[0]);
+		return 1;
+	}
+
+	load_image(image);
+	printf("benchmark,iterations,instructions_per_op,cycles_per_op,soft_float_cycles_per_op,division_cycles_per_op,libm_cycles_per_op\n");
+	run();
+	return 1;
+}
@@ -0,0 +1,172 @@
+#!/usr/bin/env python3
+"""Per-module RAM and flash usage of the firmware, from the linker map.
+
+    python3 mem_report.py _build/in4073.map [--sort flash|ram] [--top N] [--csv]
+
+Every input section of the map is attributed to the object file (or
+library member) it came from. Sections placed in the RAM region count as
+RAM; sections in FLASH count as flash, and .data counts as both because
+its initial values are copied from flash at boot. The heap and stack
+reservations of gcc_startup_nrf51.s are reported separately, what is
+left of the RAM after them is the real headroom. Run it with
+"make mem-report".
+"""
+
+import argparse
+import os
+import re
+import sys
+
+SECTION_RE = re.compile(r'^ (\S+)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S.*)$')
+NAME_ONLY_RE = re.compile(r'^ (\S+)$')
+ADDR_ONLY_RE = re.compile(r'^\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S.*)$')
+FILL_RE = re.compile(r'^ \*fill\*\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)')
+OUTPUT_RE = re.compile(r'^(\.\S+|\S+)(?:\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)(.*))?$')
+REGION_RE = re.compile(r'^(\S+)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)')
+
+# Reservations of the startup file, not real content
+RESERVED = {'.heap': 'heap', '.stack_dummy': 'stack'}
+
+
+def module_name(path):
+    """Object file name, library members as lib.a(member.o)"""
+    path = path.strip()
+    m = re.match(r'^(.*?)\((.*)\)$', path)
+    if m:
+        return '%s(%s)' % (os.path.basename(m.group(1)), m.group(2))
+    return os.path.basename(path)
+
+
+def parse(lines):
+    regions = {}
+    modules = {}
+    reserved = {'heap': 0, 'stack': 0}
+    output = None
+    loaded = False
+    pending = None
+    state = 'start'
+
+    def add(name, addr, size, path):
+        if size == 0 or output is None or output.startswith('.debug') or output in ('.comment', '.ARM.attributes'):
+            return
+        in_ram = 'RAM' in regions and regions['RAM'][0] <= addr < regions['RAM'][0] + regions['RAM'][1]
+        in_flash = 'FLASH' in regions and regions['FLASH'][0] <= addr < regions['FLASH'][0] + regions['FLASH'][1]
+        if output in RESERVED:
+            reserved[RESERVED[output]] += size
+            return
+        if not in_ram and not in_flash:
+            return
+        m = modules.setdefault(module_name(path), {'flash': 0, 'ram': 0})
+        if in_ram:
+            m['ram'] += size
+        if in_flash or loaded:
+            m['flash'] += size
+
+    for line in lines:
+        line = line.rstrip('\n')
+        if state == 'start':
+            if line.startswith('Memory Configuration'):
+                state = 'memory'
+            continue
+        if state == 'memory':
+            if line.startswith('Linker script and memory map'):
+                state = 'map'
+                continue
+            m = REGION_RE.match(line)
+            if m and m.group(1) not in ('Name', '*default*'):
+                regions[m.group(1)] = (int(m.group(2), 16), int(m.group(3), 16))
+            continue
+
+        # Output section, at the start of the line
+        if line and not line[0].isspace():
+            m = OUTPUT_RE.match(line)
+            if m and m.group(1).startswith('.'):
+                output = m.group(1)
+                loaded = 'load address' in (m.group(4) or '')
+            else:
+                output = None
+            pending = None
+            continue
+
+        # The line after an output section name that didn't fit
+        if pending is None and output is not None and 'load address' in line:
+            loaded = True
+
+        m = FILL_RE.match(line)
+        if m:
+            add('*fill*', int(m.group(1), 16), int(m.group(2), 16), '(fill)')
+            pending = None
+            continue
+
+        m = SECTION_RE.match(line)
+        if m:
+            add(m.group(1), int(m.group(2), 16), int(m.group(3), 16), m.group(4))
+            pending = None
+            continue
+
+        # Long input section names are on a line of their own
+        m = NAME_ONLY_RE.match(line)
+        if m and not m.group(1).startswith('*('):
+            pending = m.group(1)
+            continue
+
+        m = ADDR_ONLY_RE.match(line)
+        if m and pending is not None:
+            add(pending, int(m.group(1), 16), int(m.group(2), 16), m.group(3))
+        pending = None
+
+    return regions, modules, reserved
+
+
+def main():
+    parser = argparse.ArgumentParser(description='RAM and flash usage per module from a GNU ld map file')
+    parser.add_argument('map', help='linker map, e.g. _build/in4073.map')
+    parser.add_argument('--sort', choices=('ram', 'flash'), default='ram')
+    parser.add_argument('--top', type=int, default=0, help='only show the N largest modules')
+    parser.add_argument('--csv', action='store_true', help='machine readable output')
+    args = parser.parse_args()
+
+    with open(args.map) as f:
+        regions, modules, reserved = parse(f)
+
+    if 'RAM' not in regions or 'FLASH' not in regions:
+        sys.exit('%s: no FLASH / RAM memory regions found, is this a GNU ld map file?' % args.map)
+
+    other = 'flash' if args.sort == 'ram' else 'ram'
+    rows = sorted(modules.items(), key=lambda kv: (-kv[1][args.sort], -kv[1][other], kv[0]))
+    if args.top:
+        rows = rows[:args.top]
+
+    ram_used = sum(m['ram'] for m in modules.values())
+    flash_used = sum(m['flash'] for m in modules.values())
+    ram_size = regions['RAM'][1]
+    flash_size = regions['FLASH'][1]
+    ram_free = ram_size - ram_used - reserved['heap'] - reserved['stack']
+
+    if args.csv:
+        print('module,flash,ram')
+        for name, m in rows:
+            print('%s,%d,%d' % (name, m['flash'], m['ram']))
+        print('total,%d,%d' % (flash_used, ram_used))
+        print('heap,0,%d' % reserved['heap'])
+        print('stack,0,%d' % reserved['stack'])
+        print('free,%d,%d' % (flash_size - flash_used, ram_free))
+        return
+
+    width = max([len(name) for name, _ in rows] + [20])
+    print('%-*s %8s %8s' % (width, 'module', 'flash', 'ram'))
+    for name, m in rows:
+        print('%-*s %8d %8d' % (width, name, m['flash'], m['ram']))
+    print('-' * (width + 18))
+    print('%-*s %8d %8d' % (width, 'total', flash_used, ram_used))
+    print('%-*s %8s %8d' % (width, 'heap (reserved)', '', reserved['heap']))
+    print('%-*s %8s %8d' % (width, 'stack (reserved)', '', reserved['stack']))
+    print('%-*s %8d %8d' % (width, 'free', flash_size - flash_used, ram_free))
+    print()
+    print('FLASH %d of %d bytes used (%.1f%%), RAM %d of %d bytes used including heap and stack (%.1f%%)' % (
+        flash_used, flash_size, 100.0 * flash_used / flash_size,
+        ram_size - ram_free, ram_size, 100.0 * (ram_size - ram_free) / ram_size))
+
+
+if __name__ == '__main__':
+    main()
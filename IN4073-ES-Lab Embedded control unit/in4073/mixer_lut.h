@@ -0,0 +1,71 @@
+// Generated by gen_mixer_lut.py, do not edit
+#ifndef _H_MIXER_LUT
+#define _H_MIXER_LUT
+
+#include <inttypes.h>
+
+#define MIXER_LUT_B_CONSTANT 6000
+#define MIXER_LUT_D_CONSTANT 4000
+#define MIXER_B_UNIT 3 // B_CONSTANT / gcd(B_CONSTANT, D_CONSTANT)
+#define MIXER_D_UNIT 2 // D_CONSTANT / gcd(B_CONSTANT, D_CONSTANT)
+#define MIXER_LUT_SHIFT 4 // Thrust step between entries is 1 << MIXER_LUT_SHIFT
+#define MIXER_LUT_FRAC_BITS 4
+#define MIXER_LUT_ENTRIES 513
+
+// sqrt(500 * thrust) in Q4, thrust = index << MIXER_LUT_SHIFT
+static const uint16_t mixerLut[MIXER_LUT_ENTRIES] = {
+	    0,  1431,  2023,  2478,  2862,  3200,  3505,  3786,  4047,  4293,
+	 4525,  4746,  4957,  5159,  5354,  5542,  5724,  5900,  6071,  6237,
+	 6400,  6558,  6712,  6863,  7010,  7155,  7297,  7436,  7572,  7706,
+	 7838,  7967,  8095,  8220,  8344,  8466,  8586,  8704,  8821,  8937,
+	 9050,  9163,  9274,  9384,  9492,  9600,  9706,  9811,  9914, 10017,
+	10119, 10219, 10319, 10418, 10516, 10613, 10709, 10804, 10898, 10992,
+	11085, 11177, 11268, 11358, 11448, 11537, 11626, 11713, 11801, 11887,
+	11973, 12058, 12143, 12227, 12310, 12393, 12475, 12557, 12638, 12719,
+	12800, 12879, 12959, 13037, 13116, 13193, 13271, 13348, 13424, 13500,
+	13576, 13651, 13726, 13800, 13874, 13948, 14021, 14094, 14167, 14239,
+	14310, 14382, 14453, 14523, 14594, 14664, 14733, 14803, 14872, 14940,
+	15009, 15077, 15145, 15212, 15279, 15346, 15413, 15479, 15545, 15611,
+	15676, 15741, 15806, 15871, 15935, 16000, 16063, 16127, 16190, 16253,
+	16316, 16379, 16441, 16504, 16565, 16627, 16689, 16750, 16811, 16872,
+	16932, 16993, 17053, 17113, 17173, 17232, 17291, 17350, 17409, 17468,
+	17527, 17585, 17643, 17701, 17759, 17816, 17874, 17931, 17988, 18045,
+	18101, 18158, 18214, 18270, 18326, 18382, 18438, 18493, 18548, 18604,
+	18659, 18713, 18768, 18822, 18877, 18931, 18985, 19039, 19093, 19146,
+	19200, 19253, 19306, 19359, 19412, 19464, 19517, 19569, 19622, 19674,
+	19726, 19777, 19829, 19881, 19932, 19983, 20035, 20086, 20137, 20187,
+	20238, 20289, 20339, 20389, 20439, 20489, 20539, 20589, 20639, 20688,
+	20738, 20787, 20836, 20885, 20934, 20983, 21032, 21081, 21129, 21178,
+	21226, 21274, 21322, 21370, 21418, 21466, 21513, 21561, 21608, 21656,
+	21703, 21750, 21797, 21844, 21891, 21938, 21984, 22031, 22077, 22124,
+	22170, 22216, 22262, 22308, 22354, 22400, 22445, 22491, 22536, 22582,
+	22627, 22672, 22717, 22762, 22807, 22852, 22897, 22942, 22986, 23031,
+	23075, 23119, 23164, 23208, 23252, 23296, 23340, 23384, 23427, 23471,
+	23515, 23558, 23602, 23645, 23688, 23731, 23774, 23817, 23860, 23903,
+	23946, 23989, 24031, 24074, 24117, 24159, 24201, 24244, 24286, 24328,
+	24370, 24412, 24454, 24496, 24537, 24579, 24621, 24662, 24704, 24745,
+	24787, 24828, 24869, 24910, 24951, 24992, 25033, 25074, 25115, 25156,
+	25196, 25237, 25277, 25318, 25358, 25399, 25439, 25479, 25519, 25559,
+	25600, 25639, 25679, 25719, 25759, 25799, 25838, 25878, 25918, 25957,
+	25996, 26036, 26075, 26114, 26154, 26193, 26232, 26271, 26310, 26349,
+	26387, 26426, 26465, 26504, 26542, 26581, 26619, 26658, 26696, 26734,
+	26773, 26811, 26849, 26887, 26925, 26963, 27001, 27039, 27077, 27115,
+	27152, 27190, 27228, 27265, 27303, 27340, 27378, 27415, 27452, 27490,
+	27527, 27564, 27601, 27638, 27675, 27712, 27749, 27786, 27823, 27860,
+	27896, 27933, 27970, 28006, 28043, 28079, 28116, 28152, 28189, 28225,
+	28261, 28297, 28334, 28370, 28406, 28442, 28478, 28514, 28550, 28585,
+	28621, 28657, 28693, 28728, 28764, 28800, 28835, 28871, 28906, 28941,
+	28977, 29012, 29047, 29083, 29118, 29153, 29188, 29223, 29258, 29293,
+	29328, 29363, 29398, 29433, 29467, 29502, 29537, 29571, 29606, 29641,
+	29675, 29710, 29744, 29778, 29813, 29847, 29881, 29916, 29950, 29984,
+	30018, 30052, 30086, 30120, 30154, 30188, 30222, 30256, 30290, 30324,
+	30357, 30391, 30425, 30458, 30492, 30526, 30559, 30593, 30626, 30659,
+	30693, 30726, 30759, 30793, 30826, 30859, 30892, 30925, 30959, 30992,
+	31025, 31058, 31091, 31124, 31156, 31189, 31222, 31255, 31288, 31320,
+	31353, 31386, 31418, 31451, 31483, 31516, 31548, 31581, 31613, 31646,
+	31678, 31710, 31742, 31775, 31807, 31839, 31871, 31903, 31935, 31967,
+	32000, 32031, 32063, 32095, 32127, 32159, 32191, 32223, 32254, 32286,
+	32318, 32350, 32381,
+};
+
+#endif
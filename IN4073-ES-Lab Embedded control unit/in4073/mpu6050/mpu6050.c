@@ -18,14 +18,29 @@
 #include "gpio.h"
 #include "nrf_gpio.h"
 #include "math.h"
+#include "comm.h"
 #include "twi.h"
+#include "timers.h"
 
 int16_t phi, theta, psi;
 int16_t sp, sq, sr;
 int16_t sax, say, saz;
+int32_t sensor_quat[4] = {1L << 30, 0, 0, 0};
 uint8_t sensor_fifo_count;
+uint32_t sensor_time;
+uint32_t sensor_dt = SENSOR_DT_NOMINAL_US;
 
 bool sensor_mode;	// Sensor_mode = true = dmp, =false = raw mode.
+imuSwitchStats imu_switch_stats;
+
+// The DMP firmware is in the MPU memory, it stays there when the DMP is switched off
+static bool dmp_loaded = false;
+
+#define MPU_ADDR 0x68
+#define MPU_REG_RATE_DIV 0x19
+#define MPU_REG_CONFIG 0x1A
+#define MPU_REG_INT_ENABLE 0x38
+#define MPU_BIT_DATA_RDY_EN 0x01
 
 void update_euler_from_quaternions(int32_t *quat) 
 {
@@ -62,18 +77,47 @@ void update_euler_from_quaternions(int32_t *quat)
 	psi = atan2(siny_cosp, cosy_cosp) * 10430;
 }
 
+/**
+ * @brief Converts the last DMP quaternion to phi, theta and psi. Takes
+ * atan2 and asin in doubles, so it's only done at telemetry rate and
+ * while calibrating, not every sample. Nothing to do in raw mode, the
+ * estimator sets the angles itself.
+ */
+void update_euler(void)
+{
+	if (sensor_mode) update_euler_from_quaternions(sensor_quat);
+}
+
+/**
+ * @brief Dates the sample just read with the hardware timestamp of its
+ * interrupt (GPIOTE_IRQHandler()) and measures the period since the
+ * previous one. A sample without a stamp is taken a nominal period later.
+ */
+static void stamp_sample(void)
+{
+	uint32_t time;
+
+	if (!sensor_stamp_pop(&time)) time = sensor_time + SENSOR_DT_NOMINAL_US;
+
+	uint32_t dt = time - sensor_time;
+	sensor_dt = (dt >= SENSOR_DT_MIN_US && dt <= SENSOR_DT_MAX_US) ? dt : SENSOR_DT_NOMINAL_US;
+	sensor_time = time;
+}
+
 // reading & conversion takes 3.5 ms (still lots of time till 10?)
 void get_sensor_data(void)
 {
 	int8_t read_stat;
 	int16_t gyro[3], accel[3], dmp_sensors;
-	int32_t quat[4];
+	long quat[4];	// Q30, the type of the InvenSense driver
 	uint8_t sensors;
 
 	if(sensor_mode) { // DMP
 		if (!(read_stat = dmp_read_fifo(gyro, accel, quat, NULL, &dmp_sensors, &sensor_fifo_count))) {
+			stamp_sample();
+			// Only kept as quaternion, the control uses it directly, see update_euler()
 			if (dmp_sensors & INV_WXYZ_QUAT) {
-				update_euler_from_quaternions(quat);
+				for (uint8_t i = 0; i < 4; i++) sensor_quat[i] = quat[i];
 			}
 			//16.4 LSB/deg/s (+-2000 deg/s)
 			if (dmp_sensors & INV_XYZ_GYRO) {
@@ -88,10 +132,11 @@ void get_sensor_data(void)
 				saz = accel[2];
 			}
 		} else {
-			printf("Error reading dmp sensor fifo: %d\n", read_stat);
+			SEND_EVENT(EV_DMP_FIFO_ERROR, read_stat);
 		}
 	} else { // RAW mode
 		if (!(read_stat = mpu_read_fifo(gyro, accel, NULL, &sensors, &sensor_fifo_count))) {
+			stamp_sample();
 			//16.4 LSB/deg/s (+-2000 deg/s)
 			if (sensors & INV_XYZ_GYRO) {
 				sp = gyro[0];
@@ -105,7 +150,7 @@ void get_sensor_data(void)
 				saz = accel[2];
 			}
 		} else {
-			printf("Error reading raw sensor fifo: %d\n", read_stat);
+			SEND_EVENT(EV_RAW_FIFO_ERROR, read_stat);
 		}
 	}
 }
@@ -113,7 +158,7 @@ void get_sensor_data(void)
 
 bool check_sensor_int_flag(void)
 {
-	if (nrf_gpio_pin_read(INT_PIN) || sensor_fifo_count)
+	if (nrf_gpio_pin_read(INT_PIN) || sensor_fifo_count || sensor_stamp_pending())
 		return true;
 	return false;
 }
@@ -139,7 +184,9 @@ void imu_init(bool dmp, uint16_t freq)
 	mpu_set_int_latched(1);
 
 	if (dmp) {
-		printf("\r\ndmp load firm  : %d\n", dmp_load_motion_driver_firmware());
+		int8_t result = dmp_load_motion_driver_firmware();
+		dmp_loaded = (result == 0);
+		printf("\r\ndmp load firm  : %d\n", result);
 		printf("\rdmp set orient : %d\n", dmp_set_orientation(inv_orientation_matrix_to_scalar(gyro_orientation)));
 
 		printf("\rdmp en features: %d\n", dmp_enable_feature(dmp_features));
@@ -147,10 +194,55 @@ void imu_init(bool dmp, uint16_t freq)
 		printf("\rdmp set state  : %d\n", mpu_set_dmp_state(1));
 		printf("\rdlpf set freq  : %d\n", mpu_set_lpf(10));
 	} else {
+		dmp_loaded = false;
+
 		unsigned char data = 0;
-		printf("\rdisable dlpf   : %d\n", i2c_write(0x68, 0x1A, 1, &data));
+		printf("\rdisable dlpf   : %d\n", i2c_write(MPU_ADDR, MPU_REG_CONFIG, 1, &data));
 		// if dlpf is disabled (0 or 7) then the sample divider that feeds the fifo is 8kHz (derrived from gyro).
 		data = 8000 / freq - 1;
-		printf("\rset sample rate: %d\n", i2c_write(0x68, 0x19, 1, &data));
+		printf("\rset sample rate: %d\n", i2c_write(MPU_ADDR, MPU_REG_RATE_DIV, 1, &data));
+	}
+}
+
+/**
+ * @brief Switches between DMP and raw readout. The DMP firmware stays in
+ * the MPU, so only the DMP enable, FIFO, filter and sample rate settings
+ * are changed; imu_init() (reset, ~3 KB firmware upload) is only needed
+ * when the firmware was never loaded. The cost is kept in imu_switch_stats.
+ *
+ * @param dmp true for DMP, false for raw
+ * @param freq Raw sample rate (Hz), the DMP always runs at 100 Hz
+ */
+void imu_set_mode(bool dmp, uint16_t freq)
+{
+	uint32_t start = get_time_us();
+	uint32_t startTransactions = i2c_transactions;
+
+	imu_switch_stats.reloaded = !dmp_loaded;
+
+	if (!dmp_loaded) {
+		imu_init(dmp, freq);
+	} else if (dmp) {
+		// Restores the DMP sample rate and FIFO, then the filter of imu_init()
+		mpu_set_dmp_state(1);
+		mpu_set_lpf(10);
+		sensor_mode = SENSOR_DMP;
+	} else {
+		// Filter off, gyro rate 8 kHz divided down to freq, before the FIFO reset of mpu_set_dmp_state()
+		unsigned char data = 0;
+		i2c_write(MPU_ADDR, MPU_REG_CONFIG, 1, &data);
+		data = 8000 / freq - 1;
+		i2c_write(MPU_ADDR, MPU_REG_RATE_DIV, 1, &data);
+
+		// Gyro and accel into the FIFO instead of the DMP packets, data ready interrupt
+		mpu_set_dmp_state(0);
+		data = MPU_BIT_DATA_RDY_EN;
+		i2c_write(MPU_ADDR, MPU_REG_INT_ENABLE, 1, &data);
+		sensor_mode = SENSOR_RAW;
 	}
+
+	sensor_fifo_count = 0;
+	sensor_stamps_clear();
+	imu_switch_stats.us = get_time_us() - start;
+	imu_switch_stats.transactions = i2c_transactions - startTransactions;
 }
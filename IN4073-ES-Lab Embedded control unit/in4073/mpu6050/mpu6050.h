@@ -7,14 +7,33 @@
 extern int16_t phi, theta, psi;
 extern int16_t sp, sq, sr;
 extern int16_t sax, say, saz;
+extern int32_t sensor_quat[4];	// Last DMP attitude (w, x, y, z), Q30
 extern uint8_t sensor_fifo_count;
 
+// Sample timing, both modes run at 100 Hz. A period outside the
+// limits (first sample, missed interrupts) is taken as nominal.
+#define SENSOR_DT_NOMINAL_US 10000
+#define SENSOR_DT_MIN_US (SENSOR_DT_NOMINAL_US / 4)
+#define SENSOR_DT_MAX_US (SENSOR_DT_NOMINAL_US * 4)
+extern uint32_t sensor_time;	// Time (us) of the interrupt of the last sample read
+extern uint32_t sensor_dt;		// Measured period (us) that sample ends
+
 #define SENSOR_DMP true
 #define SENSOR_RAW false
 extern bool sensor_mode;	// Sensor_mode = true = dmp, =false = raw mode.
 
+// Cost of the last imu_set_mode()
+typedef struct {
+	uint32_t us;			// Time the switch took
+	uint32_t transactions;	// I2C transactions of the switch
+	bool reloaded;			// Whole init was needed (DMP firmware wasn't loaded yet)
+} imuSwitchStats;
+extern imuSwitchStats imu_switch_stats;
+
 void imu_init(bool dmp, uint16_t interrupt_frequency); // if dmp is true, the interrupt frequency is 100Hz - otherwise 32Hz-8kHz
+void imu_set_mode(bool dmp, uint16_t freq);
 void get_sensor_data(void);
+void update_euler(void);
 bool check_sensor_int_flag(void);
 void clear_sensor_int_flag(void);
 
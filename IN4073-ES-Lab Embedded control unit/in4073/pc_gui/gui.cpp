@@ -2,8 +2,6 @@
 #include <iostream>
 #include <thread>
 #include <atomic>
-#include <mutex>
-#include <queue>
 
 // ImGui includes
 #include "../imgui-master/imgui.h"
@@ -17,12 +15,29 @@
 #include "../communication/protocol.h"
 #include "../communication/joy.h"
 #include "../communication/config.h"
+#include "../communication/scheduler.h"
+#include "../communication/capture.h"
+#include "../communication/attstream.h"
+#include "../communication/ping.h"
+#include "lockfree.h"
+#include "plot.h"
+#include "logview.h"
 
 // C includes
-#include <sys/time.h>
 #include <signal.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <poll.h>
+
+// History of the plotted telemetry channels
+typedef struct
+{
+    ScrollingBuffer angles[3];
+    ScrollingBuffer rates[3];
+    ScrollingBuffer motors[4];
+    ScrollingBuffer pressure;
+    ScrollingBuffer battery;
+} telemHistory;
 
 // Struct to pass values to DrawGUI function
 typedef struct 
@@ -37,21 +52,30 @@ typedef struct
     float* motorValues;
     float* joy;
     char* text;
+
+    int* sendRate;
+    schedStats* sendStats;
+    joyLatency* joyLat;
+    linkStats* links;
+
+    telemHistory* history;
+    int* plotWindow;
+
+    LogBrowser* logBrowser;
 } pGuiValues;
 
-// Struct to pass values from main thread to GUI thread
+// Snapshot of the state shown by the GUI, published by the main thread
 typedef struct
 {
-    float joy[4] = {-1000.0f, -1000.0f, -1000.0f, -1000.0f};
-    float motorValues[4] = {-1000.0f, -1000.0f, -1000.0f, -1000.0f};
-    int8_t reqMode = -1;
-    int8_t ackMode = -1;
-    char text[TEXT_LEN] = "";
-    int16_t p = -1000;
-    int16_t p1 = -1000;
-    int16_t p2 = -1000;
-    int16_t hei = -1000;
-} toGUI;
+    float joy[4];
+    float motorValues[4];
+    uint8_t reqMode;
+    uint8_t ackMode;
+    int16_t gains[4];
+    schedStats sendStats;
+    joyLatency joyLat;
+    linkStats links[2];
+} guiState;
 
 // Struct to pass values from the GUI thread to the main thread
 typedef struct
@@ -61,13 +85,34 @@ typedef struct
     int8_t chgP1 = 0;
     int8_t chgP2 = 0;
     int8_t chgHei = 0;
+    int16_t sendRate = -1;
 } toTerm;
 
-// Mutexes and queues for message passing between threads
-std::mutex syncToGui;
-std::mutex syncToTerm;
-std::queue<toGUI> qToGUI;
-std::queue<toTerm> qToTerm;
+// Telemetry sample with its (monotonic) receive time in seconds
+typedef struct
+{
+    double t;
+    bool attitude;      // Only the angles and rates are new (ATT), else the rest (TELEM)
+    telemSample s;
+} telemPoint;
+
+// Sizes of the lock-free channels (powers of two)
+#define TERM_QUEUE_LEN 64
+#define TELEM_QUEUE_LEN 256
+#define TEXT_RING_LEN (1024*16)
+#define TEXT_CHUNK 4096
+
+// Lock-free message passing between the threads. The state is a triple
+// buffered snapshot, so a frame copies at most one guiState no matter how
+// many messages arrived. Text is streamed, only the new bytes are copied.
+TripleBuffer<guiState> stateToGui;
+SpscQueue<toTerm, TERM_QUEUE_LEN> qToTerm;
+SpscQueue<char, TEXT_RING_LEN> textToGui;
+SpscQueue<telemPoint, TELEM_QUEUE_LEN> telemToGui;
+
+// Selectable time windows of the plots
+static const int plotWindows[] = {5, 10, 30, 60, 300};
+static const char* plotWindowNames[] = {"5 s", "10 s", "30 s", "1 min", "5 min"};
 
 /**
  * @brief Cleans up everything related to GUI.
@@ -300,13 +345,131 @@ void drawGUI(pGuiValues values, SDL_Window* window, ImGuiIO& io)
         ImGui::End();
     }
 
+    // Show the CMD send timing
+    {
+        ImGui::Begin("CMD send timing");
+
+        // Send rate, only applied when the slider is released
+        ImGui::SliderInt("Send rate (Hz)", values.sendRate, 1, SEND_RATE_MAX_HZ);
+        if (ImGui::IsItemDeactivatedAfterEdit()) { dataToSendTerm.sendRate = *(values.sendRate); }
+
+        schedStats* st = values.sendStats;
+        ImGui::Text("Period %u us | %llu intervals | %llu missed periods", st->periodUs, (unsigned long long)st->sent, (unsigned long long)st->missed);
+        if (st->sent)
+        {
+            ImGui::Text("Deviation: mean %.1f us | stddev %.1f us | min %d us | max %d us", st->meanUs, sched_stddev_us(st), st->minUs, st->maxUs);
+        }
+
+        // Histogram of the period deviation, the middle bar is "on time"
+        float bins[JITTER_BINS];
+        for (int i = 0; i < JITTER_BINS; i++) bins[i] = (float)st->bins[i];
+        char overlay[64];
+        snprintf(overlay, sizeof(overlay), "%d .. %d us, %d us bins", -(JITTER_BINS / 2) * JITTER_BIN_US, (JITTER_BINS / 2) * JITTER_BIN_US, JITTER_BIN_US);
+        ImGui::PlotHistogram("##jitter", bins, JITTER_BINS, 0, overlay, 0.0f, FLT_MAX, ImVec2(-FLT_MIN, 120));
+
+        // Stick-to-wire latency, the kernel event time of a change until its CMD was written
+        joyLatency* lat = values.joyLat;
+        ImGui::Separator();
+        ImGui::Text("Stick change sends: %llu | latency samples: %llu", (unsigned long long)st->changeSent, (unsigned long long)lat->count);
+        if (lat->count)
+        {
+            ImGui::Text("Latency: mean %.0f us | stddev %.0f us | min %u us | max %u us", lat->meanUs,
+                joyLatencyStddev(lat), lat->minUs, lat->maxUs);
+        }
+        float latBins[JOY_LAT_BINS];
+        for (int i = 0; i < JOY_LAT_BINS; i++) latBins[i] = (float)lat->bins[i];
+        snprintf(overlay, sizeof(overlay), "0 .. %d ms, %d us bins", (JOY_LAT_BINS - 1) * JOY_LAT_BIN_US / 1000, JOY_LAT_BIN_US);
+        ImGui::PlotHistogram("##joylatency", latBins, JOY_LAT_BINS, 0, overlay, 0.0f, FLT_MAX, ImVec2(-FLT_MIN, 120));
+
+        ImGui::End();
+    }
+
+    // Show the round trip times of both links
+    {
+        static const char* linkNames[2] = {"UART", "Bluetooth"};
+
+        ImGui::Begin("Link latency");
+
+        for (int link = UART; link <= BLUETOOTH; link++)
+        {
+            const linkStats* l = &values.links[link];
+
+            ImGui::Text("%s: %llu PINGs sent | %llu PONGs received", linkNames[link], (unsigned long long)l->sent, (unsigned long long)l->received);
+            if (l->received)
+            {
+                ImGui::Text("RTT: last %u us | mean %.0f us | stddev %.0f us | min %u us | max %u us", l->lastUs, l->meanUs, ping_stddev_us(l), l->minUs, l->maxUs);
+                ImGui::Text("On the drone: %u us | telemetry age: last %d us, mean %.0f us", l->droneUs, l->telemLastUs, l->telemMeanUs);
+            }
+
+            float bins[RTT_BINS];
+            for (int i = 0; i < RTT_BINS; i++) bins[i] = (float)l->bins[i];
+            char overlay[64];
+            snprintf(overlay, sizeof(overlay), "0 .. %d ms, %d us bins", (RTT_BINS - 1) * RTT_BIN_US / 1000, RTT_BIN_US);
+            ImGui::PushID(link);
+            ImGui::PlotHistogram("##rtt", bins, RTT_BINS, 0, overlay, 0.0f, FLT_MAX, ImVec2(-FLT_MIN, 100));
+            ImGui::PopID();
+        }
+
+        ImGui::End();
+    }
+
+    // Show the telemetry plots
+    {
+        ImGui::Begin("Telemetry plots");
+
+        ImGui::SetNextItemWidth(100);
+        ImGui::Combo("Time window", values.plotWindow, plotWindowNames, IM_ARRAYSIZE(plotWindowNames));
+        ImGui::SameLine();
+        if (ImGui::Button("Clear"))
+        {
+            telemHistory* h = values.history;
+            for (int i = 0; i < 3; i++) { h->angles[i].clear(); h->rates[i].clear(); }
+            for (int i = 0; i < 4; i++) h->motors[i].clear();
+            h->pressure.clear();
+            h->battery.clear();
+        }
+
+        // Frame time and the time spent on the plots (smoothed), to see that the plots don't slow down the GUI
+        static float plotUs = 0.0f;
+        ImGui::SameLine();
+        ImGui::Text("Frame: %.2f ms | Plots: %.0f us | %u samples", 1000.0f * ImGui::GetIO().DeltaTime, plotUs, (unsigned)values.history->battery.size());
+
+        uint64_t plotStart = get_mono_ns();
+        double tNow = plotStart / 1e9;
+        double window = plotWindows[*(values.plotWindow)];
+        telemHistory* h = values.history;
+        const ImU32 colors[4] = {IM_COL32(255, 90, 90, 255), IM_COL32(90, 255, 90, 255), IM_COL32(90, 160, 255, 255), IM_COL32(255, 220, 80, 255)};
+
+        plotSeries angles[3] = {{"phi", &h->angles[0], colors[0]}, {"theta", &h->angles[1], colors[1]}, {"psi", &h->angles[2], colors[2]}};
+        drawScrollingPlot("Angles (deg)", angles, 3, tNow, window, 120);
+
+        plotSeries rates[3] = {{"sp", &h->rates[0], colors[0]}, {"sq", &h->rates[1], colors[1]}, {"sr", &h->rates[2], colors[2]}};
+        drawScrollingPlot("Rates", rates, 3, tNow, window, 120);
+
+        plotSeries motors[4] = {{"ae1", &h->motors[0], colors[0]}, {"ae2", &h->motors[1], colors[1]}, {"ae3", &h->motors[2], colors[2]}, {"ae4", &h->motors[3], colors[3]}};
+        drawScrollingPlot("Motors", motors, 4, tNow, window, 120);
+
+        plotSeries pressure = {"pressure", &h->pressure, colors[2]};
+        drawScrollingPlot("Pressure", &pressure, 1, tNow, window, 80);
+
+        plotSeries battery = {"battery", &h->battery, colors[3]};
+        drawScrollingPlot("Battery", &battery, 1, tNow, window, 80);
+
+        plotUs = 0.95f * plotUs + 0.05f * ((get_mono_ns() - plotStart) / 1000.0f);
+
+        ImGui::End();
+    }
+
+    // Show the log browser
+    values.logBrowser->draw();
+
     // Show the text output
     {
         ImGui::Begin("Text output");
 
         ImGui::BeginDisabled(true);
         static ImGuiInputTextFlags flags = ImGuiInputTextFlags_ReadOnly;
-        ImGui::InputTextMultiline("##source", values.text, IM_ARRAYSIZE(values.text), ImVec2(-FLT_MIN, ImGui::GetTextLineHeight() * 16), flags);
+        ImGui::InputTextMultiline("##source", values.text, TEXT_LEN, ImVec2(-FLT_MIN, ImGui::GetTextLineHeight() * 16), flags);
         ImGui::EndDisabled();
 
         ImGui::End();
@@ -320,22 +483,102 @@ void drawGUI(pGuiValues values, SDL_Window* window, ImGuiIO& io)
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
     SDL_GL_SwapWindow(window);
 
-    // Put items into queue
+    // Only queue frames where something was requested. If the queue is
+    // full the main thread is stuck anyway, so the request is dropped.
+    if (dataToSendTerm.reqMode != -1 || dataToSendTerm.chgP || dataToSendTerm.chgP1 ||
+        dataToSendTerm.chgP2 || dataToSendTerm.chgHei || dataToSendTerm.sendRate != -1)
     {
-        // Lock with lock_guard
-        std::lock_guard<std::mutex> myLock(syncToTerm);
+        if (!qToTerm.push(dataToSendTerm)) printf("GUI request dropped, terminal queue full\n");
+    }
 
-        qToTerm.push(dataToSendTerm);
+    return;
+}
 
-        // Unlocks as lock_guard goes out of scope
+/**
+ * @brief Appends received text to the text window buffer. When the buffer
+ * is full the oldest half is thrown away (cut at a line end), so the
+ * newest messages are always visible.
+ * @param char* Text window buffer (TEXT_LEN long, null terminated)
+ * @param size_t* Current length of the text in the buffer
+ * @param char* New text (not null terminated)
+ * @param size_t Length of the new text
+ */
+void appendGuiText(char* text, size_t* textLen, const char* src, size_t len)
+{
+    if (len >= TEXT_LEN / 2) return;
+
+    if (*textLen + len >= TEXT_LEN)
+    {
+        const char* cut = (const char*)memchr(text + *textLen / 2, '\n', *textLen - *textLen / 2);
+        size_t drop = cut ? (size_t)(cut - text) + 1 : *textLen / 2;
+        memmove(text, text + drop, *textLen - drop);
+        *textLen -= drop;
     }
 
-    return;
+    memcpy(text + *textLen, src, len);
+    *textLen += len;
+    text[*textLen] = '\0';
+}
+
+/**
+ * @brief Maps the joystick part of the command into the symmetric
+ * percent range shown by the GUI
+ * @param uint8_t* Pointer to pilotCmd array
+ * @param float* Pitch, roll, yaw, throttle
+ */
+void joyToGui(const uint8_t* pilotCmd, float* joy)
+{
+    // Pitch
+    if (pilotCmd[3] == 127) joy[0] = 0.0f;
+    else if (pilotCmd[3] < 127) joy[0] = (float)((pilotCmd[3] - 127) / 127.0f * 100.0f);
+    else joy[0] = (float)((pilotCmd[3] - 127) / 128.0f * 100.0f);
+
+    // Roll
+    if (pilotCmd[2] == 127) joy[1] = 0.0f;
+    else if (pilotCmd[2] < 127) joy[1] = (float)((pilotCmd[2] - 127) / 127.0f * 100.0f);
+    else joy[1] = (float)((pilotCmd[2] - 127) / 128.0f * 100.0f);
+
+    // Yaw
+    if (pilotCmd[4] == 127) joy[2] = 0.0f;
+    else if (pilotCmd[4] < 127) joy[2] = (float)((pilotCmd[4] - 127) / 127.0f * 100.0f);
+    else joy[2] = (float)((pilotCmd[4] - 127) / 128.0f * 100.0f);
+
+    // Throttle
+    joy[3] = (float)(pilotCmd[5] / 255.0f * 100);
+}
+
+/**
+ * @brief Queues the telemetry or attitude sample that was just received
+ * for the plots (dropped if the GUI stalls). Called after every received
+ * character, several ATT messages can arrive in one loop cycle.
+ * @param telemSample* Sample filled by processMsgGui()
+ * @param uint32_t* Sequence number of the last queued telemetry
+ * @param uint32_t* Sequence number of the last queued attitude
+ */
+void queueTelemPoint(const telemSample* telem, uint32_t* lastSeq, uint32_t* lastAttSeq)
+{
+    telemPoint tp;
+
+    if (telem->attSeq != *lastAttSeq)
+    {
+        *lastAttSeq = telem->attSeq;
+        tp.attitude = true;
+    }
+    else if (telem->seq != *lastSeq)
+    {
+        *lastSeq = telem->seq;
+        tp.attitude = false;
+    }
+    else return;
+
+    tp.t = get_mono_ns() / 1e9;
+    tp.s = *telem;
+    telemToGui.push(tp);
 }
 
 /**
  * @brief Thread function for GUI. Runs completely separated from
- * the PC terminal. Gets and sends the values in mutex protected queues.
+ * the PC terminal. Gets and sends the values through lock-free channels.
  * @author Kristóf
  */
 void guiThread()
@@ -394,6 +637,20 @@ void guiThread()
     static float joy[4] = {0, 0, 0, 0};
 
     static char text[TEXT_LEN] = "Messages output:\n";
+    size_t textLen = strlen(text);
+
+    // CMD send rate and its statistics
+    static int sendRate = SEND_RATE_HZ;
+    static schedStats sendStats = {};
+    static joyLatency joyLat = {};
+    static linkStats links[2] = {};
+
+    // Telemetry history and the selected plot time window
+    static telemHistory history;
+    static int plotWindow = 1;
+
+    // Viewer of the downloaded log files
+    static LogBrowser logBrowser;
     
     // Struct to pass values to draw function (also fill the struct)
     pGuiValues guiValues;
@@ -403,6 +660,13 @@ void guiThread()
     guiValues.motorValues = motorValues;
     guiValues.joy = joy;
     guiValues.text = text;
+    guiValues.sendRate = &sendRate;
+    guiValues.sendStats = &sendStats;
+    guiValues.joyLat = &joyLat;
+    guiValues.links = links;
+    guiValues.history = &history;
+    guiValues.plotWindow = &plotWindow;
+    guiValues.logBrowser = &logBrowser;
 
     printf("GUI started\n");
 
@@ -424,30 +688,51 @@ void guiThread()
                 done = true;
         }
 
-        // Get items from queue
+        // Take the newest state snapshot (if there is a new one)
+        if (stateToGui.fetch())
         {
-            // Lock with lock_guard
-            std::lock_guard<std::mutex> myLock(syncToGui);
+            const guiState& st = stateToGui.front();
+            reqMode = st.reqMode;
+            ackMode = st.ackMode;
+            for (uint8_t i = 0; i < 4; i++)
+            {
+                motorValues[i] = st.motorValues[i];
+                joy[i] = st.joy[i];
+            }
+            p = (int)st.gains[0];
+            p1 = (int)st.gains[1];
+            p2 = (int)st.gains[2];
+            hei = (int)st.gains[3];
+            sendStats = st.sendStats;
+            joyLat = st.joyLat;
+            links[UART] = st.links[UART];
+            links[BLUETOOTH] = st.links[BLUETOOTH];
+        }
 
-            // Save all values from the queue
-            while (!qToGUI.empty())
+        // Store the telemetry received since the last frame
+        telemPoint tp;
+        while (telemToGui.pop(tp))
+        {
+            if (tp.attitude)
             {
-                toGUI rec = qToGUI.front();
-                if (rec.reqMode != -1) reqMode = (uint8_t)rec.reqMode;
-                if (rec.ackMode != -1) ackMode = (uint8_t)rec.ackMode;
-                for (uint8_t i = 0; i < 4; i++)
+                for (int i = 0; i < 3; i++)
                 {
-                    if (rec.motorValues[i] != -1000.0f) motorValues[i] = rec.motorValues[i];
-                    if (rec.joy[i] != -1000.0f) joy[i] = rec.joy[i];
+                    history.angles[i].add(tp.t, tp.s.angles[i]);
+                    history.rates[i].add(tp.t, tp.s.rates[i]);
                 }
-                if (strlen(rec.text) > 0) strncpy(text, rec.text, TEXT_LEN);
-                if (rec.p != -1000) p = (int)rec.p;
-                if (rec.p1 != -1000) p1 = (int)rec.p1;
-                if (rec.p2 != -1000) p2 = (int)rec.p2;
-                if (rec.hei != -1000) hei = (int)rec.hei;
-                qToGUI.pop();
+                continue;
             }
-            // Unlocks as lock_guard goes out of scope
+            for (int i = 0; i < 4; i++) history.motors[i].add(tp.t, tp.s.motors[i]);
+            history.pressure.add(tp.t, tp.s.pressure);
+            history.battery.add(tp.t, tp.s.battery);
+        }
+
+        // Append the text received since the last frame
+        char chunk[TEXT_CHUNK];
+        size_t len;
+        while ((len = textToGui.pop(chunk, sizeof(chunk))) > 0)
+        {
+            appendGuiText(text, &textLen, chunk, len);
         }
 
         // Draw the windows
@@ -455,6 +740,7 @@ void guiThread()
     }
 
     // Clean up GUI
+    logBrowser.close();
     cleanUpGUI(window, gl_context);
 
     printf("GUI closed\n");
@@ -470,8 +756,28 @@ void guiThread()
  * Handles PC-drone communication, processes keyboard inputs.
  * @author Kristóf
  */
-int main(int, char**) 
+int main(int argc, char** argv) 
 {
+    // Options: capture the received bytes or replay a capture instead of the ports
+    const char* captureFile = NULL;
+    const char* replayFile = NULL;
+    double replaySpeed = 1.0;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:r:s:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'c': captureFile = optarg; break;
+            case 'r': replayFile = optarg; break;
+            case 's': replaySpeed = atof(optarg); break;
+            default:
+                printf("Usage: %s [-c capture file | -r replay file [-s speed, 0 = as fast as possible]]\n", argv[0]);
+                return -1;
+        }
+    }
+    if (replayFile != NULL && !replay_open(replayFile, replaySpeed)) return -1;
+    if (captureFile != NULL && replayFile == NULL && !capture_open(captureFile)) return -1;
+
     // Init console
     term_initio();
 	term_puts("\nTerminal program - Embedded Real-Time Systems\n");
@@ -496,17 +802,28 @@ int main(int, char**)
     // State machine for receiving by uart
     recMachine SSM;
     SSM.actualState = START;
+    SSM.link = UART;
 
     // State machine for receiving by bluetooth
     recMachine BSM;
     BSM.actualState = START;
+    BSM.link = BLUETOOTH;
 
     // Initialize GUI variables
     static int16_t gains[4] = {P_VALUE, P1_VALUE, P2_VALUE, HEIGHT_GAIN};
     static uint8_t ackMode = 0;
     static float motorValues[4] = { 0.00f, 0.00f, 0.00f, 0.00f };
     static float joy[4] = {0, 0, 0, 0}; // Pitch, roll, yaw, throttle
-    static char text[TEXT_LEN] = "Messages output:\n";
+    static char text[TEXT_LEN] = ""; // Only collects the text of one loop cycle
+    static telemSample telem = {};
+    uint32_t lastTelemSeq = 0;
+    uint32_t lastAttSeq = 0;
+
+    // State published to the GUI thread
+    guiState state = {};
+    state.reqMode = SafeMode;
+    state.ackMode = SafeMode;
+    for (int i = 0; i < 4; i++) state.gains[i] = gains[i];
 
     // Struct to pass the pointers
     pointers pointers;
@@ -514,6 +831,7 @@ int main(int, char**)
     pointers.motorValues = motorValues;
     pointers.ackMode = &ackMode;
     pointers.gains = gains;
+    pointers.telem = &telem;
 
     // Open /dev/ttyUSB0
 	serial_port_open(SERIAL_PORT);
@@ -524,7 +842,7 @@ int main(int, char**)
 		printf("Joystick not found, disabling joystick controll\n");
 		joystickFound = false;
 
-		if(!DEBUG_MODE) {
+		if(!DEBUG_MODE && !replay_active()) {
 			return -1;
 		}
 	}
@@ -539,15 +857,21 @@ int main(int, char**)
     i16_to_ui8(gains[3], &config[6]);
 	packMessage(CFG, config);
 
-    // Set before time
-	struct timeval tval_before, tval_after, tval_result;
-	gettimeofday(&tval_before, NULL);
+    // Periodic timer for sending the CMD messages
+    if (sched_open(SEND_RATE_HZ) == -1)
+    {
+        printf("Couldn't create the send timer\n");
+        return -1;
+    }
+    sched_get_stats(&state.sendStats);
+    stateToGui.back() = state;
+    stateToGui.publish();
 
     // Start thread
     gui = std::thread(guiThread);
     
-    // Open TCP socket -> for processing
-	openSocket();
+    // Attitude stream for the viewers (processing/drone_view)
+	att_stream_open(ATT_STREAM_PORT);
 
     // Variables for short-term usage
     int res;
@@ -557,38 +881,51 @@ int main(int, char**)
     bool done = false;
     while (!done)
     {
-        // Structure which we can be pushed into the queue
-        toGUI dataToSendGUI;
+        // Sleep until a key, a received byte or the send timer wakes us up.
+        // The timeout keeps the GUI requests served when nothing else happens.
+        struct pollfd fds[5];
+        int nfds = 0;
+        fds[nfds].fd = 0; fds[nfds++].events = POLLIN;
+        fds[nfds].fd = sched_get_fd(); fds[nfds++].events = POLLIN;
+        if (joystickFound) { fds[nfds].fd = get_fd_joy(); fds[nfds++].events = POLLIN; }
+        if (get_fd_serial() != -1) { fds[nfds].fd = get_fd_serial(); fds[nfds++].events = POLLIN; }
+        if (get_fd_ble() != -1) { fds[nfds].fd = get_fd_ble(); fds[nfds++].events = POLLIN; }
+        int timeout = 10;
+        if (replay_active() && replay_timeout_ms() >= 0 && replay_timeout_ms() < timeout) timeout = replay_timeout_ms();
+        if (joystickFound && joyChanged() && sched_change_holdoff_ms() < timeout) timeout = sched_change_holdoff_ms();
+        if (ping_timeout_ms() >= 0 && ping_timeout_ms() < timeout) timeout = ping_timeout_ms();
+        if (poll(fds, nfds, timeout) == -1 && errno != EINTR)
+        {
+            perror("poll");
+            break;
+        }
+
+        // Publish a new snapshot only if something changed
+        bool stateChanged = false;
 
         // Process keys (like in pc_terminal)
         if ((c = term_getchar_nb()) != -1)
 		{
             int8_t ret = processKeyboard(c, pilotCmd);
-			if(ret != -1) dataToSendGUI.reqMode = ret;
+			if(ret != -1) { state.reqMode = ret; stateChanged = true; }
 		}
 
         // We set it to 9 as it is not a possible mode. If it stays 9, there was no mode request from the GUI side
         uint8_t modeChgFromGui = 9;
-        // Get items from queue
+        // Get the requests of the GUI
+        toTerm rec;
+        while (qToTerm.pop(rec))
         {
-            // Lock with lock_guard
-            std::lock_guard<std::mutex> myLock(syncToTerm);
-
-            while (!qToTerm.empty())
-            {
-                toTerm rec = qToTerm.front();
-                if (rec.reqMode != -1) modeChgFromGui = (uint8_t)rec.reqMode;
-                if (rec.chgP    ==  1)  pilotCmd[1] |= (0x01 << 5); // U key
-                if (rec.chgP    == -1)  pilotCmd[1] |= (0x01 << 4); // J key
-                if (rec.chgP1   ==  1)  pilotCmd[1] |= (0x01 << 3); // I key
-                if (rec.chgP1   == -1)  pilotCmd[1] |= (0x01 << 2); // K key
-                if (rec.chgP2   ==  1)  pilotCmd[1] |= (0x01 << 1); // O key
-                if (rec.chgP2   == -1)  pilotCmd[1] |=  0x01;       // L key
-                if (rec.chgHei  ==  1)  pilotCmd[6] |= (0x01 << 1); // Y key
-                if (rec.chgHei  == -1)  pilotCmd[6] |=  0x01;       // H key
-                qToTerm.pop();
-            }
-            // Unlocks as lock_guard goes out of scope
+            if (rec.reqMode != -1) modeChgFromGui = (uint8_t)rec.reqMode;
+            if (rec.chgP    ==  1)  pilotCmd[1] |= (0x01 << 5); // U key
+            if (rec.chgP    == -1)  pilotCmd[1] |= (0x01 << 4); // J key
+            if (rec.chgP1   ==  1)  pilotCmd[1] |= (0x01 << 3); // I key
+            if (rec.chgP1   == -1)  pilotCmd[1] |= (0x01 << 2); // K key
+            if (rec.chgP2   ==  1)  pilotCmd[1] |= (0x01 << 1); // O key
+            if (rec.chgP2   == -1)  pilotCmd[1] |=  0x01;       // L key
+            if (rec.chgHei  ==  1)  pilotCmd[6] |= (0x01 << 1); // Y key
+            if (rec.chgHei  == -1)  pilotCmd[6] |=  0x01;       // H key
+            if (rec.sendRate != -1) sched_set_rate((uint32_t)rec.sendRate);
         }
 
         // Send the mode change to the drone and set the requested mode
@@ -596,7 +933,8 @@ int main(int, char**)
         {
             if (get_fd_serial() == -1) serial_port_open(SERIAL_PORT);
             packMessage(MODE, &modeChgFromGui);
-            dataToSendGUI.reqMode = modeChgFromGui;
+            state.reqMode = modeChgFromGui;
+            stateChanged = true;
         }
         else if (modeChgFromGui == 8)
         {
@@ -607,7 +945,8 @@ int main(int, char**)
             if (get_fd_ble() != -1)
             {
                 packMessage(MODE, &modeChgFromGui);
-                dataToSendGUI.reqMode = modeChgFromGui;
+                state.reqMode = modeChgFromGui;
+                stateChanged = true;
             }
             else
             {
@@ -616,52 +955,45 @@ int main(int, char**)
         }
         
 
-        // Check elapsed time -> for periodic sending
-        gettimeofday(&tval_after, NULL);
-        timersub(&tval_after, &tval_before, &tval_result);
-        double time_elapsed = ((double)tval_result.tv_sec*1000.0f) + ((double)tval_result.tv_usec/1000.0f);
+        // Latency probe on the active link
+        ping_poll();
 
-        // Send if more time elapsed then SEND_RATE_MS
-        if (time_elapsed > SEND_RATE_MS)
+        // Read joystick axes and buttons as soon as they change
+        if (joystickFound) {
+            readJoyEvents();
+        }
+
+        // A significant stick change is sent right away (rate limited by
+        // CMD_CHANGE_MIN_MS), the periodic send keeps the link alive
+        bool changeSend = joystickFound && joyChanged() && sched_change_holdoff_ms() == 0;
+        bool periodicSend = sched_expired() != 0;
+        if (changeSend || periodicSend)
         {
-            // Read joystick axes and buttons
             if(joystickFound) {
-                getJoyValues(pilotCmd);
+                fillJoyCmd(pilotCmd);
             }
 
             // Map into symmetric range for GUI
-            // Pitch
-            if (pilotCmd[3] == 127) joy[0] = 0.0f;
-            else if (pilotCmd[3] < 127) joy[0] = (float)((pilotCmd[3] - 127) / 127.0f * 100.0f);
-            else joy[0] = (float)((pilotCmd[3] - 127) / 128.0f * 100.0f);
-
-            // Roll
-            if (pilotCmd[2] == 127) joy[1] = 0.0f;
-            else if (pilotCmd[2] < 127) joy[1] = (float)((pilotCmd[2] - 127) / 127.0f * 100.0f);
-            else joy[1] = (float)((pilotCmd[2] - 127) / 128.0f * 100.0f);
-
-            // Yaw
-            if (pilotCmd[4] == 127) joy[2] = 0.0f;
-            else if (pilotCmd[4] < 127) joy[2] = (float)((pilotCmd[4] - 127) / 127.0f * 100.0f);
-            else joy[2] = (float)((pilotCmd[4] - 127) / 128.0f * 100.0f);
-
-            // Throttle
-            joy[3] = (float)(pilotCmd[5] / 255.0f * 100);
-
+            joyToGui(pilotCmd, joy);
             for (int i = 0; i < 4; i++)
             {
-                dataToSendGUI.joy[i] = joy[i];
-            }       
+                state.joy[i] = joy[i];
+            }
 
             // Send the CMD message
             packMessage(CMD, pilotCmd);
+            if (periodicSend) sched_mark_sent();
+            else sched_mark_sent_change();
+            joyMarkSent();
             // Don't reset the joystick axes (2, 3, 4, 5) !!!
             pilotCmd[0] = 0;
             pilotCmd[1] = 0;
             pilotCmd[6] = 0;
 
-            // Store new before time
-            gettimeofday(&tval_before, NULL);
+            // Send timing for the GUI
+            sched_get_stats(&state.sendStats);
+            getJoyLatency(&state.joyLat);
+            stateChanged = true;
         }
 
         // Process received characters -> both serial and bluetooth
@@ -672,6 +1004,7 @@ int main(int, char**)
         {
             c = (char)res;
             ret = unpackMessageGui(c, &SSM, pointers);
+            if (ret) queueTelemPoint(&telem, &lastTelemSeq, &lastAttSeq);
             if (ret == '.') done = true;
             finishedMsg |= ret;
         }
@@ -679,45 +1012,67 @@ int main(int, char**)
         {
             c = (char)res;
             ret = unpackMessageGui(c, &BSM, pointers);
+            if (ret) queueTelemPoint(&telem, &lastTelemSeq, &lastAttSeq);
             if (ret == '.') done = true;
             finishedMsg |= ret;
         }
 
-        // Update motorValues, ackMode, text, gains if at least a message was finished (saves lots of copy instructions)
+        // Update motorValues, ackMode, gains if at least a message was finished
         if (finishedMsg)
         {
             for (int i = 0; i < 4; i++)
             {
-                dataToSendGUI.motorValues[i] = motorValues[i];
+                state.motorValues[i] = motorValues[i];
+                state.gains[i] = gains[i];
             }
-            dataToSendGUI.ackMode = ackMode;
-            strncpy(dataToSendGUI.text, text, TEXT_LEN);
-            dataToSendGUI.p = gains[0];
-            dataToSendGUI.p1 = gains[1];
-            dataToSendGUI.p2 = gains[2];
-            dataToSendGUI.hei = gains[3];
+            state.ackMode = ackMode;
+            ping_get_stats(UART, &state.links[UART]);
+            ping_get_stats(BLUETOOTH, &state.links[BLUETOOTH]);
+            stateChanged = true;
         }
 
-        // Put items into queue
+        // Hand over the new snapshot, the GUI picks up the newest one
+        if (stateChanged)
         {
-            // Lock with lock_guard
-            std::lock_guard<std::mutex> myLock(syncToGui);
+            stateToGui.back() = state;
+            stateToGui.publish();
+        }
 
-            qToGUI.push(dataToSendGUI);
+        // Stream the new text to the GUI. If the GUI stalls and the ring
+        // is full the rest is dropped instead of piling up.
+        if (text[0] != '\0')
+        {
+            textToGui.push(text, strlen(text));
+            text[0] = '\0';
+        }
 
-            // Unlocks as lock_guard goes out of scope
+        // Print the replay results once, the GUI stays open to look at the flight
+        static bool replayReported = false;
+        if (replay_finished() && !replayReported)
+        {
+            replay_print_stats(stdout);
+            replayReported = true;
         }
-        
     }
 
+    // Capture and replay
+    capture_close();
+    replay_close();
+
     // Close the serial and bluetooth port
     serial_port_close();
     ble_port_close();
     printf("Ports closed\n");
 
 
-    // Close TCP socket
-    closeSocket();
+    // Close the attitude stream
+    att_stream_close();
+
+    // Print the send statistics of the whole flight
+    sched_print_stats(stdout);
+    printJoyLatency(stdout);
+    ping_print_stats(stdout);
+    sched_close();
 
     // Waiting threads to finish
     if (gui.joinable()) 
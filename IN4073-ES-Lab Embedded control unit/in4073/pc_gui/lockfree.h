@@ -0,0 +1,108 @@
+#ifndef LOCKFREE_H__
+#define LOCKFREE_H__
+
+// Lock-free containers for passing data between the terminal (I/O) thread
+// and the GUI thread. Both are single producer / single consumer.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Triple buffer for state snapshots. The writer fills back() and
+ * publishes it, the reader always gets the newest complete snapshot.
+ * Neither side ever waits and a stalled reader only skips snapshots,
+ * so the cost per frame is one copy of T, however fast the writer is.
+ */
+template <typename T>
+class TripleBuffer
+{
+public:
+    TripleBuffer() : middle(1), backIdx(0), frontIdx(2) {}
+
+    // Writer side: fill this buffer, then call publish()
+    T& back() { return buf[backIdx]; }
+
+    void publish()
+    {
+        backIdx = middle.exchange(backIdx | DIRTY, std::memory_order_acq_rel) & INDEX;
+    }
+
+    // Reader side: true if a new snapshot was swapped into front()
+    bool fetch()
+    {
+        if (!(middle.load(std::memory_order_relaxed) & DIRTY)) return false;
+        frontIdx = middle.exchange(frontIdx, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+
+    const T& front() const { return buf[frontIdx]; }
+
+private:
+    static const uint8_t INDEX = 0x03;
+    static const uint8_t DIRTY = 0x04;
+
+    T buf[3];
+    std::atomic<uint8_t> middle;    // Index of the shared buffer + dirty flag
+    uint8_t backIdx;                // Only touched by the writer
+    uint8_t frontIdx;               // Only touched by the reader
+};
+
+/**
+ * @brief Bounded ring buffer. push() fails instead of growing when the
+ * consumer falls behind. N has to be a power of two.
+ */
+template <typename T, size_t N>
+class SpscQueue
+{
+    static_assert((N & (N - 1)) == 0, "SpscQueue size has to be a power of two");
+
+public:
+    SpscQueue() : head(0), tail(0) {}
+
+    bool push(const T& item)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == N) return false;
+        items[h & (N - 1)] = item;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& item)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) return false;
+        item = items[t & (N - 1)];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Bulk versions, return the number of items actually moved
+    size_t push(const T* src, size_t count)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t space = N - (h - tail.load(std::memory_order_acquire));
+        if (count > space) count = space;
+        for (size_t i = 0; i < count; i++) items[(h + i) & (N - 1)] = src[i];
+        head.store(h + count, std::memory_order_release);
+        return count;
+    }
+
+    size_t pop(T* dst, size_t max)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t count = head.load(std::memory_order_acquire) - t;
+        if (count > max) count = max;
+        for (size_t i = 0; i < count; i++) dst[i] = items[(t + i) & (N - 1)];
+        tail.store(t + count, std::memory_order_release);
+        return count;
+    }
+
+private:
+    T items[N];
+    std::atomic<size_t> head;   // Written by the producer
+    std::atomic<size_t> tail;   // Written by the consumer
+};
+
+#endif // LOCKFREE_H__
@@ -0,0 +1,306 @@
+#include "logview.h"
+
+#include "../imgui-master/imgui.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+#include <glob.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Rows the filter goes through per frame, keeps the frame time bounded while a big file is filtered
+#define FILTER_BUDGET (1 << 20)
+
+static const char* typeNames[LOG_TYPES] = {"Telemetry", "ModeChg", "Command", "Profiling", "Other"};
+
+/**
+ * @brief Gets the timestamp and the type of a log row.
+ * Rows look like "%10d | <type specific text>" (see processMsgGui()).
+ * @param char* Start of the row (not null terminated)
+ * @param size_t Length of the row
+ * @param logRecord* Record to fill
+ */
+static void parseRow(const char* line, size_t len, logRecord* r)
+{
+    size_t i = 0;
+    uint32_t ts = 0;
+    bool negative = false;
+
+    // The timestamp is printed with %d, so it is negative after 2^31 us
+    while (i < len && line[i] == ' ') i++;
+    if (i < len && line[i] == '-') { negative = true; i++; }
+    while (i < len && line[i] >= '0' && line[i] <= '9') ts = ts * 10 + (line[i++] - '0');
+    r->ts = negative ? (uint32_t)0 - ts : ts;
+    r->type = LOG_OTHER;
+
+    if (i + 2 >= len || line[i] != ' ' || line[i + 1] != '|') return;
+    const char* text = line + i + 3;
+    size_t rest = len - (i + 3);
+
+    if (rest >= 11 && !memcmp(text, "Mode change", 11)) r->type = LOG_MODECHG;
+    else if (rest >= 6 && !memcmp(text, "Mode: ", 6)) r->type = LOG_TELEMETRY;
+    else if (rest >= 3 && !memcmp(text, "A: ", 3)) r->type = LOG_COMMAND;
+    else if (rest >= 12 && !memcmp(text, "Control loop", 12)) r->type = LOG_PROFILING;
+}
+
+LogBrowser::LogBrowser() : data(NULL), size(0), indexed(0), bytesIndexed(0), indexDone(false), stop(false),
+    filterScanned(0), filesListed(false), selected(0), scrollToRow(-1)
+{
+    for (int i = 0; i < LOG_TYPES; i++) show[i] = true;
+    jumpText[0] = '\0';
+}
+
+LogBrowser::~LogBrowser()
+{
+    close();
+}
+
+/**
+ * @brief Maps a log file and starts indexing it in the background
+ * @param char* Path of the log file
+ * @return true on success
+ */
+bool LogBrowser::open(const char* filePath)
+{
+    close();
+
+    int fd = ::open(filePath, O_RDONLY);
+    if (fd == -1)
+    {
+        perror("Log browser open");
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size == 0)
+    {
+        printf("Log browser: %s is empty\n", filePath);
+        ::close(fd);
+        return false;
+    }
+
+    void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+    {
+        perror("Log browser mmap");
+        return false;
+    }
+    madvise(p, st.st_size, MADV_SEQUENTIAL);
+
+    data = (const char*)p;
+    size = st.st_size;
+    path = filePath;
+
+    // Every row is at least one byte, so this many chunks are always enough
+    chunks.assign(size / LOG_CHUNK + 1, NULL);
+    indexed.store(0);
+    bytesIndexed.store(0);
+    indexDone.store(false);
+    stop.store(false);
+    filtered.clear();
+    filterScanned = 0;
+    scrollToRow = -1;
+
+    thread = std::thread(&LogBrowser::indexer, this);
+    return true;
+}
+
+/**
+ * @brief Stops the indexer and unmaps the file
+ */
+void LogBrowser::close()
+{
+    stop.store(true);
+    if (thread.joinable()) thread.join();
+
+    for (size_t i = 0; i < chunks.size(); i++) delete[] chunks[i];
+    chunks.clear();
+    filtered.clear();
+    filterScanned = 0;
+    indexed.store(0);
+
+    if (data != NULL) munmap((void*)data, size);
+    data = NULL;
+    size = 0;
+}
+
+/**
+ * @brief Thread function of the indexer. Finds the row boundaries and
+ * publishes the finished rows in batches.
+ */
+void LogBrowser::indexer()
+{
+    size_t pos = 0;
+    size_t n = 0;
+
+    while (pos < size && !stop.load(std::memory_order_relaxed))
+    {
+        const char* line = data + pos;
+        const char* end = (const char*)memchr(line, '\n', size - pos);
+        size_t len = end ? (size_t)(end - line) : size - pos;
+
+        if (n % LOG_CHUNK == 0) chunks[n / LOG_CHUNK] = new logRecord[LOG_CHUNK];
+        logRecord& r = chunks[n / LOG_CHUNK][n % LOG_CHUNK];
+        r.offset = pos;
+        r.length = len > 0xFFFF ? 0xFFFF : (uint16_t)len;
+        parseRow(line, len, &r);
+
+        n++;
+        pos += len + 1;
+
+        if ((n & 0x3FF) == 0)
+        {
+            indexed.store(n, std::memory_order_release);
+            bytesIndexed.store(pos, std::memory_order_relaxed);
+        }
+    }
+
+    indexed.store(n, std::memory_order_release);
+    bytesIndexed.store(std::min(pos, size), std::memory_order_relaxed);
+    indexDone.store(true, std::memory_order_release);
+}
+
+/**
+ * @brief Adds the newly indexed rows which pass the type filter to the row list
+ * @param size_t Maximum number of rows to check now
+ */
+void LogBrowser::updateFilter(size_t budget)
+{
+    size_t n = indexed.load(std::memory_order_acquire);
+    size_t end = std::min(n, filterScanned + budget);
+
+    for (; filterScanned < end; filterScanned++)
+    {
+        if (show[record(filterScanned).type]) filtered.push_back((uint32_t)filterScanned);
+    }
+}
+
+/**
+ * @brief Finds the first shown row at or after a timestamp. Linear search,
+ * because a file can contain more flights and the drone time restarts.
+ * @param uint32_t Drone timestamp in us
+ * @return Index in the shown rows, the last one if no row is that late
+ */
+size_t LogBrowser::findTimestamp(uint32_t ts) const
+{
+    for (size_t i = 0; i < filtered.size(); i++)
+    {
+        if (record(filtered[i]).ts >= ts) return i;
+    }
+    return filtered.empty() ? 0 : filtered.size() - 1;
+}
+
+/**
+ * @brief Lists the log files in the working directory (newest name last)
+ */
+void LogBrowser::findLogFiles()
+{
+    glob_t g;
+    files.clear();
+    if (glob("log_*.txt", 0, NULL, &g) == 0)
+    {
+        for (size_t i = 0; i < g.gl_pathc; i++) files.push_back(g.gl_pathv[i]);
+    }
+    globfree(&g);
+    if (selected >= (int)files.size()) selected = files.empty() ? 0 : (int)files.size() - 1;
+}
+
+/**
+ * @brief Draws the log browser window. Only the visible rows are read
+ * from the mapped file, using ImGuiListClipper.
+ */
+void LogBrowser::draw()
+{
+    // Select the newest log the first time
+    if (!filesListed)
+    {
+        findLogFiles();
+        if (!files.empty()) selected = (int)files.size() - 1;
+        filesListed = true;
+    }
+
+    ImGui::Begin("Log browser");
+
+    // File selection
+    ImGui::SetNextItemWidth(300);
+    if (ImGui::BeginCombo("##file", files.empty() ? "No log files" : files[selected].c_str()))
+    {
+        for (int i = 0; i < (int)files.size(); i++)
+        {
+            if (ImGui::Selectable(files[i].c_str(), i == selected)) selected = i;
+        }
+        ImGui::EndCombo();
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Refresh")) findLogFiles();
+    ImGui::SameLine();
+    if (ImGui::Button("Open") && !files.empty()) open(files[selected].c_str());
+
+    if (data == NULL)
+    {
+        ImGui::End();
+        return;
+    }
+
+    // Indexing progress
+    size_t rows = indexed.load(std::memory_order_acquire);
+    if (indexDone.load(std::memory_order_acquire))
+    {
+        ImGui::Text("%s: %.1f MB, %zu rows", path.c_str(), size / 1e6, rows);
+    }
+    else
+    {
+        ImGui::Text("%s: indexing %.0f%% (%zu rows)", path.c_str(), 100.0 * bytesIndexed.load(std::memory_order_relaxed) / size, rows);
+    }
+
+    // Type filter, the row list is rebuilt (over more frames) when it changes
+    bool filterChanged = false;
+    for (int i = 0; i < LOG_TYPES; i++)
+    {
+        if (i) ImGui::SameLine();
+        filterChanged |= ImGui::Checkbox(typeNames[i], &show[i]);
+    }
+    if (filterChanged)
+    {
+        filtered.clear();
+        filterScanned = 0;
+    }
+    updateFilter(FILTER_BUDGET);
+
+    // Jump to timestamp
+    ImGui::SetNextItemWidth(120);
+    bool jump = ImGui::InputText("Timestamp (us)", jumpText, sizeof(jumpText), ImGuiInputTextFlags_CharsDecimal | ImGuiInputTextFlags_EnterReturnsTrue);
+    ImGui::SameLine();
+    jump |= ImGui::Button("Go");
+    if (jump && jumpText[0] != '\0') scrollToRow = (long)findTimestamp((uint32_t)strtoul(jumpText, NULL, 10));
+    ImGui::SameLine();
+    ImGui::Text("%zu rows shown", filtered.size());
+
+    // Rows
+    ImGui::BeginChild("rows", ImVec2(0, 0), true, ImGuiWindowFlags_HorizontalScrollbar);
+    if (scrollToRow >= 0)
+    {
+        ImGui::SetScrollY(scrollToRow * ImGui::GetTextLineHeightWithSpacing());
+        scrollToRow = -1;
+    }
+    ImGuiListClipper clipper;
+    clipper.Begin((int)filtered.size());
+    while (clipper.Step())
+    {
+        for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++)
+        {
+            const logRecord& r = record(filtered[i]);
+            ImGui::TextUnformatted(data + r.offset, data + r.offset + r.length);
+        }
+    }
+    clipper.End();
+    ImGui::EndChild();
+
+    ImGui::End();
+}
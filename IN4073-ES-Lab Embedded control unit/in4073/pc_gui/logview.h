@@ -0,0 +1,86 @@
+#ifndef LOGVIEW_H__
+#define LOGVIEW_H__
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+// Record types of the log file, the same order as logType in protocol.h
+// (LOG_OTHER covers "Flash is full", invalid rows and anything unparsable)
+enum
+{
+    LOG_TELEMETRY,
+    LOG_MODECHG,
+    LOG_COMMAND,
+    LOG_PROFILING,
+    LOG_OTHER,
+    LOG_TYPES
+};
+
+// One row of the log file
+typedef struct
+{
+    uint64_t offset;    // Start of the row in the file
+    uint32_t ts;        // Drone timestamp (us) at the start of the row
+    uint16_t length;    // Length without the line end
+    uint8_t type;       // LOG_TELEMETRY .. LOG_OTHER
+} logRecord;
+
+// Records are stored in fixed size chunks, so the GUI can read the
+// finished ones while the indexer thread is still adding new ones
+#define LOG_CHUNK 65536
+
+/**
+ * @brief Browser for the log_*.txt files written by the LOG handler.
+ * The file is memory-mapped and indexed on a background thread, only the
+ * visible rows are ever touched by the GUI.
+ */
+class LogBrowser
+{
+public:
+    LogBrowser();
+    ~LogBrowser();
+
+    bool open(const char* path);
+    void close();
+
+    // Draws the "Log browser" window, called every frame from the GUI thread
+    void draw();
+
+private:
+    const logRecord& record(size_t i) const { return chunks[i / LOG_CHUNK][i % LOG_CHUNK]; }
+    void indexer();
+    void updateFilter(size_t budget);
+    void findLogFiles();
+    size_t findTimestamp(uint32_t ts) const;
+
+    // Mapped file
+    const char* data;
+    size_t size;
+    std::string path;
+
+    // Index, written by the indexer thread
+    std::vector<logRecord*> chunks;
+    std::atomic<size_t> indexed;
+    std::atomic<size_t> bytesIndexed;
+    std::atomic<bool> indexDone;
+    std::atomic<bool> stop;
+    std::thread thread;
+
+    // Filtered row list, only used by the GUI thread
+    bool show[LOG_TYPES];
+    std::vector<uint32_t> filtered;
+    size_t filterScanned;
+
+    // Controls
+    std::vector<std::string> files;
+    bool filesListed;
+    int selected;
+    char jumpText[16];
+    long scrollToRow;
+};
+
+#endif // LOGVIEW_H__
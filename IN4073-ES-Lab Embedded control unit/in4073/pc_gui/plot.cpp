@@ -0,0 +1,141 @@
+#include "plot.h"
+
+#include <cfloat>
+#include <cstdio>
+
+/**
+ * @brief Appends a sample, overwrites the oldest one when the buffer is full.
+ * Times have to be increasing.
+ * @param double Time of the sample in seconds
+ * @param float Value of the sample
+ */
+void ScrollingBuffer::add(double time, float value)
+{
+    size_t idx = (start + count) % PLOT_HISTORY;
+    t[idx] = time;
+    v[idx] = value;
+
+    if (count < PLOT_HISTORY) count++;
+    else start = (start + 1) % PLOT_HISTORY;
+}
+
+/**
+ * @brief Binary search for the first sample which is not older than the given time
+ * @param double Time in seconds
+ * @return Index of the sample, size() if all samples are older
+ */
+size_t ScrollingBuffer::lowerBound(double time) const
+{
+    size_t lo = 0, hi = count;
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (this->time(mid) < time) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/**
+ * @brief Draws a scrolling line plot with the ImGui draw list. Samples are
+ * reduced to the min and max of every pixel column, so at most two points
+ * per column are drawn however many samples are in the window.
+ * @param char* Label shown in the top left corner (also the ImGui ID)
+ * @param plotSeries* Lines to draw
+ * @param int Number of lines
+ * @param double Right edge of the plot in seconds
+ * @param double Width of the plot in seconds
+ * @param float Height of the plot in pixels
+ */
+void drawScrollingPlot(const char* label, const plotSeries* series, int count, double tNow, double window, float height)
+{
+    ImDrawList* drawList = ImGui::GetWindowDrawList();
+    ImVec2 p0 = ImGui::GetCursorScreenPos();
+    float width = ImGui::GetContentRegionAvail().x;
+    if (width < 50.0f) width = 50.0f;
+    ImVec2 p1 = ImVec2(p0.x + width, p0.y + height);
+    int columns = (int)width;
+    double tStart = tNow - window;
+
+    ImGui::InvisibleButton(label, ImVec2(width, height));
+    drawList->AddRectFilled(p0, p1, IM_COL32(20, 20, 20, 255));
+    drawList->AddRect(p0, p1, IM_COL32(90, 90, 90, 255));
+
+    // Y range of the visible samples
+    float yMin = FLT_MAX, yMax = -FLT_MAX;
+    for (int s = 0; s < count; s++)
+    {
+        const ScrollingBuffer* d = series[s].data;
+        for (size_t i = d->lowerBound(tStart); i < d->size(); i++)
+        {
+            float v = d->value(i);
+            if (v < yMin) yMin = v;
+            if (v > yMax) yMax = v;
+        }
+    }
+    if (yMin > yMax) { yMin = -1.0f; yMax = 1.0f; }
+    if (yMax - yMin < 1e-3f) { yMin -= 1.0f; yMax += 1.0f; }
+    float margin = (yMax - yMin) * 0.05f;
+    yMin -= margin; yMax += margin;
+    float yScale = (height - 2.0f) / (yMax - yMin);
+
+    // Zero line if it is visible
+    if (yMin < 0.0f && yMax > 0.0f)
+    {
+        float y0 = p1.y - 1.0f - (0.0f - yMin) * yScale;
+        drawList->AddLine(ImVec2(p0.x, y0), ImVec2(p1.x, y0), IM_COL32(60, 60, 60, 255));
+    }
+
+    drawList->PushClipRect(p0, p1, true);
+
+    ImVector<ImVec2> points;
+    points.reserve(2 * columns + 2);
+    for (int s = 0; s < count; s++)
+    {
+        const ScrollingBuffer* d = series[s].data;
+        size_t i = d->lowerBound(tStart);
+        points.resize(0);
+
+        // Min/max decimation: one column at a time
+        while (i < d->size())
+        {
+            int col = (int)((d->time(i) - tStart) / window * columns);
+            if (col >= columns) col = columns - 1;
+            size_t iMin = i, iMax = i;
+            for (i++; i < d->size(); i++)
+            {
+                int c = (int)((d->time(i) - tStart) / window * columns);
+                if (c >= columns) c = columns - 1;
+                if (c != col) break;
+                if (d->value(i) < d->value(iMin)) iMin = i;
+                if (d->value(i) > d->value(iMax)) iMax = i;
+            }
+
+            // Keep the order of the extremes, so the line goes through them as they happened
+            float x = p0.x + col + 0.5f;
+            size_t first = iMin < iMax ? iMin : iMax;
+            size_t last = iMin < iMax ? iMax : iMin;
+            points.push_back(ImVec2(x, p1.y - 1.0f - (d->value(first) - yMin) * yScale));
+            if (last != first) points.push_back(ImVec2(x, p1.y - 1.0f - (d->value(last) - yMin) * yScale));
+        }
+
+        if (points.Size > 1) drawList->AddPolyline(points.Data, points.Size, series[s].color, 0, 1.0f);
+    }
+
+    drawList->PopClipRect();
+
+    // Label, legend and range
+    char text[64];
+    ImVec2 pos = ImVec2(p0.x + 4.0f, p0.y + 2.0f);
+    drawList->AddText(pos, IM_COL32(200, 200, 200, 255), label);
+    pos.x += ImGui::CalcTextSize(label).x + 12.0f;
+    for (int s = 0; s < count; s++)
+    {
+        drawList->AddText(pos, series[s].color, series[s].name);
+        pos.x += ImGui::CalcTextSize(series[s].name).x + 8.0f;
+    }
+    snprintf(text, sizeof(text), "%.1f", yMax);
+    drawList->AddText(ImVec2(p1.x - ImGui::CalcTextSize(text).x - 4.0f, p0.y + 2.0f), IM_COL32(150, 150, 150, 255), text);
+    snprintf(text, sizeof(text), "%.1f", yMin);
+    drawList->AddText(ImVec2(p1.x - ImGui::CalcTextSize(text).x - 4.0f, p1.y - ImGui::GetTextLineHeight() - 2.0f), IM_COL32(150, 150, 150, 255), text);
+}
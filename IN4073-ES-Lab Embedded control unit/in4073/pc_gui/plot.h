@@ -0,0 +1,50 @@
+#ifndef PLOT_H__
+#define PLOT_H__
+
+#include <cstddef>
+#include <cstdint>
+
+#include "../imgui-master/imgui.h"
+
+// Samples kept per channel: the longest plot window (5 minutes) of the
+// 100 Hz attitude (ATT), the 1 Hz telemetry channels keep over 9 hours
+#define PLOT_HISTORY 32768
+
+/**
+ * @brief Fixed capacity history of one telemetry channel. When it is
+ * full the oldest sample is overwritten, nothing is ever allocated.
+ */
+class ScrollingBuffer
+{
+public:
+    ScrollingBuffer() : start(0), count(0) {}
+
+    void add(double t, float v);
+    void clear() { start = 0; count = 0; }
+
+    size_t size() const { return count; }
+    double time(size_t i) const { return t[(start + i) % PLOT_HISTORY]; }
+    float value(size_t i) const { return v[(start + i) % PLOT_HISTORY]; }
+
+    // Index of the first sample at or after the given time
+    size_t lowerBound(double time) const;
+
+private:
+    double t[PLOT_HISTORY];
+    float v[PLOT_HISTORY];
+    size_t start;
+    size_t count;
+};
+
+// One line of a plot
+typedef struct
+{
+    const char* name;
+    const ScrollingBuffer* data;
+    ImU32 color;
+} plotSeries;
+
+// Scrolling line plot of the last 'window' seconds (ending at tNow)
+void drawScrollingPlot(const char* label, const plotSeries* series, int count, double tNow, double window, float height);
+
+#endif // PLOT_H__
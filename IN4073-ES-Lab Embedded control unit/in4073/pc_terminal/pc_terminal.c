@@ -18,13 +18,17 @@
 #include "../communication/protocol.h"
 #include "../communication/joy.h"
 #include "../communication/config.h"
+#include "../communication/scheduler.h"
+#include "../communication/capture.h"
+#include "../communication/attstream.h"
+#include "../communication/ping.h"
 
 // Timer for periodic stuff
 #include <signal.h>
 #include <errno.h>
 #include <stdlib.h>
 #include <signal.h>
-#include <sys/time.h>
+#include <poll.h>
 
 /*----------------------------------------------------------------
  * main -- execute terminal
@@ -56,32 +60,64 @@ int main(int argc, char **argv)
 	// State machine for receiving by uart
 	recMachine SSM;
 	SSM.actualState = START;
+	SSM.link = UART;
 
 	// State machine for receiving by bluetooth
 	recMachine BSM;
 	BSM.actualState = START;
+	BSM.link = BLUETOOTH;
 
 	term_initio();
 	term_puts("\nTerminal program - Embedded Real-Time Systems\n");
 
-	// If no argument is given at execution time, /dev/ttyUSB0 is assumed
+	// Options: capture the received bytes or replay a capture instead of the ports,
+	// list the flights stored on the drone or download one of them and exit
+	const char *captureFile = NULL;
+	const char *replayFile = NULL;
+	double replaySpeed = 1.0;
+	int flightRequest = -1;
+	uint32_t flightNumber = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "c:r:s:ld:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'c': captureFile = optarg; break;
+			case 'r': replayFile = optarg; break;
+			case 's': replaySpeed = atof(optarg); break;
+			case 'l': flightRequest = FLIGHT_LIST; break;
+			case 'd': flightRequest = FLIGHT_SEND; flightNumber = (uint32_t)strtoul(optarg, NULL, 10); break;
+			default:
+				printf("Usage: %s [-c capture file | -r replay file [-s speed, 0 = as fast as possible]] [-l | -d flight] [serial device] [send rate in Hz, max %d]\n", argv[0], SEND_RATE_MAX_HZ);
+				return -1;
+		}
+	}
+
+	if (replayFile != NULL && !replay_open(replayFile, replaySpeed)) return -1;
+	if (captureFile != NULL && replayFile == NULL && !capture_open(captureFile)) return -1;
+
+	// If no serial device is given at execution time, /dev/ttyUSB0 is assumed
 	// Asserts are in the function
-	if (argc == 1) {
+	// Optional second argument is the CMD send rate in Hz
+	uint32_t sendRate = SEND_RATE_HZ;
+	if (argc - optind == 0) {
 		serial_port_open(SERIAL_PORT);
-	} else if (argc == 2) {
-		serial_port_open(argv[1]);
+	} else if (argc - optind == 1 || argc - optind == 2) {
+		serial_port_open(argv[optind]);
+		if (argc - optind == 2) sendRate = (uint32_t)atoi(argv[optind + 1]);
 	} else {
 		printf("Wrong number of arguments\n");
+		printf("Usage: %s [-c capture file | -r replay file [-s speed, 0 = as fast as possible]] [-l | -d flight] [serial device] [send rate in Hz, max %d]\n", argv[0], SEND_RATE_MAX_HZ);
 		return -1;
 	}
 
-	// Open joystick
+	// Open joystick -> not needed for a replay or a flight log download
 	if(openJoy())
 	{
 		printf("Joystick not found, disabling joystick controll\n");
 		joystickFound = false;
 
-		if(!DEBUG_MODE) {
+		if(!DEBUG_MODE && !replay_active() && flightRequest == -1) {
 			return -1;
 		}
 	}
@@ -97,44 +133,98 @@ int main(int argc, char **argv)
     i16_to_ui8(gains[3], &config[6]);
 	packMessage(CFG, config);
 
-	// Open TCP socket -> for processing
-	openSocket();
+	// Ask the log catalog, the drone answers in safe mode
+	if (flightRequest != -1) requestFlight((uint8_t)flightRequest, flightNumber);
 
-	// Set before time
-	struct timeval tval_before, tval_after, tval_result;
-	gettimeofday(&tval_before, NULL);
+	// Attitude stream for the viewers (processing/drone_view)
+	att_stream_open(ATT_STREAM_PORT);
+
+	// Periodic timer for sending the CMD messages
+	if (sched_open(sendRate) == -1)
+	{
+		printf("Couldn't create the send timer\n");
+		return -1;
+	}
+	term_puts("Press p to print the CMD send jitter and the link latency\n");
+	term_puts("Press f to list the flights stored on the drone\n");
 
 	bool finished = false;
 	while (!finished) 
 	{
+		// Sleep until a key, a stick event, a received byte or the send timer wakes us up
+		struct pollfd fds[5];
+		int nfds = 0;
+		fds[nfds].fd = 0; fds[nfds++].events = POLLIN;
+		fds[nfds].fd = sched_get_fd(); fds[nfds++].events = POLLIN;
+		if (joystickFound) { fds[nfds].fd = get_fd_joy(); fds[nfds++].events = POLLIN; }
+		if (get_fd_serial() != -1) { fds[nfds].fd = get_fd_serial(); fds[nfds++].events = POLLIN; }
+		if (get_fd_ble() != -1) { fds[nfds].fd = get_fd_ble(); fds[nfds++].events = POLLIN; }
+
+		// In replay mode wake up when the next captured block is due,
+		// with a rate limited stick change when it may be sent
+		int timeout = replay_active() ? replay_timeout_ms() : ping_timeout_ms();
+		if (joystickFound && joyChanged())
+		{
+			int holdoff = sched_change_holdoff_ms();
+			if (timeout == -1 || holdoff < timeout) timeout = holdoff;
+		}
+
+		if (poll(fds, nfds, timeout) == -1 && errno != EINTR)
+		{
+			perror("poll");
+			break;
+		}
+
 		// Read characters and act
 		if ((c = term_getchar_nb()) != -1)
 		{
+			if (c == 'p')
+			{
+				sched_print_stats(stdout);
+				printJoyLatency(stdout);
+				ping_print_stats(stdout);
+			}
 			processKeyboard(c, pilotCmd);
 		}
 
-		// Get current time to compare time before
-		gettimeofday(&tval_after, NULL);
-        timersub(&tval_after, &tval_before, &tval_result);
-        double time_elapsed = ((double)tval_result.tv_sec*1000.0f) + ((double)tval_result.tv_usec/1000.0f);
+		// Read joystick axes and buttons as soon as they change
+		if (joystickFound) {
+			readJoyEvents();
+		}
 
-		// Pack and send the messages
-		if (time_elapsed > SEND_RATE_MS)
+		// Send a significant stick change right away, not rate limited
+		// below CMD_CHANGE_MIN_MS
+		if (joystickFound && joyChanged() && sched_change_holdoff_ms() == 0)
+		{
+			fillJoyCmd(pilotCmd);
+			packMessage(CMD, pilotCmd);
+			sched_mark_sent_change();
+			joyMarkSent();
+			// Don't reset the joystick axes (2, 3, 4, 5) !!!
+			pilotCmd[0] = 0;
+			pilotCmd[1] = 0;
+			pilotCmd[6] = 0;
+		}
+
+		// Latency probe on the active link
+		ping_poll();
+
+		// Pack and send the messages when the send period elapsed,
+		// this keeps the link alive while the stick is not moved
+		if (sched_expired())
 		{
-			// Read joystick axes and buttons
 			if(joystickFound) {
-				getJoyValues(pilotCmd);
+				fillJoyCmd(pilotCmd);
 			}
 			
 			// Pack message
 			packMessage(CMD, pilotCmd);
+			sched_mark_sent();
+			joyMarkSent();
 			// Don't reset the joystick axes (2, 3, 4, 5) !!!
 			pilotCmd[0] = 0;
 			pilotCmd[1] = 0;
 			pilotCmd[6] = 0;
-
-			// Store new before time
-			gettimeofday(&tval_before, NULL);
 		}
 
         // Process received characters -> both serial and bluetooth
@@ -145,22 +235,41 @@ int main(int argc, char **argv)
 			c = (char)res;
 			ret = unpackMessage(c, &SSM);
 			if (ret == '.') finished = true;
+			if ((ret == 'F' && flightRequest == FLIGHT_LIST) || (ret == 'L' && flightRequest == FLIGHT_SEND)) finished = true;
 		}
 		while ((res = serial_port_getchar(BLUETOOTH)) != -1)
 		{
 			c = (char)res;
 			ret = unpackMessage(c, &BSM);
 			if (ret == '.') finished = true;
+			if ((ret == 'F' && flightRequest == FLIGHT_LIST) || (ret == 'L' && flightRequest == FLIGHT_SEND)) finished = true;
 		}
+
+		// Stop at the end of the replayed capture
+		if (replay_finished()) finished = true;
 	}
 
+	// Capture and replay results
+	capture_close();
+	if (replay_active())
+	{
+		replay_print_stats(stdout);
+		replay_close();
+	}
+
+	// Print the send statistics of the whole flight
+	sched_print_stats(stdout);
+	printJoyLatency(stdout);
+	ping_print_stats(stdout);
+	sched_close();
+
     // Close the serial and bluetooth port
 	serial_port_close();
 	ble_port_close();
 	printf("Ports closed\n");
 	
-	// Close TCP socket
-	closeSocket();
+	// Close the attitude stream
+	att_stream_close();
 
 	term_exitio();
 	term_puts("\n<exit>\n");
@@ -0,0 +1,149 @@
+#include "pid.h"
+
+#define PID_MAX_SHIFT 15
+
+/**
+ * @brief Clamps a number to the int16 range
+ */
+static int16_t sat16(int32_t x) {
+  if (x > INT16_MAX) return INT16_MAX;
+  if (x < INT16_MIN) return INT16_MIN;
+  return (int16_t)x;
+}
+
+/**
+ * @brief Clamps a 64 bit sum to a range
+ */
+static int32_t clamp(int64_t x, int32_t lo, int32_t hi) {
+  if (x > hi) return hi;
+  if (x < lo) return lo;
+  return (int32_t)x;
+}
+
+/**
+ * @brief a + b + c, clamped to the int32 range. Products of 16 bit
+ * numbers reach 2^30, a sum of three of them doesn't always fit in 32
+ * bits. It nearly always does though, and 64 bit adds and compares cost
+ * the M0 register spills, so the 64 bit sum is only taken on overflow.
+ */
+static int32_t sum3(int32_t a, int32_t b, int32_t c) {
+  int32_t s;
+  if (!__builtin_add_overflow(a, b, &s) && !__builtin_add_overflow(s, c, &s)) return s;
+  return clamp((int64_t)a + b + c, INT32_MIN, INT32_MAX);
+}
+
+/**
+ * @brief Largest integral: the output range, Q(shift)
+ */
+static int32_t integralLimit(const PidState_t *state) {
+  return (int32_t)(state->outMax > -state->outMin ? state->outMax : -state->outMin) << state->shift;
+}
+
+/**
+ * @brief Initializes a controller with zero gains
+ *
+ * @param outMin, outMax Output saturation
+ * @param dShift Derivative low pass, 0 = no filtering, 2 = a quarter of the new value per sample
+ */
+void initPidState(PidState_t *state, int16_t outMin, int16_t outMax, uint8_t dShift) {
+  state->kp = state->ki = state->kd = 0;
+  state->shift = 0;
+  state->dShift = dShift;
+  state->outMin = outMin;
+  state->outMax = outMax;
+  pidReset(state);
+}
+
+/**
+ * @brief Sets the gains as fractions (gain = num / den). The divisions
+ * are done here, once, picking the most fraction bits for which all the
+ * gains still fit in 16 bits.
+ *
+ * @param kpNum, kiNum, kdNum Numerators of the gains (ki and kd per sample)
+ * @param den Common denominator, values below 1 are taken as 1
+ */
+void pidSetGains(PidState_t *state, int32_t kpNum, int32_t kiNum, int32_t kdNum, int32_t den) {
+  int64_t n[3] = {kpNum, kiNum, kdNum};
+  int16_t q[3];
+  int8_t shift = PID_MAX_SHIFT;
+
+  if (den < 1) den = 1;
+
+  for (; shift > 0; shift--) {
+    bool fits = true;
+    for (uint8_t i = 0; i < 3; i++) {
+      int64_t v = (n[i] * (1LL << shift)) / den;
+      if (v > INT16_MAX || v < -INT16_MAX) fits = false;
+    }
+    if (fits) break;
+  }
+
+  for (uint8_t i = 0; i < 3; i++) {
+    q[i] = sat16((int32_t)((n[i] * (1LL << shift)) / den));
+  }
+
+  // Keep the integral at the same value in output units, within the new limit
+  int64_t integral = state->integral;
+  if (shift > state->shift) integral *= (1 << (shift - state->shift));
+  else integral >>= (state->shift - shift);
+
+  state->kp = q[0];
+  state->ki = q[1];
+  state->kd = q[2];
+  state->shift = shift;
+
+  int32_t limit = integralLimit(state);
+  state->integral = clamp(integral, -limit, limit);
+}
+
+/**
+ * @brief Clears the integral and the derivative history
+ */
+void pidReset(PidState_t *state) {
+  state->integral = 0;
+  state->d = 0;
+  state->lastMeas = 0;
+  state->started = false;
+}
+
+/**
+ * @brief Executes one iteration of the PID controller. Only multiplies,
+ * shifts and compares, no division.
+ * The derivative acts on the measurement (no kick when the setpoint
+ * jumps) and is low pass filtered. The integral stops growing while the
+ * output is saturated in the same direction (anti-windup).
+ *
+ * @param setpoint Desired value
+ * @param measurement Measured value
+ * @return Controller output, between outMin and outMax
+ */
+int16_t pid(PidState_t *state, int32_t setpoint, int32_t measurement) {
+  int16_t error = sat16(setpoint - measurement);
+
+  // Filtered derivative of the measurement
+  if (!state->started) {
+    state->lastMeas = measurement;
+    state->started = true;
+  }
+  int16_t change = sat16(measurement - state->lastMeas);
+  state->lastMeas = measurement;
+  state->d = sat16(state->d + ((change - state->d) >> state->dShift));
+
+  // The sum saturates in 32 bits: beyond 2^31 >> shift it is far out of the int16 output range
+  int32_t p = (int32_t)state->kp * error;
+  int32_t d = -(int32_t)state->kd * state->d;
+  int32_t out = sum3(p, state->integral, d) >> state->shift;
+
+  // Integrate only if it doesn't push the output further into saturation
+  int32_t di = (int32_t)state->ki * error;
+  if (di != 0 && !((out >= state->outMax && di > 0) || (out <= state->outMin && di < 0))) {
+    int32_t limit = integralLimit(state);
+    int32_t integral = sum3(state->integral, di, 0);
+    state->integral = integral > limit ? limit : (integral < -limit ? -limit : integral);
+    out = sum3(p, state->integral, d) >> state->shift;
+  }
+
+  if (out > state->outMax) out = state->outMax;
+  if (out < state->outMin) out = state->outMin;
+  return (int16_t)out;
+}
@@ -0,0 +1,31 @@
+#ifndef _H_PID
+#define _H_PID
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+// The gains are Q(shift) fixed point numbers which fit in 16 bits, so
+// every product in pid() is a 16x16 -> 32 bit multiply. They are only
+// computed (with divisions) when a gain changes.
+typedef struct {
+  int16_t kp;         // Proportional gain, Q(shift)
+  int16_t ki;         // Integral gain per sample, Q(shift)
+  int16_t kd;         // Derivative gain per sample, Q(shift)
+  uint8_t shift;      // Fraction bits of the gains
+  uint8_t dShift;     // Derivative low pass: d += (new - d) >> dShift
+
+  int32_t integral;   // Sum of ki * error, Q(shift), clamped to the output range
+  int16_t d;          // Filtered change of the measurement
+  int32_t lastMeas;   // Measurement of the previous sample
+  bool started;       // lastMeas is valid
+
+  int16_t outMin;     // Output saturation
+  int16_t outMax;
+} PidState_t;
+
+void initPidState(PidState_t *state, int16_t outMin, int16_t outMax, uint8_t dShift);
+void pidSetGains(PidState_t *state, int32_t kpNum, int32_t kiNum, int32_t kdNum, int32_t den);
+void pidReset(PidState_t *state);
+int16_t pid(PidState_t *state, int32_t setpoint, int32_t measurement);
+
+#endif
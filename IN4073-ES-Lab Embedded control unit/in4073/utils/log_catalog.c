@@ -0,0 +1,552 @@
+#include "log_catalog.h"
+#include "crc16.h"
+#include "comm.h"
+#include "hal/timers.h"
+
+#include <string.h>
+#include <stddef.h>
+
+// Probe step of the row search at boot: less than a sector, wrap gap included
+#define CATALOG_PROBE_ROWS ((FLASH_SECTOR_SIZE - (LOG_AREA_SIZE % (LOG_SIZE))) / (LOG_SIZE) - 1)
+
+// Flight in the log area and its catalog entry
+typedef struct {
+	uint32_t number;
+	uint32_t start;
+	uint32_t length;
+	uint8_t entry;
+} flightSpan;
+
+static flightSpan flights[CATALOG_FLIGHTS];	// Stored flights, oldest first
+static uint8_t flightCount;
+static flightSpan current;					// Flight being logged
+static uint32_t currentRows;
+static bool logging = false;
+
+static uint32_t catalogSector;		// Address of the catalog sector in use
+static uint32_t generation;
+static uint8_t freeEntry;			// First free entry, CATALOG_ENTRIES + 1 when full
+static uint32_t nextNumber;
+static uint16_t bootNumber;
+
+/**
+ * @brief Address of an entry in the catalog sector in use
+ */
+static uint32_t entry_address(uint8_t entry)
+{
+	return catalogSector + entry * CATALOG_ENTRY_SIZE;
+}
+
+/**
+ * @brief Bytes from one address of the log area forward to another,
+ * around the end of the ring
+ */
+static uint32_t ring_distance(uint32_t from, uint32_t to)
+{
+	return (to - from + LOG_AREA_SIZE) % LOG_AREA_SIZE;
+}
+
+/**
+ * @brief Address a number of bytes after another in the log area
+ */
+static uint32_t ring_add(uint32_t address, uint32_t count)
+{
+	return LOG_AREA_START + (address - LOG_AREA_START + count) % LOG_AREA_SIZE;
+}
+
+/**
+ * @brief Start address of a row: a row that doesn't fit before the end of
+ * the log area is written at its start
+ * @param uint32_t Address after the previous row
+ * @return Address of the row
+ */
+uint32_t catalog_row_address(uint32_t address)
+{
+	if (address < LOG_AREA_START || address + (LOG_SIZE) > LOG_AREA_END) return LOG_AREA_START;
+	return address;
+}
+
+/**
+ * @brief Address of a row of a flight
+ * @param uint32_t Address of the first row
+ * @param uint32_t Row number
+ */
+static uint32_t row_address(uint32_t start, uint32_t row)
+{
+	uint32_t first = (LOG_AREA_END - start) / (LOG_SIZE);	// Rows before the wrap
+
+	if (row < first) return start + row * (LOG_SIZE);
+	return LOG_AREA_START + (row - first) * (LOG_SIZE);
+}
+
+static uint16_t header_crc(const catalogHeader *header)
+{
+	return crc16_compute((const uint8_t *)header, offsetof(catalogHeader, crc), NULL);
+}
+
+static uint16_t flight_crc(const flightRecord *flight)
+{
+	return crc16_compute((const uint8_t *)&flight->number, offsetof(flightRecord, crc) - offsetof(flightRecord, number), NULL);
+}
+
+/**
+ * @brief Reads a catalog entry of a flight
+ * @return true if it holds a flight
+ */
+static bool read_flight(uint8_t entry, flightRecord *flight)
+{
+	if (!flash_read_bytes(entry_address(entry), (uint8_t *)flight, sizeof(flightRecord))) return false;
+	return flight->magic == FLIGHT_MAGIC && flight->crc == flight_crc(flight);
+}
+
+/**
+ * @brief Writes to the catalog sector in use. At boot and in safe mode
+ * it waits for the flash when the queue is full; while logging the
+ * caller checks flash_queue_free() first (erase_for_log()).
+ */
+static void catalog_write(uint32_t address, const void *data, uint32_t count)
+{
+	if (!flash_write_bytes(address, (uint8_t *)data, count))
+	{
+		flash_sync();
+		flash_write_bytes(address, (uint8_t *)data, count);
+	}
+}
+
+/**
+ * @brief Marks the entry of a flight as dropped, its data is overwritten
+ */
+static void drop_entry(uint8_t entry)
+{
+	uint8_t dropped = 0x00;
+
+	catalog_write(entry_address(entry) + offsetof(flightRecord, dropped), &dropped, 1);
+}
+
+/**
+ * @brief Adds a finished flight to the stored ones, the oldest one is
+ * dropped when all are in use
+ */
+static void keep_flight(const flightSpan *flight)
+{
+	if (flightCount == CATALOG_FLIGHTS)
+	{
+		drop_entry(flights[0].entry);
+		memmove(&flights[0], &flights[1], (CATALOG_FLIGHTS - 1) * sizeof(flightSpan));
+		flightCount--;
+	}
+	flights[flightCount++] = *flight;
+}
+
+/**
+ * @brief Checks if a flight has data in a sector of the log area
+ */
+static bool flight_in_sector(const flightSpan *flight, uint32_t sector)
+{
+	return ring_distance(flight->start, sector) < flight->length || ring_distance(sector, flight->start) < FLASH_SECTOR_SIZE;
+}
+
+/**
+ * @brief Erases a sector of the log area for the next rows, unless it is
+ * erased already. The stored flights with data in it are dropped first.
+ * The sector where the flight being logged started is never erased once
+ * the flight has rows in it.
+ * @param uint32_t Any address in the sector
+ * @return false if the sector holds the start of the flight being logged,
+ * or the drops and the erase don't fit in the flash queue (try again later)
+ */
+static bool erase_for_log(uint32_t address)
+{
+	uint32_t sector = address / FLASH_SECTOR_SIZE * FLASH_SECTOR_SIZE;
+	uint8_t drops = 0;
+
+	if (flash_sector_erased(sector)) return true;
+	if (logging && current.length && current.start / FLASH_SECTOR_SIZE * FLASH_SECTOR_SIZE == sector) return false;
+
+	for (uint8_t i = 0; i < flightCount; i++)
+	{
+		if (flight_in_sector(&flights[i], sector)) drops++;
+	}
+	if (flash_queue_free() < drops + 1) return false;
+
+	for (uint8_t i = 0; i < flightCount; )
+	{
+		if (flight_in_sector(&flights[i], sector))
+		{
+			drop_entry(flights[i].entry);
+			memmove(&flights[i], &flights[i + 1], (flightCount - i - 1) * sizeof(flightSpan));
+			flightCount--;
+		}
+		else
+		{
+			i++;
+		}
+	}
+	return flash_erase_sector(sector);
+}
+
+/**
+ * @brief Writes an empty catalog with a new generation to a catalog sector
+ */
+static void write_header(uint32_t sector)
+{
+	catalogHeader header;
+
+	memset(&header, 0xFF, sizeof(header));
+	header.magic = CATALOG_MAGIC;
+	header.version = CATALOG_VERSION;
+	header.entrySize = CATALOG_ENTRY_SIZE;
+	header.generation = generation;
+	header.crc = header_crc(&header);
+	catalog_write(sector, &header, sizeof(header));
+}
+
+/**
+ * @brief Copies the stored flights to the other catalog sector when all
+ * entries are used. The new header is written last: until then the old
+ * sector stays the valid one. Only called in safe mode, it waits for the
+ * flash.
+ */
+static void compact(void)
+{
+	uint32_t target = (catalogSector == 0) ? FLASH_SECTOR_SIZE : 0;
+	flightRecord flight;
+	uint8_t entry = 1;
+
+	// The first write erases the target
+	flash_discard(target, FLASH_SECTOR_SIZE);
+
+	for (uint8_t i = 0; i < flightCount; i++)
+	{
+		if (!flash_read_bytes(entry_address(flights[i].entry), (uint8_t *)&flight, sizeof(flight))) continue;
+		catalog_write(target + entry * CATALOG_ENTRY_SIZE, &flight, sizeof(flight));
+		flights[i].entry = entry++;
+	}
+
+	generation++;
+	write_header(target);
+	catalogSector = target;
+	freeEntry = entry;
+}
+
+/**
+ * @brief Checks if a row of a flight was written
+ */
+static bool row_written(uint32_t start, uint32_t row)
+{
+	uint8_t head[5];
+
+	if (!flash_read_bytes(row_address(start, row), head, sizeof(head))) return false;
+	for (uint8_t i = 0; i < sizeof(head); i++)
+	{
+		if (head[i] != 0xFF) return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Counts the rows of a flight that wasn't closed (power off while
+ * logging). The log keeps more than a sector erased after the last row
+ * (catalog_make_room()), so probing every CATALOG_PROBE_ROWS rows doesn't
+ * step over it into older data; a binary search finds the end from there.
+ * @param uint32_t Address of the first row
+ * @return Number of written rows
+ */
+static uint32_t recover_rows(uint32_t start)
+{
+	uint32_t low = 0;		// Rows before low are written
+	uint32_t high = 0;		// Row high isn't
+	uint32_t maxRows = CATALOG_FLIGHT_MAX / (LOG_SIZE);
+
+	while (high < maxRows && row_written(start, high))
+	{
+		low = high + 1;
+		high += CATALOG_PROBE_ROWS;
+	}
+	if (high > maxRows) high = maxRows;
+
+	while (low < high)
+	{
+		uint32_t mid = (low + high) / 2;
+		if (row_written(start, mid)) low = mid + 1;
+		else high = mid;
+	}
+	return low;
+}
+
+/**
+ * @brief Finds the catalog at boot and the address after the last
+ * flight, where the log goes on. A flight that wasn't closed is closed
+ * with the rows found in the log area. The free entries are found with a
+ * binary search, only the used ones are read. Without a valid catalog the
+ * flash is formatted: the sectors are erased when the log gets to them.
+ * @return Address of the next row
+ */
+uint32_t catalog_init(void)
+{
+	uint32_t startTime = get_time_us();
+	uint32_t append = LOG_AREA_START;
+	uint32_t recovered = 0;
+	bool found = false;
+	catalogHeader header;
+	flightRecord flight;
+
+	flightCount = 0;
+	logging = false;
+	nextNumber = 1;
+	bootNumber = 1;
+
+	// Catalog sector with the highest generation
+	for (uint8_t i = 0; i < CATALOG_SECTORS; i++)
+	{
+		if (!flash_read_bytes(i * FLASH_SECTOR_SIZE, (uint8_t *)&header, sizeof(header))) continue;
+		if (header.magic != CATALOG_MAGIC || header.version != CATALOG_VERSION || header.entrySize != CATALOG_ENTRY_SIZE) continue;
+		if (header.crc != header_crc(&header)) continue;
+		if (!found || header.generation > generation)
+		{
+			catalogSector = i * FLASH_SECTOR_SIZE;
+			generation = header.generation;
+			found = true;
+		}
+	}
+
+	if (!found)
+	{
+		catalogSector = 0;
+		generation = 1;
+		freeEntry = 1;
+		flash_discard(0, FLASH_SECTOR_SIZE);
+		write_header(catalogSector);
+		SEND_EVENT(EV_CATALOG_FORMATTED);
+		return append;
+	}
+
+	// Entries are used in order, the new ones go after the bytes in use
+	flash_mark_erased(catalogSector);
+	uint8_t low = 1, high = CATALOG_ENTRIES + 1;
+	while (low < high)
+	{
+		uint8_t mid = (low + high) / 2;
+		uint16_t magic = 0xFFFF;
+		flash_read_bytes(entry_address(mid) + offsetof(flightRecord, magic), (uint8_t *)&magic, sizeof(magic));
+		if (magic != 0xFFFF) low = mid + 1;
+		else high = mid;
+	}
+	freeEntry = low;
+
+	// Newest flights first: the newest gives the next address, the numbers
+	// and may still be open, the kept ones are collected from the end
+	uint8_t kept = CATALOG_FLIGHTS;
+	bool newest = true;
+	for (uint8_t entry = freeEntry - 1; entry >= 1; entry--)
+	{
+		if (!read_flight(entry, &flight)) continue;
+
+		if (newest)
+		{
+			newest = false;
+			nextNumber = flight.number + 1;
+			bootNumber = flight.boot + 1;
+
+			if (flight.length == FLIGHT_OPEN || flight.rows == FLIGHT_OPEN)
+			{
+				flight.rows = recover_rows(flight.start);
+				flight.length = flight.rows ? ring_distance(flight.start, row_address(flight.start, flight.rows - 1)) + (LOG_SIZE) : 0;
+				catalog_write(entry_address(entry) + offsetof(flightRecord, length), &flight.length, 2 * sizeof(uint32_t));
+				recovered = flight.rows;
+			}
+			append = flight.rows ? row_address(flight.start, flight.rows - 1) + (LOG_SIZE) : flight.start;
+			append = catalog_row_address(append);
+			flash_mark_erased(append);
+		}
+		// Only the newest flight can be open
+		else if (flight.length == FLIGHT_OPEN || flight.rows == FLIGHT_OPEN)
+		{
+			if (flight.dropped == 0xFF) drop_entry(entry);
+			continue;
+		}
+
+		if (flight.dropped != 0xFF || !flight.rows) continue;
+		if (!kept)
+		{
+			drop_entry(entry);
+			continue;
+		}
+
+		kept--;
+		flights[kept].number = flight.number;
+		flights[kept].start = flight.start;
+		flights[kept].length = flight.length;
+		flights[kept].entry = entry;
+	}
+
+	// Oldest first
+	flightCount = CATALOG_FLIGHTS - kept;
+	memmove(&flights[0], &flights[kept], flightCount * sizeof(flightSpan));
+
+	SEND_EVENT(EV_CATALOG_LOADED, flightCount, append, recovered, get_time_us() - startTime);
+	return append;
+}
+
+/**
+ * @brief Starts a flight at the first row, writes its catalog entry.
+ * Only in safe mode, the catalog writes and the compaction of a full
+ * catalog wait for the flash.
+ * @param uint32_t Address of the first row
+ * @return false if not in safe mode, a flight is open already or the
+ * catalog stays full
+ */
+bool catalog_open(uint32_t address)
+{
+	flightRecord flight;
+
+	if (logging || systemState != SafeMode) return false;
+	if (freeEntry > CATALOG_ENTRIES) compact();
+	if (freeEntry > CATALOG_ENTRIES) return false;
+
+	memset(&flight, 0xFF, sizeof(flight));
+	flight.magic = FLIGHT_MAGIC;
+	flight.number = nextNumber++;
+	flight.build = FIRMWARE_BUILD;
+	flight.bootTime = get_time_us();
+	flight.start = address;
+	flight.boot = bootNumber;
+	flight.crc = flight_crc(&flight);
+	catalog_write(entry_address(freeEntry), &flight, offsetof(flightRecord, length));
+
+	current.number = flight.number;
+	current.start = address;
+	current.length = 0;
+	current.entry = freeEntry++;
+	currentRows = 0;
+	logging = true;
+	return true;
+}
+
+/**
+ * @brief Tells if a flight is being logged (catalog_open() until catalog_close())
+ */
+bool catalog_is_open(void)
+{
+	return logging;
+}
+
+/**
+ * @brief Makes room for the next row of the flight being logged. The
+ * sectors up to a sector after the row have to be erased: the flights in
+ * them are dropped and the erases queued before the row.
+ * @param uint32_t Address of the row (catalog_row_address())
+ * @return false if the erases don't fit in the flash queue now, the row
+ * has to be dropped
+ */
+bool catalog_make_room(uint32_t address)
+{
+	uint32_t sector = address / FLASH_SECTOR_SIZE * FLASH_SECTOR_SIZE;
+
+	// The log left the sector before: it is erased again on the next lap
+	flash_discard(ring_add(sector, LOG_AREA_SIZE - FLASH_SECTOR_SIZE), FLASH_SECTOR_SIZE);
+
+	return erase_for_log(address) &&
+		erase_for_log(ring_add(address, FLASH_SECTOR_SIZE)) &&
+		erase_for_log(ring_add(address, FLASH_SECTOR_SIZE + (LOG_SIZE) - 1));
+}
+
+/**
+ * @brief Counts a row of the flight being logged, once it is queued
+ * @param uint32_t Address of the row
+ */
+void catalog_add_row(uint32_t address)
+{
+	if (logging)
+	{
+		currentRows++;
+		current.length = ring_distance(current.start, address) + (LOG_SIZE);
+	}
+}
+
+/**
+ * @brief Ends the flight being logged: writes its length and rows to the
+ * catalog and keeps it with the stored flights.
+ * @return Number of the flight, FLIGHT_NONE if none was logged
+ */
+uint32_t catalog_close(void)
+{
+	uint32_t size[2] = {current.length, currentRows};
+
+	if (!logging) return FLIGHT_NONE;
+	logging = false;
+
+	catalog_write(entry_address(current.entry) + offsetof(flightRecord, length), size, sizeof(size));
+	if (currentRows) keep_flight(&current);
+	else drop_entry(current.entry);
+
+	return current.number;
+}
+
+/**
+ * @brief Erases the next sectors of the log area in idle time, so the log
+ * doesn't wait for an erase. Call it from the main loop with the address
+ * of the next row; it queues at most one sector erase, and only when the
+ * flash has nothing else to do.
+ * @param uint32_t Address of the next row
+ */
+void catalog_poll(uint32_t address)
+{
+	if (!flash_idle()) return;
+
+	address = catalog_row_address(address);
+	for (uint8_t i = 0; i <= CATALOG_ERASE_AHEAD; i++)
+	{
+		uint32_t sector = ring_add(address, i * FLASH_SECTOR_SIZE);
+		if (!flash_sector_erased(sector))
+		{
+			erase_for_log(sector);
+			return;
+		}
+	}
+}
+
+/**
+ * @brief Number of flights in the catalog, the one being logged included
+ */
+uint8_t catalog_count(void)
+{
+	return flightCount + (logging ? 1 : 0);
+}
+
+/**
+ * @brief Reads the catalog entry of a flight. The flight being logged
+ * comes last, with the rows logged so far.
+ * @param uint8_t Index, 0 is the oldest flight
+ * @param flightRecord* Entry of the flight
+ * @return true if there is such a flight
+ */
+bool catalog_get(uint8_t index, flightRecord *flight)
+{
+	if (index < flightCount)
+	{
+		return read_flight(flights[index].entry, flight);
+	}
+	if (logging && index == flightCount && read_flight(current.entry, flight))
+	{
+		flight->length = current.length;
+		flight->rows = currentRows;
+		return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Reads the catalog entry of a flight by its number
+ * @param uint32_t Flight number
+ * @param flightRecord* Entry of the flight
+ * @return true if the flight is in the catalog
+ */
+bool catalog_find(uint32_t number, flightRecord *flight)
+{
+	for (uint8_t i = 0; i < catalog_count(); i++)
+	{
+		if (catalog_get(i, flight) && flight->number == number) return true;
+	}
+	return false;
+}
@@ -0,0 +1,75 @@
+#ifndef LOG_CATALOG_H__
+#define LOG_CATALOG_H__
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include "hal/spi_flash.h"
+
+// SPI flash layout: two catalog sectors, used in turn, then the log area.
+// The log area is a ring of flights: when the log wraps around, the
+// oldest flights are dropped from the catalog before their sectors are
+// erased. Bump CATALOG_VERSION when the layout changes, the flash is
+// formatted when the catalog has another version.
+#define CATALOG_MAGIC 0x474F4C46	// "FLOG"
+#define CATALOG_VERSION 1
+#define CATALOG_SECTORS 2
+#define CATALOG_ENTRY_SIZE 32		// sizeof(catalogHeader) and sizeof(flightRecord)
+#define CATALOG_ENTRIES (FLASH_SECTOR_SIZE / CATALOG_ENTRY_SIZE - 1)	// 127 flights, the header takes the first entry
+#define CATALOG_FLIGHTS 16			// Stored flights kept, older ones are dropped
+#define CATALOG_ERASE_AHEAD 2		// Sectors kept erased after the one being written
+
+#define LOG_AREA_START (CATALOG_SECTORS * FLASH_SECTOR_SIZE)
+#define LOG_AREA_END 0x20000		// End of the 128 KB flash
+#define LOG_AREA_SIZE (LOG_AREA_END - LOG_AREA_START)
+// Longest flight: it must not reach the sectors erased ahead of it
+#define CATALOG_FLIGHT_MAX (LOG_AREA_SIZE - 3 * FLASH_SECTOR_SIZE)
+
+#define FLIGHT_MAGIC 0x4C46			// "FL"
+#define FLIGHT_OPEN 0xFFFFFFFF		// Length and rows of a flight still being logged
+#define FLIGHT_NONE 0xFFFFFFFF		// No flight number
+
+// Build time of the firmware (Unix time), set by the Makefile
+#ifndef FIRMWARE_BUILD
+#define FIRMWARE_BUILD 0
+#endif
+
+// First entry of a catalog sector
+typedef struct {
+	uint32_t magic;			// CATALOG_MAGIC
+	uint16_t version;		// CATALOG_VERSION
+	uint16_t entrySize;		// CATALOG_ENTRY_SIZE
+	uint32_t generation;	// The valid catalog sector with the highest generation is used
+	uint32_t reserved[4];
+	uint16_t reserved2;
+	uint16_t crc;			// CRC16 (CCITT) of everything above
+} catalogHeader;
+
+// Catalog entry of a flight. The first part is written when the flight
+// starts, length and rows when it ends: the flash can only clear bits.
+typedef struct {
+	uint16_t magic;			// FLIGHT_MAGIC, erased (0xFFFF) in the free entries
+	uint8_t dropped;		// 0xFF, 0x00 once the flight isn't kept any more
+	uint8_t reserved;
+	uint32_t number;		// Flight number, counts up over the flights
+	uint32_t build;			// FIRMWARE_BUILD of the firmware that logged the flight
+	uint32_t bootTime;		// Drone time (us since the boot) of the first row
+	uint32_t start;			// Address of the first row
+	uint16_t boot;			// Boot number, counts up over the boots
+	uint16_t crc;			// CRC16 (CCITT) of number to boot
+	uint32_t length;		// Bytes of the log area used, FLIGHT_OPEN while logging
+	uint32_t rows;			// Logged rows, FLIGHT_OPEN while logging
+} flightRecord;
+
+uint32_t catalog_init(void);
+uint32_t catalog_row_address(uint32_t address);
+bool catalog_open(uint32_t address);
+bool catalog_is_open(void);
+bool catalog_make_room(uint32_t address);
+void catalog_add_row(uint32_t address);
+uint32_t catalog_close(void);
+void catalog_poll(uint32_t address);
+uint8_t catalog_count(void);
+bool catalog_get(uint8_t index, flightRecord *flight);
+bool catalog_find(uint32_t number, flightRecord *flight);
+
+#endif /* LOG_CATALOG_H__ */
@@ -29,18 +29,14 @@ void initProfiling(profilingData *profileData) {
 bool startProfiling(enum ProfileType type) {
     //Checking if type exists:
     if((type < 0) || (type >= ProfileTypes)) {
-        char msg[100];
-        snprintf(msg, 100, "Cannot start profiling for type %d, type does not exist.", type);
-        packMessage(DEBUG, NULL, msg);
+        SEND_EVENT(EV_PROFILING_START_TYPE, type);
 
         return false;
     }
 
     //Checking if profile is not already running for this type:
     if(profilingStartTimes[type] != 0) {
-        char msg[100];
-        snprintf(msg, 100, "Cannot start profiling for type %d, aleady running.", type);
-        packMessage(DEBUG, NULL, msg); 
+        SEND_EVENT(EV_PROFILING_RUNNING, type);
 
         return false;    
     }
@@ -62,10 +58,8 @@ bool startProfiling(enum ProfileType type) {
  */
 uint32_t stopProfiling(enum ProfileType type, bool saveData, profilingData *data) {
     //Checking if type exists:
-    if(type < 0 || type > ProfileTypes) {
-        char msg[100];
-        snprintf(msg, 100, "Cannot stop profiling for type %d, type does not exist.", type);
-        packMessage(DEBUG, NULL, msg);
+    if(type < 0 || type >= ProfileTypes) {
+        SEND_EVENT(EV_PROFILING_STOP_TYPE, type);
 
         return 0;
     }
@@ -74,9 +68,7 @@ uint32_t stopProfiling(enum ProfileType type, bool saveData, profilingData *data
 
     //Checking if profiling was started:
     if(startTime == 0) {
-        char msg[100];
-        snprintf(msg, 100, "Cannot stop profiling for type %d, no profile was running for this type.", type);
-        packMessage(DEBUG, NULL, msg);  
+        SEND_EVENT(EV_PROFILING_NOT_RUNNING, type);
 
         return 0;    
     }
@@ -85,10 +77,10 @@ uint32_t stopProfiling(enum ProfileType type, bool saveData, profilingData *data
     uint32_t timeDiff = endTime - startTime;
 
     //Saving it:
-    // if(saveData) {
-    //     data->profilingData[type] += timeDiff;
-    //     data->profilingDataCnt[type]++;
-    // }
+    if(saveData) {
+        data->profilingData[type] += timeDiff;
+        data->profilingDataCnt[type]++;
+    }
 
     //Setting start time back to 0:
     profilingStartTimes[type] = 0;
@@ -5,7 +5,7 @@
 #include <stdbool.h>
 #include <stdlib.h>
 
-#define ProfileTypes 8 
+#define ProfileTypes 9 
 #define ProfileHistorySizeMax 64
 
 enum ProfileType {
@@ -16,7 +16,8 @@ enum ProfileType {
     p_HeightMode,
     p_Logging,
     p_Sqrt,
-    p_Timer_Flag
+    p_Timer_Flag,
+    p_Attitude
 };
 
 typedef struct  {
@@ -10,6 +10,7 @@
 #include "app_timer.h"
 #include "nrf_gpio.h"
 #include "ble_nus.h"
+#include "pstorage.h"
 #include "app_util_platform.h"
 
 #include <stdbool.h>
@@ -219,6 +220,16 @@ static void ble_evt_dispatch(ble_evt_t * p_ble_evt)
 }
 
 
+/**@brief Function for dispatching a system event to the modules that use them.
+ *
+ * @param[in] sys_evt  System event.
+ */
+static void sys_evt_dispatch(uint32_t sys_evt)
+{
+	pstorage_sys_event_handler(sys_evt);
+}
+
+
 /**@brief Function for the S110 SoftDevice initialization.
  *
  * @details This function initializes the S110 SoftDevice and the BLE event interrupt.
@@ -240,6 +251,10 @@ static void ble_stack_init(void)
 	// Subscribe for BLE events.
 	err_code = softdevice_ble_evt_handler_set(ble_evt_dispatch);
 	APP_ERROR_CHECK(err_code);
+
+	// Subscribe for system events, flash operations report through these.
+	err_code = softdevice_sys_evt_handler_set(sys_evt_dispatch);
+	APP_ERROR_CHECK(err_code);
 }
 
 
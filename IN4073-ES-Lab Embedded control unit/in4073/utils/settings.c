@@ -0,0 +1,227 @@
+#include "settings.h"
+#include "nrf_error.h"
+#include "pstorage.h"
+#include "crc16.h"
+#include "in4073.h"
+#include "control.h"
+#include "comm.h"
+#include "hal/timers.h"
+
+#include <string.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+static pstorage_handle_t settingsHandle;
+static bool storageReady = false;
+
+// Source of the pending flash write, has to stay untouched until pstorage is done with it
+static settingsRecord writeBuffer;
+static bool writeBusy = false;
+static bool dirty = false;
+
+// Record in the flash (loaded or last written), saving it again is skipped
+static settingsRecord stored;
+static bool storedValid = false;
+
+// Boot drift check
+static bool driftCheckPending = false;
+static bool calibrationNeeded = false;
+static int32_t driftSum[3];
+static uint16_t driftCount = 0;
+
+/**
+ * @brief Called by pstorage when a flash operation has finished, from the
+ * softdevice event interrupt: reports with SEND_EVENT, not packMessage
+ */
+static void settings_pstorage_cb(pstorage_handle_t *handle, uint8_t op_code, uint32_t result, uint8_t *p_data, uint32_t data_len)
+{
+	writeBusy = false;
+
+	if (result != NRF_SUCCESS) {
+		// Try again at the next poll
+		storedValid = false;
+		dirty = true;
+		SEND_EVENT(EV_SETTINGS_SAVE_FAILED, result);
+	}
+}
+
+/**
+ * @brief CRC of a record, without the crc field itself
+ */
+static uint16_t settings_crc(const settingsRecord *record)
+{
+	return crc16_compute((const uint8_t *)record, offsetof(settingsRecord, crc), NULL);
+}
+
+/**
+ * @brief Copies the current trims and gains into a record
+ * @param settingsRecord* Record to fill
+ */
+static void settings_fill(settingsRecord *record)
+{
+	memset(record, 0, sizeof(settingsRecord));
+	record->magic = SETTINGS_MAGIC;
+	record->version = SETTINGS_VERSION;
+	record->size = sizeof(settingsRecord);
+
+	record->sp_trim = sp_trim;
+	record->sq_trim = sq_trim;
+	record->sr_trim = sr_trim;
+	record->phi_trim = phi_trim;
+	record->theta_trim = theta_trim;
+	record->psi_trim = psi_trim;
+
+	record->gainYaw = Gain_Yaw;
+	record->gainP1 = Gain_P1;
+	record->gainP2 = Gain_P2;
+	record->gainHeight = Gain_height;
+
+	record->crc = settings_crc(record);
+}
+
+/**
+ * @brief Sets up the flash block and loads the stored trims and gains,
+ * if there is a valid record. Has to be called after the softdevice is
+ * enabled (quad_ble_init).
+ * @return true if the settings were loaded
+ */
+bool settings_init(void)
+{
+	pstorage_module_param_t param;
+	settingsRecord record;
+	uint32_t start = get_time_us();
+
+	param.block_size = SETTINGS_BLOCK_SIZE;
+	param.block_count = 1;
+	param.cb = settings_pstorage_cb;
+
+	if (pstorage_init() != NRF_SUCCESS || pstorage_register(&param, &settingsHandle) != NRF_SUCCESS) {
+		packMessage(DEBUG, NULL, "Settings storage not available");
+		return false;
+	}
+	storageReady = true;
+
+	if (pstorage_load((uint8_t *)&record, &settingsHandle, sizeof(settingsRecord), 0) != NRF_SUCCESS) {
+		return false;
+	}
+
+	if (record.magic != SETTINGS_MAGIC || record.version != SETTINGS_VERSION || record.size != sizeof(settingsRecord)) {
+		packMessage(DEBUG, NULL, "No stored settings, calibrate and send the gains");
+		return false;
+	}
+	if (record.crc != settings_crc(&record)) {
+		packMessage(DEBUG, NULL, "Stored settings corrupt (CRC), calibrate and send the gains");
+		return false;
+	}
+
+	sp_trim = record.sp_trim;
+	sq_trim = record.sq_trim;
+	sr_trim = record.sr_trim;
+	phi_trim = record.phi_trim;
+	theta_trim = record.theta_trim;
+	psi_trim = record.psi_trim;
+
+	Gain_Yaw = record.gainYaw;
+	Gain_P1 = record.gainP1;
+	Gain_P2 = record.gainP2;
+	Gain_height = record.gainHeight;
+	updateControlGains();
+
+	stored = record;
+	storedValid = true;
+
+	driftCheckPending = true;
+
+	SEND_EVENT(EV_SETTINGS_LOADED, get_time_us() - start, sp_trim, sq_trim, sr_trim);
+	SEND_EVENT(EV_SETTINGS_GAINS, Gain_Yaw, Gain_P1, Gain_P2, Gain_height);
+
+	return true;
+}
+
+/**
+ * @brief Whether the current trims and gains are already in the flash
+ * @param settingsRecord* Record filled with the current values
+ */
+static bool settings_unchanged(const settingsRecord *record)
+{
+	return storedValid && memcmp(record, &stored, sizeof(settingsRecord)) == 0;
+}
+
+/**
+ * @brief Marks the trims and gains to be written to flash, if they differ
+ * from the stored ones. The write itself happens in settings_poll().
+ */
+void settings_save(void)
+{
+	settingsRecord record;
+
+	settings_fill(&record);
+	if (!settings_unchanged(&record)) dirty = true;
+}
+
+/**
+ * @brief Called when a calibration finished: the new trims are valid and
+ * get saved
+ */
+void settings_calibrated(void)
+{
+	calibrationNeeded = false;
+	driftCheckPending = false;
+	settings_save();
+}
+
+/**
+ * @brief Writes the settings when they changed. Erasing a flash page stops
+ * the CPU for milliseconds, so only write when the motors are off.
+ * @param bool Writing is allowed now (safe mode)
+ */
+void settings_poll(bool allowWrite)
+{
+	if (!dirty || !allowWrite || !storageReady || writeBusy) return;
+
+	settings_fill(&writeBuffer);
+	// Changed back to the stored values before the write
+	if (settings_unchanged(&writeBuffer)) {
+		dirty = false;
+		return;
+	}
+	if (pstorage_update(&settingsHandle, (uint8_t *)&writeBuffer, sizeof(settingsRecord), 0) == NRF_SUCCESS) {
+		stored = writeBuffer;
+		storedValid = true;
+		writeBusy = true;
+		dirty = false;
+	}
+}
+
+/**
+ * @brief Boot drift check, called with the gyro samples while in safe
+ * mode. After SETTINGS_DRIFT_SAMPLES samples the average is compared with
+ * the stored trims; if the bias moved too much a new calibration is
+ * required before the controlled modes can be entered.
+ */
+void settings_drift_sample(int16_t sp, int16_t sq, int16_t sr)
+{
+	if (!driftCheckPending) return;
+
+	driftSum[0] += sp;
+	driftSum[1] += sq;
+	driftSum[2] += sr;
+	if (++driftCount < SETTINGS_DRIFT_SAMPLES) return;
+
+	int16_t dp = (int16_t)(driftSum[0] >> SETTINGS_DRIFT_SHIFT) - sp_trim;
+	int16_t dq = (int16_t)(driftSum[1] >> SETTINGS_DRIFT_SHIFT) - sq_trim;
+	int16_t dr = (int16_t)(driftSum[2] >> SETTINGS_DRIFT_SHIFT) - sr_trim;
+
+	driftCheckPending = false;
+	calibrationNeeded = abs(dp) > SETTINGS_DRIFT_LIMIT || abs(dq) > SETTINGS_DRIFT_LIMIT || abs(dr) > SETTINGS_DRIFT_LIMIT;
+
+	SEND_EVENT(calibrationNeeded ? EV_DRIFT_TOO_LARGE : EV_DRIFT_OK, dp, dq, dr);
+}
+
+/**
+ * @brief Whether the boot drift check failed and no calibration was done since
+ */
+bool settings_calibration_needed(void)
+{
+	return calibrationNeeded;
+}
@@ -0,0 +1,47 @@
+#ifndef SETTINGS_H__
+#define SETTINGS_H__
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+// Record kept in internal flash (pstorage). Bump SETTINGS_VERSION when the
+// layout changes, records of another version are ignored.
+#define SETTINGS_MAGIC 0x5154		// "QT"
+#define SETTINGS_VERSION 1
+#define SETTINGS_BLOCK_SIZE 32		// pstorage block, at least sizeof(settingsRecord) and word aligned
+
+// Boot drift check: average of the first SETTINGS_DRIFT_SAMPLES gyro samples
+// (power of 2) has to be within SETTINGS_DRIFT_LIMIT of the stored trims
+#define SETTINGS_DRIFT_SHIFT 6
+#define SETTINGS_DRIFT_SAMPLES (1 << SETTINGS_DRIFT_SHIFT)
+#define SETTINGS_DRIFT_LIMIT 40
+
+typedef struct {
+	uint16_t magic;
+	uint8_t version;
+	uint8_t size;			// sizeof(settingsRecord)
+
+	int16_t sp_trim;
+	int16_t sq_trim;
+	int16_t sr_trim;
+	int16_t phi_trim;
+	int16_t theta_trim;
+	int16_t psi_trim;
+
+	int16_t gainYaw;
+	int16_t gainP1;
+	int16_t gainP2;
+	int16_t gainHeight;
+
+	uint16_t reserved;
+	uint16_t crc;			// CRC16 (CCITT) of everything above
+} settingsRecord;
+
+bool settings_init(void);
+void settings_save(void);
+void settings_calibrated(void);
+void settings_poll(bool allowWrite);
+void settings_drift_sample(int16_t sp, int16_t sq, int16_t sr);
+bool settings_calibration_needed(void);
+
+#endif /* SETTINGS_H__ */
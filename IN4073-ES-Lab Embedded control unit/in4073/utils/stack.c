@@ -0,0 +1,61 @@
+#include "stack.h"
+#include "nrf.h"
+#include "comm.h"
+
+// Provided by the linker script (nrf5x_common.ld), the stack is the
+// top Stack_Size bytes of RAM
+extern uint32_t __StackLimit;
+extern uint32_t __StackTop;
+
+/**
+ * @brief Fills the stack below the current stack pointer with STACK_PAINT.
+ * Has to be called first thing in main, before any interrupt is enabled.
+ */
+void stack_paint(void)
+{
+	uint32_t *p = &__StackLimit;
+	uint32_t *sp = (uint32_t *)__get_MSP();
+
+	while (p < sp) {
+		*p++ = STACK_PAINT;
+	}
+}
+
+/**
+ * @brief Size of the stack in bytes
+ */
+uint16_t stack_size(void)
+{
+	return (uint16_t)((&__StackTop - &__StackLimit) * sizeof(uint32_t));
+}
+
+/**
+ * @brief Most stack used since boot, in bytes. Scans the painted words from
+ * the bottom, so it takes longer the more stack is free (2 KB ~ 0.2 ms).
+ * Returns stack_size() if the stack has overflowed into the heap.
+ */
+uint16_t stack_high_water(void)
+{
+	const uint32_t *p = &__StackLimit;
+
+	while (p < &__StackTop && *p == STACK_PAINT) {
+		p++;
+	}
+
+	return (uint16_t)((&__StackTop - p) * sizeof(uint32_t));
+}
+
+/**
+ * @brief Sends a warning, once, when the stack came within STACK_WARN_FREE
+ * bytes of its limit
+ * @param uint16_t High-water mark from stack_high_water()
+ */
+void stack_check(uint16_t used)
+{
+	static bool warned = false;
+
+	if (warned || stack_size() - used >= STACK_WARN_FREE) return;
+
+	warned = true;
+	SEND_EVENT(EV_STACK_ALMOST_FULL, used, stack_size());
+}
@@ -0,0 +1,18 @@
+#ifndef STACK_H__
+#define STACK_H__
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+// The unused part of the stack is filled with STACK_PAINT at boot, the
+// deepest word that no longer holds it is the high-water mark. The
+// softdevice and all interrupts run on the same (main) stack.
+#define STACK_PAINT 0xC5C5C5C5
+#define STACK_WARN_FREE 256		// Warn once when less than this many bytes were never used
+
+void stack_paint(void);
+uint16_t stack_size(void);
+uint16_t stack_high_water(void);
+void stack_check(uint16_t used);
+
+#endif /* STACK_H__ */
@@ -38,4 +38,83 @@ int32_t calculateAverage(int32_t *data, uint16_t nrOfItems) {
     }
 
     return total;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Starts a new running mean / variance
+ * 
+ * @param state Estimator to reset
+ */
+void welfordInit(welfordState *state) {
+    state->n = 0;
+    state->mean = 0;
+    state->m2 = 0;
+}
+
+/**
+ * @brief Adds a sample to the running mean and variance (Welford's algorithm,
+ * no large sums so no overflow and no cancellation)
+ * 
+ * @param state Estimator
+ * @param x New sample
+ */
+void welfordAdd(welfordState *state, int16_t x) {
+    int32_t xq = (int32_t)x << 8;
+    int32_t delta = xq - state->mean;
+
+    state->n++;
+    state->mean += delta / state->n;
+    state->m2 += (int64_t)delta * (xq - state->mean);
+}
+
+/**
+ * @brief Mean of the samples so far, rounded
+ * 
+ * @param state Estimator
+ * @return int16_t mean
+ */
+int16_t welfordMean(const welfordState *state) {
+    return (int16_t)((state->mean + 128) >> 8);
+}
+
+/**
+ * @brief Sample variance of the samples so far
+ * 
+ * @param state Estimator
+ * @return uint32_t variance in Q16, 0 with less than 2 samples
+ */
+uint32_t welfordVariance(const welfordState *state) {
+    if (state->n < 2) {
+        return 0;
+    }
+    return (uint32_t)(state->m2 / (state->n - 1));
+}
+
+/**
+ * @brief Distance of a sample from the current mean
+ * 
+ * @param state Estimator
+ * @param x Sample
+ * @return int32_t |x - mean|, rounded down
+ */
+int32_t welfordDeviation(const welfordState *state, int16_t x) {
+    int32_t d = ((int32_t)x << 8) - state->mean;
+    return (d < 0 ? -d : d) >> 8;
+}
+
+/**
+ * @brief Checks if the mean is known well enough: the 95% confidence interval
+ * (2 standard errors) is within +-halfWidth. Compared in squares, so without
+ * square root: 4 * m2 / (n * (n - 1)) <= halfWidth^2.
+ * 
+ * @param state Estimator
+ * @param halfWidth Allowed half width of the confidence interval
+ * @return true if the mean is accurate enough
+ */
+bool welfordMeanWithin(const welfordState *state, int16_t halfWidth) {
+    if (state->n < 2) {
+        return false;
+    }
+    int64_t limit = ((int64_t)halfWidth * halfWidth << 16) * state->n * (state->n - 1);
+    return 4 * state->m2 <= limit;
+}
@@ -4,7 +4,21 @@
 #include <inttypes.h>
 #include <stdbool.h>
 
+// Running mean and variance (Welford), mean in Q8 and sum of squared differences in Q16
+typedef struct {
+    uint16_t n;
+    int32_t mean;
+    int64_t m2;
+} welfordState;
+
 uint32_t calculateAverage_unsigned(uint32_t *data, uint16_t nrOfItems);
 int32_t calculateAverage(int32_t *data, uint16_t nrOfItems);
 
+void welfordInit(welfordState *state);
+void welfordAdd(welfordState *state, int16_t x);
+int16_t welfordMean(const welfordState *state);
+uint32_t welfordVariance(const welfordState *state);
+int32_t welfordDeviation(const welfordState *state, int16_t x);
+bool welfordMeanWithin(const welfordState *state, int16_t halfWidth);
+
 #endif
\ No newline at end of file
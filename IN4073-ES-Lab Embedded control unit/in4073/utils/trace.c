@@ -0,0 +1,112 @@
+#include "trace.h"
+#include "app_util_platform.h"
+#include "hal/timers.h"
+#include "comm.h"
+
+typedef struct {
+	traceRecord records[TRACE_LEN];
+	uint32_t head;		// Records written so far
+} traceRing;
+
+static traceRing rings[TRACE_LEVELS];
+
+// Set while the rings are read, the records of that time are dropped
+static volatile bool frozen = false;
+
+/**
+ * @brief Adds a record to the ring of the current interrupt level,
+ * overwriting the oldest one. Safe in any interrupt, takes a few cycles.
+ * @param traceId What happened
+ * @param uint8_t, uint16_t Arguments, see TRACE_LIST in events.h
+ */
+void trace(traceId id, uint8_t a, uint16_t b)
+{
+	if (frozen) return;
+
+	uint8_t priority = current_int_priority_get();
+	traceRing *ring = &rings[priority == NRF_APP_PRIORITY_THREAD ? 0 : (priority == APP_IRQ_PRIORITY_LOW ? 1 : 2)];
+	traceRecord *record = &ring->records[ring->head & (TRACE_LEN - 1)];
+
+	record->time = get_time_us();
+	record->id = id;
+	record->a = a;
+	record->b = b;
+	ring->head++;
+}
+
+/**
+ * @brief Merges the rings by time and passes the records in blocks of
+ * TRACE_BLOCK_RECORDS to output, oldest first
+ * @param output Called with the serialized block (TRACE_BLOCK_SIZE bytes)
+ */
+static void trace_read(void (*output)(uint8_t *block))
+{
+	uint32_t next[TRACE_LEVELS];
+	uint8_t block[TELEM_SIZE] = {0};	// saveLog stores TELEM_SIZE bytes
+	uint8_t count = 0;
+
+	frozen = true;
+
+	for (uint8_t l = 0; l < TRACE_LEVELS; l++) {
+		next[l] = rings[l].head > TRACE_LEN ? rings[l].head - TRACE_LEN : 0;
+	}
+
+	while (true) {
+		// Oldest of the next record of every level
+		int8_t oldest = -1;
+		for (uint8_t l = 0; l < TRACE_LEVELS; l++) {
+			if (next[l] == rings[l].head) continue;
+			if (oldest < 0 || (int32_t)(rings[l].records[next[l] & (TRACE_LEN - 1)].time
+					- rings[oldest].records[next[oldest] & (TRACE_LEN - 1)].time) < 0) {
+				oldest = l;
+			}
+		}
+
+		if (oldest >= 0) {
+			const traceRecord *record = &rings[oldest].records[next[oldest]++ & (TRACE_LEN - 1)];
+			uint8_t *p = &block[1 + count * TRACE_RECORD_SIZE];
+			ui32_to_ui8(record->time, p);
+			p[4] = record->id;
+			p[5] = record->a;
+			ui16_to_ui8(record->b, &p[6]);
+			count++;
+		}
+
+		if (count == TRACE_BLOCK_RECORDS || (oldest < 0 && count > 0)) {
+			block[0] = count;
+			output(block);
+			count = 0;
+		}
+		if (oldest < 0) break;
+	}
+
+	frozen = false;
+}
+
+static void trace_send_block(uint8_t *block)
+{
+	packMessage(TRACE, block, NULL);
+}
+
+static void trace_log_block(uint8_t *block)
+{
+	saveLog(l_Trace, block);
+}
+
+/**
+ * @brief Sends the whole trace to the PC, the PC prints the timeline
+ */
+void trace_dump(void)
+{
+	trace(TR_DUMP, 0, 0);
+	trace_read(trace_send_block);
+}
+
+/**
+ * @brief Writes the whole trace to the flight log in flash, called when
+ * panic mode is entered. It is sent to the PC with the rest of the log.
+ */
+void trace_save(void)
+{
+	trace_read(trace_log_block);
+}
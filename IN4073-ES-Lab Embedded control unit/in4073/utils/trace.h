@@ -0,0 +1,31 @@
+#ifndef TRACE_H__
+#define TRACE_H__
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include "events.h"
+
+// Flight recorder: the last TRACE_LEN records of every interrupt level,
+// sent to the PC on request ('t') and saved in the flight log at a panic.
+// There is one ring per level (thread mode, APP_IRQ_PRIORITY_LOW,
+// APP_IRQ_PRIORITY_HIGH), so every ring has a single writer and needs no
+// lock: a writer can only be interrupted by a higher level, which writes
+// another ring.
+#define TRACE_LEVELS 3
+#define TRACE_LEN 16		// Records per level, power of 2 (3 x 16 x 8 bytes of RAM)
+#define TRACE_RECORD_SIZE 8	// Serialized record: time (4), id (1), a (1), b (2)
+#define TRACE_BLOCK_RECORDS 4	// Records per TRACE message / log row
+#define TRACE_BLOCK_SIZE (1 + TRACE_BLOCK_RECORDS * TRACE_RECORD_SIZE)	// Count + records
+
+typedef struct {
+	uint32_t time;		// get_time_us()
+	uint8_t id;		// traceId
+	uint8_t a;
+	uint16_t b;
+} traceRecord;
+
+void trace(traceId id, uint8_t a, uint16_t b);
+void trace_dump(void);
+void trace_save(void);
+
+#endif /* TRACE_H__ */
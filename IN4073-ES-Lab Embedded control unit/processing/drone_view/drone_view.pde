@@ -1,8 +1,23 @@
 // Author: Philip Groet
 
-import processing.net.*;
+// Binary UDP attitude stream from pc_terminal / pc_gui (format: in4073/communication/attstream.h)
+import java.net.*;
+import java.nio.*;
 
-Server s;
+final int STREAM_PORT = 12345;      // ATT_STREAM_PORT
+final int PACKET_SIZE = 32;         // ATT_PACKET_SIZE
+final int STREAM_VERSION = 1;       // ATT_STREAM_VERSION
+final int SUBSCRIBE_MS = 1000;      // Has to be less than ATT_VIEWER_TIMEOUT_MS
+
+DatagramSocket socket;
+InetAddress terminalAddr;
+int lastSubscribe = -SUBSCRIBE_MS;
+byte[] rxBuf = new byte[64];
+
+long lastSeq = -1;
+long lostPackets = 0;
+long receivedPackets = 0;
+long droneTimeUs = 0;
 
 float dronePitch;
 float droneRoll;
@@ -12,33 +27,62 @@ void setup() {
   size(640,640,P3D);
   lights();
   
-  s = new Server(this, 12345);
+  try {
+    // Any free local port, so more viewers can run at the same time
+    socket = new DatagramSocket();
+    socket.setSoTimeout(1);
+    terminalAddr = InetAddress.getByName("127.0.0.1");
+  } catch (Exception e) {
+    println("Couldn't open the UDP socket: " + e);
+  }
+}
+
+// (Re)subscribe periodically, so the stream comes back when the terminal is restarted
+void subscribe() {
+  if (socket == null || millis() - lastSubscribe < SUBSCRIBE_MS) return;
+  lastSubscribe = millis();
+  try {
+    byte[] msg = "ATSUB".getBytes();
+    socket.send(new DatagramPacket(msg, msg.length, terminalAddr, STREAM_PORT));
+  } catch (Exception e) {}
 }
 
 float yaw_offset = 0;
 float yaw_raw;
-void draw() {
-  Client c = s.available();
-  if (c != null) {
-    try { // Try catch because sometimes invalid characters are received which are not valid packets
-      String input = c.readStringUntil('\n');
-                                // Remove 0 character at end
-      String parts[] = split(input.substring(0, input.length()-1), ' ');
-      int data[] = int(parts);  // Split values into an array
-      println("Received: " + data[0] + " " + data[1] + " " + data[2]);
-      
-      // The result is in radians. ~182 LSB per degree
-      dronePitch = (float)data[1] / 10430;
-      droneRoll = (float)data[0] / 10430;
-      yaw_raw = -(float)data[2]/10430;
-      
-      droneYaw = yaw_raw + yaw_offset;
-      // Simple I controller to compensate for drift
-      yaw_offset = yaw_offset - droneYaw*0.5;
-      //droneYaw = (float)data[2] / 10430;
-    } catch(Exception e) {}
-    
+
+// Read every datagram that arrived since the last frame
+void receive() {
+  if (socket == null) return;
+  DatagramPacket p = new DatagramPacket(rxBuf, rxBuf.length);
+  while (true) {
+    try {
+      socket.receive(p);
+    } catch (Exception e) {
+      break; // Timeout -> nothing more to read
+    }
+    if (p.getLength() < PACKET_SIZE || rxBuf[0] != 'A' || rxBuf[1] != 'T' || rxBuf[2] != STREAM_VERSION) continue;
+
+    ByteBuffer bb = ByteBuffer.wrap(rxBuf); // Big endian, like the stream
+    long seq = bb.getInt(4) & 0xFFFFFFFFL;
+    if (lastSeq >= 0 && seq > lastSeq + 1) lostPackets += seq - lastSeq - 1;
+    lastSeq = seq; // A smaller number means the terminal was restarted
+    receivedPackets++;
+    droneTimeUs = bb.getInt(8) & 0xFFFFFFFFL;
+
+    // The result is in radians. ~182 LSB per degree
+    droneRoll = (float)bb.getShort(20) / 10430;
+    dronePitch = (float)bb.getShort(22) / 10430;
+    yaw_raw = -(float)bb.getShort(24) / 10430;
+
+    droneYaw = yaw_raw + yaw_offset;
+    // Simple I controller to compensate for drift
+    yaw_offset = yaw_offset - droneYaw*0.5;
   }
+}
+
+void draw() {
+  subscribe();
+  receive();
   
   background(0);
   int TEXTSIZE = 15;
@@ -49,6 +93,7 @@ void draw() {
   text("Yaw:   "+droneYaw/PI*180+"°",   10, 20+2*LINESPACING+2*TEXTSIZE);
   text("YawDrift:   "+yaw_offset/PI*180+"°",   10, 20+3*LINESPACING+3*TEXTSIZE);
   text("YawRaw:   "+yaw_raw/PI*180+"°",   10, 20+4*LINESPACING+4*TEXTSIZE);
+  text("Drone time: "+droneTimeUs/1e6+" s | Samples: "+receivedPackets+" | Lost: "+lostPackets, 10, 20+5*LINESPACING+5*TEXTSIZE);
   
   translate(width/2, height/2, 0);
   